@@ -34,7 +34,8 @@ CREATE TABLE IF NOT EXISTS public.changesets (
     source text,
     validated boolean,
     quality integer,
-    bbox public.geometry(MultiPolygon,4326)
+    bbox public.geometry(MultiPolygon,4326),
+    files int8[] NOT NULL DEFAULT '{}'
 );
 ALTER TABLE ONLY public.changesets
     ADD CONSTRAINT changesets_pkey PRIMARY KEY (id);
@@ -0,0 +1,7 @@
+-- Upgrade a database where the statistics of each replication file
+-- were kept in the changeset_files table. The totals already in the
+-- changesets table stay, but the files they came from were keyed by
+-- their timestamp, not their sequence number, so replaying one of
+-- them after the upgrade counts it again.
+ALTER TABLE public.changesets ADD COLUMN IF NOT EXISTS files int8[] NOT NULL DEFAULT '{}';
+DROP TABLE IF EXISTS public.changeset_files;
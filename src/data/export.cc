@@ -0,0 +1,491 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <boost/endian/conversion.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <libpq-fe.h>
+
+#include "data/export.hh"
+#include "data/pq.hh"
+#include "utils/log.hh"
+
+using namespace logger;
+
+/// \namespace exporter
+namespace exporter {
+
+namespace {
+
+/// Microseconds from the Unix epoch to the PostgreSQL one, in 2000
+const std::int64_t postgresEpoch = 946684800000000;
+
+/// A big endian integer of a binary COPY
+template <typename T>
+T
+load(const char *data)
+{
+    T value;
+    std::memcpy(&value, data, sizeof(T));
+    return boost::endian::big_to_native(value);
+}
+
+typedef std::unique_ptr<PGconn, decltype(&PQfinish)> connection_t;
+typedef std::unique_ptr<PGresult, decltype(&PQclear)> result_t;
+
+/// \class CopyReader
+/// \brief Read the rows of a COPY in the binary format
+class CopyReader {
+  public:
+    CopyReader(PGconn *conn) : conn(conn) {};
+
+    /// Read the next row, with the size and data of each field, which
+    /// is -1 for a null. The data is valid until the next call.
+    /// Returns false at the end, or if the COPY failed.
+    bool next(std::vector<std::pair<int, const char *>> &fields)
+    {
+        // Drop the rows already read once they're half of the buffer
+        if (pos > buffer.size() / 2) {
+            buffer.erase(0, pos);
+            pos = 0;
+        }
+        while (true) {
+            if (!header) {
+                if (available(19)) {
+                    if (std::memcmp(&buffer[pos], "PGCOPY\n\377\r\n\0", 11) != 0) {
+                        log_error("Not a binary COPY");
+                        error = true;
+                        return false;
+                    }
+                    std::size_t extension = load<std::uint32_t>(&buffer[pos + 15]);
+                    if (available(19 + extension)) {
+                        pos += 19 + extension;
+                        header = true;
+                        continue;
+                    }
+                }
+            } else if (available(2)) {
+                std::int16_t count = load<std::int16_t>(&buffer[pos]);
+                if (count < 0) {
+                    // The end of the data, which is followed by the end of the COPY
+                    pos += 2;
+                    while (read()) {
+                    }
+                    return false;
+                }
+                if (parse(count, fields)) {
+                    return true;
+                }
+            }
+            if (!read()) {
+                return false;
+            }
+        }
+    };
+
+    /// If the data ended in the middle of a row, or couldn't be read
+    bool failed(void) const { return error; };
+
+  private:
+    bool available(std::size_t size) const { return buffer.size() - pos >= size; };
+
+    /// Split a row into fields, if it was all read
+    bool parse(int count, std::vector<std::pair<int, const char *>> &fields)
+    {
+        std::size_t end = pos + 2;
+        fields.clear();
+        for (int i = 0; i < count; i++) {
+            if (buffer.size() < end + 4) {
+                return false;
+            }
+            std::int32_t size = load<std::int32_t>(&buffer[end]);
+            end += 4;
+            if (size > 0 && buffer.size() < end + size) {
+                return false;
+            }
+            fields.emplace_back(size, &buffer[end]);
+            end += std::max(size, 0);
+        }
+        pos = end;
+        return true;
+    };
+
+    /// Append the next message of the COPY to the buffer
+    bool read(void)
+    {
+        char *data = nullptr;
+        int size = PQgetCopyData(conn, &data, 0);
+        if (size > 0) {
+            buffer.append(data, size);
+            PQfreemem(data);
+            return true;
+        }
+        if (size == -2 || pos < buffer.size()) {
+            log_error("COPY failed: %1%", PQerrorMessage(conn));
+            error = true;
+        }
+        return false;
+    };
+
+    PGconn *conn;
+    std::string buffer;
+    std::size_t pos = 0;                 ///< The start of the next row
+    bool header = false;
+    bool error = false;
+};
+
+/// The elements of a one dimensional text[] in the binary format. A
+/// null element is an empty string.
+bool
+elements(const char *data, int size, std::vector<std::string_view> &values)
+{
+    values.clear();
+    if (size < 12) {
+        return false;
+    }
+    int dimensions = load<std::int32_t>(data);
+    if (dimensions == 0) {
+        return true;
+    }
+    if (dimensions != 1 || size < 20) {
+        return false;
+    }
+    int count = load<std::int32_t>(data + 12);
+    const char *end = data + size;
+    data += 20;
+    for (int i = 0; i < count; i++) {
+        if (end - data < 4) {
+            return false;
+        }
+        std::int32_t length = load<std::int32_t>(data);
+        data += 4;
+        if (length < 0) {
+            values.emplace_back();
+            continue;
+        }
+        if (end - data < length) {
+            return false;
+        }
+        values.emplace_back(data, length);
+        data += length;
+    }
+    return true;
+}
+
+/// Write a field of a row
+bool
+add(parquet::Writer &writer, parquet::type_t type, int size, const char *data,
+    std::vector<std::string_view> &values)
+{
+    if (size < 0) {
+        writer.null();
+        return true;
+    }
+    switch (type) {
+        case parquet::int32:
+        case parquet::int64:
+            if (size == 2) {
+                writer.integer(load<std::int16_t>(data));
+            } else if (size == 4) {
+                writer.integer(load<std::int32_t>(data));
+            } else if (size == 8) {
+                writer.integer(load<std::int64_t>(data));
+            } else {
+                return false;
+            }
+            break;
+        case parquet::timestamp:
+            if (size != 8) {
+                return false;
+            } else {
+                // infinity and -infinity, which don't fit once moved to
+                // the Unix epoch
+                auto value = load<std::int64_t>(data);
+                if (value == INT64_MAX || value == INT64_MIN) {
+                    writer.null();
+                } else {
+                    writer.integer(value + postgresEpoch);
+                }
+            }
+            break;
+        case parquet::string:
+        case parquet::binary:
+            writer.bytes(std::string_view(data, size));
+            break;
+        case parquet::map:
+        case parquet::list:
+            if (!elements(data, size, values)) {
+                return false;
+            }
+            writer.strings(values);
+            break;
+    }
+    return true;
+}
+
+/// The columns of the nodes, ways and relations, with the tags as an
+/// array of keys and values
+const std::string objectColumns = "osm_id, changeset, version, uid, \"user\", timestamp, "
+    "ARRAY(SELECT unnest(ARRAY[key, coalesce(value, '')]) FROM jsonb_each_text(tags)), ST_AsBinary(geom)";
+
+const std::vector<parquet::Field> objectFields = {
+    {"osm_id", parquet::int64, true},
+    {"changeset", parquet::int64, true},
+    {"version", parquet::int32},
+    {"uid", parquet::int64, true},
+    {"user", parquet::string, false, true},
+    {"timestamp", parquet::timestamp, true},
+    {"tags", parquet::map, false, true},
+    {"geom", parquet::binary}};
+
+} // anonymous namespace
+
+const std::vector<Table> &
+Exporter::tables(void)
+{
+    static const std::vector<Table> tables = {
+        {"nodes", objectColumns, objectFields, "geom", {"Point"}},
+        {"ways_poly", objectColumns, objectFields, "geom", {"Polygon"}},
+        {"ways_line", objectColumns, objectFields, "geom", {"LineString"}},
+        {"relations", objectColumns, objectFields, "geom", {}},
+        {"validation",
+         "osm_id, changeset, version, uid, timestamp, type::text, status::text, source, values, "
+         "ST_AsBinary(location)",
+         {{"osm_id", parquet::int64, true},
+          {"changeset", parquet::int64, true},
+          {"version", parquet::int64},
+          {"uid", parquet::int64, true},
+          {"timestamp", parquet::timestamp, true},
+          {"type", parquet::string, false, true},
+          {"status", parquet::string, false, true},
+          {"source", parquet::string, false, true},
+          {"values", parquet::list, false, true},
+          {"location", parquet::binary}},
+         "location",
+         {}}};
+    return tables;
+}
+
+std::string
+Exporter::geoMetadata(const Table &table)
+{
+    std::string types;
+    for (const auto &type: table.types) {
+        types += (types.empty() ? "\"" : ",\"") + type + "\"";
+    }
+    return "{\"version\":\"1.0.0\",\"primary_column\":\"" + table.geometry + "\",\"columns\":{\"" +
+           table.geometry + "\":{\"encoding\":\"WKB\",\"geometry_types\":[" + types + "]}}}";
+}
+
+Exporter::Exporter(const std::string &dburl, const std::string &dir) : dir(dir)
+{
+    pq::Pq db;
+    if (db.parseURL(dburl)) {
+        args = db.arguments();
+    }
+}
+
+bool
+Exporter::exportTable(const std::string &name, unsigned int partitions, unsigned int threads)
+{
+    const Table *table = nullptr;
+    for (const auto &candidate: tables()) {
+        if (candidate.name == name) {
+            table = &candidate;
+        }
+    }
+    if (!table) {
+        log_error("Can't export %1%, it's not one of the raw or validation tables", name);
+        return false;
+    }
+
+    connection_t conn(PQconnectdb(args.c_str()), &PQfinish);
+    if (PQstatus(conn.get()) != CONNECTION_OK) {
+        log_error("Couldn't connect to the database: %1%", PQerrorMessage(conn.get()));
+        return false;
+    }
+    // The ranges are all read from the snapshot of this transaction,
+    // which stays open until they're exported
+    result_t snapshot(PQexec(conn.get(), "BEGIN ISOLATION LEVEL REPEATABLE READ READ ONLY; "
+                                         "SELECT pg_export_snapshot()"), &PQclear);
+    if (PQresultStatus(snapshot.get()) != PGRES_TUPLES_OK) {
+        log_error("Couldn't export a snapshot: %1%", PQerrorMessage(conn.get()));
+        return false;
+    }
+    std::string id = PQgetvalue(snapshot.get(), 0, 0);
+    result_t range(PQexec(conn.get(), ("SELECT min(osm_id), max(osm_id) FROM " + name).c_str()), &PQclear);
+    if (PQresultStatus(range.get()) != PGRES_TUPLES_OK) {
+        log_error("Couldn't read the IDs of %1%: %2%", name, PQerrorMessage(conn.get()));
+        return false;
+    }
+
+    // The files are written to a new directory, which replaces the one
+    // of an earlier export once they all are
+    boost::filesystem::path path(dir);
+    path /= name;
+    auto partial = path.parent_path() / boost::filesystem::unique_path("." + name + "-%%%%%%%%");
+    boost::system::error_code ec;
+    boost::filesystem::create_directories(partial, ec);
+    if (ec) {
+        log_error("Couldn't create %1%: %2%", partial.string(), ec.message());
+        return false;
+    }
+
+    std::atomic<bool> ok = true;
+    if (PQgetisnull(range.get(), 0, 0)) {
+        log_info("%1% is empty, nothing to export", name);
+    } else {
+        long first = std::stol(PQgetvalue(range.get(), 0, 0));
+        long last = std::stol(PQgetvalue(range.get(), 0, 1));
+        partitions = std::max(partitions, 1U);
+        long span = (last - first) / partitions + 1;
+        boost::asio::thread_pool pool(std::max(threads, 1U));
+        for (unsigned int i = 0; i < partitions && first + span * i <= last; i++) {
+            long start = first + span * i;
+            long end = std::min(last, start + span - 1);
+            auto filespec = (partial / (boost::format("part-%05d.parquet") % i).str()).string();
+            boost::asio::post(pool, [this, table, start, end, filespec, &id, &ok] {
+                if (!exportRange(*table, start, end, filespec, id)) {
+                    ok = false;
+                }
+            });
+        }
+        pool.join();
+    }
+    conn.reset();
+
+    // An earlier export is only replaced by a complete one
+    auto old = path.parent_path() / boost::filesystem::unique_path("." + name + "-%%%%%%%%");
+    if (ok && boost::filesystem::exists(path)) {
+        boost::filesystem::rename(path, old, ec);
+    }
+    if (ok && !ec) {
+        boost::filesystem::rename(partial, path, ec);
+        if (ec && boost::filesystem::exists(old)) {
+            boost::system::error_code restored;
+            boost::filesystem::rename(old, path, restored);
+        }
+    }
+    if (ok && ec) {
+        log_error("Couldn't replace %1%: %2%", path.string(), ec.message());
+        ok = false;
+    }
+    boost::filesystem::remove_all(ok ? old : partial, ec);
+    return ok;
+}
+
+bool
+Exporter::exportRange(const Table &table, long first, long last, const std::string &filespec,
+                      const std::string &snapshot)
+{
+    connection_t conn(PQconnectdb(args.c_str()), &PQfinish);
+    if (PQstatus(conn.get()) != CONNECTION_OK) {
+        log_error("Couldn't connect to the database: %1%", PQerrorMessage(conn.get()));
+        return false;
+    }
+    auto begin = boost::format("BEGIN ISOLATION LEVEL REPEATABLE READ READ ONLY; SET TRANSACTION SNAPSHOT '%1%'") % snapshot;
+    result_t started(PQexec(conn.get(), begin.str().c_str()), &PQclear);
+    if (PQresultStatus(started.get()) != PGRES_COMMAND_OK) {
+        log_error("Couldn't use the snapshot of %1%: %2%", table.name, PQerrorMessage(conn.get()));
+        return false;
+    }
+    auto query = boost::format("COPY (SELECT %1% FROM %2% WHERE osm_id BETWEEN %3% AND %4% ORDER BY osm_id) "
+                               "TO STDOUT (FORMAT binary)") % table.columns % table.name % first % last;
+    result_t result(PQexec(conn.get(), query.str().c_str()), &PQclear);
+    if (PQresultStatus(result.get()) != PGRES_COPY_OUT) {
+        log_error("Couldn't export %1%: %2%", table.name, PQerrorMessage(conn.get()));
+        return false;
+    }
+
+    std::string partial = filespec + ".tmp";
+    parquet::Writer writer(table.fields);
+    if (!writer.open(partial)) {
+        return false;
+    }
+    writer.metadata("geo", geoMetadata(table));
+    CopyReader reader(conn.get());
+    std::vector<std::pair<int, const char *>> fields;
+    std::vector<std::string_view> values;
+    bool ok = true;
+    while (ok && reader.next(fields)) {
+        if (fields.size() != table.fields.size()) {
+            log_error("Expected %1% columns in %2%, got %3%", table.fields.size(), table.name, fields.size());
+            ok = false;
+            break;
+        }
+        for (std::size_t i = 0; i < fields.size(); i++) {
+            if (!add(writer, table.fields[i].type, fields[i].first, fields[i].second, values)) {
+                log_error("Can't read %1% in %2%", table.fields[i].name, table.name);
+                ok = false;
+                break;
+            }
+        }
+        if (ok) {
+            writer.endRow();
+        }
+    }
+    ok = writer.close() && ok && !reader.failed();
+    // The COPY ends with its status, unless it was stopped
+    while (ok) {
+        result_t status(PQgetResult(conn.get()), &PQclear);
+        if (!status) {
+            break;
+        }
+        if (PQresultStatus(status.get()) != PGRES_COMMAND_OK) {
+            log_error("Couldn't export %1%: %2%", table.name, PQerrorMessage(conn.get()));
+            ok = false;
+        }
+    }
+
+    boost::system::error_code ec;
+    if (!ok || writer.rows() == 0) {
+        boost::filesystem::remove(partial, ec);
+        return ok;
+    }
+    boost::filesystem::rename(partial, filespec, ec);
+    if (ec) {
+        log_error("Couldn't rename %1% to %2%: %3%", partial, filespec, ec.message());
+        boost::filesystem::remove(partial, ec);
+        return false;
+    }
+    log_info("Exported %1% rows of %2% to %3%", writer.rows(), table.name, filespec);
+    return true;
+}
+
+} // namespace exporter
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,89 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __EXPORT_HH__
+#define __EXPORT_HH__
+
+/// \file export.hh
+/// \brief Export the raw tables and validation results to GeoParquet
+///
+/// The rows are read with a binary COPY, so nothing is formatted as
+/// text, and written as Parquet files with the geometries as WKB. Each
+/// table is split in ranges of OSM IDs, which are exported in parallel
+/// to one file each.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <string>
+#include <vector>
+
+#include "data/parquet.hh"
+
+/// \namespace exporter
+namespace exporter {
+
+/// \struct Table
+/// \brief How a table is exported
+struct Table {
+    std::string name;
+    std::string columns;                 ///< The SELECT list, in the order of the fields
+    std::vector<parquet::Field> fields;
+    std::string geometry;                ///< The name of the geometry column
+    std::vector<std::string> types;      ///< Its geometry types, or none if they vary
+};
+
+/// \class Exporter
+/// \brief Write tables from the database to GeoParquet files
+class Exporter {
+  public:
+    /// Export from the database at \a dburl to the directory \a dir
+    Exporter(const std::string &dburl, const std::string &dir);
+
+    /// The tables that can be exported
+    static const std::vector<Table> &tables(void);
+
+    /// Export a table to \a partitions files of an ID range each, with
+    /// \a threads connections. The files are dir/table/part-N.parquet,
+    /// which replace the ones of an earlier export once all are written.
+    bool exportTable(const std::string &name, unsigned int partitions, unsigned int threads);
+
+    /// The GeoParquet metadata of a table
+    static std::string geoMetadata(const Table &table);
+
+  private:
+    /// Export the rows with IDs in [first, last] of a table, as of
+    /// the exported \a snapshot
+    bool exportRange(const Table &table, long first, long last, const std::string &filespec,
+                     const std::string &snapshot);
+
+    std::string args;                    ///< The connection string for libpq
+    std::string dir;
+};
+
+} // namespace exporter
+
+#endif // EOF __EXPORT_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
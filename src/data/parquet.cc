@@ -0,0 +1,680 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <boost/endian/conversion.hpp>
+
+#include "data/parquet.hh"
+#include "utils/log.hh"
+
+using namespace logger;
+
+/// \namespace parquet
+namespace parquet {
+
+namespace {
+
+// The values of the enums in parquet.thrift
+enum { BOOLEAN, INT32, INT64, INT96, FLOAT, DOUBLE, BYTE_ARRAY };
+enum { REQUIRED, OPTIONAL, REPEATED };
+enum { UTF8 = 0, MAP = 1, LIST = 3, TIMESTAMP_MICROS = 10 };
+enum { PLAIN = 0, RLE = 3, DELTA_BINARY_PACKED = 5, RLE_DICTIONARY = 8 };
+enum { DATA_PAGE = 0, DICTIONARY_PAGE = 2 };
+
+/// The bytes the metadata is written in, in the compact protocol of Thrift
+const std::uint8_t T_TRUE = 1, T_FALSE = 2, T_I32 = 5, T_I64 = 6, T_BINARY = 8, T_LIST = 9,
+                   T_STRUCT = 12;
+
+/// Append a little endian integer
+template <typename T>
+void
+append(std::string &out, T value)
+{
+    boost::endian::native_to_little_inplace(value);
+    out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+void
+varint(std::string &out, std::uint64_t value)
+{
+    while (value >= 0x80) {
+        out += static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+void
+zigzag(std::string &out, std::int64_t value)
+{
+    varint(out, (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63));
+}
+
+/// The bits needed for \a value
+int
+width(std::uint64_t value)
+{
+    int bits = 0;
+    while (value) {
+        bits++;
+        value >>= 1;
+    }
+    return bits;
+}
+
+/// \class BitPacker
+/// \brief Pack integers of a fixed width, the lowest bits first
+class BitPacker {
+  public:
+    BitPacker(std::string &out, int bits) : out(out), bits(bits) {};
+    ~BitPacker(void) { flush(); };
+
+    void add(std::uint64_t value)
+    {
+        if (bits == 0) {
+            return;
+        }
+        buffer |= value << used;
+        if (used + bits >= 64) {
+            append<std::uint64_t>(out, buffer);
+            buffer = used ? value >> (64 - used) : 0;
+            used = used + bits - 64;
+        } else {
+            used += bits;
+        }
+    };
+    void flush(void)
+    {
+        for (; used > 0; used -= 8) {
+            out += static_cast<char>(buffer);
+            buffer >>= 8;
+        }
+        used = 0;
+    };
+
+  private:
+    std::string &out;
+    int bits;
+    std::uint64_t buffer = 0;
+    int used = 0;
+};
+
+/// Levels as runs of the same value, with the length of the runs first
+void
+levels(std::string &out, const std::vector<std::uint8_t> &values)
+{
+    std::string runs;
+    for (std::size_t i = 0; i < values.size();) {
+        std::size_t end = i;
+        while (end < values.size() && values[end] == values[i]) {
+            end++;
+        }
+        varint(runs, (end - i) << 1);
+        runs += static_cast<char>(values[i]);
+        i = end;
+    }
+    append<std::uint32_t>(out, runs.size());
+    out += runs;
+}
+
+/// Dictionary indexes, bit packed in groups of 8
+void
+indexes(std::string &out, const std::vector<std::uint32_t> &values, std::size_t dictionary)
+{
+    const int bits = std::max(1, width(dictionary - 1));
+    out += static_cast<char>(bits);
+    // Some readers only take runs of up to 63 groups
+    const std::size_t run = 63 * 8;
+    for (std::size_t i = 0; i < values.size(); i += run) {
+        std::size_t end = std::min(i + run, values.size());
+        varint(out, ((end - i + 7) / 8) << 1 | 1);
+        BitPacker packer(out, bits);
+        for (std::size_t j = i; j < end; j++) {
+            packer.add(values[j]);
+        }
+        for (std::size_t j = end; (j - i) % 8; j++) {
+            packer.add(0);
+        }
+    }
+}
+
+/// Integers as the differences to the previous one, in blocks of 128
+/// with 4 miniblocks, each bit packed at its own width
+void
+delta(std::string &out, const std::vector<std::int64_t> &values)
+{
+    const std::size_t block = 128, miniblocks = 4, miniblock = block / miniblocks;
+    varint(out, block);
+    varint(out, miniblocks);
+    varint(out, values.size());
+    zigzag(out, values.empty() ? 0 : values.front());
+    std::vector<std::uint64_t> deltas;
+    for (std::size_t start = 1; start < values.size(); start += block) {
+        std::size_t end = std::min(start + block, values.size());
+        deltas.clear();
+        for (std::size_t i = start; i < end; i++) {
+            deltas.push_back(static_cast<std::uint64_t>(values[i]) - static_cast<std::uint64_t>(values[i - 1]));
+        }
+        auto min = *std::min_element(deltas.begin(), deltas.end(), [](std::uint64_t a, std::uint64_t b) {
+            return static_cast<std::int64_t>(a) < static_cast<std::int64_t>(b);
+        });
+        zigzag(out, static_cast<std::int64_t>(min));
+        int bits[miniblocks] = {0};
+        for (std::size_t i = 0; i < deltas.size(); i++) {
+            deltas[i] -= min;
+            bits[i / miniblock] = std::max(bits[i / miniblock], width(deltas[i]));
+        }
+        for (std::size_t m = 0; m < miniblocks; m++) {
+            out += static_cast<char>(bits[m]);
+        }
+        // The last miniblock is padded, and the unused ones are left out
+        for (std::size_t m = 0; m * miniblock < deltas.size(); m++) {
+            BitPacker packer(out, bits[m]);
+            for (std::size_t i = m * miniblock; i < (m + 1) * miniblock; i++) {
+                packer.add(i < deltas.size() ? deltas[i] : 0);
+            }
+        }
+    }
+}
+
+/// \class Thrift
+/// \brief Write structs in the compact protocol of Thrift
+class Thrift {
+  public:
+    std::string out;
+
+    void i32(int id, std::int32_t value)
+    {
+        header(id, T_I32);
+        zigzag(out, value);
+    };
+    void i64(int id, std::int64_t value)
+    {
+        header(id, T_I64);
+        zigzag(out, value);
+    };
+    void binary(int id, const std::string &value)
+    {
+        header(id, T_BINARY);
+        element(value);
+    };
+    void boolean(int id, bool value) { header(id, value ? T_TRUE : T_FALSE); };
+
+    /// A struct field, ended by end()
+    void beginStruct(int id)
+    {
+        header(id, T_STRUCT);
+        begin();
+    };
+    /// A list field. The elements follow, structs between begin() and end().
+    void list(int id, std::uint8_t type, std::size_t size)
+    {
+        header(id, T_LIST);
+        if (size < 15) {
+            out += static_cast<char>(size << 4 | type);
+        } else {
+            out += static_cast<char>(0xf0 | type);
+            varint(out, size);
+        }
+    };
+    void element(std::int32_t value) { zigzag(out, value); };
+    void element(const std::string &value)
+    {
+        varint(out, value.size());
+        out += value;
+    };
+    void begin(void)
+    {
+        stack.push_back(last);
+        last = 0;
+    };
+    void end(void)
+    {
+        out += '\0';
+        last = stack.back();
+        stack.pop_back();
+    };
+
+  private:
+    /// The fields are written in order, as the difference to the last one
+    void header(int id, std::uint8_t type)
+    {
+        if (id > last && id - last <= 15) {
+            out += static_cast<char>((id - last) << 4 | type);
+        } else {
+            out += static_cast<char>(type);
+            zigzag(out, id);
+        }
+        last = id;
+    };
+
+    int last = 0;
+    std::vector<int> stack;
+};
+
+} // anonymous namespace
+
+void
+Writer::Leaf::add(std::string_view value)
+{
+    count++;
+    if (!dictionary) {
+        append<std::uint32_t>(plain, value.size());
+        plain.append(value.data(), value.size());
+        return;
+    }
+    auto found = index.find(std::string(value));
+    if (found == index.end()) {
+        found = index.emplace(std::string(value), entries.size()).first;
+        entries.emplace_back(value);
+    }
+    indexes.push_back(found->second);
+}
+
+void
+Writer::Leaf::clear(void)
+{
+    definitions.clear();
+    repetitions.clear();
+    count = 0;
+    integers.clear();
+    plain.clear();
+    indexes.clear();
+    index.clear();
+    entries.clear();
+}
+
+std::size_t
+Writer::Leaf::size(void) const
+{
+    return definitions.size() + repetitions.size() + integers.size() * sizeof(std::int64_t) +
+           plain.size() + indexes.size() * sizeof(std::uint32_t);
+}
+
+Writer::Writer(const std::vector<Field> &fields, std::size_t groupRows)
+    : fields(fields), groupRows(groupRows)
+{
+    for (const auto &field: fields) {
+        leaves.emplace_back();
+        Leaf leaf;
+        leaf.maxDefinition = 1;
+        leaf.maxRepetition = 0;
+        switch (field.type) {
+            case int32:
+                leaf.physical = INT32;
+                break;
+            case int64:
+                leaf.physical = INT64;
+                // Only 64 bit integers are delta encoded, so the
+                // differences always fit
+                leaf.delta = field.delta;
+                break;
+            case timestamp:
+                leaf.physical = INT64;
+                leaf.delta = field.delta;
+                break;
+            case string:
+            case binary:
+                leaf.physical = BYTE_ARRAY;
+                leaf.dictionary = field.dictionary;
+                break;
+            case map:
+            case list:
+                leaf.physical = BYTE_ARRAY;
+                leaf.maxDefinition = 2;
+                leaf.maxRepetition = 1;
+                break;
+        }
+        if (field.type == map) {
+            leaf.path = {field.name, "key_value", "key"};
+            leaf.dictionary = field.dictionary;
+            leaves.back().push_back(columns.size());
+            columns.push_back(leaf);
+            leaf.path.back() = "value";
+            leaf.dictionary = false;
+        } else if (field.type == list) {
+            leaf.path = {field.name, "list", "element"};
+            leaf.dictionary = field.dictionary;
+        } else {
+            leaf.path = {field.name};
+        }
+        leaves.back().push_back(columns.size());
+        columns.push_back(leaf);
+    }
+}
+
+bool
+Writer::open(const std::string &filespec)
+{
+    file.open(filespec, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        log_error("Couldn't create %1%", filespec);
+        return false;
+    }
+    file.write("PAR1", 4);
+    offset = 4;
+    return true;
+}
+
+void
+Writer::metadata(const std::string &key, const std::string &value)
+{
+    keyValues.emplace_back(key, value);
+}
+
+void
+Writer::null(void)
+{
+    for (auto i: leaves[field]) {
+        columns[i].definitions.push_back(0);
+        if (columns[i].maxRepetition) {
+            columns[i].repetitions.push_back(0);
+        }
+    }
+    field++;
+}
+
+void
+Writer::integer(std::int64_t value)
+{
+    auto &leaf = columns[leaves[field++].front()];
+    leaf.definitions.push_back(1);
+    leaf.integers.push_back(value);
+    leaf.count++;
+}
+
+void
+Writer::bytes(std::string_view value)
+{
+    auto &leaf = columns[leaves[field++].front()];
+    leaf.definitions.push_back(1);
+    leaf.add(value);
+}
+
+void
+Writer::strings(const std::vector<std::string_view> &values)
+{
+    const auto &ids = leaves[field++];
+    if (values.size() < ids.size()) {
+        // An empty map or list isn't null, but has no elements
+        for (auto i: ids) {
+            columns[i].definitions.push_back(1);
+            columns[i].repetitions.push_back(0);
+        }
+        return;
+    }
+    for (std::size_t i = 0; i + ids.size() <= values.size(); i += ids.size()) {
+        for (std::size_t j = 0; j < ids.size(); j++) {
+            auto &leaf = columns[ids[j]];
+            leaf.definitions.push_back(2);
+            leaf.repetitions.push_back(i ? 1 : 0);
+            leaf.add(values[i + j]);
+        }
+    }
+}
+
+void
+Writer::endRow(void)
+{
+    field = 0;
+    buffered++;
+    total++;
+    if (buffered >= groupRows) {
+        writeGroup();
+        return;
+    }
+    // Pages are limited to 2GB, so big rows make smaller groups
+    if (buffered % 1024 == 0) {
+        std::size_t size = 0;
+        for (const auto &leaf: columns) {
+            size += leaf.size();
+        }
+        if (size > (64 << 20)) {
+            writeGroup();
+        }
+    }
+}
+
+Writer::Chunk
+Writer::writeChunk(Leaf &leaf)
+{
+    Chunk chunk{offset, 0, 0, leaf.definitions.size(), {}};
+    std::string values;
+    int encoding = PLAIN;
+    // A dictionary with few repeated values is larger than the strings
+    if (leaf.dictionary && (leaf.entries.empty() || leaf.entries.size() > leaf.count / 2)) {
+        for (auto i: leaf.indexes) {
+            append<std::uint32_t>(leaf.plain, leaf.entries[i].size());
+            leaf.plain += leaf.entries[i];
+        }
+        leaf.dictionary = false;
+    }
+    if (leaf.dictionary) {
+        std::string entries;
+        for (const auto &entry: leaf.entries) {
+            append<std::uint32_t>(entries, entry.size());
+            entries += entry;
+        }
+        Thrift header;
+        header.i32(1, DICTIONARY_PAGE);
+        header.i32(2, entries.size());
+        header.i32(3, entries.size());
+        header.beginStruct(7);
+        header.i32(1, leaf.entries.size());
+        header.i32(2, PLAIN);
+        header.end();
+        header.out += '\0';
+        file.write(header.out.data(), header.out.size());
+        file.write(entries.data(), entries.size());
+        chunk.dictionaryOffset = offset;
+        offset += header.out.size() + entries.size();
+        chunk.offset = offset;
+        indexes(values, leaf.indexes, leaf.entries.size());
+        encoding = RLE_DICTIONARY;
+    } else if (leaf.physical != BYTE_ARRAY && leaf.delta) {
+        delta(values, leaf.integers);
+        encoding = DELTA_BINARY_PACKED;
+    } else if (leaf.physical == INT32) {
+        values.reserve(leaf.integers.size() * sizeof(std::int32_t));
+        for (auto value: leaf.integers) {
+            append<std::int32_t>(values, value);
+        }
+    } else if (leaf.physical == INT64) {
+        values.reserve(leaf.integers.size() * sizeof(std::int64_t));
+        for (auto value: leaf.integers) {
+            append<std::int64_t>(values, value);
+        }
+    } else {
+        values.swap(leaf.plain);
+    }
+
+    std::string page;
+    if (leaf.maxRepetition) {
+        levels(page, leaf.repetitions);
+    }
+    levels(page, leaf.definitions);
+    page += values;
+
+    Thrift header;
+    header.i32(1, DATA_PAGE);
+    header.i32(2, page.size());
+    header.i32(3, page.size());
+    header.beginStruct(5);
+    header.i32(1, leaf.definitions.size());
+    header.i32(2, encoding);
+    header.i32(3, RLE);
+    header.i32(4, RLE);
+    header.end();
+    header.out += '\0';
+    file.write(header.out.data(), header.out.size());
+    file.write(page.data(), page.size());
+    offset += header.out.size() + page.size();
+
+    chunk.size = offset - (chunk.dictionaryOffset ? chunk.dictionaryOffset : chunk.offset);
+    chunk.encodings = {RLE, encoding};
+    if (encoding == RLE_DICTIONARY) {
+        chunk.encodings.push_back(PLAIN);
+    }
+    return chunk;
+}
+
+void
+Writer::writeGroup(void)
+{
+    std::vector<Chunk> chunks;
+    for (auto &leaf: columns) {
+        bool dictionary = leaf.dictionary;
+        chunks.push_back(writeChunk(leaf));
+        leaf.clear();
+        leaf.dictionary = dictionary;
+    }
+    groups.emplace_back(buffered, std::move(chunks));
+    buffered = 0;
+}
+
+bool
+Writer::close(void)
+{
+    if (!file.is_open()) {
+        return false;
+    }
+    if (buffered) {
+        writeGroup();
+    }
+
+    Thrift meta;
+    meta.i32(1, 1);
+    // The schema is flattened depth first, after a root with the fields
+    std::size_t elements = 1;
+    for (const auto &field: fields) {
+        elements += field.type == map ? 4 : field.type == list ? 3 : 1;
+    }
+    meta.list(2, T_STRUCT, elements);
+    meta.begin();
+    meta.binary(4, "schema");
+    meta.i32(5, fields.size());
+    meta.end();
+    for (std::size_t i = 0; i < fields.size(); i++) {
+        const auto &field = fields[i];
+        const auto &leaf = columns[leaves[i].front()];
+        meta.begin();
+        if (field.type == map || field.type == list) {
+            meta.i32(3, OPTIONAL);
+            meta.binary(4, field.name);
+            meta.i32(5, 1);
+            meta.i32(6, field.type == map ? MAP : LIST);
+            meta.end();
+            meta.begin();
+            meta.i32(3, REPEATED);
+            meta.binary(4, leaf.path[1]);
+            meta.i32(5, leaves[i].size());
+            meta.end();
+            for (auto id: leaves[i]) {
+                meta.begin();
+                meta.i32(1, BYTE_ARRAY);
+                meta.i32(3, REQUIRED);
+                meta.binary(4, columns[id].path.back());
+                meta.i32(6, UTF8);
+                meta.end();
+            }
+            continue;
+        }
+        meta.i32(1, leaf.physical);
+        meta.i32(3, OPTIONAL);
+        meta.binary(4, field.name);
+        if (field.type == string) {
+            meta.i32(6, UTF8);
+        } else if (field.type == timestamp) {
+            meta.i32(6, TIMESTAMP_MICROS);
+        }
+        meta.end();
+    }
+    meta.i64(3, total);
+
+    meta.list(4, T_STRUCT, groups.size());
+    for (const auto &group: groups) {
+        meta.begin();
+        meta.list(1, T_STRUCT, group.second.size());
+        std::uint64_t bytes = 0;
+        for (std::size_t i = 0; i < group.second.size(); i++) {
+            const auto &chunk = group.second[i];
+            const auto &leaf = columns[i];
+            bytes += chunk.size;
+            meta.begin();
+            meta.i64(2, chunk.dictionaryOffset ? chunk.dictionaryOffset : chunk.offset);
+            meta.beginStruct(3);
+            meta.i32(1, leaf.physical);
+            meta.list(2, T_I32, chunk.encodings.size());
+            for (auto encoding: chunk.encodings) {
+                meta.element(encoding);
+            }
+            meta.list(3, T_BINARY, leaf.path.size());
+            for (const auto &name: leaf.path) {
+                meta.element(name);
+            }
+            meta.i32(4, 0);
+            meta.i64(5, chunk.values);
+            meta.i64(6, chunk.size);
+            meta.i64(7, chunk.size);
+            meta.i64(9, chunk.offset);
+            if (chunk.dictionaryOffset) {
+                meta.i64(11, chunk.dictionaryOffset);
+            }
+            meta.end();
+            meta.end();
+        }
+        meta.i64(2, bytes);
+        meta.i64(3, group.first);
+        meta.end();
+    }
+
+    if (!keyValues.empty()) {
+        meta.list(5, T_STRUCT, keyValues.size());
+        for (const auto &kv: keyValues) {
+            meta.begin();
+            meta.binary(1, kv.first);
+            meta.binary(2, kv.second);
+            meta.end();
+        }
+    }
+    meta.binary(6, "underpass");
+    meta.out += '\0';
+
+    append<std::uint32_t>(meta.out, meta.out.size());
+    meta.out += "PAR1";
+    file.write(meta.out.data(), meta.out.size());
+    file.close();
+    return !file.fail();
+}
+
+} // namespace parquet
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
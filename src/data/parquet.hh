@@ -0,0 +1,160 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __PARQUET_HH__
+#define __PARQUET_HH__
+
+/// \file parquet.hh
+/// \brief Write tables to Parquet files
+///
+/// This is a small Parquet writer for the exported tables, so there is
+/// no dependency on Arrow. It writes uncompressed pages, one page per
+/// column chunk, and only the types the tables use. Integers can be
+/// delta encoded, like sorted IDs, and strings dictionary encoded,
+/// like tag keys.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/// \namespace parquet
+namespace parquet {
+
+/// The column types
+typedef enum {
+    int32,     ///< A 32 bit integer
+    int64,     ///< A 64 bit integer
+    timestamp, ///< Microseconds since the epoch, in UTC
+    string,    ///< UTF-8 text
+    binary,    ///< Bytes, like WKB geometries
+    map,       ///< A map of strings to strings
+    list       ///< A list of strings
+} type_t;
+
+/// \struct Field
+/// \brief A column of the table
+struct Field {
+    std::string name;
+    type_t type;
+    bool delta = false;        ///< Delta encode the integers
+    bool dictionary = false;   ///< Dictionary encode the strings, or the keys of a map
+};
+
+/// \class Writer
+/// \brief Write the rows of a table to a Parquet file
+///
+/// A row is written by setting each of its fields, in order, then
+/// calling endRow(). All the columns are nullable. The rows are
+/// buffered and written in row groups.
+class Writer {
+  public:
+    Writer(const std::vector<Field> &fields, std::size_t groupRows = 1 << 17);
+
+    /// Create the file, returns false if it can't be written
+    bool open(const std::string &filespec);
+    /// Add a key to the metadata in the footer, like "geo" for GeoParquet
+    void metadata(const std::string &key, const std::string &value);
+
+    /// Set the next field of the row to null
+    void null(void);
+    /// Set the next field of the row, an int32, int64 or timestamp
+    void integer(std::int64_t value);
+    /// Set the next field of the row, a string or binary
+    void bytes(std::string_view value);
+    /// Set the next field of the row, a list, or a map with the keys
+    /// and values alternating
+    void strings(const std::vector<std::string_view> &values);
+    /// Finish the row
+    void endRow(void);
+
+    /// Write the last row group and the footer
+    bool close(void);
+
+    /// The number of rows written
+    std::uint64_t rows(void) const { return total; };
+
+  private:
+    /// \struct Leaf
+    /// \brief The buffered values of a column, or of the keys or values of a map
+    struct Leaf {
+        std::vector<std::string> path;       ///< The path in the schema
+        int physical;                        ///< The Parquet type
+        int maxDefinition;
+        int maxRepetition;
+        bool delta = false;
+        bool dictionary = false;
+
+        std::vector<std::uint8_t> definitions;
+        std::vector<std::uint8_t> repetitions;
+        std::size_t count = 0;               ///< The values that aren't null
+        std::vector<std::int64_t> integers;
+        std::string plain;                   ///< PLAIN encoded strings
+        std::vector<std::uint32_t> indexes;  ///< Dictionary encoded strings
+        std::unordered_map<std::string, std::uint32_t> index;
+        std::vector<std::string> entries;    ///< The dictionary
+
+        /// Add a value that isn't null
+        void add(std::string_view value);
+        void clear(void);
+        /// The bytes buffered, about
+        std::size_t size(void) const;
+    };
+    /// \struct Chunk
+    /// \brief Where a column chunk was written
+    struct Chunk {
+        std::uint64_t offset;                ///< The data page
+        std::uint64_t dictionaryOffset;      ///< The dictionary page, or 0
+        std::uint64_t size;                  ///< The bytes of all pages
+        std::uint64_t values;                ///< The values, with the nulls
+        std::vector<int> encodings;
+    };
+
+    void writeGroup(void);
+    Chunk writeChunk(Leaf &leaf);
+
+    std::vector<Field> fields;
+    std::vector<std::vector<std::size_t>> leaves; ///< The leaves of each field
+    std::vector<Leaf> columns;
+    std::vector<std::pair<std::string, std::string>> keyValues;
+    std::vector<std::pair<std::uint64_t, std::vector<Chunk>>> groups; ///< Rows and chunks
+    std::size_t groupRows;
+    std::size_t buffered = 0;            ///< Rows in the current group
+    std::size_t field = 0;               ///< The next field of the row
+    std::uint64_t total = 0;
+    std::uint64_t offset = 0;            ///< Bytes written so far
+    std::ofstream file;
+};
+
+} // namespace parquet
+
+#endif // EOF __PARQUET_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
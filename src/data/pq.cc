@@ -120,16 +120,19 @@ Pq::parseURL(const std::string &dburl)
 }
 
 
+std::string
+Pq::arguments(void) const
+{
+    return host + " " + port + " " + dbname + " " + user + " " + passwd;
+}
+
 bool
 Pq::connect(const std::string &dburl)
 {
-    std::string args;
-
-    if (parseURL(dburl)) {
-        args = host + " " + port + " " + dbname + " " + user + " " + passwd;
-    } else {
+    if (!parseURL(dburl)) {
         return false;
     }
+    std::string args = arguments();
 
     // log_debug(args);
     try {
@@ -150,6 +153,11 @@ Pq::connect(const std::string &dburl)
 pqxx::result
 Pq::query(const std::string &query)
 {
+    // Without a connection the query is discarded, which is used to
+    // replay replication files without a database.
+    if (!sdb) {
+        return pqxx::result();
+    }
     std::scoped_lock write_lock{pqxx_mutex};
     pqxx::work worker(*sdb);
     auto result = worker.exec(query);
@@ -174,6 +182,9 @@ Pq::escapedString(const std::string &s)
         }
         i++;
     }
+    if (!sdb) {
+        return newstr;
+    }
     return sdb->esc(newstr);
 }
 
@@ -55,10 +55,13 @@ class Pq {
     /// \return TRUE if the DB is open.
     bool isOpen() const;
 
-    /// Run query into the database
+    /// Run query into the database. If it was never connected, the
+    /// query is discarded and the result is empty.
     pqxx::result query(const std::string &query);
     /// Parse the URL for the database connection
     bool parseURL(const std::string &query);
+    /// The connection string for libpq, once the URL is parsed
+    std::string arguments(void) const;
 
     /// Dump internal data for debugging
     void dump(void);
@@ -0,0 +1,520 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/timer/timer.hpp>
+
+#include "osm/binarychange.hh"
+#include "replicator/mirror.hh"
+#include "utils/log.hh"
+
+using namespace logger;
+using namespace osmobjects;
+
+/// \namespace osmchange
+namespace osmchange {
+
+const char BinaryChangeFile::magic[8] = {'U', 'P', 'O', 'S', 'C', 'B', '0', '1'};
+
+namespace {
+
+/// The epoch timestamps are stored relative to
+const ptime epoch(date(1970, 1, 1));
+
+/// Coordinates in osmChange files have at most 7 decimals
+const double scale = 1e7;
+
+void
+putVarint(std::string &out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+/// Zigzag encoding, so small negative deltas stay small
+void
+putSigned(std::string &out, int64_t value)
+{
+    putVarint(out, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+void
+putDouble(std::string &out, double value)
+{
+    char buf[sizeof(double)];
+    std::memcpy(buf, &value, sizeof(double));
+    out.append(buf, sizeof(double));
+}
+
+/// \class Cursor
+/// \brief Reads varints from one column, remembering any overrun
+class Cursor {
+  public:
+    Cursor(void) {};
+    Cursor(const unsigned char *_data, std::size_t _size) : data(_data), end(_data + _size) {};
+
+    uint64_t varint(void) {
+        uint64_t value = 0;
+        int shift = 0;
+        while (data < end && shift < 64) {
+            unsigned char byte = *data++;
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return value;
+            }
+            shift += 7;
+        }
+        ok = false;
+        return 0;
+    };
+    int64_t signedVarint(void) {
+        uint64_t value = varint();
+        return static_cast<int64_t>((value >> 1) ^ (~(value & 1) + 1));
+    };
+    unsigned char byte(void) {
+        if (data >= end) {
+            ok = false;
+            return 0;
+        }
+        return *data++;
+    };
+    double rawDouble(void) {
+        double value = 0;
+        if (end - data < static_cast<std::ptrdiff_t>(sizeof(double))) {
+            ok = false;
+            return value;
+        }
+        std::memcpy(&value, data, sizeof(double));
+        data += sizeof(double);
+        return value;
+    };
+    std::string bytes(std::size_t size) {
+        if (static_cast<std::size_t>(end - data) < size) {
+            ok = false;
+            return std::string();
+        }
+        std::string value(reinterpret_cast<const char *>(data), size);
+        data += size;
+        return value;
+    };
+
+    /// Read a count, failing if it's larger than \a limit, so corrupt
+    /// input can't make the reader allocate more than the column holds
+    uint64_t count(std::size_t limit) {
+        uint64_t value = varint();
+        if (value > limit) {
+            ok = false;
+            return 0;
+        }
+        return value;
+    };
+
+    /// The bytes not read yet
+    std::size_t left(void) const { return data < end ? end - data : 0; };
+
+    /// If the whole column has been read
+    bool done(void) const { return data >= end; };
+
+    bool ok = true;
+  private:
+    const unsigned char *data = nullptr;
+    const unsigned char *end = nullptr;
+};
+
+/// \class Encoder
+/// \brief Holds the columns and delta state while encoding
+class Encoder {
+  public:
+    std::array<std::string, BinaryChangeFile::column_count> columns;
+
+    uint64_t intern(const std::string &value) {
+        auto it = dictionary.find(value);
+        if (it != dictionary.end()) {
+            return it->second;
+        }
+        uint64_t index = dictionary.size();
+        dictionary[value] = index;
+        putVarint(columns[BinaryChangeFile::strings], value.size());
+        columns[BinaryChangeFile::strings].append(value);
+        return index;
+    };
+
+    /// The number of strings in the dictionary
+    uint64_t entries(void) const { return dictionary.size(); };
+
+    void object(const OsmObject &obj, unsigned char extra) {
+        unsigned char flags = extra;
+        if (!obj.timestamp.is_not_a_date_time()) {
+            flags |= BinaryChangeFile::has_timestamp;
+        }
+        columns[BinaryChangeFile::types].push_back(static_cast<char>(obj.type));
+        columns[BinaryChangeFile::actions].push_back(static_cast<char>(obj.action));
+        putSigned(columns[BinaryChangeFile::ids], obj.id - last_id);
+        last_id = obj.id;
+        putVarint(columns[BinaryChangeFile::versions], obj.version);
+        if (flags & BinaryChangeFile::has_timestamp) {
+            int64_t seconds = (obj.timestamp - epoch).total_seconds();
+            putSigned(columns[BinaryChangeFile::timestamps], seconds - last_timestamp);
+            last_timestamp = seconds;
+        }
+        putSigned(columns[BinaryChangeFile::uids], obj.uid - last_uid);
+        last_uid = obj.uid;
+        putVarint(columns[BinaryChangeFile::users], intern(obj.user));
+        putSigned(columns[BinaryChangeFile::changesets], obj.changeset - last_changeset);
+        last_changeset = obj.changeset;
+        columns[BinaryChangeFile::flags].push_back(static_cast<char>(flags));
+        putVarint(columns[BinaryChangeFile::tags], obj.tags.size());
+        for (auto it = std::begin(obj.tags); it != std::end(obj.tags); ++it) {
+            putVarint(columns[BinaryChangeFile::tags], intern(it->first));
+            putVarint(columns[BinaryChangeFile::tags], intern(it->second));
+        }
+    };
+
+    void node(const OsmNode &node, bool located) {
+        double lat = node.point.get<1>();
+        double lon = node.point.get<0>();
+        int64_t ilat = std::llround(lat * scale);
+        int64_t ilon = std::llround(lon * scale);
+        // Dividing the exact integer gives back the same double as
+        // parsing the decimal string, if there were at most 7 decimals.
+        bool exact = ilat / scale == lat && ilon / scale == lon;
+        unsigned char extra = 0;
+        if (located) {
+            extra |= BinaryChangeFile::has_location;
+            if (!exact) {
+                extra |= BinaryChangeFile::raw_location;
+            }
+        }
+        object(node, extra);
+        if (!located) {
+            return;
+        }
+        if (exact) {
+            putSigned(columns[BinaryChangeFile::lats], ilat - last_lat);
+            putSigned(columns[BinaryChangeFile::lons], ilon - last_lon);
+            last_lat = ilat;
+            last_lon = ilon;
+        } else {
+            putDouble(columns[BinaryChangeFile::lats], lat);
+            putDouble(columns[BinaryChangeFile::lons], lon);
+        }
+    };
+
+    void way(const OsmWay &way) {
+        object(way, 0);
+        std::string &out = columns[BinaryChangeFile::refs];
+        putVarint(out, way.refs.size());
+        int64_t last = 0;
+        for (auto it = std::begin(way.refs); it != std::end(way.refs); ++it) {
+            putSigned(out, *it - last);
+            last = *it;
+        }
+    };
+
+    void relation(const OsmRelation &relation) {
+        object(relation, 0);
+        std::string &out = columns[BinaryChangeFile::members];
+        putVarint(out, relation.members.size());
+        int64_t last = 0;
+        for (auto it = std::begin(relation.members); it != std::end(relation.members); ++it) {
+            out.push_back(static_cast<char>(it->type));
+            putSigned(out, it->ref - last);
+            last = it->ref;
+            putVarint(out, intern(it->role));
+        }
+    };
+
+  private:
+    std::unordered_map<std::string, uint64_t> dictionary;
+    int64_t last_id = 0;
+    int64_t last_timestamp = 0;
+    int64_t last_uid = 0;
+    int64_t last_changeset = 0;
+    int64_t last_lat = 0;
+    int64_t last_lon = 0;
+};
+
+} // anonymous namespace
+
+std::string
+BinaryChangeFile::encode(const OsmChangeFile &osc)
+{
+#ifdef TIMING_DEBUG
+    boost::timer::auto_cpu_timer timer("BinaryChangeFile::encode: took %w seconds\n");
+#endif
+    Encoder encoder;
+    for (auto it = std::begin(osc.changes); it != std::end(osc.changes); ++it) {
+        OsmChange *change = it->get();
+        std::string &out = encoder.columns[BinaryChangeFile::changes];
+        out.push_back(static_cast<char>(change->action));
+        if (change->final_entry.is_not_a_date_time()) {
+            out.push_back(0);
+        } else {
+            out.push_back(1);
+            putSigned(out, (change->final_entry - epoch).total_seconds());
+        }
+        putVarint(out, change->nodes.size());
+        putVarint(out, change->ways.size());
+        putVarint(out, change->relations.size());
+
+        for (auto nit = std::begin(change->nodes); nit != std::end(change->nodes); ++nit) {
+            OsmNode *node = nit->get();
+            // The parser only caches nodes that had coordinates
+            encoder.node(*node, osc.nodecache.count(node->id) > 0);
+        }
+        for (auto wit = std::begin(change->ways); wit != std::end(change->ways); ++wit) {
+            encoder.way(*wit->get());
+        }
+        for (auto rit = std::begin(change->relations); rit != std::end(change->relations); ++rit) {
+            encoder.relation(*rit->get());
+        }
+    }
+
+    // The string count isn't known until the end, so it's
+    // prepended once all the objects are encoded.
+    std::string strings;
+    putVarint(strings, encoder.entries());
+    encoder.columns[BinaryChangeFile::strings].insert(0, strings);
+
+    // Header, then the directory of column offsets and sizes
+    std::string out(magic, sizeof(magic));
+    uint64_t offset = sizeof(magic) + column_count * 2 * sizeof(uint64_t);
+    for (auto it = std::begin(encoder.columns); it != std::end(encoder.columns); ++it) {
+        uint64_t size = it->size();
+        out.append(reinterpret_cast<const char *>(&offset), sizeof(uint64_t));
+        out.append(reinterpret_cast<const char *>(&size), sizeof(uint64_t));
+        offset += size;
+    }
+    for (auto it = std::begin(encoder.columns); it != std::end(encoder.columns); ++it) {
+        out.append(*it);
+    }
+    return out;
+}
+
+bool
+BinaryChangeFile::isBinary(const unsigned char *data, std::size_t size)
+{
+    return size >= sizeof(magic) && std::memcmp(data, magic, sizeof(magic)) == 0;
+}
+
+bool
+BinaryChangeFile::decode(const unsigned char *data, std::size_t size, OsmChangeFile &osc)
+{
+#ifdef TIMING_DEBUG
+    boost::timer::auto_cpu_timer timer("BinaryChangeFile::decode: took %w seconds\n");
+#endif
+    std::size_t header = sizeof(magic) + column_count * 2 * sizeof(uint64_t);
+    if (!isBinary(data, size) || size < header) {
+        log_error("Not an encoded OsmChange file!");
+        return false;
+    }
+
+    std::array<Cursor, column_count> columns;
+    for (int i = 0; i < column_count; i++) {
+        uint64_t offset;
+        uint64_t length;
+        std::memcpy(&offset, data + sizeof(magic) + i * 2 * sizeof(uint64_t), sizeof(uint64_t));
+        std::memcpy(&length, data + sizeof(magic) + (i * 2 + 1) * sizeof(uint64_t), sizeof(uint64_t));
+        if (offset > size || length > size - offset) {
+            log_error("Encoded OsmChange column %1% is truncated!", i);
+            return false;
+        }
+        columns[i] = Cursor(data + offset, length);
+    }
+
+    std::vector<std::string> dictionary;
+    Cursor &strings = columns[BinaryChangeFile::strings];
+    // Each entry has at least its length
+    uint64_t entries = strings.count(strings.left());
+    for (uint64_t i = 0; i < entries && strings.ok; i++) {
+        dictionary.push_back(strings.bytes(strings.varint()));
+    }
+    auto lookup = [&dictionary](uint64_t index, bool &ok) -> const std::string & {
+        static const std::string none;
+        if (index >= dictionary.size()) {
+            ok = false;
+            return none;
+        }
+        return dictionary[index];
+    };
+
+    int64_t last_id = 0;
+    int64_t last_timestamp = 0;
+    int64_t last_uid = 0;
+    int64_t last_changeset = 0;
+    int64_t last_lat = 0;
+    int64_t last_lon = 0;
+    bool ok = strings.ok;
+
+    // Stop at the first column overrun, not at the end of the change
+    auto valid = [&columns, &ok]() -> bool {
+        for (const auto &column: columns) {
+            if (!column.ok) {
+                ok = false;
+            }
+        }
+        return ok;
+    };
+
+    // Fill in the fields common to all objects, and return the flags
+    auto object = [&](OsmObject &obj) -> unsigned char {
+        obj.type = static_cast<osmobjects::osmtype_t>(columns[BinaryChangeFile::types].byte());
+        obj.action = static_cast<action_t>(columns[BinaryChangeFile::actions].byte());
+        last_id += columns[BinaryChangeFile::ids].signedVarint();
+        obj.id = last_id;
+        obj.version = columns[BinaryChangeFile::versions].varint();
+        unsigned char flags = columns[BinaryChangeFile::flags].byte();
+        if (flags & has_timestamp) {
+            last_timestamp += columns[BinaryChangeFile::timestamps].signedVarint();
+            obj.timestamp = epoch + boost::posix_time::seconds(last_timestamp);
+        }
+        last_uid += columns[BinaryChangeFile::uids].signedVarint();
+        obj.uid = last_uid;
+        obj.user = lookup(columns[BinaryChangeFile::users].varint(), ok);
+        last_changeset += columns[BinaryChangeFile::changesets].signedVarint();
+        obj.changeset = last_changeset;
+        Cursor &tags = columns[BinaryChangeFile::tags];
+        // A key and a value
+        uint64_t count = tags.count(tags.left() / 2);
+        for (uint64_t i = 0; i < count && tags.ok && ok; i++) {
+            const std::string &key = lookup(tags.varint(), ok);
+            obj.tags[key] = lookup(tags.varint(), ok);
+        }
+        return flags;
+    };
+
+    Cursor &changes = columns[BinaryChangeFile::changes];
+    while (valid() && !changes.done()) {
+        auto action = changes.byte();
+        auto change = std::make_shared<OsmChange>(static_cast<action_t>(action));
+        if (changes.byte()) {
+            change->final_entry = epoch + boost::posix_time::seconds(changes.signedVarint());
+        }
+        // Each object has a type
+        Cursor &types = columns[BinaryChangeFile::types];
+        uint64_t nodes = changes.count(types.left());
+        uint64_t ways = changes.count(types.left() - nodes);
+        uint64_t relations = changes.count(types.left() - nodes - ways);
+
+        for (uint64_t i = 0; i < nodes && valid(); i++) {
+            auto node = change->newNode();
+            unsigned char flags = object(*node);
+            if (flags & has_location) {
+                if (flags & raw_location) {
+                    node->setPoint(columns[BinaryChangeFile::lats].rawDouble(),
+                                   columns[BinaryChangeFile::lons].rawDouble());
+                } else {
+                    last_lat += columns[BinaryChangeFile::lats].signedVarint();
+                    last_lon += columns[BinaryChangeFile::lons].signedVarint();
+                    node->setPoint(last_lat / scale, last_lon / scale);
+                }
+                osc.nodecache[node->id] = node->point;
+            }
+        }
+        for (uint64_t i = 0; i < ways && valid(); i++) {
+            auto way = change->newWay();
+            object(*way);
+            Cursor &refs = columns[BinaryChangeFile::refs];
+            uint64_t count = refs.count(refs.left());
+            int64_t last = 0;
+            for (uint64_t j = 0; j < count && refs.ok; j++) {
+                last += refs.signedVarint();
+                way->refs.push_back(last);
+            }
+        }
+        for (uint64_t i = 0; i < relations && valid(); i++) {
+            auto relation = change->newRelation();
+            object(*relation);
+            Cursor &members = columns[BinaryChangeFile::members];
+            // A type, a reference and a role
+            uint64_t count = members.count(members.left() / 3);
+            int64_t last = 0;
+            for (uint64_t j = 0; j < count && members.ok && ok; j++) {
+                auto type = static_cast<osmobjects::osmtype_t>(members.byte());
+                last += members.signedVarint();
+                relation->addMember(last, type, lookup(members.varint(), ok));
+            }
+        }
+        if (!valid()) {
+            break;
+        }
+        // Like the parser, the last object is the current one
+        if (relations) {
+            change->obj = change->relations.back();
+        } else if (ways) {
+            change->obj = change->ways.back();
+        } else if (nodes) {
+            change->obj = change->nodes.back();
+        }
+        osc.changes.push_back(change);
+    }
+
+    for (auto it = std::begin(columns); it != std::end(columns); ++it) {
+        ok &= it->ok;
+    }
+    if (!ok) {
+        log_error("Encoded OsmChange file is corrupted!");
+    }
+    return ok;
+}
+
+bool
+BinaryChangeFile::write(const OsmChangeFile &osc, const std::string &filespec)
+{
+    auto data = encode(osc);
+    std::ofstream out(filespec, std::ios::binary | std::ios::trunc);
+    out.write(data.data(), data.size());
+    out.close();
+    if (!out) {
+        log_error("Couldn't write %1%", filespec);
+        return false;
+    }
+    return true;
+}
+
+bool
+BinaryChangeFile::read(const std::string &filespec, OsmChangeFile &osc)
+{
+    mirror::MappedFile file(filespec);
+    if (!file.isValid()) {
+        return false;
+    }
+    return decode(file.data(), file.size(), osc);
+}
+
+} // namespace osmchange
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
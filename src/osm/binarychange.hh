@@ -0,0 +1,103 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __BINARYCHANGE_HH__
+#define __BINARYCHANGE_HH__
+
+/// \file binarychange.hh
+/// \brief A compact columnar encoding of a parsed OsmChange file
+///
+/// Parsing the XML is the most expensive part of processing a change
+/// file, so once a file has been parsed it can be saved in this format,
+/// and replays decode it straight from a memory mapping.
+///
+/// The file starts with a magic string and a directory of columns,
+/// followed by the columns. Every column is a sequence of varints, with
+/// IDs, timestamps and coordinates delta coded against the previous
+/// object, and all strings (tag keys and values, user names and roles)
+/// interned in a dictionary column.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <cstdint>
+#include <string>
+
+#include "osm/osmchange.hh"
+
+/// \namespace osmchange
+namespace osmchange {
+
+/// \class BinaryChangeFile
+/// \brief Encode and decode an OsmChangeFile in the columnar format
+class BinaryChangeFile {
+  public:
+    /// The columns in the file, in the order of the directory
+    typedef enum {
+        strings,    ///< The string dictionary
+        changes,    ///< Action, final entry and object counts of each change
+        types,      ///< Object type
+        actions,    ///< Object action
+        ids,        ///< Delta coded object IDs
+        versions,   ///< Object versions
+        timestamps, ///< Delta coded timestamps, in seconds
+        uids,       ///< Delta coded user IDs
+        users,      ///< User names, as dictionary indexes
+        changesets, ///< Delta coded changeset IDs
+        flags,      ///< Which optional fields an object has
+        tags,       ///< Tag count, then key and value dictionary indexes
+        lats,       ///< Delta coded latitudes of nodes, in 1e-7 degrees
+        lons,       ///< Delta coded longitudes of nodes, in 1e-7 degrees
+        refs,       ///< Ref count, then delta coded node refs of ways
+        members,    ///< Member count, then type, delta coded ref and role of relations
+        column_count
+    } column_t;
+
+    /// Bits in the flags column
+    typedef enum {
+        has_location = 1,   ///< The node has coordinates
+        has_timestamp = 2,  ///< The object has a timestamp
+        raw_location = 4    ///< The coordinates are stored as raw doubles
+    } flag_t;
+
+    static const char magic[8]; ///< The start of every file
+
+    /// Encode the parsed changes
+    static std::string encode(const OsmChangeFile &osc);
+    /// Decode changes into \a osc, which should be empty
+    static bool decode(const unsigned char *data, std::size_t size, OsmChangeFile &osc);
+    /// If the data starts like an encoded file
+    static bool isBinary(const unsigned char *data, std::size_t size);
+
+    /// Write the parsed changes to disk
+    static bool write(const OsmChangeFile &osc, const std::string &filespec);
+    /// Memory map a file from disk and decode it
+    static bool read(const std::string &filespec, OsmChangeFile &osc);
+};
+
+} // namespace osmchange
+
+#endif // EOF __BINARYCHANGE_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,586 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/endian/conversion.hpp>
+#include <boost/geometry.hpp>
+#include <boost/timer/timer.hpp>
+
+#include "osm/changebatch.hh"
+#include "stats/statsconfig.hh"
+#include "utils/log.hh"
+#include "utils/metrics.hh"
+
+using namespace logger;
+using namespace osmobjects;
+
+/// \namespace osmchange
+namespace osmchange {
+
+namespace {
+
+/// The time a validation check takes for one object
+metrics::Histogram &
+validationTime(const std::string &object, const std::string &check)
+{
+    return metrics::Registry::getDefaultInstance().histogram("underpass_validation_seconds",
+        "Time to validate an object", {{"object", object}, {"check", check}}, 1e-6);
+}
+
+/// Forget a deleted object once the batch is committed when the caller
+/// collects \a validated, so a failed write doesn't lose it, else now
+void
+forget(validatecache::ValidateCache &cache, std::vector<validatecache::ValidateCache::Validated> *validated,
+       osmobjects::osmtype_t type, long id, long version)
+{
+    if (validated) {
+        validated->push_back({type, id, version, 0, true});
+    } else {
+        cache.remove(type, id);
+    }
+}
+
+/// Append the little endian bytes of \a value
+template <typename T>
+void
+append(std::vector<unsigned char> &wkb, T value)
+{
+    unsigned char bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    if (boost::endian::order::native == boost::endian::order::big) {
+        std::reverse(bytes, bytes + sizeof(T));
+    }
+    wkb.insert(wkb.end(), bytes, bytes + sizeof(T));
+}
+
+/// The byte order and type of a WKB geometry
+void
+header(std::vector<unsigned char> &wkb, std::uint32_t type)
+{
+    wkb.push_back(1);
+    append<std::uint32_t>(wkb, type);
+}
+
+/// The points of a linestring or ring, with their count
+template <typename Range>
+void
+points(std::vector<unsigned char> &wkb, const Range &range)
+{
+    append<std::uint32_t>(wkb, boost::geometry::num_points(range));
+    for (const auto &point: range) {
+        append<double>(wkb, boost::geometry::get<0>(point));
+        append<double>(wkb, boost::geometry::get<1>(point));
+    }
+}
+
+void
+polygon(std::vector<unsigned char> &wkb, const polygon_t &poly)
+{
+    header(wkb, 3);
+    append<std::uint32_t>(wkb, 1 + poly.inners().size());
+    points(wkb, poly.outer());
+    for (const auto &inner: poly.inners()) {
+        points(wkb, inner);
+    }
+}
+
+} // anonymous namespace
+
+bool
+ChangeBatch::Columns::hasKey(std::size_t i, string_t key) const
+{
+    for (auto t = tags[i]; t < tags[i + 1]; t++) {
+        if (keys[t] == key) {
+            return true;
+        }
+    }
+    return false;
+}
+
+ChangeBatch::ChangeBatch(OsmChangeFile &_osc) : osc(_osc)
+{
+#ifdef TIMING_DEBUG_X
+    boost::timer::auto_cpu_timer timer("ChangeBatch: took %w seconds\n");
+#endif
+    std::array<Columns *, 3> all = {&nodes, &ways, &relations};
+    for (auto it = std::begin(all); it != std::end(all); ++it) {
+        (*it)->changes.push_back(0);
+        (*it)->tags.push_back(0);
+    }
+    ways.offsets.push_back(0);
+    relations.offsets.push_back(0);
+
+    for (auto it = std::begin(osc.changes); it != std::end(osc.changes); ++it) {
+        OsmChange *change = it->get();
+        for (auto nit = std::begin(change->nodes); nit != std::end(change->nodes); ++nit) {
+            OsmNode *node = nit->get();
+            addObject(nodes, *node);
+            nodes.lats.push_back(node->point.get<1>());
+            nodes.lons.push_back(node->point.get<0>());
+            nodes.objects.push_back(node);
+        }
+        for (auto wit = std::begin(change->ways); wit != std::end(change->ways); ++wit) {
+            OsmWay *way = wit->get();
+            addObject(ways, *way);
+            ways.refs.insert(ways.refs.end(), way->refs.begin(), way->refs.end());
+            ways.offsets.push_back(ways.refs.size());
+            ways.objects.push_back(way);
+        }
+        for (auto rit = std::begin(change->relations); rit != std::end(change->relations); ++rit) {
+            OsmRelation *relation = rit->get();
+            addObject(relations, *relation);
+            for (auto mit = std::begin(relation->members); mit != std::end(relation->members); ++mit) {
+                relations.refs.push_back(mit->ref);
+                relations.types.push_back(mit->type);
+                relations.roles.push_back(intern(mit->role));
+            }
+            relations.offsets.push_back(relations.refs.size());
+            relations.objects.push_back(relation);
+        }
+        for (auto cit = std::begin(all); cit != std::end(all); ++cit) {
+            (*cit)->changes.push_back((*cit)->size());
+        }
+    }
+}
+
+void
+ChangeBatch::addObject(Columns &columns, OsmObject &obj)
+{
+    columns.ids.push_back(obj.id);
+    columns.versions.push_back(obj.version);
+    columns.actions.push_back(obj.action);
+    columns.changesets.push_back(obj.changeset);
+    columns.uids.push_back(obj.uid);
+    columns.users.push_back(intern(obj.user));
+    columns.timestamps.push_back(obj.timestamp);
+    columns.priority.push_back(obj.priority);
+    for (auto it = std::begin(obj.tags); it != std::end(obj.tags); ++it) {
+        columns.keys.push_back(intern(it->first));
+        columns.values.push_back(intern(it->second));
+    }
+    columns.tags.push_back(columns.keys.size());
+}
+
+ChangeBatch::string_t
+ChangeBatch::intern(const std::string &value)
+{
+    auto it = dictionary.find(value);
+    if (it != dictionary.end()) {
+        return it->second;
+    }
+    string_t index = strings.size();
+    strings.push_back(value);
+    dictionary[value] = index;
+    return index;
+}
+
+ChangeBatch::string_t
+ChangeBatch::find(const std::string &value) const
+{
+    auto it = dictionary.find(value);
+    if (it != dictionary.end()) {
+        return it->second;
+    }
+    return npos;
+}
+
+void
+ChangeBatch::areaFilter(const multipolygon_t &poly)
+{
+#ifdef TIMING_DEBUG_X
+    boost::timer::auto_cpu_timer timer("ChangeBatch::areaFilter: took %w seconds\n");
+#endif
+    // Most points are far outside the boundary, so a bounding
+    // box check avoids the expensive polygon test.
+    boost::geometry::model::box<point_t> bbox;
+    if (!poly.empty()) {
+        boost::geometry::envelope(poly, bbox);
+    }
+    auto within = [&poly, &bbox](const point_t &point) {
+        return boost::geometry::covered_by(point, bbox) && boost::geometry::within(point, poly);
+    };
+    // Ways share nodes, so only test each one once
+    std::unordered_map<long, bool> inside;
+
+    for (std::size_t k = 0; k + 1 < nodes.changes.size(); k++) {
+        // Filter nodes
+        for (auto i = nodes.changes[k]; i < nodes.changes[k + 1]; i++) {
+            point_t point(nodes.lons[i], nodes.lats[i]);
+            bool priority = poly.empty() || within(point);
+            nodes.priority[i] = priority;
+            nodes.objects[i]->priority = priority;
+            if (priority) {
+                osc.nodecache[nodes.ids[i]] = point;
+                inside.erase(nodes.ids[i]);
+            }
+        }
+
+        // Filter ways
+        for (auto i = ways.changes[k]; i < ways.changes[k + 1]; i++) {
+            bool priority = poly.empty();
+            for (auto r = ways.offsets[i]; !priority && r < ways.offsets[i + 1]; r++) {
+                long ref = ways.refs[r];
+                auto cached = osc.nodecache.find(ref);
+                if (cached == osc.nodecache.end()) {
+                    continue;
+                }
+                auto test = inside.find(ref);
+                if (test == inside.end()) {
+                    test = inside.emplace(ref, within(cached->second)).first;
+                }
+                priority = test->second;
+            }
+            ways.priority[i] = priority;
+            ways.objects[i]->priority = priority;
+            auto cached = osc.waycache.find(ways.ids[i]);
+            if (cached != osc.waycache.end()) {
+                cached->second->priority = priority;
+            }
+        }
+
+        // Filter relations
+        for (auto i = relations.changes[k]; i < relations.changes[k + 1]; i++) {
+            bool priority = true;
+            for (auto m = relations.offsets[i]; !poly.empty() && m < relations.offsets[i + 1]; m++) {
+                auto cached = osc.waycache.find(relations.refs[m]);
+                if (cached == osc.waycache.end() || !cached->second->priority) {
+                    priority = false;
+                    break;
+                }
+            }
+            relations.priority[i] = priority;
+            relations.objects[i]->priority = priority;
+        }
+    }
+}
+
+void
+ChangeBatch::bounds(tiles::TileSet &dirty) const
+{
+    for (std::size_t i = 0; i < nodes.size(); i++) {
+        if (nodes.priority[i]) {
+            dirty.add(nodes.lons[i], nodes.lats[i], nodes.lons[i], nodes.lats[i]);
+        }
+    }
+    // Deleted ways are written too, but only have a geometry if their
+    // nodes are in the cache. Where the objects were before is added
+    // by QueryRaw::buildGeometries().
+    for (std::size_t i = 0; i < ways.size(); i++) {
+        if (!ways.priority[i] && ways.actions[i] != osmobjects::remove) {
+            continue;
+        }
+        const auto &way = *ways.objects[i];
+        boost::geometry::model::box<point_t> box;
+        if (!way.linestring.empty()) {
+            boost::geometry::envelope(way.linestring, box);
+        } else if (!way.polygon.outer().empty()) {
+            boost::geometry::envelope(way.polygon, box);
+        } else {
+            continue;
+        }
+        dirty.add(box.min_corner().x(), box.min_corner().y(), box.max_corner().x(), box.max_corner().y());
+    }
+}
+
+std::shared_ptr<std::map<long, std::shared_ptr<ChangeStats>>>
+ChangeBatch::collectStats(const multipolygon_t &poly)
+{
+#ifdef TIMING_DEBUG_X
+    boost::timer::auto_cpu_timer timer("ChangeBatch::collectStats: took %w seconds\n");
+#endif
+    auto mstats = std::make_shared<std::map<long, std::shared_ptr<ChangeStats>>>();
+    auto statsconfig = statsconfig::StatsConfig();
+
+    // The same tags appear over and over, so remember what
+    // each key and value pair matched for each object type.
+    std::array<std::unordered_map<std::uint64_t, std::string>, 3> matches;
+    auto match = [&](osmchange::osmtype_t type, string_t key, string_t value) -> const std::string & {
+        auto &cache = matches[type - osmchange::node];
+        std::uint64_t pair = (static_cast<std::uint64_t>(key) << 32) | value;
+        auto it = cache.find(pair);
+        if (it == cache.end()) {
+            it = cache.emplace(pair, statsconfig.search(strings[key], strings[value], type)).first;
+        }
+        return it->second;
+    };
+    auto changeStats = [&](const Columns &columns, std::size_t i) {
+        auto &ostats = (*mstats)[columns.changesets[i]];
+        if (!ostats) {
+            ostats = std::make_shared<ChangeStats>();
+            ostats->changeset = columns.changesets[i];
+            ostats->uid = columns.uids[i];
+            ostats->username = strings[columns.users[i]];
+            ostats->closed_at = columns.timestamps[i];
+        }
+        return ostats;
+    };
+    auto count = [](ChangeStats &ostats, osmobjects::action_t action, const std::string &hit) {
+        if (action == osmobjects::create) {
+            ostats.added[hit]++;
+        } else if (action == osmobjects::modify) {
+            ostats.modified[hit]++;
+        }
+    };
+
+    // Some older objects wound up with this one tag, which
+    // nobody noticed, so ignore them.
+    string_t created_at = find("created_at");
+    string_t empty = find("");
+    auto ignored = [created_at](const Columns &columns, std::size_t i) {
+        return columns.tags[i + 1] - columns.tags[i] == 1 && columns.keys[columns.tags[i]] == created_at;
+    };
+
+    for (std::size_t k = 0; k + 1 < nodes.changes.size(); k++) {
+        // Stats for Nodes
+        for (auto i = nodes.changes[k]; i < nodes.changes[k + 1]; i++) {
+            if (!nodes.priority[i] || ignored(nodes, i)) {
+                continue;
+            }
+            auto ostats = changeStats(nodes, i);
+            for (auto t = nodes.tags[i]; t < nodes.tags[i + 1]; t++) {
+                if (nodes.values[t] == empty) {
+                    continue;
+                }
+                auto &hit = match(osmchange::node, nodes.keys[t], nodes.values[t]);
+                if (!hit.empty()) {
+                    count(*ostats, nodes.actions[i], hit);
+                }
+            }
+        }
+
+        // Stats for Ways. If there are no tags, assume it's part of a relation.
+        for (auto i = ways.changes[k]; i < ways.changes[k + 1]; i++) {
+            if (!ways.priority[i] || ways.actions[i] == osmobjects::remove ||
+                ways.tags[i] == ways.tags[i + 1] || ignored(ways, i)) {
+                continue;
+            }
+            auto ostats = changeStats(ways, i);
+            for (auto t = ways.tags[i]; t < ways.tags[i + 1]; t++) {
+                if (ways.values[t] == empty) {
+                    continue;
+                }
+                auto &hit = match(osmchange::way, ways.keys[t], ways.values[t]);
+                if (hit.empty()) {
+                    continue;
+                }
+                count(*ostats, ways.actions[i], hit);
+
+                // Calculate length
+                if ((hit == "highway" || hit == "waterway") && ways.actions[i] == osmobjects::create) {
+                    // Get the geometry behind each reference
+                    boost::geometry::model::linestring<sphere_t> globe;
+                    for (auto r = ways.offsets[i]; r < ways.offsets[i + 1]; r++) {
+                        auto cached = osc.nodecache.find(ways.refs[r]);
+                        if (cached == osc.nodecache.end()) {
+                            continue;
+                        }
+                        double x = cached->second.get<0>();
+                        double y = cached->second.get<1>();
+                        if (x != 0 && y != 0) {
+                            globe.push_back(sphere_t(x, y));
+                            boost::geometry::append(ways.objects[i]->linestring, cached->second);
+                        }
+                    }
+                    double length = boost::geometry::length(globe,
+                            boost::geometry::strategy::distance::haversine<float>(6371.0));
+                    ostats->added[hit + "_km"] += length;
+                }
+            }
+        }
+
+        // Stats for Relations. If there are no tags, ignore it.
+        for (auto i = relations.changes[k]; i < relations.changes[k + 1]; i++) {
+            if (!relations.priority[i] || relations.tags[i] == relations.tags[i + 1]) {
+                continue;
+            }
+            auto ostats = changeStats(relations, i);
+            for (auto t = relations.tags[i]; t < relations.tags[i + 1]; t++) {
+                if (relations.values[t] == empty) {
+                    continue;
+                }
+                auto &hit = match(osmchange::relation, relations.keys[t], relations.values[t]);
+                if (!hit.empty()) {
+                    count(*ostats, relations.actions[i], hit);
+                }
+            }
+        }
+    }
+    return mstats;
+}
+
+std::shared_ptr<std::vector<std::shared_ptr<ValidateStatus>>>
+ChangeBatch::validateNodes(const multipolygon_t &poly, std::shared_ptr<Validate> &plugin,
+                           std::shared_ptr<validatecache::ValidateCache> cache,
+                           std::vector<validatecache::ValidateCache::Validated> *validated)
+{
+#ifdef TIMING_DEBUG_X
+    boost::timer::auto_cpu_timer timer("ChangeBatch::validateNodes: took %w seconds\n");
+#endif
+    auto totals = std::make_shared<std::vector<std::shared_ptr<ValidateStatus>>>();
+    static const std::vector<std::string> node_tests = {"building", "natural", "place", "waterway"};
+    // Looked up once, as the registry takes a lock
+    static const auto timings = [] {
+        std::vector<metrics::Histogram *> timings;
+        for (auto it = std::begin(node_tests); it != std::end(node_tests); ++it) {
+            timings.push_back(&validationTime("node", *it));
+        }
+        return timings;
+    }();
+    std::vector<string_t> keys;
+    for (auto it = std::begin(node_tests); it != std::end(node_tests); ++it) {
+        keys.push_back(find(*it));
+    }
+    std::size_t skipped = 0;
+    for (std::size_t i = 0; i < nodes.size(); i++) {
+        if (cache && nodes.actions[i] == osmobjects::remove) {
+            forget(*cache, validated, osmobjects::node, nodes.ids[i], nodes.versions[i]);
+        }
+        if (!nodes.priority[i] || nodes.tags[i] == nodes.tags[i + 1] ||
+            nodes.actions[i] == osmobjects::remove) {
+            continue;
+        }
+        std::uint64_t fingerprint = 0;
+        if (cache) {
+            fingerprint = validatecache::ValidateCache::fingerprint(*nodes.objects[i]);
+            if (cache->unchanged(osmobjects::node, nodes.ids[i], nodes.versions[i], fingerprint)) {
+                skipped++;
+                continue;
+            }
+        }
+        for (std::size_t test = 0; test < keys.size(); test++) {
+            if (keys[test] != npos && nodes.hasKey(i, keys[test])) {
+                metrics::Timer timer(*timings[test]);
+                totals->push_back(plugin->checkNode(*nodes.objects[i], node_tests[test]));
+            }
+        }
+        if (cache && validated) {
+            validated->push_back({osmobjects::node, nodes.ids[i], nodes.versions[i], fingerprint});
+        }
+    }
+    if (skipped) {
+        log_debug("Skipped validating %1% unchanged nodes", skipped);
+    }
+    return totals;
+}
+
+std::shared_ptr<std::vector<std::shared_ptr<ValidateStatus>>>
+ChangeBatch::validateWays(const multipolygon_t &poly, std::shared_ptr<Validate> &plugin,
+                          std::shared_ptr<validatecache::ValidateCache> cache,
+                          std::vector<validatecache::ValidateCache::Validated> *validated)
+{
+#ifdef TIMING_DEBUG_X
+    boost::timer::auto_cpu_timer timer("ChangeBatch::validateWays: took %w seconds\n");
+#endif
+    auto totals = std::make_shared<std::vector<std::shared_ptr<ValidateStatus>>>();
+    static auto &timing = validationTime("way", "building");
+    std::size_t skipped = 0;
+    for (std::size_t i = 0; i < ways.size(); i++) {
+        if (cache && ways.actions[i] == osmobjects::remove) {
+            forget(*cache, validated, osmobjects::way, ways.ids[i], ways.versions[i]);
+        }
+        if (!ways.priority[i]) {
+            continue;
+        }
+        // A deleted way is still checked, which removes its results
+        if (!cache || ways.actions[i] == osmobjects::remove) {
+            metrics::Timer timer(timing);
+            totals->push_back(plugin->checkWay(*ways.objects[i], "building"));
+            continue;
+        }
+        auto fingerprint = validatecache::ValidateCache::fingerprint(*ways.objects[i], "building");
+        if (cache->unchanged(osmobjects::way, ways.ids[i], ways.versions[i], fingerprint)) {
+            skipped++;
+            continue;
+        }
+        metrics::Timer timer(timing);
+        totals->push_back(plugin->checkWay(*ways.objects[i], "building"));
+        timer.stop();
+        if (validated) {
+            validated->push_back({osmobjects::way, ways.ids[i], ways.versions[i], fingerprint});
+        }
+    }
+    if (skipped) {
+        log_debug("Skipped validating %1% unchanged ways", skipped);
+    }
+    return totals;
+}
+
+ChangeBatch::Geometries
+ChangeBatch::geometries(osmobjects::osmtype_t type) const
+{
+    Geometries result;
+    std::vector<unsigned char> &wkb = result.wkb;
+    result.offsets.push_back(0);
+    if (type == osmobjects::node) {
+        wkb.reserve(nodes.size() * 21);
+        for (std::size_t i = 0; i < nodes.size(); i++) {
+            header(wkb, 1);
+            append<double>(wkb, nodes.lons[i]);
+            append<double>(wkb, nodes.lats[i]);
+            result.offsets.push_back(wkb.size());
+        }
+    } else if (type == osmobjects::way) {
+        for (const auto *way: ways.objects) {
+            if (!way->polygon.outer().empty()) {
+                polygon(wkb, way->polygon);
+            } else if (way->linestring.size() >= 2) {
+                header(wkb, 2);
+                points(wkb, way->linestring);
+            }
+            result.offsets.push_back(wkb.size());
+        }
+    } else if (type == osmobjects::relation) {
+        for (const auto *relation: relations.objects) {
+            if (!relation->multipolygon.empty()) {
+                header(wkb, 6);
+                append<std::uint32_t>(wkb, relation->multipolygon.size());
+                for (const auto &poly: relation->multipolygon) {
+                    polygon(wkb, poly);
+                }
+            } else if (!relation->multilinestring.empty()) {
+                header(wkb, 5);
+                append<std::uint32_t>(wkb, relation->multilinestring.size());
+                for (const auto &line: relation->multilinestring) {
+                    header(wkb, 2);
+                    points(wkb, line);
+                }
+            }
+            result.offsets.push_back(wkb.size());
+        }
+    }
+    return result;
+}
+
+} // namespace osmchange
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
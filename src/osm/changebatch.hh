@@ -0,0 +1,184 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __CHANGEBATCH_HH__
+#define __CHANGEBATCH_HH__
+
+/// \file changebatch.hh
+/// \brief A columnar view of the objects in an OsmChange file
+///
+/// The parsed changes are linked lists of shared pointers, which is
+/// slow to walk once per pass. A ChangeBatch copies the fields the
+/// passes need into contiguous columns, with the tags, way refs and
+/// relation members of all objects stored back to back and indexed by
+/// offset. Strings are interned, so tags compare as integers.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "osm/osmchange.hh"
+#include "validate/validatecache.hh"
+#include "utils/tiles.hh"
+
+/// \namespace osmchange
+namespace osmchange {
+
+/// \class ChangeBatch
+/// \brief Structure of arrays storage for the objects in an OsmChangeFile
+///
+/// Row \a i of each column is the same object, and the rows are in the
+/// same order as in the file. Each row also points back to its object,
+/// which is updated by the passes so the rest of the code sees the same
+/// results. The batch doesn't own the objects, so it must not outlive
+/// the OsmChangeFile it was built from.
+class ChangeBatch {
+  public:
+    /// An index in the string table
+    typedef std::uint32_t string_t;
+
+    /// \struct Columns
+    /// \brief The columns all object types have
+    struct Columns {
+        std::vector<std::uint32_t> changes;      ///< Rows of change k are [changes[k], changes[k+1])
+        std::vector<long> ids;                   ///< Object ID
+        std::vector<int> versions;               ///< Object version
+        std::vector<osmobjects::action_t> actions; ///< Object action
+        std::vector<long> changesets;            ///< Changeset ID
+        std::vector<long> uids;                  ///< User ID
+        std::vector<string_t> users;             ///< User name
+        std::vector<ptime> timestamps;           ///< Object timestamp
+        std::vector<unsigned char> priority;     ///< If it's in the priority area
+        std::vector<std::uint32_t> tags;         ///< Tags of row i are [tags[i], tags[i+1])
+        std::vector<string_t> keys;              ///< Tag keys
+        std::vector<string_t> values;            ///< Tag values
+
+        /// The number of rows
+        std::size_t size(void) const { return ids.size(); };
+        /// If row \a i has a tag with the key \a key
+        bool hasKey(std::size_t i, string_t key) const;
+    };
+
+    /// \struct NodeColumns
+    /// \brief The columns of the nodes
+    struct NodeColumns : Columns {
+        std::vector<double> lats;                ///< Latitude
+        std::vector<double> lons;                ///< Longitude
+        std::vector<osmobjects::OsmNode *> objects; ///< The parsed node
+    };
+
+    /// \struct WayColumns
+    /// \brief The columns of the ways
+    struct WayColumns : Columns {
+        std::vector<std::uint32_t> offsets;      ///< Refs of row i are [offsets[i], offsets[i+1])
+        std::vector<long> refs;                  ///< Node references
+        std::vector<osmobjects::OsmWay *> objects; ///< The parsed way
+    };
+
+    /// \struct RelationColumns
+    /// \brief The columns of the relations
+    struct RelationColumns : Columns {
+        std::vector<std::uint32_t> offsets;      ///< Members of row i are [offsets[i], offsets[i+1])
+        std::vector<long> refs;                  ///< Member references
+        std::vector<osmobjects::osmtype_t> types; ///< Member types
+        std::vector<string_t> roles;             ///< Member roles
+        std::vector<osmobjects::OsmRelation *> objects; ///< The parsed relation
+    };
+
+    /// \struct Geometries
+    /// \brief The geometry of each row, as Well Known Binary
+    struct Geometries {
+        std::vector<std::uint32_t> offsets;      ///< Row i is bytes [offsets[i], offsets[i+1])
+        std::vector<unsigned char> wkb;          ///< Little endian WKB, back to back
+    };
+
+    /// Copy the objects in \a osc into columns
+    ChangeBatch(OsmChangeFile &osc);
+
+    /// Encode the geometries of the nodes, ways or relations. Nodes are
+    /// points, ways polygons if they're closed or else linestrings, and
+    /// relations multipolygons or multilinestrings. An object without
+    /// a geometry, like a way with missing nodes, has no bytes.
+    Geometries geometries(osmobjects::osmtype_t type) const;
+
+    /// Set the priority of all objects by the boundary polygon
+    void areaFilter(const multipolygon_t &poly);
+
+    /// Add the tiles of the nodes and ways written to the database,
+    /// which are the ones in the priority area and the deleted ones
+    void bounds(tiles::TileSet &dirty) const;
+
+    /// Collect statistics for each changeset
+    std::shared_ptr<std::map<long, std::shared_ptr<ChangeStats>>>
+    collectStats(const multipolygon_t &poly);
+
+    /// Validate the nodes in the priority area. With a \a cache, nodes
+    /// whose tags and location didn't change since they were last
+    /// validated are skipped, and the fingerprints of the ones validated
+    /// are added to \a validated, for the cache once they're committed.
+    std::shared_ptr<std::vector<std::shared_ptr<ValidateStatus>>>
+    validateNodes(const multipolygon_t &poly, std::shared_ptr<Validate> &plugin,
+                  std::shared_ptr<validatecache::ValidateCache> cache = nullptr,
+                  std::vector<validatecache::ValidateCache::Validated> *validated = nullptr);
+
+    /// Validate the ways in the priority area. With a \a cache, ways
+    /// whose tags and geometry didn't change since they were last
+    /// validated are skipped, and the fingerprints of the ones validated
+    /// are added to \a validated, for the cache once they're committed.
+    std::shared_ptr<std::vector<std::shared_ptr<ValidateStatus>>>
+    validateWays(const multipolygon_t &poly, std::shared_ptr<Validate> &plugin,
+                 std::shared_ptr<validatecache::ValidateCache> cache = nullptr,
+                 std::vector<validatecache::ValidateCache::Validated> *validated = nullptr);
+
+    /// Add a string to the string table
+    string_t intern(const std::string &value);
+    /// Find a string in the string table, or return npos
+    string_t find(const std::string &value) const;
+
+    static const string_t npos = UINT32_MAX; ///< Not in the string table
+
+    NodeColumns nodes;                       ///< All the nodes
+    WayColumns ways;                         ///< All the ways
+    RelationColumns relations;               ///< All the relations
+    std::vector<std::string> strings;        ///< The string table
+
+  private:
+    /// Add the columns shared by all object types
+    void addObject(Columns &columns, osmobjects::OsmObject &obj);
+
+    OsmChangeFile &osc;                      ///< The file the objects belong to
+    std::unordered_map<std::string, string_t> dictionary; ///< Index of the string table
+};
+
+} // namespace osmchange
+
+#endif // EOF __CHANGEBATCH_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -29,6 +29,7 @@
 #include "unconfig.h"
 #endif
 
+#include <algorithm>
 #include <array>
 #include <cstdlib>
 #include <cstring>
@@ -74,10 +75,12 @@ using namespace boost::gregorian;
 #include <boost/tokenizer.hpp>
 #include <boost/tokenizer.hpp>
 #include <boost/timer/timer.hpp>
-#include <regex>
 
 #include "osm/changeset.hh"
+#include "osm/changesettokenizer.hh"
+#include "stats/hashtags.hh"
 #include "stats/querystats.hh"
+#include "utils/preparedarea.hh"
 
 #define BOOST_BIND_GLOBAL_PLACEHOLDERS 1
 
@@ -90,8 +93,7 @@ namespace changesets {
 bool
 ChangeSetFile::readChanges(const std::vector<unsigned char> &buffer)
 {
-
-    // parse_memory((const Glib::ustring &)buffer);
+    return readXML(reinterpret_cast<const char *>(buffer.data()), buffer.size());
 }
 
 // Read a changeset file from disk or memory into internal storage
@@ -100,6 +102,7 @@ ChangeSetFile::readChanges(const std::string &file)
 {
     std::ifstream change;
     int size = 0;
+    bool ok = false;
     //    store = false;
 
     unsigned char *buffer;
@@ -116,54 +119,57 @@ ChangeSetFile::readChanges(const std::string &file)
             inbuf.push(ifile);
             std::istream instream(&inbuf);
             // log_debug(instream.rdbuf());
-            readXML(instream);
+            ok = readXML(instream);
         } catch (std::exception &e) {
             log_error("opening %1% %2%", file, e.what());
             // return false;
         }
     } else { // it's a text file
         change.open(file, std::ifstream::in);
-        readXML(change);
+        ok = readXML(change);
     }
 
     change.close();
+    return ok;
 }
 
 void
 ChangeSetFile::areaFilter(const multipolygon_t &poly)
+{
+    areaFilter(geoutil::PreparedArea(poly));
+}
+
+void
+ChangeSetFile::areaFilter(const geoutil::PreparedArea &area)
 {
 #ifdef TIMING_DEBUG_X
     boost::timer::auto_cpu_timer timer("ChangeSetFile::areaFilter: took %w seconds\n");
 #endif
-    // log_debug("Pre filtering changeset size is %1%", changes.size());
-    for (auto it = std::begin(changes); it != std::end(changes); it++) {
-        ChangeSet *change = it->get();
-        if (poly.empty()) {
-            // log_debug("Accepting changeset %1% as in priority area because area information is missing",
-            // change->id);
-            change->priority = true;
-            continue;
-        }
-        boost::geometry::append(change->bbox, point_t(change->max_lon, change->max_lat));
-        boost::geometry::append(change->bbox, point_t(change->max_lon, change->min_lat));
-        boost::geometry::append(change->bbox, point_t(change->min_lon, change->min_lat));
-        boost::geometry::append(change->bbox, point_t(change->min_lon, change->max_lat));
-        boost::geometry::append(change->bbox, point_t(change->max_lon, change->max_lat));
-        // point_t pt;
-        // boost::geometry::centroid(change->bbox, pt);
-        if (!boost::geometry::intersects(change->bbox, poly)) {
-            // log_debug("Validating changeset %1% is not in a priority area", change->id);
-
-            change->priority = false;
+    // Without any area information, everything is in the priority area
+    changes.remove_if([&area](const std::shared_ptr<ChangeSet> &change) {
+        box_t bbox(point_t(change->min_lon, change->min_lat), point_t(change->max_lon, change->max_lat));
+        change->priority = area.empty() || area.intersects(bbox);
+        return !change->priority;
+    });
+}
 
-            changes.erase(it--);
-        } else {
-            // log_debug("Validating changeset %1% is in a priority area", change->id);
-            change->priority = true;
-        }
+void
+ChangeSet::addTag(const std::string &key, const std::string &value)
+{
+    std::vector<std::string> found;
+    if (key == "hashtags") {
+        hashtags::scanList(value, found);
+    } else if (key == "comment") {
+        // The hashtag tag wasn't added till later, so many older
+        // hashtags are in the comment field instead.
+        addComment(value);
+        hashtags::scanComment(value, found);
+    } else if (key == "created_by") {
+        addEditor(value);
+    }
+    for (auto &hashtag: found) {
+        addHashtags(std::move(hashtag));
     }
-    // log_debug("Post filtering changeset size is %1%",
-    // changeset->changes.size());
 }
 
 void
@@ -272,7 +278,12 @@ ChangeSetFile::dump(void)
 bool
 ChangeSetFile::readXML(std::istream &xml)
 {
-#ifdef LIBXML
+#ifdef FASTXML
+    // The tokenizer works on a buffer, and replication files
+    // are small enough to hold in memory.
+    std::string buffer{std::istreambuf_iterator<char>(xml), {}};
+    return readXML(buffer.data(), buffer.size());
+#elif defined(LIBXML)
     // libxml calls on_element_start for each node, using a SAX parser,
     // and works well for large files.
     try {
@@ -305,30 +316,30 @@ ChangeSetFile::readXML(std::istream &xml)
 
     for (auto value: pt.get_child("osm")) {
         if (value.first == "changeset") {
-            changesets::ChangeSet change;
+            auto change = std::make_shared<changesets::ChangeSet>();
             // Process the tags. These don't exist for every element
             for (auto tag: value.second) {
                 if (tag.first == "tag") {
                     std::string key = tag.second.get("<xmlattr>.k", "");
                     std::string val = tag.second.get("<xmlattr>.v", "");
-                    change.tags[key] = val;
+                    change->addTag(key, val);
                 }
             }
             // Process the attributes, which do exist in every element
-            change.id = value.second.get("<xmlattr>.id", 0);
-            change.created_at = value.second.get("<xmlattr>.created_at",
+            change->id = value.second.get("<xmlattr>.id", 0);
+            change->created_at = value.second.get("<xmlattr>.created_at",
                                  boost::posix_time::second_clock::universal_time());
-            change.closed_at = value.second.get("<xmlattr>.closed_at",
+            change->closed_at = value.second.get("<xmlattr>.closed_at",
                                  boost::posix_time::second_clock::universal_time());
-            change.open = value.second.get("<xmlattr>.open", false);
-            change.user = value.second.get("<xmlattr>.user", "");
-            change.uid = value.second.get("<xmlattr>.uid", 0);
-            change.min_lat = value.second.get("<xmlattr>.min_lat", 0.0);
-            change.min_lon = value.second.get("<xmlattr>.min_lon", 0.0);
-            change.max_lat = value.second.get("<xmlattr>.max_lat", 0.0);
-            change.max_lon = value.second.get("<xmlattr>.max_lon", 0.0);
-            change.num_changes = value.second.get("<xmlattr>.num_changes", 0);
-            change.comments_count = value.second.get("<xmlattr>.comments_count", 0);
+            change->open = value.second.get("<xmlattr>.open", false);
+            change->user = value.second.get("<xmlattr>.user", "");
+            change->uid = value.second.get("<xmlattr>.uid", 0);
+            change->min_lat = value.second.get("<xmlattr>.min_lat", 0.0);
+            change->min_lon = value.second.get("<xmlattr>.min_lon", 0.0);
+            change->max_lat = value.second.get("<xmlattr>.max_lat", 0.0);
+            change->max_lon = value.second.get("<xmlattr>.max_lon", 0.0);
+            change->num_changes = value.second.get("<xmlattr>.num_changes", 0);
+            change->comments_count = value.second.get("<xmlattr>.comments_count", 0);
             changes.push_back(change);
         }
     }
@@ -336,6 +347,18 @@ ChangeSetFile::readXML(std::istream &xml)
     return true;
 }
 
+bool
+ChangeSetFile::readXML(const char *data, std::size_t size)
+{
+#ifdef FASTXML
+    setlocale(LC_NUMERIC, "C");
+    return ChangeSetTokenizer::parse(data, size, *this, threads);
+#else
+    std::istringstream xml(std::string(data, size));
+    return readXML(xml);
+#endif
+}
+
 #ifdef LIBXML
 void
 ChangeSetFile::on_end_element(const Glib::ustring &name)
@@ -357,73 +380,21 @@ ChangeSetFile::on_start_element(const Glib::ustring &name,
         // changes.back().dump();
     } else if (name == "tag") {
         // We ignore most of the attributes, as they're not used for OSM stats.
-        // Processing a tag requires multiple passes through the loop. The
-        // two tags to look for are 'k' (keyword) and 'v' (value). So when
-        // we see a key we want, we have to wait for the next iteration of
-        // the loop to get the value.
-        bool hashit = false;
-        bool comhit = false;
-        bool cbyhit = false;
-
+        std::string key;
+        std::string value;
         for (const auto &attr_pair: attributes) {
-            if (attr_pair.name == "k" && attr_pair.value == "hashtags") {
-                hashit = true;
-            } else if (attr_pair.name == "k" && attr_pair.value == "comment") {
-                comhit = true;
-            } else if (attr_pair.name == "k" && attr_pair.value == "created_by") {
-                cbyhit = true;
-            }
-
-            if (changes.size() == 0) {
-                std::cerr << "No changes!" << std::endl;
-                auto change = std::make_shared<ChangeSet>();
-                changes.push_back(change);
-            }
-
-            if (hashit && attr_pair.name == "v") {
-                hashit = false;
-                std::size_t pos = attr_pair.value.find('#', 0);
-                if (pos != std::string::npos) {
-                    // Don't allow really short hashtags, they're usually a typo
-                    if (attr_pair.value.length() < 3) {
-                        continue;
-                    }
-                    char *token = std::strtok((char *)attr_pair.value.c_str(), "#;");
-                    while (token != NULL) {
-                        if (token) {
-                            changes.back()->addHashtags(token);
-                        }
-                        token = std::strtok(NULL, "#;");
-                    }
-                } else {
-                    changes.back()->addHashtags(attr_pair.value);
-                }
-            }
-            // Hashtags start with an # of course. The hashtag tag wasn't
-            // added till later, so many older hashtags are in the comment
-            // field instead.
-            if (comhit && attr_pair.name == "v") {
-                comhit = false;
-                changes.back()->addComment(attr_pair.value);
-                std::string value = attr_pair.value;
-                // Treat most punctuation (except -, _, +, &) as hashtag delimiters
-                // https://github.com/openstreetmap/iD/blob/develop/modules/ui/commit.js
-                std::regex subjectRx("(#[^\u2000-\u206F\u2E00-\u2E7F\\s\\'!\"#$%()*,.\\/:;<=>?@\\[\\]^`{|}~]+)", std::regex_constants::icase);
-                std::regex_iterator<std::string::iterator> it (value.begin(), value.end(), subjectRx);
-                std::regex_iterator<std::string::iterator> end;
-                while (it != end) {
-                    std::string hashtag = it->str(1).erase(0,1);
-                    if (hashtag.size() > 2) {
-                        changes.back()->addHashtags(hashtag);
-                    }
-                    ++it;
-                }
-            }
-            if (cbyhit && attr_pair.name == "v") {
-                cbyhit = false;
-                changes.back()->addEditor(attr_pair.value);
+            if (attr_pair.name == "k") {
+                key = attr_pair.value;
+            } else if (attr_pair.name == "v") {
+                value = attr_pair.value;
             }
         }
+        if (changes.size() == 0) {
+            std::cerr << "No changes!" << std::endl;
+            auto change = std::make_shared<ChangeSet>();
+            changes.push_back(change);
+        }
+        changes.back()->addTag(key, value);
     }
 }
 #endif // EOF LIBXML
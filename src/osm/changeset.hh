@@ -59,6 +59,7 @@ using namespace boost::gregorian;
 // Forward declaration
 namespace geoutil {
 class GeoUtil;
+class PreparedArea;
 };
 
 /// \namespace changesets
@@ -102,6 +103,10 @@ class ChangeSet {
         editor = text;
     };
 
+    /// Add a tag of the changeset. Only the hashtags, comment and
+    /// created_by tags are kept.
+    void addTag(const std::string &key, const std::string &value);
+
     // protected so testcases can access private data
     // protected:
     // These fields come from the changeset replication file
@@ -124,7 +129,6 @@ class ChangeSet {
     std::string comment; ///< The comment for this changeset
     std::string editor;  ///< The OSM editor the end user used
     std::string source;  ///< The imagery source
-    polygon_t bbox;
     bool priority;        ///< Is this feature in the boundary area
 };
 
@@ -147,6 +151,9 @@ class ChangeSetFile
     /// Delete features not in the boundary
     void areaFilter(const multipolygon_t &poly);
 
+    /// Delete features not in the boundary, prepared once for all files
+    void areaFilter(const geoutil::PreparedArea &area);
+
     /// Read a changeset file from disk or memory into internal storage
     bool readChanges(const std::string &file);
 
@@ -164,6 +171,9 @@ class ChangeSetFile
     /// Read an istream of the data and parse the XML
     bool readXML(std::istream &xml);
 
+    /// Parse the XML in a buffer
+    bool readXML(const char *data, std::size_t size);
+
     /// Dump the data of this class to the terminal. This should only
     /// be used for debugging.
     void dump(void);
@@ -178,6 +188,9 @@ class ChangeSetFile
     bool parse_error = false;
 
     ptime last_closed_at = not_a_date_time;
+
+    /// The threads parsing a large file with the built-in tokenizer
+    unsigned int threads = 1;
 };
 } // namespace changesets
 
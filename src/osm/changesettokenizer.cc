@@ -0,0 +1,227 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <boost/timer/timer.hpp>
+
+#include "osm/changesettokenizer.hh"
+#include "osm/xmlscan.hh"
+#include "utils/log.hh"
+
+using namespace logger;
+
+/// \namespace changesets
+namespace changesets {
+
+namespace {
+
+using namespace xmlscan;
+
+/// The changesets parsed from part of a buffer
+struct Chunk {
+    const char *begin = nullptr;
+    const char *end = nullptr;
+    std::list<std::shared_ptr<ChangeSet>> changes;
+    ptime last_closed_at = not_a_date_time;
+    bool ok = true;
+};
+
+/// Parse the elements that start between \a chunk.begin and \a chunk.end
+bool
+parseChunk(Chunk &chunk)
+{
+    const char *p = chunk.begin;
+    const char *end = chunk.end;
+    std::shared_ptr<ChangeSet> change;
+    std::string scratch;
+    std::string key;
+    std::string text;
+
+    while (p < end) {
+        p = static_cast<const char *>(std::memchr(p, '<', end - p));
+        if (p == nullptr) {
+            break;
+        }
+        if (++p >= end) {
+            break;
+        }
+
+        bool error = false;
+        if (skipMarkup(p, end, error)) {
+            if (error) {
+                return false;
+            }
+            continue;
+        }
+
+        const char *name = p;
+        while (p < end && !isSpace(*p) && *p != '/' && *p != '>') {
+            p++;
+        }
+        std::string_view element(name, p - name);
+        bool changeset = element == "changeset";
+        bool tag = element == "tag";
+        if (changeset) {
+            change = std::make_shared<ChangeSet>();
+            chunk.changes.push_back(change);
+        }
+        bool has_key = false;
+        text.clear();
+
+        std::string_view attrname;
+        std::string_view value;
+        while (true) {
+            auto scanned = readAttribute(p, end, attrname, value, scratch);
+            if (scanned == bad_attribute) {
+                return false;
+            } else if (scanned == end_of_element) {
+                break;
+            }
+            if (!changeset && !tag) {
+                continue;
+            } else if (tag) {
+                if (attrname == "k") {
+                    key.assign(value);
+                    has_key = true;
+                } else if (attrname == "v") {
+                    text.assign(value);
+                }
+            } else if (attrname == "id") {
+                toNumber(value, change->id);
+            } else if (attrname == "created_at") {
+                change->created_at = toTimestamp(value);
+            } else if (attrname == "closed_at") {
+                change->closed_at = toTimestamp(value);
+            } else if (attrname == "open") {
+                change->open = value == "true";
+            } else if (attrname == "user") {
+                change->user.assign(value);
+            } else if (attrname == "uid") {
+                toNumber(value, change->uid);
+            } else if (attrname == "source") {
+                change->source.assign(value);
+            } else if (attrname == "lat") {
+                toNumber(value, change->min_lat);
+                change->max_lat = change->min_lat;
+            } else if (attrname == "lon") {
+                toNumber(value, change->min_lon);
+                change->max_lon = change->min_lon;
+            } else if (attrname == "min_lat") {
+                toNumber(value, change->min_lat);
+            } else if (attrname == "max_lat") {
+                toNumber(value, change->max_lat);
+            } else if (attrname == "min_lon") {
+                toNumber(value, change->min_lon);
+            } else if (attrname == "max_lon") {
+                toNumber(value, change->max_lon);
+            } else if (attrname == "num_changes" || attrname == "changes_count") {
+                toNumber(value, change->num_changes);
+            } else if (attrname == "comments_count") {
+                toNumber(value, change->comments_count);
+            }
+        }
+
+        if (changeset && change->closed_at != not_a_date_time
+            && (chunk.last_closed_at == not_a_date_time || change->closed_at > chunk.last_closed_at)) {
+            chunk.last_closed_at = change->closed_at;
+        }
+        if (tag && has_key) {
+            if (change) {
+                change->addTag(key, text);
+            } else {
+                log_debug("Ignoring tag %1% outside of a changeset", key);
+            }
+        }
+
+        if (!skipElement(p, end)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // anonymous namespace
+
+bool
+ChangeSetTokenizer::parse(const char *data, std::size_t size, ChangeSetFile &file, unsigned int threads)
+{
+#ifdef TIMING_DEBUG_X
+    boost::timer::auto_cpu_timer timer("ChangeSetTokenizer::parse: took %w seconds\n");
+#endif
+    const char *end = data + size;
+    std::size_t count = std::max<std::size_t>(1, std::min<std::size_t>(threads, size / chunk));
+
+    // Split the buffer where a changeset starts, so no element is
+    // cut in two. The first chunk also gets the header.
+    std::vector<Chunk> chunks(count);
+    std::string_view buffer(data, size);
+    const char *begin = data;
+    for (std::size_t i = 0; i < count; i++) {
+        chunks[i].begin = begin;
+        if (i + 1 < count) {
+            auto next = buffer.find("<changeset ", size / count * (i + 1));
+            begin = next == std::string_view::npos ? end : data + std::max<std::size_t>(next, begin - data);
+        } else {
+            begin = end;
+        }
+        chunks[i].end = begin;
+    }
+
+    if (count == 1) {
+        chunks.front().ok = parseChunk(chunks.front());
+    } else {
+        boost::asio::thread_pool pool(count);
+        for (auto &piece: chunks) {
+            boost::asio::post(pool, [&piece] { piece.ok = parseChunk(piece); });
+        }
+        pool.join();
+    }
+
+    bool ok = true;
+    for (auto &piece: chunks) {
+        ok = ok && piece.ok;
+        file.changes.splice(file.changes.end(), piece.changes);
+        if (piece.last_closed_at != not_a_date_time
+            && (file.last_closed_at == not_a_date_time || piece.last_closed_at > file.last_closed_at)) {
+            file.last_closed_at = piece.last_closed_at;
+        }
+    }
+    return ok;
+}
+
+} // namespace changesets
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,62 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __CHANGESETTOKENIZER_HH__
+#define __CHANGESETTOKENIZER_HH__
+
+/// \file changesettokenizer.hh
+/// \brief A specialized tokenizer for changeset replication files
+///
+/// Like the osmChange tokenizer, this scans the decompressed buffer in
+/// place, as a changeset file only has changeset and tag elements. The
+/// changesets don't depend on each other, so a large file is split at
+/// changeset boundaries and the pieces are parsed in parallel.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <cstddef>
+
+#include "osm/changeset.hh"
+
+/// \namespace changesets
+namespace changesets {
+
+/// \class ChangeSetTokenizer
+/// \brief Parse a changeset buffer into a ChangeSetFile
+class ChangeSetTokenizer {
+  public:
+    /// Parse the XML in \a data, appending the changesets to \a file,
+    /// using up to \a threads for a large buffer
+    static bool parse(const char *data, std::size_t size, ChangeSetFile &file, unsigned int threads = 1);
+
+    /// The smallest piece of a buffer parsed by a thread
+    static const std::size_t chunk = 1 << 20;
+};
+
+} // namespace changesets
+
+#endif // EOF __CHANGESETTOKENIZER_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,308 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <charconv>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include <boost/timer/timer.hpp>
+
+#include "osm/osctokenizer.hh"
+#include "osm/xmlscan.hh"
+#include "utils/log.hh"
+
+using namespace logger;
+
+/// \namespace osmchange
+namespace osmchange {
+
+namespace {
+
+using namespace xmlscan;
+
+/// The elements the tokenizer cares about
+typedef enum {
+    other_element,
+    create_element,
+    modify_element,
+    delete_element,
+    node_element,
+    way_element,
+    relation_element,
+    tag_element,
+    nd_element,
+    member_element
+} element_t;
+
+inline element_t
+toElement(std::string_view name)
+{
+    switch (name.size()) {
+      case 2:
+          return name == "nd" ? nd_element : other_element;
+      case 3:
+          if (name == "tag") {
+              return tag_element;
+          }
+          return name == "way" ? way_element : other_element;
+      case 4:
+          return name == "node" ? node_element : other_element;
+      case 6:
+          if (name == "create") {
+              return create_element;
+          } else if (name == "modify") {
+              return modify_element;
+          } else if (name == "delete") {
+              return delete_element;
+          }
+          return name == "member" ? member_element : other_element;
+      case 8:
+          return name == "relation" ? relation_element : other_element;
+      default:
+          return other_element;
+    }
+}
+
+/// Parse the number in the attribute \a name, logging it if it's not one
+template <typename T>
+inline bool
+readNumber(std::string_view name, std::string_view value, T &number)
+{
+    if (toNumber(value, number)) {
+        return true;
+    }
+    log_error("Invalid number in attribute %1%: '%2%'", std::string(name), std::string(value));
+    return false;
+}
+
+} // anonymous namespace
+
+bool
+OscTokenizer::parse(const char *data, std::size_t size, OsmChangeFile &osc)
+{
+#ifdef TIMING_DEBUG_X
+    boost::timer::auto_cpu_timer timer("OscTokenizer::parse: took %w seconds\n");
+#endif
+    const char *p = data;
+    const char *end = data + size;
+    std::shared_ptr<OsmChange> change;
+    std::string scratch;
+    std::string key;
+
+    while (p < end) {
+        p = static_cast<const char *>(std::memchr(p, '<', end - p));
+        if (p == nullptr) {
+            break;
+        }
+        if (++p >= end) {
+            break;
+        }
+
+        // Closing tags carry no data, and the XML declaration,
+        // comments and DTDs can all be skipped.
+        bool error = false;
+        if (skipMarkup(p, end, error)) {
+            if (error) {
+                return false;
+            }
+            continue;
+        }
+
+        const char *name = p;
+        while (p < end && !isSpace(*p) && *p != '/' && *p != '>') {
+            p++;
+        }
+        element_t element = toElement(std::string_view(name, p - name));
+
+        std::shared_ptr<osmobjects::OsmObject> obj;
+        osmobjects::OsmNode *location = nullptr;
+        bool located = false;
+        switch (element) {
+          case create_element:
+              change = std::make_shared<OsmChange>(osmobjects::create);
+              osc.changes.push_back(change);
+              break;
+          case modify_element:
+              change = std::make_shared<OsmChange>(osmobjects::modify);
+              osc.changes.push_back(change);
+              break;
+          case delete_element:
+              change = std::make_shared<OsmChange>(osmobjects::remove);
+              osc.changes.push_back(change);
+              break;
+          case node_element:
+          case way_element:
+          case relation_element:
+              if (!change) {
+                  log_error("OSM object outside of a change!");
+                  return false;
+              }
+              if (element == node_element) {
+                  auto newnode = change->newNode();
+                  location = newnode.get();
+                  obj = newnode;
+              } else if (element == way_element) {
+                  obj = change->newWay();
+              } else {
+                  obj = change->newRelation();
+              }
+              obj->action = change->action;
+              change->obj = obj;
+              break;
+          default:
+              break;
+        }
+
+        // Member and tag attributes have to be collected first,
+        // as they don't arrive in a fixed order.
+        long ref = -1;
+        osmobjects::osmtype_t type = osmobjects::osmtype_t::empty;
+        std::string role;
+        std::string text;
+        bool has_key = false;
+        key.clear();
+
+        // Process the attributes
+        // A number that doesn't parse fails the file, like malformed XML
+        std::string_view attrname;
+        std::string_view value;
+        bool valid = true;
+        while (valid) {
+            auto scanned = readAttribute(p, end, attrname, value, scratch);
+            if (scanned == bad_attribute) {
+                return false;
+            } else if (scanned == end_of_element) {
+                break;
+            }
+
+            switch (element) {
+              case node_element:
+              case way_element:
+              case relation_element:
+                  if (attrname == "id") {
+                      valid = readNumber(attrname, value, obj->id);
+                  } else if (attrname == "version") {
+                      valid = readNumber(attrname, value, obj->version);
+                  } else if (attrname == "timestamp") {
+                      obj->timestamp = toTimestamp(value);
+                      change->final_entry = obj->timestamp;
+                  } else if (attrname == "uid") {
+                      valid = readNumber(attrname, value, obj->uid);
+                  } else if (attrname == "user") {
+                      obj->user.assign(value);
+                  } else if (attrname == "changeset") {
+                      valid = readNumber(attrname, value, obj->changeset);
+                  } else if (location && attrname == "lat") {
+                      double lat = 0;
+                      valid = readNumber(attrname, value, lat);
+                      location->setLatitude(lat);
+                      located = true;
+                  } else if (location && attrname == "lon") {
+                      double lon = 0;
+                      valid = readNumber(attrname, value, lon);
+                      location->setLongitude(lon);
+                      located = true;
+                  }
+                  break;
+              case tag_element:
+                  if (attrname == "k") {
+                      key.assign(value);
+                      has_key = true;
+                  } else if (attrname == "v") {
+                      text.assign(value);
+                  }
+                  break;
+              case nd_element:
+                  if (attrname == "ref") {
+                      valid = readNumber(attrname, value, ref);
+                  }
+                  break;
+              case member_element:
+                  if (attrname == "type") {
+                      if (value == "way") {
+                          type = osmobjects::osmtype_t::way;
+                      } else if (value == "node") {
+                          type = osmobjects::osmtype_t::node;
+                      } else if (value == "relation") {
+                          type = osmobjects::osmtype_t::relation;
+                      } else {
+                          log_debug("Invalid relation type '%1%'!", std::string(value));
+                      }
+                  } else if (attrname == "ref") {
+                      valid = readNumber(attrname, value, ref);
+                  } else if (attrname == "role") {
+                      role.assign(value);
+                  }
+                  break;
+              default:
+                  break;
+            }
+        }
+        if (!valid) {
+            return false;
+        }
+
+        switch (element) {
+          case node_element:
+              if (located) {
+                  osc.nodecache[location->id] = location->point;
+              }
+              break;
+          case tag_element:
+              if (change && change->obj && has_key) {
+                  change->obj->tags[key] = text;
+              }
+              break;
+          case nd_element:
+              if (change && ref != -1) {
+                  change->addRef(ref);
+              }
+              break;
+          case member_element:
+              if (change && ref != -1 && type != osmobjects::osmtype_t::empty) {
+                  change->addMember(ref, type, role);
+              } else {
+                  log_debug("Invalid relation (ref: %1%, type: %2%, role: %3%",
+                            ref, type, role);
+              }
+              break;
+          default:
+              break;
+        }
+
+        // Skip the rest of the tag, which is either > or />
+        if (!skipElement(p, end)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace osmchange
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,60 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __OSCTOKENIZER_HH__
+#define __OSCTOKENIZER_HH__
+
+/// \file osctokenizer.hh
+/// \brief A specialized tokenizer for the osmChange XML dialect
+///
+/// osmChange only uses a handful of elements and attributes, so instead
+/// of a general purpose XML parser this scans the decompressed buffer
+/// directly. Element and attribute names are compared in place, numbers
+/// are converted with std::from_chars, and only attribute values that
+/// contain entities get copied. Configure with --enable-parser=fast to
+/// use it in place of libxml++.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <cstddef>
+
+#include "osm/osmchange.hh"
+
+/// \namespace osmchange
+namespace osmchange {
+
+/// \class OscTokenizer
+/// \brief Parse an osmChange buffer into an OsmChangeFile
+class OscTokenizer {
+  public:
+    /// Parse the XML in \a data, appending the changes to \a osc
+    static bool parse(const char *data, std::size_t size, OsmChangeFile &osc);
+};
+
+} // namespace osmchange
+
+#endif // EOF __OSCTOKENIZER_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
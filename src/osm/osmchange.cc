@@ -31,6 +31,7 @@
 #include <pqxx/pqxx>
 #include <list>
 #include <locale>
+#include <sstream>
 
 #ifdef LIBXML
 #include <libxml++/libxml++.h>
@@ -58,6 +59,10 @@ using namespace boost::gregorian;
 #include "validate/validate.hh"
 #include "osm/osmobjects.hh"
 #include "osm/osmchange.hh"
+#include "osm/binarychange.hh"
+#include "osm/changebatch.hh"
+#include "osm/osctokenizer.hh"
+#include "osm/relationbuilder.hh"
 #include <ogr_geometry.h>
 
 #include "stats/statsconfig.hh"
@@ -95,6 +100,10 @@ OsmChangeFile::readChanges(const std::string &file)
     unsigned char *buffer;
     log_debug("Reading OsmChange file %1%", file);
     std::string suffix = boost::filesystem::extension(file);
+    // It's already been parsed and encoded, so skip the XML
+    if (suffix == ".oscb") {
+        return BinaryChangeFile::read(file, *this);
+    }
     // It's a gzipped file, common for files downloaded from planet
     std::ifstream ifile(file, std::ios_base::in | std::ios_base::binary);
     if (suffix == ".gz") { // it's a compressed file
@@ -156,241 +165,9 @@ OsmChangeFile::buildGeometriesFromNodeCache() {
     }
 }
 
-// FIXME
-// TODO: refactor, divide this function into multiple parts
 void
 OsmChangeFile::buildRelationGeometry(osmobjects::OsmRelation &relation) {
-
-    // A way is missing from cache
-    bool noWay = false;
-    // There are not Way relation members
-    bool noWayMembers = true;
-
-    bool first = true;
-    std::string innerGeoStr;
-    std::string geometry_str;
-    std::string linestring_tmp;
-    bool using_linestring_tmp = false;
-    linestring_t lastLinestring;
-    point_t firstLinestringPoint;
-    bool isMultiPolygon = relation.isMultiPolygon();
-    bool close = false;
-
-    for (auto mit = relation.members.begin(); mit != relation.members.end(); ++mit) {
-
-        // Process Way objects only, not Nodes or other Relations
-        if (mit->type == osmobjects::way) {
-            noWayMembers = false;
-            
-            if (close == true) {
-                first = true;
-                close = false;
-                using_linestring_tmp = false;
-            }
-
-            // If a reference is not on Way cache, skip this relation
-            if (!waycache.count(mit->ref)) { 
-                noWay = true;
-                break;
-            }
-
-            auto way = waycache.at(mit->ref);
-
-            if (first) {
-                firstLinestringPoint = point_t(
-                    boost::geometry::get<0>(way->linestring[0]),
-                    boost::geometry::get<1>(way->linestring[0])
-                );
-            }
-
-            // 1. When 
-            // A) Relation is a LineString or MultiLineString but
-            //    we want to save it as a MultiPolygon (this is the case for boundaries)
-            // B) the Relation is MultiPolygon but is composed of several LineStrings
-            if (using_linestring_tmp || (isMultiPolygon &&
-                boost::geometry::num_points(way->linestring) > 0 &&
-                boost::geometry::num_points(way->polygon) == 0)
-            ) {
-
-                using_linestring_tmp = true;
-                std::stringstream ss;
-                std::string geometry;
-
-                // If way's geometry is a polygon, save the outer
-                if (boost::geometry::num_points(way->polygon) > 0) {
-                    ss << std::setprecision(12) << boost::geometry::wkt(way->polygon.outer());
-                    geometry = ss.str();
-                    geometry.erase(geometry.size() - 1);
-
-                // Way's geometry is a LineString
-                } else {
-
-                    if (first) {
-                        std::cout << "Check if first linestring have to be reversed" << std::endl;
-                        auto nextWay = waycache.at(std::next(mit)->ref);
-
-                        auto first_node_way1 = way->refs.front();
-                        auto first_node_way2 = nextWay->refs.front();
-                        auto last_node_way2 = nextWay->refs.back();
-
-                        if (first_node_way1 == first_node_way2 ||
-                            first_node_way1 == last_node_way2) {
-                            std::cout << "Yes! reverse first line" << std::endl;
-                            bg::reverse(way->linestring);
-                            firstLinestringPoint = point_t(
-                                boost::geometry::get<0>(way->linestring.front()),
-                                boost::geometry::get<1>(way->linestring.front())
-                            );
-                        }
-                    }
-
-                    if (!first) {
-                        // Reverse the line direction if it's necessary
-                        if (lastLinestring.size() > 0 && way->linestring.size() > 0) {
-                            bool reverse_line = bg::equals(lastLinestring.front(), way->linestring.front()) ||
-                            bg::equals(lastLinestring.front(), way->linestring.back()) ||
-                            bg::equals(lastLinestring.back(), way->linestring.front()) ||
-                            bg::equals(lastLinestring.back(), way->linestring.back());
-                            if (reverse_line) {
-                                bg::reverse(way->linestring);
-                            }
-                        }
-
-                        // Check if object is closed
-
-                        // FIXME:
-                        // If one linestring reaches the beginning of the multilinestring
-                        // take it as a polygon and start with a new one, to solve cases
-                        // like this one https://www.openstreetmap.org/relation/16193116
-
-                        if (bg::equals(way->linestring.back(), firstLinestringPoint)) {
-                            close = true;
-                        }
-
-                    }
-                    lastLinestring = way->linestring;
-                    ss << std::setprecision(12) << boost::geometry::wkt(way->linestring);
-                    geometry = ss.str();
-                }
-
-                // Erase "LINESTRING("
-                geometry.erase(0,11);
-                geometry.erase(geometry.size() - 1);
-                // Get geometry coordinates as a string (lat lon, lat lon, ...),
-                if (close) {
-                    std::cout << "***** [CLOSED OBJECT]" << std::endl;
-                    std::cout << way->id << std::endl;
-                }
-                linestring_tmp += "(" + geometry + "),";
-
-            } else {
-
-                // 2. Any other MultiPolygon or MultiLineString
-
-                // When Relation is MultiLineString but way's geometry is a Polygon
-                if (!isMultiPolygon && boost::geometry::num_points(way->linestring) == 0 &&
-                    boost::geometry::num_points(way->polygon) > 0
-                ) {
-                    // Convert way's Polygon to LineString
-                    bg::assign_points(way->linestring, way->polygon.outer());
-                }
-
-                std::stringstream ss;
-                std::string geometry;
-
-                if (isMultiPolygon) {
-                    ss << std::setprecision(12) << boost::geometry::wkt(way->polygon);
-                    geometry = ss.str();
-                    // Erase "POLYGON("
-                    geometry.erase(0,8);
-                } else {
-                    ss << std::setprecision(12) << boost::geometry::wkt(way->linestring);
-                    geometry = ss.str();
-                    // Erase "LINESTRING("
-                    geometry.erase(0,11);
-                }
-                // Erase ")"
-                geometry.erase(geometry.size() - 1);
-                
-
-                // Get geometry coordinates as a string (lat lon, lat lon, ...)
-                if (!isMultiPolygon) {
-                    geometry = "(" + geometry + ")";
-                }
-
-                // Add way's geometry to the final result
-                // FIXME CHECK
-                if (first && (mit->role != "inner")) {
-                    geometry_str += geometry + ",";
-                } else {
-                    if (mit->role == "inner" && isMultiPolygon) {
-                        innerGeoStr += geometry + ",";
-                    } else {
-                        geometry_str += geometry + ",";
-                        geometry_str += innerGeoStr;
-                        innerGeoStr = "";
-                    }
-                }
-            }
-            first = false;
-        }
-    }
-
-    // If the relation has way members and all ways were found in the ways cache
-    if (!noWay && !noWayMembers) {
-        
-        // FIXME CHECK 
-        if (linestring_tmp.size() == 0) {
-            if (!isMultiPolygon) {
-                geometry_str.erase(geometry_str.size() - 1);
-                geometry_str = "MULTILINESTRING(" + geometry_str;
-            } else {
-                geometry_str = "MULTIPOLYGON((" + geometry_str;
-            }
-            if (innerGeoStr.size() > 0) {
-                geometry_str += innerGeoStr;
-            }
-            geometry_str.erase(geometry_str.size() - 1);
-            geometry_str += "))";
-
-        // FIXME CHECK 
-        } else {
-
-            std::cout << "HERE!" << std::endl;
-            
-            // Create a MultiLineString
-            // TODO: do this for each part
-            linestring_tmp.erase(linestring_tmp.size() - 1);
-            geometry_str = "MULTILINESTRING(" + linestring_tmp + ")";
-            boost::geometry::read_wkt(geometry_str, relation.multilinestring);
-            linestring_t mergedLineString;
-            for (auto& line : relation.multilinestring) {
-                bg::append(mergedLineString, line);
-            }
-
-            // Create a Polygon from the MultiLineString
-            polygon_t polygon;
-            bg::append(polygon.outer(), mergedLineString);
-            std::stringstream ss;
-            ss << std::setprecision(12) << boost::geometry::wkt(polygon);
-            geometry_str = ss.str();
-            
-            // Erase "POLYGON"
-            geometry_str.erase(0, 8);
-
-            // Create final MultiPolygon
-            geometry_str = "MULTIPOLYGON((" + geometry_str + ")";
-
-        }
-
-        // Save the final geometry string
-        if (isMultiPolygon) {
-            boost::geometry::read_wkt(geometry_str, relation.multipolygon);
-        } else {
-            boost::geometry::read_wkt(geometry_str, relation.multilinestring);
-        }
-
-    }
+    RelationBuilder(waycache).build(relation);
 }
 
 bool
@@ -406,7 +183,12 @@ OsmChangeFile::readXML(std::istream &xml)
     setlocale(LC_NUMERIC, "C");
     // log_debug("OsmChangeFile::readXML(): " << xml.rdbuf());
     std::ofstream myfile;
-#ifdef LIBXML
+#ifdef FASTXML
+    // The tokenizer works on a buffer, and replication files
+    // are small enough to hold in memory.
+    std::string buffer{std::istreambuf_iterator<char>(xml), {}};
+    return OscTokenizer::parse(buffer.data(), buffer.size(), *this);
+#elif defined(LIBXML)
     // libxml calls on_element_start for each node, using a SAX parser,
     // and works well for large files.
     try {
@@ -502,6 +284,18 @@ OsmChangeFile::readXML(std::istream &xml)
     return false;
 }
 
+bool
+OsmChangeFile::readXML(const char *data, std::size_t size)
+{
+#ifdef FASTXML
+    setlocale(LC_NUMERIC, "C");
+    return OscTokenizer::parse(data, size, *this);
+#else
+    std::istringstream xml(std::string(data, size));
+    return readXML(xml);
+#endif
+}
+
 #ifdef LIBXML
 // Called by libxml++ for each element of the XML file
 void
@@ -704,207 +498,15 @@ OsmChangeFile::dump(void)
 void
 OsmChangeFile::areaFilter(const multipolygon_t &poly)
 {
-#ifdef TIMING_DEBUG_X
-    boost::timer::auto_cpu_timer timer("OsmChangeFile::areaFilter: took %w seconds\n");
-#endif
-    std::map<long, bool> priority;
-    for (auto it = std::begin(changes); it != std::end(changes); it++) {
-
-        OsmChange *change = it->get();
-        bool debug = false;
-
-        // Filter nodes
-        for (auto nit = std::begin(change->nodes); nit != std::end(change->nodes); ++nit) {
-            OsmNode *node = nit->get();
-            if (poly.empty() || boost::geometry::within(node->point, poly)) {
-                node->priority = true;
-                nodecache[node->id] = node->point;
-            } else if (!boost::geometry::within(node->point, poly)) {
-                node->priority = false;
-            }
-        }
-
-        // Filter ways
-        for (auto wit = std::begin(change->ways); wit != std::end(change->ways); ++wit) {
-            OsmWay *way = wit->get();
-            if (poly.empty()) {
-                way->priority = true;
-            } else {
-                way->priority = false;
-                for (auto rit = std::begin(way->refs); rit != std::end(way->refs); ++rit) {
-                    if (nodecache.count(*rit) && boost::geometry::within(nodecache[*rit], poly)) {
-                        way->priority = true;
-                        break;
-                    }
-                }
-            }
-            if (waycache.count(way->id)) {
-                waycache.at(way->id)->priority = way->priority;
-            }
-            
-        }
-
-        // Filter relations
-        for (auto rit = std::begin(change->relations); rit != std::end(change->relations); ++rit) {
-            OsmRelation *relation = rit->get();
-            relation->priority = true;
-            if (!poly.empty()) {
-                for (auto mit = std::begin(relation->members); mit != std::end(relation->members); ++mit) {
-                    if (waycache.count(mit->ref)) {
-                        auto way = waycache.at(mit->ref);
-                        if (!way->priority) {
-                            relation->priority = false;
-                            break;
-                        }
-                    } else {
-                        relation->priority = false;
-                        break;
-                    }
-                }
-            }
-        }
-    }
+    ChangeBatch batch(*this);
+    batch.areaFilter(poly);
 }
 
 std::shared_ptr<std::map<long, std::shared_ptr<ChangeStats>>>
 OsmChangeFile::collectStats(const multipolygon_t &poly)
 {
-#ifdef TIMING_DEBUG_X
-    boost::timer::auto_cpu_timer timer("OsmChangeFile::collectStats: took %w seconds\n");
-#endif
-
-    auto mstats =
-        std::make_shared<std::map<long, std::shared_ptr<ChangeStats>>>();
-        std::shared_ptr<ChangeStats> ostats;
-
-    for (auto it = std::begin(changes); it != std::end(changes); ++it) {
-        OsmChange *change = it->get();
-        // Stats for Nodes
-        for (auto it = std::begin(change->nodes); it != std::end(change->nodes); ++it) {
-            OsmNode *node = it->get();
-            if (!node->priority) {
-                continue;
-            }
-            // Some older nodes in a way wound up with this one tag, which nobody noticed,
-            // so ignore it.
-            if (node->tags.size() == 1 &&
-                node->tags.find("created_at") != node->tags.end()) {
-                continue;
-            }
-            ostats = (*mstats)[node->changeset];
-            if (ostats.get() == 0) {
-                ostats = std::make_shared<ChangeStats>();
-                ostats->changeset = node->changeset;
-                ostats->uid = node->uid;
-                ostats->username = node->user;
-                ostats->closed_at = node->timestamp;
-                (*mstats)[node->changeset] = ostats;
-            }
-            auto hits = scanTags(node->tags, osmchange::node);
-            for (auto hit = std::begin(*hits); hit != std::end(*hits); ++hit) {
-                if (node->action == osmobjects::create) {
-                    ostats->added[*hit]++;
-                } else if (node->action == osmobjects::modify) {
-                    ostats->modified[*hit]++;
-                }
-            }
-        }
-
-        // Stats for Ways
-        for (auto it = std::begin(change->ways); it != std::end(change->ways); ++it) {
-            OsmWay *way = it->get();
-            if (!way->priority) {
-                continue;
-            }
-            // If there are no tags, assume it's part of a relation
-            if (way->tags.size() == 0 && way->action != osmobjects::remove) {
-                continue;
-            }
-            if (way->action == osmobjects::remove) {
-                continue;
-            }
-
-            // Some older ways in a way wound up with this one tag, which nobody noticed,
-            // so ignore it.
-            if (way->tags.size() == 1 && way->tags.find("created_at") != way->tags.end()) {
-                continue;
-            }
-            ostats = (*mstats)[way->changeset];
-            if (ostats.get() == 0) {
-                ostats = std::make_shared<ChangeStats>();
-                ostats->changeset = way->changeset;
-                ostats->uid = way->uid;
-                ostats->username = way->user;
-                ostats->closed_at = way->timestamp;
-                (*mstats)[way->changeset] = ostats;
-            }
-
-            auto hits = scanTags(way->tags, osmchange::way);
-            for (auto hit = std::begin(*hits); hit != std::end(*hits); ++hit) {
-
-                if (way->action == osmobjects::create) {
-                    ostats->added[*hit]++;
-                } else if (way->action == osmobjects::modify) {
-                    ostats->modified[*hit]++;
-                }
-
-                // Calculate length
-                if ( (*hit == "highway" || *hit == "waterway") && way->action == osmobjects::create) {
-                    // Get the geometry behind each reference
-                    boost::geometry::model::linestring<sphere_t> globe;
-                    for (auto lit = std::begin(way->refs); lit != std::end(way->refs); ++lit) {
-                        double x = nodecache[*lit].get<0>();
-                        double y = nodecache[*lit].get<1>();
-                        if (x != 0 && y != 0) {
-                            globe.push_back(sphere_t(x,y));
-                            boost::geometry::append(way->linestring, nodecache[*lit]);
-                        }
-                    }
-                    std::string tag;
-                    if (*hit == "highway") {
-                        tag = "highway_km";
-                    }
-                    if (*hit == "waterway") {
-                        tag = "waterway_km";
-                    }
-                    double length = boost::geometry::length(globe,
-                            boost::geometry::strategy::distance::haversine<float>(6371.0));
-                    // log_debug("LENGTH: %1% %2%", std::to_string(length), way->changeset);
-                    ostats->added[tag] += length;
-                }
-            }
-        }
-
-        // Stats for Relations
-        for (auto it = std::begin(change->relations); it != std::end(change->relations); ++it) {
-            OsmRelation *relation = it->get();
-            if (!relation->priority) {
-                continue;
-            }
-            // If there are no tags, ignore it
-            if (relation->tags.size() == 0) {
-                continue;
-            }
-            ostats = (*mstats)[relation->changeset];
-            if (ostats.get() == 0) {
-                ostats = std::make_shared<ChangeStats>();
-                ostats->changeset = relation->changeset;
-                ostats->uid = relation->uid;
-                ostats->username = relation->user;
-                ostats->closed_at = relation->timestamp;
-                (*mstats)[relation->changeset] = ostats;
-            }
-            auto hits = scanTags(relation->tags, osmchange::relation);
-            for (auto hit = std::begin(*hits); hit != std::end(*hits); ++hit) {
-                if (relation->action == osmobjects::create) {
-                    ostats->added[*hit]++;
-                } else if (relation->action == osmobjects::modify) {
-                    ostats->modified[*hit]++;
-                }
-            }
-        }
-    }
-    return mstats;
+    ChangeBatch batch(*this);
+    return batch.collectStats(poly);
 }
 
 std::shared_ptr<std::vector<std::string>>
@@ -955,50 +557,15 @@ ChangeStats::dump(void)
 std::shared_ptr<std::vector<std::shared_ptr<ValidateStatus>>>
 OsmChangeFile::validateNodes(const multipolygon_t &poly, std::shared_ptr<Validate> &plugin)
 {
-#ifdef TIMING_DEBUG_X
-    boost::timer::auto_cpu_timer timer("OsmChangeFile::validateNodes: took %w seconds\n");
-#endif
-    auto totals =
-        std::make_shared<std::vector<std::shared_ptr<ValidateStatus>>>();
-    for (auto it = std::begin(changes); it != std::end(changes); ++it) {
-        OsmChange *change = it->get();
-        for (auto nit = std::begin(change->nodes);
-            nit != std::end(change->nodes); ++nit) {
-            OsmNode *node = nit->get();
-            if (!node->priority || node->tags.empty() || node->action == osmobjects::remove) {
-                continue;
-            }
-            std::vector<std::string> node_tests = {"building", "natural", "place", "waterway"};
-            for (auto test_it = std::begin(node_tests); test_it != std::end(node_tests); ++test_it) {
-                if (node->containsKey(*test_it)) {
-                    auto status = plugin->checkNode(*node, *test_it);
-                    totals->push_back(status);
-                }
-            }
-        }
-    }
-    return totals;
+    ChangeBatch batch(*this);
+    return batch.validateNodes(poly, plugin);
 }
 
 std::shared_ptr<std::vector<std::shared_ptr<ValidateStatus>>>
 OsmChangeFile::validateWays(const multipolygon_t &poly, std::shared_ptr<Validate> &plugin)
 {
-#ifdef TIMING_DEBUG_X
-    boost::timer::auto_cpu_timer timer("OsmChangeFile::validateWays: took %w seconds\n");
-#endif
-    auto totals = std::make_shared<std::vector<std::shared_ptr<ValidateStatus>>>();
-    for (auto it = std::begin(changes); it != std::end(changes); ++it) {
-        OsmChange *change = it->get();
-        for (auto nit = std::begin(change->ways); nit != std::end(change->ways); ++nit) {
-            OsmWay *way = nit->get();
-            if (!way->priority) {
-                continue;
-            }
-            auto status = plugin->checkWay(*way, "building");
-            totals->push_back(status);
-        }
-    }
-    return totals;
+    ChangeBatch batch(*this);
+    return batch.validateWays(poly, plugin);
 }
 
 } // namespace osmchange
@@ -25,7 +25,8 @@
 ///
 /// This file parses an OsmChange formatted data file using an libxml++
 /// SAX parser, which works better for large files, or boost parse trees
-/// using a DOM parser, which is faster for small files.
+/// using a DOM parser, which is faster for small files. When configured
+/// with --enable-parser=fast, a specialized tokenizer is used instead.
 
 // This is generated by autoconf
 #ifdef HAVE_CONFIG_H
@@ -246,6 +247,7 @@ class OsmChangeFile
     void areaFilter(const multipolygon_t &poly);
 
     void buildGeometriesFromNodeCache();
+    /// Build the geometry of a relation from the ways in the cache
     void buildRelationGeometry(osmobjects::OsmRelation &relation);
 
 
@@ -257,6 +259,8 @@ class OsmChangeFile
 
     /// Read an istream of the data and parse the XML
     bool readXML(std::istream &xml);
+    /// Parse XML that's already in memory
+    bool readXML(const char *data, std::size_t size);
 
     std::map<long, std::shared_ptr<ChangeStats>> userstats; ///< User statistics for this file
 
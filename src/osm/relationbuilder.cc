@@ -0,0 +1,289 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <numeric>
+#include <unordered_map>
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <boost/geometry/index/rtree.hpp>
+
+#include "osm/relationbuilder.hh"
+#include "utils/log.hh"
+
+using namespace logger;
+
+namespace bgi = boost::geometry::index;
+typedef boost::geometry::model::box<point_t> box_t;
+
+/// \namespace osmchange
+namespace osmchange {
+
+namespace {
+
+/// Add \a from to the end of \a to, which it shares a node with
+void
+append(RelationBuilder::Line &to, const RelationBuilder::Line &from)
+{
+    bool forward = from.refs.front() == to.refs.back();
+    std::size_t size = from.refs.size();
+    for (std::size_t k = 1; k < size; k++) {
+        auto i = forward ? k : size - 1 - k;
+        to.refs.push_back(from.refs[i]);
+        to.points.push_back(from.points[i]);
+    }
+}
+
+} // anonymous namespace
+
+bool
+RelationBuilder::line(long id, Line &line) const
+{
+    auto cached = waycache.find(id);
+    if (cached == waycache.end() || cached->second->refs.empty()) {
+        return false;
+    }
+    const auto &way = *cached->second;
+    line.refs.assign(way.refs.begin(), way.refs.end());
+    // The ways from the database only have a polygon when closed
+    if (way.linestring.size() == way.refs.size()) {
+        line.points = way.linestring;
+    } else if (way.polygon.outer().size() == way.refs.size()) {
+        line.points.assign(way.polygon.outer().begin(), way.polygon.outer().end());
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void
+RelationBuilder::missing(const osmobjects::OsmRelation &relation, std::set<long> &ids) const
+{
+    for (const auto &member: relation.members) {
+        if (member.type == osmobjects::way && !waycache.count(member.ref)) {
+            ids.insert(member.ref);
+        }
+    }
+}
+
+bool
+RelationBuilder::join(const std::vector<Line> &lines, std::vector<Line> &joined, bool rings)
+{
+    // Closed ways are rings already, and the others are joined at
+    // the nodes they start or end with
+    std::vector<const Line *> open;
+    for (const auto &line: lines) {
+        if (line.refs.size() < 2) {
+            continue;
+        }
+        if (line.refs.front() == line.refs.back()) {
+            if (line.closed()) {
+                joined.push_back(line);
+            }
+        } else {
+            open.push_back(&line);
+        }
+    }
+    std::unordered_multimap<long, std::size_t> ends;
+    for (std::size_t i = 0; i < open.size(); i++) {
+        ends.emplace(open[i]->refs.front(), i);
+        ends.emplace(open[i]->refs.back(), i);
+    }
+    std::vector<bool> used(open.size(), false);
+    auto next = [&](long node) {
+        auto range = ends.equal_range(node);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (!used[it->second]) {
+                used[it->second] = true;
+                return open[it->second];
+            }
+        }
+        return static_cast<const Line *>(nullptr);
+    };
+
+    bool complete = true;
+    for (std::size_t i = 0; i < open.size(); i++) {
+        if (used[i]) {
+            continue;
+        }
+        used[i] = true;
+        Line current = *open[i];
+        // Grow the end, then the start for lines, which can't close
+        for (int side = 0; side < (rings ? 1 : 2); side++) {
+            if (side == 1) {
+                std::reverse(current.refs.begin(), current.refs.end());
+                std::reverse(current.points.begin(), current.points.end());
+            }
+            while (current.refs.front() != current.refs.back()) {
+                auto line = next(current.refs.back());
+                if (!line) {
+                    break;
+                }
+                append(current, *line);
+            }
+        }
+        if (!rings) {
+            joined.push_back(std::move(current));
+        } else if (current.closed()) {
+            joined.push_back(std::move(current));
+        } else {
+            complete = false;
+        }
+    }
+    return complete;
+}
+
+multipolygon_t
+RelationBuilder::nest(const std::vector<Line> &rings)
+{
+    std::vector<polygon_t> shapes(rings.size());
+    std::vector<double> areas(rings.size());
+    std::vector<box_t> boxes(rings.size());
+    std::vector<std::vector<long>> nodes(rings.size());
+    for (std::size_t i = 0; i < rings.size(); i++) {
+        boost::geometry::assign_points(shapes[i].outer(), rings[i].points);
+        boost::geometry::correct(shapes[i]);
+        areas[i] = std::abs(boost::geometry::area(shapes[i]));
+        boost::geometry::envelope(shapes[i], boxes[i]);
+        nodes[i] = rings[i].refs;
+        std::sort(nodes[i].begin(), nodes[i].end());
+    }
+
+    // A ring is inside another if one of its nodes that isn't shared
+    // with it is, as rings can touch
+    auto inside = [&](std::size_t i, std::size_t j) {
+        for (std::size_t k = 0; k < rings[i].refs.size(); k++) {
+            if (!std::binary_search(nodes[j].begin(), nodes[j].end(), rings[i].refs[k])) {
+                return boost::geometry::within(rings[i].points[k], shapes[j]);
+            }
+        }
+        return false;
+    };
+
+    // The largest rings go first, so the ones already in the index
+    // are the only ones a ring can be inside of
+    std::vector<std::size_t> order(rings.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&areas](std::size_t a, std::size_t b) {
+        return areas[a] > areas[b];
+    });
+    bgi::rtree<std::pair<box_t, std::size_t>, bgi::rstar<16>> index;
+    std::vector<int> depth(rings.size(), 0);
+    std::vector<std::size_t> polygon(rings.size(), 0);
+    multipolygon_t result;
+    for (auto i: order) {
+        std::vector<std::pair<box_t, std::size_t>> candidates;
+        index.query(bgi::covers(boxes[i]), std::back_inserter(candidates));
+        // The smallest ring around this one is its parent
+        std::size_t parent = rings.size();
+        for (const auto &candidate: candidates) {
+            auto j = candidate.second;
+            if ((parent == rings.size() || areas[j] < areas[parent]) && inside(i, j)) {
+                parent = j;
+            }
+        }
+        depth[i] = parent == rings.size() ? 0 : depth[parent] + 1;
+        if (depth[i] % 2 == 0) {
+            polygon[i] = result.size();
+            result.push_back(shapes[i]);
+        } else {
+            polygon[i] = polygon[parent];
+            result[polygon[i]].inners().push_back(shapes[i].outer());
+        }
+        index.insert(std::make_pair(boxes[i], i));
+    }
+    boost::geometry::correct(result);
+    return result;
+}
+
+bool
+RelationBuilder::build(osmobjects::OsmRelation &relation) const
+{
+    relation.multipolygon.clear();
+    relation.multilinestring.clear();
+
+    std::vector<Line> lines;
+    std::set<long> seen;
+    for (const auto &member: relation.members) {
+        if (member.type != osmobjects::way || !seen.insert(member.ref).second) {
+            continue;
+        }
+        lines.emplace_back();
+        if (!line(member.ref, lines.back())) {
+            log_debug("Relation %1% is missing way %2%", relation.id, member.ref);
+            return false;
+        }
+    }
+    if (lines.empty()) {
+        return false;
+    }
+
+    std::vector<Line> joined;
+    if (relation.isMultiPolygon()) {
+        if (!join(lines, joined, true)) {
+            log_debug("Relation %1% has a ring that isn't closed", relation.id);
+            return false;
+        }
+        relation.multipolygon = nest(joined);
+        return !relation.multipolygon.empty();
+    }
+    join(lines, joined, false);
+    for (auto &line: joined) {
+        relation.multilinestring.push_back(std::move(line.points));
+    }
+    return !relation.multilinestring.empty();
+}
+
+std::size_t
+RelationBuilder::build(const std::vector<osmobjects::OsmRelation *> &relations, unsigned int threads) const
+{
+    std::atomic<std::size_t> built = 0;
+    auto run = [&](std::size_t first, std::size_t step) {
+        for (auto i = first; i < relations.size(); i += step) {
+            if (build(*relations[i])) {
+                built++;
+            }
+        }
+    };
+    // Most files only have a few relations, which isn't worth the threads
+    if (threads < 2 || relations.size() < 2 * threads) {
+        run(0, 1);
+    } else {
+        boost::asio::thread_pool pool(threads);
+        for (unsigned int t = 0; t < threads; t++) {
+            boost::asio::post(pool, [&run, t, threads] { run(t, threads); });
+        }
+        pool.join();
+    }
+    return built;
+}
+
+} // namespace osmchange
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
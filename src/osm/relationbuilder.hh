@@ -0,0 +1,97 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __RELATIONBUILDER_HH__
+#define __RELATIONBUILDER_HH__
+
+/// \file relationbuilder.hh
+/// \brief Build the geometry of relations from their member ways
+///
+/// The member ways are joined end to end by their node IDs, into rings
+/// for multipolygons and into lines for the other relations. The rings
+/// are then nested by containment, largest first, using an index of
+/// their bounding boxes, so the roles of the members don't have to be
+/// right. All the member ways have to be in the way cache already, as
+/// this never queries the database.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
+
+#include "osm/osmobjects.hh"
+
+/// \namespace osmchange
+namespace osmchange {
+
+/// \class RelationBuilder
+/// \brief Assembles multipolygons and multilinestrings from way node sequences
+class RelationBuilder {
+  public:
+    typedef std::map<long, std::shared_ptr<osmobjects::OsmWay>> waycache_t;
+
+    RelationBuilder(const waycache_t &_waycache) : waycache(_waycache) {};
+
+    /// \struct Line
+    /// \brief A sequence of nodes with their locations
+    struct Line {
+        std::vector<long> refs;
+        linestring_t points;
+        bool closed(void) const { return refs.size() > 3 && refs.front() == refs.back(); };
+    };
+
+    /// Add the member ways of \a relation that aren't cached to \a ids
+    void missing(const osmobjects::OsmRelation &relation, std::set<long> &ids) const;
+
+    /// Build the geometry of \a relation. When a member way is missing,
+    /// or a ring of a multipolygon doesn't close, the geometry is left
+    /// empty and this returns false.
+    bool build(osmobjects::OsmRelation &relation) const;
+
+    /// Build the geometries of \a relations on \a threads threads,
+    /// returning how many were built
+    std::size_t build(const std::vector<osmobjects::OsmRelation *> &relations, unsigned int threads) const;
+
+    /// Join \a lines at their ends. For \a rings, the closed ones are
+    /// kept and this returns false if any are left open.
+    static bool join(const std::vector<Line> &lines, std::vector<Line> &joined, bool rings);
+
+    /// Nest \a rings, the ones inside an odd number of others being holes
+    static multipolygon_t nest(const std::vector<Line> &rings);
+
+  private:
+    /// Get the nodes of a way, false if it or some locations are missing
+    bool line(long id, Line &line) const;
+
+    const waycache_t &waycache;
+};
+
+} // namespace osmchange
+
+#endif // EOF __RELATIONBUILDER_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
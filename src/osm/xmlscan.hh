@@ -0,0 +1,254 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __XMLSCAN_HH__
+#define __XMLSCAN_HH__
+
+/// \file xmlscan.hh
+/// \brief The scanning shared by the tokenizers of the OSM XML dialects
+///
+/// The osmChange and changeset tokenizers read a buffer in place. These
+/// are the pieces of XML they both need: markup to skip, attributes,
+/// entities, numbers and timestamps.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <charconv>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include "boost/date_time/posix_time/posix_time.hpp"
+
+#include "utils/log.hh"
+
+/// \namespace xmlscan
+namespace xmlscan {
+
+inline bool
+isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/// Append a code point to a UTF-8 string
+inline void
+appendUTF8(std::string &out, unsigned long cp)
+{
+    if (cp < 0x80) {
+        out.push_back(static_cast<char>(cp));
+    } else if (cp < 0x800) {
+        out.push_back(static_cast<char>(0xc0 | (cp >> 6)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+    } else if (cp < 0x10000) {
+        out.push_back(static_cast<char>(0xe0 | (cp >> 12)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+    } else {
+        out.push_back(static_cast<char>(0xf0 | (cp >> 18)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3f)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+    }
+}
+
+/// Expand the entities in an attribute value, and normalize literal
+/// whitespace to spaces like any XML parser does.
+inline bool
+unescape(std::string_view value, std::string &out)
+{
+    out.clear();
+    for (std::size_t i = 0; i < value.size(); i++) {
+        char c = value[i];
+        if (c == '\t' || c == '\n' || c == '\r') {
+            out.push_back(' ');
+            continue;
+        }
+        if (c != '&') {
+            out.push_back(c);
+            continue;
+        }
+        auto semicolon = value.find(';', i);
+        if (semicolon == std::string_view::npos) {
+            return false;
+        }
+        auto entity = value.substr(i + 1, semicolon - i - 1);
+        if (entity == "amp") {
+            out.push_back('&');
+        } else if (entity == "lt") {
+            out.push_back('<');
+        } else if (entity == "gt") {
+            out.push_back('>');
+        } else if (entity == "quot") {
+            out.push_back('"');
+        } else if (entity == "apos") {
+            out.push_back('\'');
+        } else if (entity.size() > 1 && entity[0] == '#') {
+            unsigned long cp = 0;
+            int base = 10;
+            auto digits = entity.substr(1);
+            if (digits[0] == 'x' || digits[0] == 'X') {
+                base = 16;
+                digits.remove_prefix(1);
+            }
+            auto result = std::from_chars(digits.data(), digits.data() + digits.size(), cp, base);
+            if (result.ec != std::errc() || result.ptr != digits.data() + digits.size() || cp > 0x10ffff) {
+                return false;
+            }
+            appendUTF8(out, cp);
+        } else {
+            return false;
+        }
+        i = semicolon;
+    }
+    return true;
+}
+
+template <typename T>
+inline bool
+toNumber(std::string_view value, T &number)
+{
+    auto result = std::from_chars(value.data(), value.data() + value.size(), number);
+    return result.ec == std::errc();
+}
+
+/// Parse a timestamp like 2021-09-10T00:00:00Z
+inline boost::posix_time::ptime
+toTimestamp(std::string_view value)
+{
+    int year = 0, month = 0, day = 0, hour = 0, minute = 0, second = 0;
+    if (value.size() < 19 ||
+        !toNumber(value.substr(0, 4), year) || !toNumber(value.substr(5, 2), month) ||
+        !toNumber(value.substr(8, 2), day) || !toNumber(value.substr(11, 2), hour) ||
+        !toNumber(value.substr(14, 2), minute) || !toNumber(value.substr(17, 2), second)) {
+        // Let boost complain about it, like the other parsers
+        std::string tmp(value);
+        return boost::posix_time::time_from_string(tmp);
+    }
+    return boost::posix_time::ptime(boost::gregorian::date(year, month, day),
+                                    boost::posix_time::time_duration(hour, minute, second));
+}
+
+/// Skip the markup after a '<' that isn't an element: closing tags,
+/// the XML declaration, comments and DTDs, which carry no data. Returns
+/// false when there is nothing to skip, and leaves \a p on the name.
+inline bool
+skipMarkup(const char *&p, const char *end, bool &error)
+{
+    error = false;
+    if (*p != '/' && *p != '?' && *p != '!') {
+        return false;
+    }
+    const char *close = ">";
+    if (*p == '!' && end - p > 2 && p[1] == '-' && p[2] == '-') {
+        close = "-->";
+    }
+    std::string_view rest(p, end - p);
+    auto found = rest.find(close);
+    if (found == std::string_view::npos) {
+        log_error("Unterminated XML markup!");
+        error = true;
+        return true;
+    }
+    p += found + std::strlen(close);
+    return true;
+}
+
+/// The result of reading an attribute
+typedef enum { next_attribute, end_of_element, bad_attribute } attribute_t;
+
+/// Read the next attribute of an element. The \a value is in the
+/// buffer, unless it had to be decoded into \a scratch.
+inline attribute_t
+readAttribute(const char *&p, const char *end, std::string_view &name,
+              std::string_view &value, std::string &scratch)
+{
+    while (p < end && isSpace(*p)) {
+        p++;
+    }
+    if (p >= end) {
+        log_error("Unterminated XML element!");
+        return bad_attribute;
+    }
+    if (*p == '>' || *p == '/') {
+        return end_of_element;
+    }
+    const char *attr = p;
+    while (p < end && *p != '=' && !isSpace(*p)) {
+        p++;
+    }
+    name = std::string_view(attr, p - attr);
+    while (p < end && isSpace(*p)) {
+        p++;
+    }
+    if (p + 1 >= end || *p != '=') {
+        log_error("Malformed XML attribute!");
+        return bad_attribute;
+    }
+    p++;
+    while (p < end && isSpace(*p)) {
+        p++;
+    }
+    if (p >= end || (*p != '"' && *p != '\'')) {
+        log_error("Malformed XML attribute!");
+        return bad_attribute;
+    }
+    char quote = *p++;
+    const char *quoted = static_cast<const char *>(std::memchr(p, quote, end - p));
+    if (quoted == nullptr) {
+        log_error("Unterminated XML attribute!");
+        return bad_attribute;
+    }
+    value = std::string_view(p, quoted - p);
+    p = quoted + 1;
+    // Only copy values that need decoding
+    if (value.find_first_of("&\t\n\r") != std::string_view::npos) {
+        if (!unescape(value, scratch)) {
+            log_error("Invalid XML entity in %1%", std::string(value));
+            return bad_attribute;
+        }
+        value = scratch;
+    }
+    return next_attribute;
+}
+
+/// Skip the rest of an element, which is either > or />
+inline bool
+skipElement(const char *&p, const char *end)
+{
+    p = static_cast<const char *>(std::memchr(p, '>', end - p));
+    if (p == nullptr) {
+        log_error("Unterminated XML element!");
+        return false;
+    }
+    p++;
+    return true;
+}
+
+} // namespace xmlscan
+
+#endif // EOF __XMLSCAN_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
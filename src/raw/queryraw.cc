@@ -37,12 +37,16 @@
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
 #include <map>
+#include <set>
 #include <string>
 #include "utils/log.hh"
+#include "utils/metrics.hh"
 #include "data/pq.hh"
 #include "raw/queryraw.hh"
 #include "osm/osmobjects.hh"
 #include "osm/osmchange.hh"
+#include "osm/relationbuilder.hh"
+#include "utils/tiles.hh"
 
 #include <boost/timer/timer.hpp>
 
@@ -200,7 +204,11 @@ QueryRaw::applyChange(const OsmNode &node) const
         query += fmt.str();
 
     } else if (node.action == osmobjects::remove) {
-        query = "DELETE from nodes where osm_id = " + std::to_string(node.id) + ";";
+        if (versioned) {
+            query = buildRemovalQuery(node);
+        } else {
+            query = "DELETE from nodes where osm_id = " + std::to_string(node.id) + ";";
+        }
     }
 
     return query;
@@ -209,6 +217,8 @@ QueryRaw::applyChange(const OsmNode &node) const
 
 const std::string QueryRaw::polyTable = "ways_poly";
 const std::string QueryRaw::lineTable = "ways_line";
+const std::string QueryRaw::removalsTable = "backfill_removals";
+const std::string QueryRaw::touchedTable = "backfill_touched";
 
 std::string
 QueryRaw::applyChange(const OsmWay &way) const
@@ -283,15 +293,31 @@ QueryRaw::applyChange(const OsmWay &way) const
 
             query += fmt.str();
 
-            query += "DELETE FROM way_refs WHERE way_id=" + std::to_string(way.id) + ";";
-            for (auto ref = way.refs.begin(); ref != way.refs.end(); ++ref) {
-                query += "INSERT INTO way_refs (way_id, node_id) VALUES (" + std::to_string(way.id) + "," + std::to_string(*ref) + ");";
+            if (versioned) {
+                // A newer version of this way may already be applied, in
+                // which case it's refs are the current ones.
+                std::string id = std::to_string(way.id);
+                std::string version = std::to_string(way.version);
+                std::string newest = "NOT EXISTS (SELECT 1 FROM " + QueryRaw::polyTable + " WHERE osm_id = " + id + " AND version > " + version + ")";
+                newest += " AND NOT EXISTS (SELECT 1 FROM " + QueryRaw::lineTable + " WHERE osm_id = " + id + " AND version > " + version + ")";
+                query += "DELETE FROM way_refs WHERE way_id=" + id + " AND " + newest + ";";
+                query += "INSERT INTO way_refs (way_id, node_id) SELECT " + id + ", unnest(" + refs + ") WHERE " + newest + ";";
+                query += "INSERT INTO " + QueryRaw::touchedTable + " (osm_id, type) VALUES(" + id + ", 'way');";
+            } else {
+                query += "DELETE FROM way_refs WHERE way_id=" + std::to_string(way.id) + ";";
+                for (auto ref = way.refs.begin(); ref != way.refs.end(); ++ref) {
+                    query += "INSERT INTO way_refs (way_id, node_id) VALUES (" + std::to_string(way.id) + "," + std::to_string(*ref) + ");";
+                }
             }
         }
     } else if (way.action == osmobjects::remove) {
-        query += "DELETE FROM way_refs WHERE way_id=" + std::to_string(way.id) + ";";
-        query += "DELETE FROM " + QueryRaw::polyTable + " where osm_id = " + std::to_string(way.id) + ";";
-        query += "DELETE FROM " + QueryRaw::lineTable + " where osm_id = " + std::to_string(way.id) + ";";
+        if (versioned) {
+            query += buildRemovalQuery(way);
+        } else {
+            query += "DELETE FROM way_refs WHERE way_id=" + std::to_string(way.id) + ";";
+            query += "DELETE FROM " + QueryRaw::polyTable + " where osm_id = " + std::to_string(way.id) + ";";
+            query += "DELETE FROM " + QueryRaw::lineTable + " where osm_id = " + std::to_string(way.id) + ";";
+        }
     }
 
     return query;
@@ -334,9 +360,6 @@ QueryRaw::applyChange(const OsmRelation &relation) const
             // geometry
             std::string geometry;
             geometry = "ST_GeomFromText(\'" + geostring + "\', 4326)";
-            
-            std::cout << "Relation " << relation.id << " " << geostring << std::endl;
-            
             fmt % geometry;
 
             // timestamp
@@ -364,19 +387,55 @@ QueryRaw::applyChange(const OsmRelation &relation) const
 
             query += fmt.str();
 
+            // The member ways, replacing the ones of older versions
+            std::string id = std::to_string(relation.id);
+            std::string ways;
             for (auto it = std::begin(relation.members); it != std::end(relation.members); ++it) {
-                query += "INSERT INTO rel_refs (rel_id, way_id) VALUES (" + std::to_string(relation.id) + "," + std::to_string(it->ref) + ");";
+                if (it->type == osmobjects::way) {
+                    ways += std::to_string(it->ref) + ",";
+                }
+            }
+            std::string newest = "true";
+            if (versioned) {
+                newest = "NOT EXISTS (SELECT 1 FROM relations WHERE osm_id = " + id + " AND version > " + std::to_string(relation.version) + ")";
+                query += "INSERT INTO " + QueryRaw::touchedTable + " (osm_id, type) VALUES(" + id + ", 'relation');";
+            }
+            query += "DELETE FROM rel_refs WHERE rel_id=" + id + " AND " + newest + ";";
+            if (!ways.empty()) {
+                ways.erase(ways.size() - 1);
+                query += "INSERT INTO rel_refs (rel_id, way_id) SELECT " + id + ", unnest(ARRAY[" + ways + "]) WHERE " + newest + ";";
             }
         } else {
-            std::cout << "Relation " << relation.id << " geometry is empty" << std::endl;
+            log_debug("Relation %1% has no geometry", relation.id);
         }
     } else if (relation.action == osmobjects::remove) {
-        query += "DELETE FROM relations where osm_id = " + std::to_string(relation.id) + ";";
+        if (versioned) {
+            query += buildRemovalQuery(relation);
+        } else {
+            query += "DELETE FROM rel_refs WHERE rel_id=" + std::to_string(relation.id) + ";";
+            query += "DELETE FROM relations where osm_id = " + std::to_string(relation.id) + ";";
+        }
     }
 
     return query;
 }
 
+std::string
+QueryRaw::buildRemovalQuery(const OsmObject &object) const
+{
+    std::map<osmobjects::osmtype_t, std::string> types = {
+        {osmobjects::node, "node"},
+        {osmobjects::way, "way"},
+        {osmobjects::relation, "relation"}
+    };
+    boost::format fmt("INSERT INTO %s (osm_id, type, version) VALUES(%d, '%s', %d);");
+    fmt % QueryRaw::removalsTable;
+    fmt % object.id;
+    fmt % types[object.type];
+    fmt % object.version;
+    return fmt.str();
+}
+
 std::vector<long> arrayStrToVector(std::string &refs_str) {
     refs_str.erase(0, 1);
     refs_str.erase(refs_str.size() - 1);
@@ -389,18 +448,12 @@ std::vector<long> arrayStrToVector(std::string &refs_str) {
     return refs;
 }
 
+// Relations from rows of osm_id, refs, version, tags, uid, changeset
 std::list<std::shared_ptr<OsmRelation>>
-QueryRaw::getRelationsByWaysRefs(std::string &wayIds) const
+relationsFromResult(const pqxx::result &rels_result)
 {
-#ifdef TIMING_DEBUG
-    boost::timer::auto_cpu_timer timer("getRelationsByWaysRefs(wayIds): took %w seconds\n");
-#endif
-    // Get all relations that have references to ways
     std::list<std::shared_ptr<osmobjects::OsmRelation>> rels;
 
-    std::string relsQuery = "SELECT distinct(osm_id), refs, version, tags, uid, changeset from rel_refs join relations r on r.osm_id = rel_id where way_id = any(ARRAY[" + wayIds + "])";
-    auto rels_result = dbconn->query(relsQuery);
-
     // Fill vector of OsmRelation objects
     for (auto rel_it = rels_result.begin(); rel_it != rels_result.end(); ++rel_it) {
         auto rel = std::make_shared<OsmRelation>();
@@ -440,32 +493,178 @@ QueryRaw::getRelationsByWaysRefs(std::string &wayIds) const
     return rels;
 }
 
+std::list<std::shared_ptr<OsmRelation>>
+QueryRaw::getRelationsByWaysRefs(std::string &wayIds) const
+{
+#ifdef TIMING_DEBUG
+    boost::timer::auto_cpu_timer timer("getRelationsByWaysRefs(wayIds): took %w seconds\n");
+#endif
+    // Get all relations that have references to ways
+    std::string relsQuery = "SELECT distinct(osm_id), refs, version, tags, uid, changeset from rel_refs join relations r on r.osm_id = rel_id where way_id = any(ARRAY[" + wayIds + "])";
+    return relationsFromResult(dbconn->query(relsQuery));
+}
+
+std::list<std::shared_ptr<OsmRelation>>
+QueryRaw::getRelations(const std::string &relIds) const
+{
+    std::string relsQuery = "SELECT osm_id, refs, version, tags, uid, changeset from relations where osm_id = any(ARRAY[" + relIds + "])";
+    return relationsFromResult(dbconn->query(relsQuery));
+}
+
 void
-QueryRaw::getWaysByIds(std::string &waysIds, std::map<long, std::shared_ptr<osmobjects::OsmWay>> &waycache) {
+QueryRaw::getWaysByIds(const std::set<long> &waysIds, std::map<long, std::shared_ptr<osmobjects::OsmWay>> &waycache) const
+{
 #ifdef TIMING_DEBUG
     boost::timer::auto_cpu_timer timer("getWaysByIds(waysIds, waycache): took %w seconds\n");
 #endif
-    // Get all ways that have references to nodes
-    std::string waysQuery = "SELECT distinct(osm_id), ST_AsText(geom, 4326), 'polygon' as type from ways_poly wp where osm_id = any(ARRAY[" + waysIds + "]) ";
-    waysQuery += "UNION SELECT distinct(osm_id), ST_AsText(geom, 4326), 'linestring' as type from ways_line wp where osm_id = any(ARRAY[" + waysIds + "])";
-    auto ways_result = dbconn->query(waysQuery);
+    // The ways come with their refs, to join them by their nodes
+    for (auto &way: getWays(waysIds)) {
+        // Only the ways in the priority area are in the database
+        way->priority = true;
+        waycache.insert(std::pair(way->id, way));
+    }
+}
 
-    // Fill vector of OsmWay objects
-    for (auto way_it = ways_result.begin(); way_it != ways_result.end(); ++way_it) {
-        auto way = std::make_shared<OsmWay>();
-        auto type = (*way_it)[2].as<std::string>();
-        way->id = (*way_it)[0].as<long>();
-        if (type == "polygon") {
-            boost::geometry::read_wkt((*way_it)[1].as<std::string>(), way->polygon);
-        } else {
-            boost::geometry::read_wkt((*way_it)[1].as<std::string>(), way->linestring);
+// The time of a database lookup to build geometries
+metrics::Histogram &
+lookupTime(const std::string &query)
+{
+    return metrics::Registry::getDefaultInstance().histogram("underpass_geometry_lookup_seconds",
+        "Time of the database lookups to build geometries", {{"query", query}}, 1e-6);
+}
+
+// The IDs as a list for a query
+std::string
+listIds(const std::set<long> &ids)
+{
+    std::string list;
+    for (auto id: ids) {
+        list += std::to_string(id) + ",";
+    }
+    if (!list.empty()) {
+        list.erase(list.size() - 1);
+    }
+    return list;
+}
+
+std::string
+QueryRaw::buildTouchedWaysQuery(void) const
+{
+    // Join the nodes of each way in the order of its refs, like when
+    // building it from a change, and only when all of them are found.
+    std::map<std::string, std::string> tables = {
+        {QueryRaw::polyTable, "ST_MakePolygon(ST_MakeLine(n.geom ORDER BY r.pos))"},
+        {QueryRaw::lineTable, "ST_MakeLine(n.geom ORDER BY r.pos)"}
+    };
+    std::string query;
+    for (auto it = std::begin(tables); it != std::end(tables); ++it) {
+        boost::format fmt("UPDATE %s AS w SET geom = g.geom FROM (SELECT t.osm_id, "
+                          "CASE WHEN count(n.osm_id) = count(*) THEN %s END AS geom "
+                          "FROM (SELECT DISTINCT osm_id FROM %s WHERE type = 'way') AS t JOIN %s AS l ON l.osm_id = t.osm_id "
+                          "CROSS JOIN LATERAL unnest(l.refs) WITH ORDINALITY AS r(id, pos) LEFT JOIN nodes AS n ON n.osm_id = r.id "
+                          "GROUP BY t.osm_id) AS g WHERE w.osm_id = g.osm_id AND g.geom IS NOT NULL;");
+        fmt % it->first % it->second % QueryRaw::touchedTable % it->first;
+        query += fmt.str();
+    }
+    return query;
+}
+
+std::size_t
+QueryRaw::rebuildTouchedRelations(std::size_t pageSize) const
+{
+    boost::format fmt("SELECT osm_id FROM %s WHERE type = 'relation' UNION SELECT rel_id FROM rel_refs "
+                      "JOIN %s AS t ON t.type = 'way' AND t.osm_id = rel_refs.way_id ORDER BY 1;");
+    fmt % QueryRaw::touchedTable % QueryRaw::touchedTable;
+    auto result = dbconn->query(fmt.str());
+    std::vector<long> ids;
+    for (auto row = result.begin(); row != result.end(); ++row) {
+        ids.push_back((*row)[0].as<long>());
+    }
+
+    std::size_t updated = 0;
+    for (std::size_t first = 0; first < ids.size(); first += pageSize) {
+        std::set<long> page(ids.begin() + first, ids.begin() + std::min(ids.size(), first + pageSize));
+        auto relations = getRelations(listIds(page));
+        RelationBuilder::waycache_t waycache;
+        RelationBuilder builder(waycache);
+        std::set<long> missing;
+        std::vector<OsmRelation *> built;
+        for (auto &relation: relations) {
+            builder.missing(*relation, missing);
+            built.push_back(relation.get());
+        }
+        getWaysByIds(missing, waycache);
+        // The pages are already processed one at a time by this pass
+        builder.build(built, 1);
+
+        std::string query;
+        for (auto relation: built) {
+            std::stringstream ss;
+            if (relation->isMultiPolygon() && !relation->multipolygon.empty()) {
+                ss << std::setprecision(12) << boost::geometry::wkt(relation->multipolygon);
+            } else if (!relation->isMultiPolygon() && !relation->multilinestring.empty()) {
+                ss << std::setprecision(12) << boost::geometry::wkt(relation->multilinestring);
+            } else {
+                continue;
+            }
+            query += "UPDATE relations SET geom = ST_GeomFromText(\'" + ss.str() + "\', 4326) WHERE osm_id = " + std::to_string(relation->id) + ";";
+            updated++;
+        }
+        if (!query.empty()) {
+            dbconn->query(query);
         }
-        waycache.insert(std::pair(way->id, std::make_shared<osmobjects::OsmWay>(*way)));
     }
+    return updated;
+}
+
+// The IDs of the objects using any of children, except the ones in
+// the file already
+std::set<long>
+parentIds(const RefIndex &index, const std::vector<long> &children, const std::set<long> &known)
+{
+    std::set<long> parents;
+    for (auto child: children) {
+        index.parents(child, parents);
+    }
+    for (auto id: known) {
+        parents.erase(id);
+    }
+    return parents;
+}
+
+// The location of the nodes of a way that aren't known yet. The
+// geometry of a way from the database or the cache has all of them.
+void
+addNodes(const OsmWay &way, std::map<double, point_t> &nodecache)
+{
+    if (way.linestring.size() == way.refs.size()) {
+        for (std::size_t i = 0; i < way.refs.size(); i++) {
+            nodecache.emplace(way.refs[i], way.linestring[i]);
+        }
+    } else if (way.polygon.outer().size() == way.refs.size()) {
+        for (std::size_t i = 0; i < way.refs.size(); i++) {
+            nodecache.emplace(way.refs[i], way.polygon.outer()[i]);
+        }
+    }
+}
+
+// Add the tiles of a way as it was
+void
+addBounds(const OsmWay &way, tiles::TileSet &dirty)
+{
+    boost::geometry::model::box<point_t> box;
+    if (!way.linestring.empty()) {
+        boost::geometry::envelope(way.linestring, box);
+    } else if (!way.polygon.outer().empty()) {
+        boost::geometry::envelope(way.polygon, box);
+    } else {
+        return;
+    }
+    dirty.add(box.min_corner().x(), box.min_corner().y(), box.max_corner().x(), box.max_corner().y());
 }
 
 // TODO: divide this function into multiple ones
-void QueryRaw::buildGeometries(std::shared_ptr<OsmChangeFile> osmchanges, const multipolygon_t &poly)
+void QueryRaw::buildGeometries(std::shared_ptr<OsmChangeFile> osmchanges, const multipolygon_t &poly, tiles::TileSet *before, std::vector<OsmWay> *written, RefUpdates *refs)
 {
 #ifdef TIMING_DEBUG
     boost::timer::auto_cpu_timer timer("buildGeometries(osmchanges, poly): took %w seconds\n");
@@ -473,14 +672,44 @@ void QueryRaw::buildGeometries(std::shared_ptr<OsmChangeFile> osmchanges, const
     std::string referencedNodeIds;
     std::string modifiedNodesIds;
     std::string modifiedWaysIds;
+    std::vector<long> modifiedNodes;
+    std::vector<long> modifiedWays;
     std::vector<long> removedWays;
-    std::vector<long> removedRelations;
+    std::set<long> wayIds;
+    std::set<long> relationIds;
+    // The objects whose previous geometry is only in the database
+    std::set<long> previousNodes;
+    std::set<long> previousWays;
+    // The references for the indexes, which only change once written,
+    // as the files of a batch are built in any order
+    RefUpdates updates;
 
     for (auto it = std::begin(osmchanges->changes); it != std::end(osmchanges->changes); it++) {
         OsmChange *change = it->get();
         for (auto wit = std::begin(change->ways); wit != std::end(change->ways); ++wit) {
             OsmWay *way = wit->get();
+            wayIds.insert(way->id);
+            if (nodeWays) {
+                updates.nodeWays.push_back({way->id, way->action == osmobjects::remove ? std::vector<long>() : way->refs, way->version});
+            }
+            // The previous version, for the tiles it was on
+            auto cached = wayCache && way->action != osmobjects::create ? wayCache->get(way->id) : nullptr;
+            if (before && way->action != osmobjects::create) {
+                if (cached) {
+                    addBounds(*cached, *before);
+                } else {
+                    previousWays.insert(way->id);
+                }
+            }
             if (way->action != osmobjects::remove) {
+                if (way->action == osmobjects::modify) {
+                    modifiedWaysIds += std::to_string(way->id) + ",";
+                    modifiedWays.push_back(way->id);
+                    // The nodes of the previous version may not have moved
+                    if (cached) {
+                        addNodes(*cached, osmchanges->nodecache);
+                    }
+                }
                 // Save referenced nodes ids for later use
                 for (auto rit = std::begin(way->refs); rit != std::end(way->refs); ++rit) {
                     if (!osmchanges->nodecache.count(*rit)) {
@@ -497,33 +726,80 @@ void QueryRaw::buildGeometries(std::shared_ptr<OsmChangeFile> osmchanges, const
                 }
             } else {
                 removedWays.push_back(way->id);
+                if (wayCache) {
+                    wayCache->remove(way->id);
+                }
             }
         }
 
         // Save modified nodes for later use
         for (auto nit = std::begin(change->nodes); nit != std::end(change->nodes); ++nit) {
             OsmNode *node = nit->get();
+            if (before && node->action != osmobjects::create) {
+                previousNodes.insert(node->id);
+            }
             if (node->action == osmobjects::modify) {
                 // Get only modified nodes ids inside the priority area
                 if (poly.empty() || boost::geometry::within(node->point, poly)) {
                     modifiedNodesIds += std::to_string(node->id) + ",";
+                    modifiedNodes.push_back(node->id);
+                }
+            }
+        }
+
+        for (auto rel_it = std::begin(change->relations); rel_it != std::end(change->relations); ++rel_it) {
+            OsmRelation *relation = rel_it->get();
+            relationIds.insert(relation->id);
+            if (wayRelations) {
+                std::vector<long> ways;
+                if (relation->action != osmobjects::remove) {
+                    for (const auto &member: relation->members) {
+                        if (member.type == osmobjects::way) {
+                            ways.push_back(member.ref);
+                        }
+                    }
                 }
+                updates.wayRelations.push_back({relation->id, ways, relation->version});
             }
         }
+    }
 
-        // for (auto rel_it = std::begin(change->relations); rel_it != std::end(change->relations); ++rel_it) {
-        //     OsmRelation *relation = rel_it->get();
-        //     removedRelations.push_back(relation->id);
-        // }
+    // The tiles the moved nodes and the changed ways were on
+    if (!previousNodes.empty() || !previousWays.empty()) {
+        std::string bounds = "SELECT ST_XMin(geom), ST_YMin(geom), ST_XMax(geom), ST_YMax(geom) FROM %1% WHERE osm_id = any(ARRAY[%2%]::bigint[]) AND geom IS NOT NULL";
+        std::string query = (boost::format(bounds) % "nodes" % listIds(previousNodes)).str();
+        query += " UNION ALL " + (boost::format(bounds) % lineTable % listIds(previousWays)).str();
+        query += " UNION ALL " + (boost::format(bounds) % polyTable % listIds(previousWays)).str() + ";";
+        static auto &lookup = lookupTime("previous");
+        metrics::Timer timer(lookup);
+        auto result = dbconn->query(query);
+        timer.stop();
+        for (const auto &row: result) {
+            before->add(row[0].as<double>(), row[1].as<double>(), row[2].as<double>(), row[3].as<double>());
+        }
     }
 
     // Add indirectly modified ways to osmchanges
     if (modifiedNodesIds.size() > 1) {
         modifiedNodesIds.erase(modifiedNodesIds.size() - 1);
-        auto modifiedWays = getWaysByNodesRefs(modifiedNodesIds);
+        std::list<std::shared_ptr<OsmWay>> indirectWays;
+        {
+            static auto &lookup = lookupTime("ways");
+            metrics::Timer timer(lookup);
+            if (nodeWays) {
+                indirectWays = getWays(parentIds(*nodeWays, modifiedNodes, wayIds));
+            } else {
+                indirectWays = getWaysByNodesRefs(modifiedNodesIds);
+            }
+        }
         auto change = std::make_shared<OsmChange>(none);
-        for (auto wit = modifiedWays.begin(); wit != modifiedWays.end(); ++wit) {
+        for (auto wit = indirectWays.begin(); wit != indirectWays.end(); ++wit) {
            auto way = std::make_shared<OsmWay>(*wit->get());
+           if (before) {
+               addBounds(*way, *before);
+           }
+           // The other nodes are where they were
+           addNodes(*way, osmchanges->nodecache);
            // Save referenced nodes for later use
            for (auto rit = std::begin(way->refs); rit != std::end(way->refs); ++rit) {
                if (!osmchanges->nodecache.count(*rit)) {
@@ -535,33 +811,21 @@ void QueryRaw::buildGeometries(std::shared_ptr<OsmChangeFile> osmchanges, const
                 way->action = osmobjects::modify;
                 change->ways.push_back(way);
                 modifiedWaysIds += std::to_string(way->id) + ",";
+                modifiedWays.push_back(way->id);
            }
         }
         osmchanges->changes.push_back(change);
     }
 
-    // Add indirectly modified relations to osmchanges
-    // if (modifiedWaysIds.size() > 1) {
-    //     modifiedWaysIds.erase(modifiedWaysIds.size() - 1);
-    //     auto modifiedRelations = getRelationsByWaysRefs(modifiedWaysIds);
-    //     auto change = std::make_shared<OsmChange>(none);
-    //     for (auto rel_it = modifiedRelations.begin(); rel_it != modifiedRelations.end(); ++rel_it) {
-    //        auto relation = std::make_shared<OsmRelation>(*rel_it->get());
-    //        // If the relation is not marked as removed, mark it as modified
-    //        if (std::find(removedRelations.begin(), removedRelations.end(), relation->id) == removedRelations.end()) {
-    //             relation->action = osmobjects::modify;
-    //             change->relations.push_back(relation);
-    //        }
-    //     }
-    //     osmchanges->changes.push_back(change);
-    // }
-
     // Fill nodecache with referenced nodes
     if (referencedNodeIds.size() > 1) {
         referencedNodeIds.erase(referencedNodeIds.size() - 1);
         // Get Nodes from DB
         std::string nodesQuery = "SELECT osm_id, st_x(geom) as lat, st_y(geom) as lon FROM nodes where osm_id in (" + referencedNodeIds + ");";
+        static auto &lookup = lookupTime("nodes");
+        metrics::Timer timer(lookup);
         auto result = dbconn->query(nodesQuery);
+        timer.stop();
         // Fill nodecache
         for (auto node_it = result.begin(); node_it != result.end(); ++node_it) {
             auto node_id = (*node_it)[0].as<long>();
@@ -590,53 +854,96 @@ void QueryRaw::buildGeometries(std::shared_ptr<OsmChangeFile> osmchanges, const
             // Save way pointer for later use
             if (poly.empty() || boost::geometry::within(way->linestring, poly)) {
                 if (osmchanges->waycache.count(way->id)) {
+                    osmchanges->waycache.at(way->id)->linestring = way->linestring;
                     osmchanges->waycache.at(way->id)->polygon = way->polygon;
                 } else {
                     osmchanges->waycache.insert(std::make_pair(way->id, std::make_shared<osmobjects::OsmWay>(*way)));
                 }
+                // The way as it's written, for the next files
+                if (written) {
+                    written->push_back(*way);
+                } else if (wayCache) {
+                    wayCache->put(*way);
+                }
+            } else if (wayCache) {
+                wayCache->remove(way->id);
+                if (written) {
+                    // Without refs, so it's removed again after the commit
+                    written->emplace_back();
+                    written->back().id = way->id;
+                }
+            }
+        }
+    }
+
+    // Add the relations whose member ways changed, which need a new geometry
+    if (modifiedWaysIds.size() > 1) {
+        modifiedWaysIds.erase(modifiedWaysIds.size() - 1);
+        std::list<std::shared_ptr<OsmRelation>> modifiedRelations;
+        {
+            static auto &lookup = lookupTime("relations");
+            metrics::Timer timer(lookup);
+            if (wayRelations) {
+                auto ids = parentIds(*wayRelations, modifiedWays, relationIds);
+                if (!ids.empty()) {
+                    modifiedRelations = getRelations(listIds(ids));
+                }
+            } else {
+                modifiedRelations = getRelationsByWaysRefs(modifiedWaysIds);
+            }
+        }
+        auto change = std::make_shared<OsmChange>(none);
+        for (auto rel_it = modifiedRelations.begin(); rel_it != modifiedRelations.end(); ++rel_it) {
+            if (relationIds.insert(rel_it->get()->id).second) {
+                (*rel_it)->action = osmobjects::modify;
+                change->relations.push_back(*rel_it);
+            }
+        }
+        osmchanges->changes.push_back(change);
+    }
+
+    // Get the member ways that aren't in the file with one query,
+    // then build the relations without going back to the database
+    RelationBuilder builder(osmchanges->waycache);
+    std::vector<OsmRelation *> relations;
+    std::set<long> missingWays;
+    for (auto it = std::begin(osmchanges->changes); it != std::end(osmchanges->changes); it++) {
+        OsmChange *change = it->get();
+        for (auto rel_it = std::begin(change->relations); rel_it != std::end(change->relations); ++rel_it) {
+            OsmRelation *relation = rel_it->get();
+            if (relation->action != osmobjects::remove) {
+                relations.push_back(relation);
+                builder.missing(*relation, missingWays);
             }
         }
     }
+    if (!missingWays.empty()) {
+        static auto &lookup = lookupTime("relation_ways");
+        metrics::Timer timer(lookup);
+        getWaysByIds(missingWays, osmchanges->waycache);
+    }
+    auto built = builder.build(relations, concurrency);
+    if (built < relations.size()) {
+        log_debug("Built %1% of %2% relations", built, relations.size());
+    }
 
-    // Relations
-    // std::string relsForWayCacheIds;
-    // bool debug = false;
-    // for (auto it = std::begin(osmchanges->changes); it != std::end(osmchanges->changes); it++) {
-    //     OsmChange *change = it->get();
-    //     for (auto rel_it = std::begin(change->relations); rel_it != std::end(change->relations); ++rel_it) {
-    //         OsmRelation *relation = rel_it->get();
-    //         if (relation->isMultiPolygon()) {
-    //             bool getWaysForRelation = false;
-    //             for (auto mit = relation->members.begin(); mit != relation->members.end(); ++mit) {
-    //                 if (osmchanges->waycache.count(mit->ref)) {
-    //                     getWaysForRelation = true;
-    //                     break;
-    //                 }
-    //             }
-    //             if (getWaysForRelation) {
-    //                 for (auto mit = relation->members.begin(); mit != relation->members.end(); ++mit) {
-    //                     if (!osmchanges->waycache.count(mit->ref)) {
-    //                        relsForWayCacheIds += std::to_string(mit->ref) + ",";
-    //                     }
-    //                 }
-    //             }
-    //         }
-    //     }
-    // }
-    // // Get all missing ways geometries for relations
-    // if (relsForWayCacheIds != "") {
-    //     relsForWayCacheIds.erase(relsForWayCacheIds.size() - 1);
-    //     getWaysByIds(relsForWayCacheIds, osmchanges->waycache);
-    // }
-
-    // Build relation geometries
-    // for (auto it = std::begin(osmchanges->changes); it != std::end(osmchanges->changes); it++) {
-    //     OsmChange *change = it->get();
-    //     for (auto rel_it = std::begin(change->relations); rel_it != std::end(change->relations); ++rel_it) {
-    //         OsmRelation *relation = rel_it->get();
-    //         osmchanges->buildRelationGeometry(*relation);
-    //     }
-    // }
+    if (refs) {
+        refs->nodeWays.insert(refs->nodeWays.end(), updates.nodeWays.begin(), updates.nodeWays.end());
+        refs->wayRelations.insert(refs->wayRelations.end(), updates.wayRelations.begin(), updates.wayRelations.end());
+    } else {
+        updateRefs(updates);
+    }
+}
+
+void
+QueryRaw::updateRefs(const RefUpdates &refs)
+{
+    if (nodeWays) {
+        nodeWays->update(refs.nodeWays);
+    }
+    if (wayRelations) {
+        wayRelations->update(refs.wayRelations);
+    }
 }
 
 void
@@ -671,19 +978,13 @@ QueryRaw::getNodeCacheFromWays(std::shared_ptr<std::vector<OsmWay>> ways, std::m
     }
 }
 
+// Ways from rows of osm_id, refs, version, tags, uid, changeset, the
+// geometry and its type
 std::list<std::shared_ptr<OsmWay>>
-QueryRaw::getWaysByNodesRefs(std::string &nodeIds) const
+waysFromResult(const pqxx::result &ways_result)
 {
-#ifdef TIMING_DEBUG
-    boost::timer::auto_cpu_timer timer("getWaysByNodesRefs(nodeIds): took %w seconds\n");
-#endif
-    // Get all ways that have references to nodes
     std::list<std::shared_ptr<osmobjects::OsmWay>> ways;
 
-    std::string waysQuery = "SELECT distinct(osm_id), refs, version, tags, uid, changeset from way_refs join ways_poly wp on wp.osm_id = way_id where node_id = any(ARRAY[" + nodeIds + "])";
-    waysQuery += " UNION SELECT distinct(osm_id), refs, version, tags, uid, changeset from way_refs join ways_line wl on wl.osm_id = way_id where node_id = any(ARRAY[" + nodeIds + "]);";
-    auto ways_result = dbconn->query(waysQuery);
-
     // Fill vector of OsmWay objects
     for (auto way_it = ways_result.begin(); way_it != ways_result.end(); ++way_it) {
         auto way = std::make_shared<OsmWay>();
@@ -709,6 +1010,53 @@ QueryRaw::getWaysByNodesRefs(std::string &nodeIds) const
         if (!changeset.is_null()) {
             way->changeset = (*way_it)[5].as<long>();
         }
+        if (!(*way_it)[6].is_null()) {
+            if ((*way_it)[7].as<std::string>() == "polygon") {
+                boost::geometry::read_wkt((*way_it)[6].as<std::string>(), way->polygon);
+            } else {
+                boost::geometry::read_wkt((*way_it)[6].as<std::string>(), way->linestring);
+            }
+        }
+        ways.push_back(way);
+    }
+    return ways;
+}
+
+std::list<std::shared_ptr<OsmWay>>
+QueryRaw::getWaysByNodesRefs(std::string &nodeIds) const
+{
+#ifdef TIMING_DEBUG
+    boost::timer::auto_cpu_timer timer("getWaysByNodesRefs(nodeIds): took %w seconds\n");
+#endif
+    // Get all ways that have references to nodes
+    std::string waysQuery = "SELECT distinct(osm_id), refs, version, tags, uid, changeset, ST_AsText(geom, 4326), 'polygon' from way_refs join ways_poly wp on wp.osm_id = way_id where node_id = any(ARRAY[" + nodeIds + "])";
+    waysQuery += " UNION SELECT distinct(osm_id), refs, version, tags, uid, changeset, ST_AsText(geom, 4326), 'linestring' from way_refs join ways_line wl on wl.osm_id = way_id where node_id = any(ARRAY[" + nodeIds + "]);";
+    return waysFromResult(dbconn->query(waysQuery));
+}
+
+std::list<std::shared_ptr<OsmWay>>
+QueryRaw::getWays(const std::set<long> &wayIds) const
+{
+    std::list<std::shared_ptr<OsmWay>> ways;
+    std::set<long> missing;
+    for (auto id: wayIds) {
+        auto cached = wayCache ? wayCache->get(id) : nullptr;
+        if (cached) {
+            ways.push_back(std::make_shared<OsmWay>(*cached));
+        } else {
+            missing.insert(id);
+        }
+    }
+    if (missing.empty()) {
+        return ways;
+    }
+    std::string ids = listIds(missing);
+    std::string waysQuery = "SELECT osm_id, refs, version, tags, uid, changeset, ST_AsText(geom, 4326), 'polygon' from ways_poly where osm_id = any(ARRAY[" + ids + "])";
+    waysQuery += " UNION SELECT osm_id, refs, version, tags, uid, changeset, ST_AsText(geom, 4326), 'linestring' from ways_line where osm_id = any(ARRAY[" + ids + "]);";
+    for (auto &way: waysFromResult(dbconn->query(waysQuery))) {
+        if (wayCache) {
+            wayCache->add(*way);
+        }
         ways.push_back(way);
     }
     return ways;
@@ -32,11 +32,17 @@
 #include "unconfig.h"
 #endif
 
+#include <algorithm>
 #include <iostream>
 #include <map>
+#include <set>
+#include <thread>
 #include "data/pq.hh"
 #include "osm/osmobjects.hh"
 #include "osm/osmchange.hh"
+#include "raw/refindex.hh"
+#include "raw/waycache.hh"
+#include "utils/tiles.hh"
 
 using namespace pq;
 using namespace osmobjects;
@@ -45,6 +51,13 @@ using namespace osmchange;
 /// \namespace queryraw
 namespace queryraw {
 
+/// \struct RefUpdates
+/// \brief The references changed by a file, for the indexes of QueryRaw
+struct RefUpdates {
+    std::vector<RefUpdate> nodeWays;
+    std::vector<RefUpdate> wayRelations;
+};
+
 /// \class QueryStats
 /// \brief This handles all direct database access
 ///
@@ -59,6 +72,29 @@ class QueryRaw {
 
     static const std::string polyTable;
     static const std::string lineTable;
+    static const std::string removalsTable;
+    static const std::string touchedTable;
+
+    /// When changes are applied out of order, as in a backfill, removals
+    /// are recorded in removalsTable with their version instead of
+    /// deleting rows, and way_refs are only rewritten for the newest version.
+    /// The ways and relations written are recorded in touchedTable, as
+    /// their geometries may have been built from nodes that moved since.
+    bool versioned = false;
+
+    /// The threads building the geometries of relations. The replicator
+    /// builds the files in a pool of threads already, so it's one.
+    unsigned int concurrency = 1;
+
+    /// When set, the ways using a modified node and the relations using
+    /// a modified way are found in memory instead of with a join, and
+    /// then read by ID. Both are kept up to date from the references
+    /// collected by buildGeometries().
+    std::shared_ptr<RefIndex> nodeWays;
+    std::shared_ptr<RefIndex> wayRelations;
+
+    /// When set, the ways read and written are kept for the next files
+    std::shared_ptr<WayCache> wayCache;
 
     /// Build query for processed Node
     std::string applyChange(const OsmNode &node) const;
@@ -66,22 +102,42 @@ class QueryRaw {
     std::string applyChange(const OsmWay &way) const;
     /// Build query for processed Relation
     std::string applyChange(const OsmRelation &relation) const;
-    /// Build all geometries for osmchanges
-    void buildGeometries(std::shared_ptr<OsmChangeFile> osmchanges, const multipolygon_t &poly);
+    /// Build all geometries for osmchanges, adding the tiles of the
+    /// changed objects as they were before to \a before if set. The
+    /// ways written are added to \a written if set, for the way cache
+    /// once they're committed, else they're cached right away. Likewise
+    /// the references of the ways and relations are added to \a refs
+    /// for nodeWays and wayRelations.
+    void buildGeometries(std::shared_ptr<OsmChangeFile> osmchanges, const multipolygon_t &poly,
+                         tiles::TileSet *before = nullptr, std::vector<OsmWay> *written = nullptr,
+                         RefUpdates *refs = nullptr);
+    /// Apply the references collected by buildGeometries() to the indexes
+    void updateRefs(const RefUpdates &refs);
     /// Get nodes for filling Node cache from ways refs
     void getNodeCacheFromWays(std::shared_ptr<std::vector<OsmWay>> ways, std::map<double, point_t> &nodecache) const;
     // Get ways by refs
     std::list<std::shared_ptr<OsmWay>> getWaysByNodesRefs(std::string &nodeIds) const;
+    // Get ways with their refs and geometry by ids, from the cache first
+    std::list<std::shared_ptr<OsmWay>> getWays(const std::set<long> &wayIds) const;
     // Get ways by ids (used for getting relations geometries)
-    void getWaysByIds(std::string &relsForWayCacheIds, std::map<long, std::shared_ptr<osmobjects::OsmWay>> &waycache);
+    void getWaysByIds(const std::set<long> &waysIds, std::map<long, std::shared_ptr<osmobjects::OsmWay>> &waycache) const;
     // Get relations by referenced ways
     std::list<std::shared_ptr<OsmRelation>> getRelationsByWaysRefs(std::string &wayIds) const;
+    // Get relations by ids
+    std::list<std::shared_ptr<OsmRelation>> getRelations(const std::string &relIds) const;
     // DB connection
     std::shared_ptr<Pq> dbconn;
     // Get ways count
     int getCount(const std::string &tableName);
     // Build tags query
     std::string buildTagsQuery(std::map<std::string, std::string> tags) const;
+    // Build query recording a removal in removalsTable
+    std::string buildRemovalQuery(const OsmObject &object) const;
+    // Build query rebuilding the ways in touchedTable from their nodes
+    std::string buildTouchedWaysQuery(void) const;
+    // Rebuild the relations in touchedTable or using a way in it from
+    // their member ways, returning how many were updated
+    std::size_t rebuildTouchedRelations(std::size_t pageSize = 1000) const;
     // Get ways by page
     std::shared_ptr<std::vector<OsmWay>> getWaysFromDB(long lastid, int pageSize, const std::string &tableName);
     std::shared_ptr<std::vector<OsmWay>> getWaysFromDBWithoutRefs(long lastid, int pageSize, const std::string &tableName);
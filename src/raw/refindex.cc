@@ -0,0 +1,289 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <algorithm>
+#include <mutex>
+
+#include "raw/refindex.hh"
+#include "utils/log.hh"
+
+using namespace logger;
+
+/// \namespace queryraw
+namespace queryraw {
+
+namespace {
+
+/// The parents are read from the database in ranges of this many IDs
+const long pageSize = 1000000;
+
+/// Compact once there are this many updates, or more for a large index
+const std::size_t minUpdates = 65536;
+
+/// The rows in a block, which are read in full to find one
+const std::size_t blockSize = 64;
+
+void
+put(std::vector<std::uint8_t> &bytes, std::uint64_t value)
+{
+    while (value >= 0x80) {
+        bytes.push_back(static_cast<std::uint8_t>(value) | 0x80);
+        value >>= 7;
+    }
+    bytes.push_back(static_cast<std::uint8_t>(value));
+}
+
+std::uint64_t
+get(const std::uint8_t *&p)
+{
+    std::uint64_t value = 0;
+    for (int shift = 0;; shift += 7) {
+        std::uint8_t byte = *p++;
+        value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+}
+
+// IDs can be negative, so the first of a row is zigzag encoded
+std::uint64_t
+zigzag(long value)
+{
+    return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+}
+
+long
+unzigzag(std::uint64_t value)
+{
+    return static_cast<long>(value >> 1) ^ -static_cast<long>(value & 1);
+}
+
+/// Call \a f with each child and parent of block \a i. A row is the
+/// difference with the previous child, but for the first one, the
+/// number of parents, then the first parent and the differences.
+template <typename F>
+void
+decode(const std::vector<long> &keys, const std::vector<std::uint8_t> &bytes,
+       const std::vector<std::uint64_t> &offsets, std::size_t i, F f)
+{
+    const std::uint8_t *p = bytes.data() + offsets[i];
+    const std::uint8_t *end = bytes.data() + offsets[i + 1];
+    long child = keys[i];
+    for (bool first = true; p < end; first = false) {
+        if (!first) {
+            child += static_cast<long>(get(p));
+        }
+        auto count = get(p);
+        long parent = unzigzag(get(p));
+        f(child, parent);
+        while (--count) {
+            parent += static_cast<long>(get(p));
+            f(child, parent);
+        }
+    }
+}
+
+} // anonymous namespace
+
+bool
+RefIndex::load(pq::Pq &db, const std::string &table, const std::string &child, const std::string &parent)
+{
+    if (!db.isOpen()) {
+        return false;
+    }
+    auto range = db.query("SELECT min(" + parent + "), max(" + parent + ") FROM " + table);
+    std::vector<std::pair<long, long>> pairs;
+    if (!range.empty() && !range[0][0].is_null()) {
+        long first = range[0][0].as<long>();
+        long last = range[0][1].as<long>();
+        for (long start = first; start <= last; start += pageSize) {
+            auto result = db.query("SELECT " + child + ", " + parent + " FROM " + table + " WHERE "
+                                   + parent + " >= " + std::to_string(start) + " AND " + parent
+                                   + " < " + std::to_string(start + pageSize));
+            for (auto row = result.begin(); row != result.end(); ++row) {
+                pairs.emplace_back((*row)[0].as<long>(), (*row)[1].as<long>());
+            }
+        }
+    }
+    assign(std::move(pairs));
+    log_info("Loaded %1% references from %2%, using %3% bytes", size(), table, memory());
+    return true;
+}
+
+void
+RefIndex::assign(std::vector<std::pair<long, long>> pairs)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    overrides.clear();
+    added.clear();
+    rebuild(pairs);
+}
+
+void
+RefIndex::rebuild(std::vector<std::pair<long, long>> &pairs)
+{
+    std::sort(pairs.begin(), pairs.end());
+    pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+    keys.clear();
+    offsets.clear();
+    bytes.clear();
+    references = pairs.size();
+    std::size_t rows = 0;
+    for (std::size_t i = 0; i < pairs.size();) {
+        std::size_t end = i + 1;
+        while (end < pairs.size() && pairs[end].first == pairs[i].first) {
+            end++;
+        }
+        if (rows++ % blockSize == 0) {
+            keys.push_back(pairs[i].first);
+            offsets.push_back(bytes.size());
+        } else {
+            put(bytes, pairs[i].first - pairs[i - 1].first);
+        }
+        put(bytes, end - i);
+        put(bytes, zigzag(pairs[i].second));
+        for (std::size_t j = i + 1; j < end; j++) {
+            put(bytes, pairs[j].second - pairs[j - 1].second);
+        }
+        i = end;
+    }
+    offsets.push_back(bytes.size());
+    keys.shrink_to_fit();
+    offsets.shrink_to_fit();
+    bytes.shrink_to_fit();
+}
+
+void
+RefIndex::update(long parent, const std::vector<long> &children, long version)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto it = overrides.find(parent);
+    if (it != overrides.end()) {
+        if (version < it->second.version) {
+            return;
+        }
+        for (auto child: it->second.children) {
+            auto &others = added[child];
+            others.erase(std::remove(others.begin(), others.end(), parent), others.end());
+            if (others.empty()) {
+                added.erase(child);
+            }
+        }
+    } else {
+        it = overrides.emplace(parent, Override()).first;
+    }
+    it->second.version = version;
+    it->second.children = children;
+    std::sort(it->second.children.begin(), it->second.children.end());
+    it->second.children.erase(std::unique(it->second.children.begin(), it->second.children.end()),
+                              it->second.children.end());
+    for (auto child: it->second.children) {
+        added[child].push_back(parent);
+    }
+}
+
+void
+RefIndex::update(const std::vector<RefUpdate> &updates)
+{
+    for (const auto &update: updates) {
+        this->update(update.parent, update.children, update.version);
+    }
+    // Only between files, so the updates of one never lose their
+    // versions to a compaction half way
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    bool full = overrides.size() > std::max(minUpdates, references / 16);
+    lock.unlock();
+
+    if (full) {
+        compact();
+    }
+}
+
+void
+RefIndex::parents(long child, std::set<long> &parents) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    // The last block starting at or before the child
+    auto key = std::upper_bound(keys.begin(), keys.end(), child);
+    if (key != keys.begin()) {
+        decode(keys, bytes, offsets, key - keys.begin() - 1, [&](long row, long parent) {
+            // The references of an updated parent are the new ones
+            if (row == child && !overrides.count(parent)) {
+                parents.insert(parent);
+            }
+        });
+    }
+    auto more = added.find(child);
+    if (more != added.end()) {
+        parents.insert(more->second.begin(), more->second.end());
+    }
+}
+
+// The versions of the updates are forgotten, so an update from an
+// earlier file would be applied again
+void
+RefIndex::compact(void)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    std::vector<std::pair<long, long>> pairs;
+    pairs.reserve(references);
+    for (std::size_t i = 0; i < keys.size(); i++) {
+        decode(keys, bytes, offsets, i, [&](long child, long parent) {
+            if (!overrides.count(parent)) {
+                pairs.emplace_back(child, parent);
+            }
+        });
+    }
+    for (const auto &child: added) {
+        for (auto parent: child.second) {
+            pairs.emplace_back(child.first, parent);
+        }
+    }
+    overrides.clear();
+    added.clear();
+    rebuild(pairs);
+    log_debug("Compacted the references to %1% bytes", bytes.size());
+}
+
+std::size_t
+RefIndex::size(void) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return references;
+}
+
+std::size_t
+RefIndex::memory(void) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return keys.size() * sizeof(long) + offsets.size() * sizeof(std::uint64_t) + bytes.size();
+}
+
+} // namespace queryraw
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,121 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __REFINDEX_HH__
+#define __REFINDEX_HH__
+
+/// \file refindex.hh
+/// \brief Find the ways using a node, or the relations using a way, in memory
+///
+/// This is the way_refs or rel_refs table turned around, so the objects
+/// changed indirectly by a replication file can be found without a
+/// query. It's loaded once, then kept up to date from the changes.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <cstdint>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "data/pq.hh"
+
+/// \namespace queryraw
+namespace queryraw {
+
+/// \struct RefUpdate
+/// \brief The references of an object at a version
+struct RefUpdate {
+    long parent = 0;
+    std::vector<long> children;
+    long version = 0;
+};
+
+/// \class RefIndex
+/// \brief A compressed reverse index of references, with updates on top
+///
+/// The references loaded are stored like a compressed sparse row
+/// matrix: the sorted IDs of the referenced objects, and for each one
+/// the sorted IDs of the objects using it, delta and varint encoded.
+/// Only the first ID of each block of rows is kept as is, to find the
+/// block a row is in. An updated object overrides what the rows say
+/// about it, and once there are many updates they're merged into new
+/// rows, which forgets their versions. It can be shared by threads.
+class RefIndex {
+  public:
+    /// Load the pairs of \a table, which are all held in memory until
+    /// they're compressed
+    bool load(pq::Pq &db, const std::string &table, const std::string &child, const std::string &parent);
+
+    /// Replace the index with these (child, parent) pairs
+    void assign(std::vector<std::pair<long, long>> pairs);
+
+    /// Set the references of \a parent, none when it's removed. An
+    /// update older than the last one for the same parent is ignored.
+    void update(long parent, const std::vector<long> &children, long version);
+
+    /// Apply the updates of a file, then compact if there are many.
+    /// As compacting forgets the versions, the files must be applied
+    /// in order.
+    void update(const std::vector<RefUpdate> &updates);
+
+    /// Add the objects referencing \a child to \a parents
+    void parents(long child, std::set<long> &parents) const;
+
+    /// Merge the updates into the compressed rows
+    void compact(void);
+
+    /// The number of references in the compressed rows
+    std::size_t size(void) const;
+
+    /// The bytes used by the compressed rows
+    std::size_t memory(void) const;
+
+  private:
+    void rebuild(std::vector<std::pair<long, long>> &pairs);
+
+    /// An object updated since the rows were built
+    struct Override {
+        std::vector<long> children;
+        long version = 0;
+    };
+
+    mutable std::shared_mutex mutex;
+    std::vector<long> keys;                      ///< The first referenced ID of each block
+    std::vector<std::uint64_t> offsets;          ///< Block i is bytes [offsets[i], offsets[i+1])
+    std::vector<std::uint8_t> bytes;             ///< The encoded rows
+    std::size_t references = 0;                  ///< The number of references in the rows
+    std::unordered_map<long, Override> overrides;
+    std::unordered_map<long, std::vector<long>> added; ///< The children of the overrides
+};
+
+} // namespace queryraw
+
+#endif // EOF __REFINDEX_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,184 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <algorithm>
+
+#include "raw/waycache.hh"
+#include "utils/metrics.hh"
+
+/// \namespace queryraw
+namespace queryraw {
+
+namespace {
+
+metrics::Counter &
+lookups(const std::string &result)
+{
+    return metrics::Registry::getDefaultInstance().counter(
+        "underpass_way_cache_lookups_total", "Lookups in the way cache", {{"result", result}});
+}
+
+} // anonymous namespace
+
+WayCache::WayCache(std::size_t memory, unsigned int count)
+    : shards(std::max(count, 1U)), max(memory / std::max(count, 1U))
+{
+}
+
+std::size_t
+WayCache::bytes(const osmobjects::OsmWay &way)
+{
+    std::size_t size = sizeof(osmobjects::OsmWay) + way.refs.capacity() * sizeof(long)
+        + way.linestring.capacity() * sizeof(point_t);
+    for (const auto &tag: way.tags) {
+        // A node of the map, and the strings if they're not short
+        size += 64 + tag.first.capacity() + tag.second.capacity();
+    }
+    return size;
+}
+
+void
+WayCache::erase(Shard &shard, std::list<Entry>::iterator it)
+{
+    shard.bytes -= it->size;
+    shard.index.erase(it->way->id);
+    shard.lru.erase(it);
+}
+
+std::shared_ptr<const osmobjects::OsmWay>
+WayCache::get(long id)
+{
+    static auto &hits = lookups("hit");
+    static auto &misses = lookups("miss");
+    auto &shard = this->shard(id);
+    const std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.index.find(id);
+    if (found == shard.index.end()) {
+        misses.add();
+        return nullptr;
+    }
+    hits.add();
+    shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+    return found->second->way;
+}
+
+void
+WayCache::put(const osmobjects::OsmWay &way)
+{
+    store(way, true);
+}
+
+void
+WayCache::add(const osmobjects::OsmWay &way)
+{
+    store(way, false);
+}
+
+void
+WayCache::update(const std::vector<osmobjects::OsmWay> &ways)
+{
+    for (const auto &way: ways) {
+        store(way, true);
+    }
+}
+
+void
+WayCache::store(const osmobjects::OsmWay &way, bool replace)
+{
+    // The points are only kept once, in the linestring
+    auto copy = std::make_shared<osmobjects::OsmWay>(way);
+    if (copy->linestring.size() != copy->refs.size()
+        && copy->polygon.outer().size() == copy->refs.size()) {
+        copy->linestring.assign(copy->polygon.outer().begin(), copy->polygon.outer().end());
+    }
+    boost::geometry::clear(copy->polygon);
+    copy->action = osmobjects::none;
+    if (copy->refs.empty() || copy->linestring.size() != copy->refs.size()) {
+        if (replace) {
+            remove(way.id);
+        }
+        return;
+    }
+    std::size_t size = bytes(*copy);
+
+    auto &shard = this->shard(way.id);
+    const std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.index.find(way.id);
+    if (found != shard.index.end()) {
+        // The nodes of a way can move without a new version
+        if (found->second->way->version > way.version || (!replace && found->second->way->version == way.version)) {
+            return;
+        }
+        erase(shard, found->second);
+    }
+    if (size > max) {
+        return;
+    }
+    shard.lru.push_front({copy, size});
+    shard.index[way.id] = shard.lru.begin();
+    shard.bytes += size;
+    while (shard.bytes > max) {
+        erase(shard, std::prev(shard.lru.end()));
+    }
+}
+
+void
+WayCache::remove(long id)
+{
+    auto &shard = this->shard(id);
+    const std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.index.find(id);
+    if (found != shard.index.end()) {
+        erase(shard, found->second);
+    }
+}
+
+std::size_t
+WayCache::size(void) const
+{
+    std::size_t size = 0;
+    for (const auto &shard: shards) {
+        const std::lock_guard<std::mutex> lock(shard.mutex);
+        size += shard.index.size();
+    }
+    return size;
+}
+
+std::size_t
+WayCache::memory(void) const
+{
+    std::size_t bytes = 0;
+    for (const auto &shard: shards) {
+        const std::lock_guard<std::mutex> lock(shard.mutex);
+        bytes += shard.bytes;
+    }
+    return bytes;
+}
+
+} // namespace queryraw
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
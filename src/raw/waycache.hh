@@ -0,0 +1,109 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __WAYCACHE_HH__
+#define __WAYCACHE_HH__
+
+/// \file waycache.hh
+/// \brief Keep the ways of the last replication files in memory
+///
+/// A way changed in a file is often changed again, or has a node moved,
+/// in the next ones. The ways written by the replicator are kept here
+/// with their refs, tags and points, so they and the location of their
+/// nodes don't have to be read again from the database.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "osm/osmobjects.hh"
+
+/// \namespace queryraw
+namespace queryraw {
+
+/// \class WayCache
+/// \brief A least recently used cache of ways, with a memory limit
+///
+/// The ways are split in shards by ID, each with its own lock, so the
+/// threads rarely wait for each other. A cached way always has a point
+/// for each of its refs, in its linestring.
+class WayCache {
+  public:
+    /// Keep at most \a memory bytes of ways, in \a shards
+    WayCache(std::size_t memory, unsigned int shards = 16);
+
+    /// The way, or null if it's not cached
+    std::shared_ptr<const osmobjects::OsmWay> get(long id);
+    /// Cache a way, unless a newer version is cached already. A way
+    /// without all its points is removed instead.
+    void put(const osmobjects::OsmWay &way);
+    /// Cache a way read from the database, unless it's cached already,
+    /// as the cached one may have been committed since it was read
+    void add(const osmobjects::OsmWay &way);
+    /// Cache the ways written by a file, once they're committed
+    void update(const std::vector<osmobjects::OsmWay> &ways);
+    /// Forget a way, when it's deleted
+    void remove(long id);
+
+    /// The number of ways cached
+    std::size_t size(void) const;
+    /// The bytes used by the ways cached
+    std::size_t memory(void) const;
+
+    /// The bytes used by a way, about
+    static std::size_t bytes(const osmobjects::OsmWay &way);
+
+  private:
+    struct Entry {
+        std::shared_ptr<const osmobjects::OsmWay> way;
+        std::size_t size;
+    };
+    /// \struct Shard
+    /// \brief The ways of some IDs, with the most recent first
+    struct Shard {
+        mutable std::mutex mutex;
+        std::list<Entry> lru;
+        std::unordered_map<long, std::list<Entry>::iterator> index;
+        std::size_t bytes = 0;
+    };
+
+    Shard &shard(long id) { return shards[static_cast<unsigned long>(id) % shards.size()]; };
+    void erase(Shard &shard, std::list<Entry>::iterator it);
+    /// Cache a way, replacing the same version if \a replace
+    void store(const osmobjects::OsmWay &way, bool replace);
+
+    std::vector<Shard> shards;
+    std::size_t max;             ///< The bytes of each shard
+};
+
+} // namespace queryraw
+
+#endif // EOF __WAYCACHE_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
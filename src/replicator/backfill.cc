@@ -0,0 +1,306 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include <boost/dll/import.hpp>
+#include <boost/dll/shared_library.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <boost/function.hpp>
+#include <boost/timer/timer.hpp>
+
+#include "replicator/backfill.hh"
+#include "replicator/threads.hh"
+#include "data/pq.hh"
+#include "raw/queryraw.hh"
+#include "stats/querystats.hh"
+#include "stats/statsaggregator.hh"
+#include "validate/queryvalidate.hh"
+#include "utils/log.hh"
+
+using namespace logger;
+using namespace queryraw;
+using namespace querystats;
+using namespace queryvalidate;
+using namespace replicatorthreads;
+
+/// \namespace backfill
+namespace backfill {
+
+static std::mutex progress_mutex;
+
+namespace {
+
+/// Write \a query for \a what, trying again if it fails
+bool
+write(std::shared_ptr<Pq> &db, const std::string &query, const std::string &what)
+{
+    for (int attempt = 1; attempt <= Backfill::attempts; attempt++) {
+        try {
+            db->query(query);
+            return true;
+        } catch (std::exception &e) {
+            log_error("Couldn't write %1%, attempt %2% of %3%: %4%", what, attempt, Backfill::attempts, e.what());
+        }
+    }
+    return false;
+}
+
+} // anonymous namespace
+
+Backfill::Backfill(const underpassconfig::UnderpassConfig &_config)
+{
+    config = _config;
+}
+
+std::vector<SequenceRange>
+Backfill::partition(long first, long last, long size)
+{
+    std::vector<SequenceRange> result;
+    if (size < 1) {
+        size = 1;
+    }
+    for (long sequence = first; sequence <= last; sequence += size) {
+        SequenceRange range;
+        range.first = sequence;
+        range.last = std::min(last, sequence + size - 1);
+        result.push_back(range);
+    }
+    return result;
+}
+
+void
+Backfill::seek(replication::RemoteURL &remote, long sequence)
+{
+    remote.updatePath(sequence / 1000000, (sequence / 1000) % 1000, sequence % 1000);
+}
+
+bool
+Backfill::start(const replication::RemoteURL &start, const replication::RemoteURL &end,
+                const multipolygon_t &poly)
+{
+#ifdef TIMING_DEBUG
+    boost::timer::auto_cpu_timer timer("backfill::start: took %w seconds\n");
+#endif
+    // Like the monitoring thread, the file matching the starting
+    // timestamp has already been applied.
+    long first = start.sequence() + 1;
+    long last = end.sequence();
+    if (last < first) {
+        log_error("Nothing to backfill between %1% and %2%", start.subpath, end.subpath);
+        return false;
+    }
+
+    auto db = std::make_shared<Pq>();
+    if (!db->connect(config.underpass_db_url)) {
+        log_error("Could not connect to Underpass DB, aborting backfill!");
+        return false;
+    }
+
+    if (!config.disable_validation) {
+        std::string plugins;
+        if (boost::filesystem::exists("src/validate/.libs")) {
+            plugins = "src/validate/.libs";
+        } else {
+            plugins = PKGLIBDIR;
+        }
+        boost::dll::fs::path lib_path(plugins);
+        boost::function<plugin_t> creator;
+        try {
+            creator = boost::dll::import_alias<plugin_t>(lib_path / "libunderpass.so", "create_plugin", boost::dll::load_mode::append_decorations);
+            log_debug("Loaded plugin!");
+        } catch (std::exception &e) {
+            log_error("Couldn't load plugin! %1%", e.what());
+            return false;
+        }
+        validator = creator();
+    }
+
+    // Removals left by an interrupted backfill are still valid, as
+    // they only ever delete older versions.
+    db->query("CREATE UNLOGGED TABLE IF NOT EXISTS " + QueryRaw::removalsTable +
+              " (osm_id int8, type objtype, version int);");
+    db->query("CREATE UNLOGGED TABLE IF NOT EXISTS " + QueryRaw::touchedTable +
+              " (osm_id int8, type objtype);");
+
+    ranges = partition(first, last, config.backfill_range);
+    total = last - first + 1;
+    next_range = 0;
+    processed = 0;
+    failed = 0;
+    log_info("Backfilling %1% files in %2% ranges with %3% workers", total, ranges.size(), config.backfill);
+
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0; i < std::max(1u, config.backfill); i++) {
+        workers.push_back(std::thread(&Backfill::threadBackfillRange, this, std::cref(start), std::cref(poly)));
+    }
+    for (auto it = workers.begin(); it != workers.end(); ++it) {
+        it->join();
+    }
+    if (!config.silent) {
+        std::cout << std::endl;
+    }
+
+    db->query(reconcile());
+
+    // The ranges ran out of order, so a way may have been built from
+    // nodes that a later change moved. Rebuilding the ways and relations
+    // written from where their nodes ended up gives what a serial run
+    // would have left.
+    QueryRaw queryraw(db);
+    db->query(queryraw.buildTouchedWaysQuery());
+    auto relations = queryraw.rebuildTouchedRelations();
+    db->query("DROP TABLE " + QueryRaw::touchedTable + ";");
+    log_info("Backfill done, processed %1% files, rebuilt %2% relations", processed.load(), relations);
+    if (failed > 0 || processed < total) {
+        log_error("Backfill incomplete, %1% of %2% files processed, %3% failures", processed.load(), total, failed.load());
+        return false;
+    }
+    return true;
+}
+
+std::string
+Backfill::reconcile(void) const
+{
+    // A removal only deletes versions older than itself, so an object
+    // recreated later in the range is kept, like in a serial run.
+    const std::string removals = QueryRaw::removalsTable;
+    std::map<std::string, std::string> tables = {
+        {"nodes", "node"},
+        {QueryRaw::polyTable, "way"},
+        {QueryRaw::lineTable, "way"},
+        {"relations", "relation"}
+    };
+
+    std::string query;
+    for (auto it = std::begin(tables); it != std::end(tables); ++it) {
+        boost::format fmt("DELETE FROM %s AS o USING %s AS r WHERE r.type = '%s' AND o.osm_id = r.osm_id AND o.version < r.version;");
+        fmt % it->first % removals % it->second;
+        query += fmt.str();
+    }
+
+    boost::format refs("DELETE FROM way_refs AS w USING %s AS r WHERE r.type = 'way' AND w.way_id = r.osm_id "
+                       "AND NOT EXISTS (SELECT 1 FROM %s WHERE osm_id = r.osm_id) "
+                       "AND NOT EXISTS (SELECT 1 FROM %s WHERE osm_id = r.osm_id);");
+    refs % removals % QueryRaw::polyTable % QueryRaw::lineTable;
+    query += refs.str();
+
+    if (!config.disable_validation) {
+        boost::format val("DELETE FROM validation AS v USING %s AS r WHERE v.osm_id = r.osm_id AND v.type = r.type AND v.version < r.version;");
+        val % removals;
+        query += val.str();
+    }
+
+    query += "DROP TABLE " + removals + ";";
+    return query;
+}
+
+void
+Backfill::threadBackfillRange(const replication::RemoteURL &start, const multipolygon_t &poly)
+{
+    auto db = std::make_shared<Pq>();
+    if (!db->connect(config.underpass_db_url)) {
+        log_error("Could not connect to Underpass DB, aborting backfill worker!");
+        failed++;
+        return;
+    }
+    auto querystats = std::make_shared<QueryStats>(db);
+    auto queryvalidate = std::make_shared<QueryValidate>(db);
+    auto queryraw = std::make_shared<QueryRaw>(db);
+    queryraw->versioned = true;
+
+    // The default constructor doesn't connect, so a mirrored
+    // range can be replayed without network access.
+    auto planet = std::make_shared<replication::Planet>();
+    planet->use_mirror = config.mirror;
+    auto underpassConfig = std::make_shared<UnderpassConfig>(config);
+    auto tasks = std::make_shared<std::vector<ReplicationTask>>(1);
+    statsaggregator::StatsAggregator aggregator;
+
+    std::size_t index;
+    while ((index = next_range++) < ranges.size()) {
+        const SequenceRange &range = ranges[index];
+        log_debug("Backfilling %1% to %2%", range.first, range.last);
+        for (long sequence = range.first; sequence <= range.last; sequence++) {
+            auto remote = std::make_shared<replication::RemoteURL>(start);
+            seek(*remote, sequence);
+            OsmChangeTask osmChangeTask {
+                remote,
+                planet,
+                poly,
+                validator,
+                tasks,
+                querystats,
+                queryvalidate,
+                queryraw,
+                underpassConfig,
+                0
+            };
+            // A download can fail for a moment, so try again before
+            // giving up on the file
+            int attempt = 1;
+            threadOsmChange(osmChangeTask);
+            while (tasks->front().status != reqfile_t::success && attempt < attempts) {
+                log_error("Couldn't backfill %1%, attempt %2% of %3%", remote->filespec, attempt++, attempts);
+                threadOsmChange(osmChangeTask);
+            }
+            auto task = tasks->front();
+            if (task.status != reqfile_t::success) {
+                log_error("Couldn't backfill %1% after %2% attempts", remote->filespec, attempts);
+                failed++;
+                continue;
+            }
+            if (task.stats) {
+                aggregator.merge(*task.stats, task.sequence, task.timestamp);
+            }
+            task.query += querystats->applyChanges(aggregator.flush());
+            if (!task.query.empty() && !write(db, task.query, remote->filespec)) {
+                failed++;
+                continue;
+            }
+            processed++;
+        }
+        // The next range may not follow this one
+        auto stats = querystats->applyChanges(aggregator.flushAll());
+        if (!stats.empty() && !write(db, stats, "the statistics of the range")) {
+            failed++;
+        }
+        if (!config.silent) {
+            const std::lock_guard<std::mutex> lock(progress_mutex);
+            long count = processed.load();
+            std::cout << "\r" << "Backfilling: " << count << "/" << total << " (" << (count * 100) / total << "%)" << std::flush;
+        }
+    }
+}
+
+} // namespace backfill
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
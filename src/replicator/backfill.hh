@@ -0,0 +1,100 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __BACKFILL_HH__
+#define __BACKFILL_HH__
+
+/// \file backfill.hh
+/// \brief Reprocess a historical time range with multiple workers
+///
+/// The range of replication files between two timestamps is split into
+/// independent sequence ranges, which workers process out of order.
+/// Conflicts are reconciled by object version: upserts never replace
+/// a newer version, and removals are recorded with their version and
+/// applied once all the ranges are done.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "replicator/replication.hh"
+#include "underpassconfig.hh"
+#include "validate/validate.hh"
+
+/// \namespace backfill
+namespace backfill {
+
+/// \struct SequenceRange
+/// \brief A range of replication files, both ends included
+struct SequenceRange {
+    long first = 0;
+    long last = 0;
+};
+
+/// \class Backfill
+/// \brief Process the files between two replication sequences in parallel
+class Backfill {
+  public:
+    Backfill(const underpassconfig::UnderpassConfig &config);
+    ~Backfill(void){};
+
+    /// Split [first, last] into ranges of at most size files
+    static std::vector<SequenceRange> partition(long first, long last, long size);
+
+    /// Point a remote URL at a sequence number
+    static void seek(replication::RemoteURL &remote, long sequence);
+
+    /// Times a file is tried before it's recorded as failed
+    static constexpr int attempts = 3;
+
+    /// Process all files after \a start up to and including \a end.
+    /// This fails if any of them couldn't be processed.
+    bool start(const replication::RemoteURL &start, const replication::RemoteURL &end,
+               const multipolygon_t &poly);
+
+    /// Apply the removals recorded during the backfill
+    std::string reconcile(void) const;
+
+  private:
+    /// Worker thread, processing ranges until there are none left
+    void threadBackfillRange(const replication::RemoteURL &start, const multipolygon_t &poly);
+
+    underpassconfig::UnderpassConfig config;
+    std::shared_ptr<Validate> validator;
+    std::vector<SequenceRange> ranges;
+    std::atomic<std::size_t> next_range{0};  ///< Next range to hand out to a worker
+    std::atomic<long> processed{0};          ///< Files processed by all workers
+    std::atomic<long> failed{0};             ///< Files and writes that failed
+    long total = 0;                          ///< Files in all the ranges
+};
+
+} // namespace backfill
+
+#endif // EOF __BACKFILL_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,373 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <list>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+
+#include "replicator/events.hh"
+#include "validate/queryvalidate.hh"
+#include "utils/log.hh"
+#include "utils/metrics.hh"
+
+using namespace logger;
+
+namespace net = boost::asio;      // from <boost/asio.hpp>
+using unix_socket = net::local::stream_protocol;
+
+/// \namespace events
+namespace events {
+
+namespace {
+
+/// A client further behind than this is disconnected
+const std::size_t maxPending = 4 * 1024 * 1024;
+
+const char *actions[] = {"none", "create", "modify", "delete"};
+
+/// Append \a value as a JSON string
+void
+quote(std::string &out, const std::string &value)
+{
+    out += '"';
+    for (char c: value) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out += (boost::format("\\u%04x") % static_cast<int>(c)).str();
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+std::string
+timestamp(boost::posix_time::ptime time)
+{
+    if (time.is_special()) {
+        return "null";
+    }
+    return "\"" + boost::posix_time::to_iso_extended_string(time) + "Z\"";
+}
+
+/// The fields all objects have
+void
+object(std::string &out, const char *type, const osmchange::ChangeBatch::Columns &columns, std::size_t i)
+{
+    out += (boost::format("{\"event\":\"%s\",\"id\":%d,\"version\":%d,\"action\":\"%s\",\"changeset\":%d,\"timestamp\":%s")
+            % type % columns.ids[i] % columns.versions[i] % actions[columns.actions[i]]
+            % columns.changesets[i] % timestamp(columns.timestamps[i])).str();
+}
+
+/// The counts of features, like {"building":2}
+void
+counts(std::string &out, const std::map<std::string, int> &features)
+{
+    out += '{';
+    for (const auto &feature: features) {
+        if (out.back() != '{') {
+            out += ',';
+        }
+        quote(out, feature.first);
+        out += ':' + std::to_string(feature.second);
+    }
+    out += '}';
+}
+
+} // anonymous namespace
+
+void
+objects(std::string &out, const osmchange::ChangeBatch &batch)
+{
+    const auto &nodes = batch.nodes;
+    for (std::size_t i = 0; i < nodes.size(); i++) {
+        if (!nodes.priority[i]) {
+            continue;
+        }
+        object(out, "node", nodes, i);
+        if (nodes.actions[i] != osmobjects::remove) {
+            out += (boost::format(",\"lat\":%.7f,\"lon\":%.7f") % nodes.lats[i] % nodes.lons[i]).str();
+        }
+        out += "}\n";
+    }
+    const auto &ways = batch.ways;
+    for (std::size_t i = 0; i < ways.size(); i++) {
+        if (!ways.priority[i] && ways.actions[i] != osmobjects::remove) {
+            continue;
+        }
+        object(out, "way", ways, i);
+        out += "}\n";
+    }
+}
+
+void
+validation(std::string &out, const std::vector<std::shared_ptr<ValidateStatus>> &results)
+{
+    for (const auto &result: results) {
+        if (!result) {
+            continue;
+        }
+        // The statuses are a set, so they're sorted to be stable
+        std::vector<std::string> statuses;
+        for (auto status: result->status) {
+            auto name = queryvalidate::status_list.find(status);
+            if (name != queryvalidate::status_list.end()) {
+                statuses.push_back(name->second);
+            }
+        }
+        std::sort(statuses.begin(), statuses.end());
+        out += (boost::format("{\"event\":\"validation\",\"type\":\"%s\",\"id\":%d,\"version\":%d,\"status\":[")
+                % queryvalidate::objtypes[result->objtype] % result->osm_id % result->version).str();
+        for (std::size_t i = 0; i < statuses.size(); i++) {
+            out += (i ? ",\"" : "\"") + statuses[i] + "\"";
+        }
+        out += "]}\n";
+    }
+}
+
+void
+changesets(std::string &out, const statsaggregator::statsmap_t &stats)
+{
+    for (const auto &change: stats) {
+        const auto &stat = *change.second;
+        out += (boost::format("{\"event\":\"changeset\",\"id\":%d,\"uid\":%d,\"added\":") % change.first % stat.uid).str();
+        counts(out, stat.added);
+        out += ",\"modified\":";
+        counts(out, stat.modified);
+        out += ",\"deleted\":";
+        counts(out, stat.deleted);
+        out += "}\n";
+    }
+}
+
+void
+commit(std::string &out, const std::string &url, boost::posix_time::ptime time)
+{
+    out += "{\"event\":\"file\",\"url\":";
+    quote(out, url);
+    out += ",\"timestamp\":" + timestamp(time) + "}\n";
+}
+
+struct Publisher::Sink {
+    struct Client {
+        Client(unix_socket::socket socket) : socket(std::move(socket)) {};
+        unix_socket::socket socket;
+        std::string pending;          ///< What the client hasn't read yet
+    };
+
+    std::ofstream file;
+    net::io_context ioc;
+    std::unique_ptr<unix_socket::acceptor> acceptor;
+    std::list<Client> clients;
+
+    /// Take the clients waiting to connect
+    void accept(void) {
+        if (!acceptor) {
+            return;
+        }
+        while (true) {
+            boost::system::error_code ec;
+            unix_socket::socket socket(ioc);
+            acceptor->accept(socket, ec);
+            if (ec) {
+                return;
+            }
+            socket.non_blocking(true);
+            clients.emplace_back(std::move(socket));
+            log_debug("A client connected for events");
+        }
+    };
+
+    void write(const std::string &lines) {
+        if (file.is_open()) {
+            file << lines;
+        }
+        for (auto &client: clients) {
+            client.pending += lines;
+        }
+    };
+
+    /// Send as much as the clients read, without waiting for them
+    void flush(void) {
+        if (file.is_open()) {
+            file.flush();
+        }
+        for (auto it = clients.begin(); it != clients.end();) {
+            boost::system::error_code ec;
+            while (!it->pending.empty()) {
+                auto sent = it->socket.write_some(net::buffer(it->pending), ec);
+                it->pending.erase(0, sent);
+                if (ec) {
+                    break;
+                }
+            }
+            if ((ec && ec != net::error::would_block) || it->pending.size() > maxPending) {
+                log_error("Disconnecting a client for events: %1%",
+                          ec ? ec.message() : std::string("too slow"));
+                it = clients.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    };
+};
+
+Publisher::Publisher(std::size_t _capacity)
+    : capacity(_capacity)
+{
+}
+
+Publisher::~Publisher(void)
+{
+    close();
+}
+
+Publisher &
+Publisher::getDefaultInstance(void)
+{
+    static Publisher publisher;
+    return publisher;
+}
+
+bool
+Publisher::open(const std::string &target)
+{
+    close();
+    sink = std::make_unique<Sink>();
+    if (boost::algorithm::starts_with(target, "unix:")) {
+        std::string path = target.substr(5);
+        try {
+            boost::filesystem::remove(path);
+            sink->acceptor = std::make_unique<unix_socket::acceptor>(sink->ioc, unix_socket::endpoint(path));
+            sink->acceptor->non_blocking(true);
+        } catch (const std::exception &e) {
+            log_error("Couldn't listen for events on %1%: %2%", path, e.what());
+            sink.reset();
+            return false;
+        }
+    } else if (target != "metrics") {
+        sink->file.open(target, std::ios::app);
+        if (!sink->file) {
+            log_error("Couldn't open %1% for events", target);
+            sink.reset();
+            return false;
+        }
+    }
+    closing = false;
+    thread = std::thread([this] { run(); });
+    log_info("Publishing the committed changes to %1%", target);
+    return true;
+}
+
+void
+Publisher::publish(std::string lines)
+{
+    if (!sink || lines.empty()) {
+        return;
+    }
+    {
+        const std::lock_guard<std::mutex> lock(mutex);
+        latest.push_back(lines);
+        latestBytes += lines.size();
+        while (latestBytes > maxRecent && latest.size() > 1) {
+            latestBytes -= latest.front().size();
+            latest.pop_front();
+        }
+        if (queue.size() >= capacity) {
+            drops++;
+            static auto &dropped = metrics::Registry::getDefaultInstance().counter("underpass_events_dropped_total",
+                "Batches of events dropped because the writer was behind");
+            dropped.add();
+            return;
+        }
+        queue.push_back(std::move(lines));
+    }
+    ready.notify_one();
+}
+
+void
+Publisher::close(void)
+{
+    {
+        const std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+    }
+    ready.notify_one();
+    if (thread.joinable()) {
+        thread.join();
+    }
+    sink.reset();
+}
+
+std::string
+Publisher::recent(void) const
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    std::string lines;
+    lines.reserve(latestBytes);
+    for (const auto &batch: latest) {
+        lines += batch;
+    }
+    return lines;
+}
+
+void
+Publisher::run(void)
+{
+    while (true) {
+        std::deque<std::string> batches;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            // Wake up now and then for new clients and slow ones
+            ready.wait_for(lock, std::chrono::milliseconds(200), [this] {
+                return closing || !queue.empty();
+            });
+            batches.swap(queue);
+            if (closing && batches.empty()) {
+                break;
+            }
+        }
+        sink->accept();
+        for (const auto &lines: batches) {
+            sink->write(lines);
+        }
+        sink->flush();
+    }
+}
+
+} // namespace events
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
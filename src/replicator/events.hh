@@ -0,0 +1,126 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __EVENTS_HH__
+#define __EVENTS_HH__
+
+/// \file events.hh
+/// \brief Publish the changes written to the database as they're committed
+///
+/// Each replication file becomes a few lines of JSON: the objects
+/// written, their new validation statuses, the statistics added to
+/// their changesets, and a last line for the file itself. They're sent
+/// once the batch is committed, to an append-only file or to the
+/// clients of a Unix socket. The latest ones can also be polled from
+/// the metrics endpoint. The replication never waits for them: if the
+/// writer falls behind, batches are dropped and counted.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "osm/changebatch.hh"
+#include "stats/statsaggregator.hh"
+#include "validate/validate.hh"
+
+/// \namespace events
+namespace events {
+
+/// Add a line for each node and way written, which are the ones in
+/// the priority area and the deleted ways
+void objects(std::string &out, const osmchange::ChangeBatch &batch);
+
+/// Add a line for each object validated, with all its statuses
+void validation(std::string &out, const std::vector<std::shared_ptr<ValidateStatus>> &results);
+
+/// Add a line for the statistics of each changeset in a file
+void changesets(std::string &out, const statsaggregator::statsmap_t &stats);
+
+/// Add the line ending the events of a replication file
+void commit(std::string &out, const std::string &url, boost::posix_time::ptime timestamp);
+
+/// \class Publisher
+/// \brief Writes the events on its own thread
+class Publisher {
+  public:
+    /// At most \a capacity batches wait to be written
+    Publisher(std::size_t capacity = 256);
+    ~Publisher(void);
+
+    /// The instance the replicator publishes to
+    static Publisher &getDefaultInstance(void);
+
+    /// Publish to a file, to a Unix socket for "unix:<path>", or only
+    /// to recent() for "metrics"
+    bool open(const std::string &target);
+
+    /// Queue the events of a committed batch. This doesn't wait: when
+    /// the queue is full the batch is dropped.
+    void publish(std::string lines);
+
+    /// Write what's queued, then stop
+    void close(void);
+
+    /// The number of batches dropped
+    std::uint64_t dropped(void) const { return drops; };
+
+    /// The batches published lately, oldest first, for the clients
+    /// polling the metrics endpoint
+    std::string recent(void) const;
+    /// The most bytes of batches kept for recent()
+    static const std::size_t maxRecent = 1 << 20;
+
+  private:
+    struct Sink;
+    /// Write the queued batches until closed
+    void run(void);
+
+    std::size_t capacity;
+    mutable std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::string> queue;
+    std::deque<std::string> latest;      ///< The batches for recent()
+    std::size_t latestBytes = 0;
+    bool closing = false;
+    std::atomic<std::uint64_t> drops = 0;
+    std::unique_ptr<Sink> sink;
+    std::thread thread;
+};
+
+} // namespace events
+
+#endif // EOF __EVENTS_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,334 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <ctime>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/crc.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/copy.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/null.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filtering_streambuf.hpp>
+
+#include "replicator/mirror.hh"
+#include "osm/binarychange.hh"
+#include "utils/log.hh"
+
+using namespace logger;
+
+/// \namespace mirror
+namespace mirror {
+
+MappedFile::MappedFile(const std::string &filespec)
+{
+    int fd = ::open(filespec.c_str(), O_RDONLY);
+    if (fd < 0) {
+        log_error("Couldn't open %1%: %2%", filespec, std::strerror(errno));
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        log_error("Couldn't stat %1%: %2%", filespec, std::strerror(errno));
+        ::close(fd);
+        return;
+    }
+    length = st.st_size;
+    if (length == 0) {
+        // mmap() doesn't accept an empty range
+        ::close(fd);
+        valid = true;
+        return;
+    }
+    void *ptr = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping holds its own reference to the file
+    ::close(fd);
+    if (ptr == MAP_FAILED) {
+        log_error("Couldn't mmap %1%: %2%", filespec, std::strerror(errno));
+        length = 0;
+        return;
+    }
+    madvise(ptr, length, MADV_SEQUENTIAL);
+    addr = static_cast<const unsigned char *>(ptr);
+    valid = true;
+}
+
+MappedFile::~MappedFile(void)
+{
+    if (addr) {
+        munmap(const_cast<unsigned char *>(addr), length);
+    }
+}
+
+Mirror::Mirror(const std::string &directory, const std::string &_kind)
+{
+    kind = _kind;
+    packfile = directory + "/" + kind + ".pack";
+    indexfile = directory + "/" + kind + ".idx";
+    try {
+        if (!boost::filesystem::exists(directory)) {
+            boost::filesystem::create_directories(directory);
+        }
+    } catch (boost::system::system_error ex) {
+        log_error("Mirror directory corrupted!: %1%, %2%", directory, ex.what());
+    }
+    loadIndex();
+}
+
+std::shared_ptr<Mirror>
+Mirror::open(const std::string &directory, const std::string &kind)
+{
+    static std::mutex mirrors_mutex;
+    static std::map<std::string, std::shared_ptr<Mirror>> mirrors;
+
+    const std::lock_guard<std::mutex> lock(mirrors_mutex);
+    auto key = directory + "/" + kind;
+    auto it = mirrors.find(key);
+    if (it != mirrors.end()) {
+        return it->second;
+    }
+    auto mirror = std::make_shared<Mirror>(directory, kind);
+    mirrors[key] = mirror;
+    return mirror;
+}
+
+void
+Mirror::loadIndex(void)
+{
+    packsize = 0;
+    if (boost::filesystem::exists(packfile)) {
+        packsize = boost::filesystem::file_size(packfile);
+    }
+    if (!boost::filesystem::exists(indexfile)) {
+        return;
+    }
+
+    std::ifstream in(indexfile, std::ios::binary);
+    IndexEntry entry;
+    long dropped = 0;
+    while (in.read(reinterpret_cast<char *>(&entry), sizeof(IndexEntry))) {
+        // A crash between writing the pack and the index leaves
+        // records pointing past the end of the pack
+        if (entry.offset + entry.size > packsize) {
+            dropped++;
+            continue;
+        }
+        // Later records replace earlier ones for the same sequence
+        index[entry.sequence] = entry;
+    }
+    if (dropped) {
+        log_error("Dropped %1% truncated entries from %2%", dropped, indexfile);
+    }
+    log_debug("Loaded %1% mirrored files from %2%", index.size(), indexfile);
+}
+
+bool
+Mirror::contains(long sequence)
+{
+    const std::lock_guard<std::mutex> lock(mirror_mutex);
+    return index.count(sequence) > 0;
+}
+
+bool
+Mirror::lookup(long sequence, IndexEntry &entry)
+{
+    const std::lock_guard<std::mutex> lock(mirror_mutex);
+    auto it = index.find(sequence);
+    if (it == index.end()) {
+        return false;
+    }
+    entry = it->second;
+    return true;
+}
+
+bool
+Mirror::read(long sequence, MappedView &view)
+{
+    const std::lock_guard<std::mutex> lock(mirror_mutex);
+    auto it = index.find(sequence);
+    if (it == index.end()) {
+        return false;
+    }
+    const IndexEntry &entry = it->second;
+    // The pack only grows, so only map it again when the
+    // entry was appended after the current mapping was made.
+    if (!mapping || entry.offset + entry.size > mapping->size()) {
+        auto remap = std::make_shared<MappedFile>(packfile);
+        if (!remap->isValid()) {
+            return false;
+        }
+        mapping = remap;
+    }
+    if (entry.offset + entry.size > mapping->size()) {
+        log_error("Mirror entry %1% is past the end of %2%", sequence, packfile);
+        return false;
+    }
+    // The bytes are checked once, the first time they're served. A
+    // damaged file is dropped from the index, so it's downloaded and
+    // mirrored again.
+    if (!verified.count(sequence)) {
+        boost::crc_32_type crc;
+        crc.process_bytes(mapping->data() + entry.offset, entry.size);
+        if (crc.checksum() != entry.checksum) {
+            log_error("Mirrored %1% file %2% doesn't match its checksum", kind, sequence);
+            index.erase(it);
+            return false;
+        }
+        verified.insert(sequence);
+    }
+    view.file = mapping;
+    view.offset = entry.offset;
+    view.size = entry.size;
+    return true;
+}
+
+bool
+Mirror::validate(const unsigned char *data, std::size_t size) const
+{
+    if (size == 0) {
+        return false;
+    }
+    if (kind.size() > 3 && kind.compare(kind.size() - 3, 3, ".gz") == 0) {
+        if (size < 18 || data[0] != 0x1f || data[1] != 0x8b) {
+            return false;
+        }
+        // Inflating the whole file makes the decompressor check
+        // the CRC and length stored in the gzip trailer.
+        try {
+            boost::iostreams::filtering_streambuf<boost::iostreams::input> inbuf;
+            inbuf.push(boost::iostreams::gzip_decompressor());
+            inbuf.push(boost::iostreams::array_source{reinterpret_cast<const char *>(data), size});
+            boost::iostreams::null_sink sink;
+            boost::iostreams::copy(inbuf, sink);
+        } catch (std::exception &e) {
+            log_debug("Gzip validation failed: %1%", e.what());
+            return false;
+        }
+        return true;
+    }
+    if (kind == "oscb") {
+        return osmchange::BinaryChangeFile::isBinary(data, size);
+    }
+    if (kind == "state.txt") {
+        std::string state(reinterpret_cast<const char *>(data), size);
+        return state.find("sequenceNumber") != std::string::npos &&
+            state.find("timestamp") != std::string::npos;
+    }
+    return true;
+}
+
+bool
+Mirror::write(long sequence, const unsigned char *data, std::size_t size)
+{
+    if (!validate(data, size)) {
+        log_error("Not mirroring corrupted %1% file %2%", kind, sequence);
+        return false;
+    }
+
+    boost::crc_32_type crc;
+    crc.process_bytes(data, size);
+
+    const std::lock_guard<std::mutex> lock(mirror_mutex);
+    if (index.count(sequence)) {
+        return true;
+    }
+
+    IndexEntry entry;
+    entry.sequence = sequence;
+    entry.offset = packsize;
+    entry.size = size;
+    entry.checksum = crc.checksum();
+    entry.timestamp = std::time(nullptr);
+
+    // The data goes first, so the index never points at missing bytes
+    int fd = ::open(packfile.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        log_error("Couldn't open %1%: %2%", packfile, std::strerror(errno));
+        return false;
+    }
+    std::size_t written = 0;
+    while (written < size) {
+        auto ret = ::write(fd, data + written, size - written);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_error("Couldn't write %1%: %2%", packfile, std::strerror(errno));
+            ::close(fd);
+            // Don't reuse the space of a partial write
+            packsize = boost::filesystem::file_size(packfile);
+            return false;
+        }
+        written += ret;
+    }
+    ::close(fd);
+
+    std::ofstream out(indexfile, std::ios::binary | std::ios::app);
+    out.write(reinterpret_cast<const char *>(&entry), sizeof(IndexEntry));
+    out.close();
+    if (!out) {
+        log_error("Couldn't write %1%", indexfile);
+        packsize += size;
+        return false;
+    }
+
+    packsize += size;
+    index[sequence] = entry;
+    verified.insert(sequence);
+    log_debug("Mirrored %1% file %2% (%3% bytes)", kind, sequence, size);
+    return true;
+}
+
+std::size_t
+Mirror::size(void)
+{
+    const std::lock_guard<std::mutex> lock(mirror_mutex);
+    return index.size();
+}
+
+void
+Mirror::dump(void)
+{
+    const std::lock_guard<std::mutex> lock(mirror_mutex);
+    std::cerr << "Dumping Mirror data" << std::endl;
+    std::cerr << "\tPack: " << packfile << " (" << packsize << " bytes)" << std::endl;
+    std::cerr << "\tIndex: " << indexfile << " (" << index.size() << " entries)" << std::endl;
+    if (!index.empty()) {
+        std::cerr << "\tSequences: " << index.begin()->first << " - " << index.rbegin()->first << std::endl;
+    }
+}
+
+} // namespace mirror
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
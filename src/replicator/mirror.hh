@@ -0,0 +1,142 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __MIRROR_HH__
+#define __MIRROR_HH__
+
+/// \file mirror.hh
+/// \brief A local mirror of replication files
+///
+/// The mirror stores every downloaded replication file of one kind
+/// (osc.gz, state.txt, osm.gz) for one frequency in a single pack file,
+/// next to a compact index of fixed size records. Files are validated
+/// before they are added, and are served back from a read-only memory
+/// mapping of the pack, so replaying a historical range doesn't need
+/// the network nor any copies.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+/// \namespace mirror
+namespace mirror {
+
+/// \class MappedFile
+/// \brief A read-only memory mapping of a whole file
+///
+/// The mapping is released when the last reference goes away, so views
+/// into it stay valid even if the owner maps the file again.
+class MappedFile {
+  public:
+    MappedFile(const std::string &filespec);
+    ~MappedFile(void);
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    /// If the file could be mapped
+    bool isValid(void) const { return valid; };
+    const unsigned char *data(void) const { return addr; };
+    std::size_t size(void) const { return length; };
+
+  private:
+    const unsigned char *addr = nullptr; ///< Start of the mapping
+    std::size_t length = 0;              ///< Size of the mapping
+    bool valid = false;                  ///< If the mapping succeeded
+};
+
+/// \struct MappedView
+/// \brief A byte range inside a MappedFile
+struct MappedView {
+    std::shared_ptr<MappedFile> file; ///< Keeps the mapping alive
+    std::size_t offset = 0;           ///< Start of the range
+    std::size_t size = 0;             ///< Size of the range
+    const unsigned char *data(void) const { return file->data() + offset; };
+};
+
+/// \struct IndexEntry
+/// \brief A record in the mirror index
+///
+/// This is written as is to the index file, so the layout must not change.
+struct IndexEntry {
+    int64_t sequence = -1;  ///< The replication sequence number
+    uint64_t offset = 0;    ///< Start of the file in the pack
+    uint64_t size = 0;      ///< Size of the file in the pack
+    uint32_t checksum = 0;  ///< CRC32 of the stored bytes
+    uint32_t reserved = 0;  ///< Padding, always 0
+    int64_t timestamp = 0;  ///< When the file was mirrored, in seconds since the epoch
+};
+
+/// \class Mirror
+/// \brief A pack file plus index of replication files of one kind
+class Mirror {
+  public:
+    /// Open (or create) the mirror in \a directory for files ending in \a kind
+    Mirror(const std::string &directory, const std::string &kind);
+    ~Mirror(void) {};
+
+    /// Get the shared mirror for a directory and kind, as multiple
+    /// threads download into the same mirror
+    static std::shared_ptr<Mirror> open(const std::string &directory, const std::string &kind);
+
+    /// If the file for this sequence is in the mirror
+    bool contains(long sequence);
+    /// Get the index entry for a sequence
+    bool lookup(long sequence, IndexEntry &entry);
+    /// Get a view of the mirrored file, without copying it. A file
+    /// that doesn't match its checksum is removed from the mirror.
+    bool read(long sequence, MappedView &view);
+    /// Validate and append a file to the mirror
+    bool write(long sequence, const unsigned char *data, std::size_t size);
+    /// Check if the data is a complete file of this mirror's kind
+    bool validate(const unsigned char *data, std::size_t size) const;
+    /// The number of files in the mirror
+    std::size_t size(void);
+    /// Dump internal data to the terminal, used only for debugging
+    void dump(void);
+
+  private:
+    /// Load the index file, dropping entries past the end of the pack
+    void loadIndex(void);
+
+    std::string kind;      ///< The file suffix, ie... osc.gz
+    std::string packfile;  ///< The file holding the data
+    std::string indexfile; ///< The file holding the index records
+    uint64_t packsize = 0; ///< Current size of the pack file
+    std::map<long, IndexEntry> index;  ///< The index by sequence
+    std::unordered_set<long> verified; ///< The files whose checksum was checked
+    std::shared_ptr<MappedFile> mapping; ///< The current mapping of the pack
+    std::mutex mirror_mutex;           ///< Protects index, packsize and mapping
+};
+
+} // namespace mirror
+
+#endif // EOF __MIRROR_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -107,13 +107,8 @@ std::shared_ptr<RemoteURL> PlanetReplicator::findRemotePath(const underpassconfi
     yaml.read(rep_file);
     std::map<int, ptime> hashes;
 
-    yaml::Node hashes_config;
-
-    if (config.frequency == replication::minutely) {
-        hashes_config = yaml.get("minute");
-    } else {
-        hashes_config = yaml.get("changeset");
-    }
+    const yaml::Node &hashes_config = yaml.get_ref(
+        (config.frequency == replication::minutely) ? "minute" : "changeset");
     for (auto it = hashes_config.children.begin(); it != hashes_config.children.end(); ++it) {
         hashes.insert(
             std::make_pair(
@@ -128,7 +123,7 @@ std::shared_ptr<RemoteURL> PlanetReplicator::findRemotePath(const underpassconfi
     std::pair<int, ptime> closest_next;
     auto it = hashes.begin();
     for (; it != hashes.end(); ++it) {
-        delta = config.start_time - it->second;
+        delta = time - it->second;
         if (delta.total_seconds() < 0) {
             break;
         }
@@ -146,7 +141,7 @@ std::shared_ptr<RemoteURL> PlanetReplicator::findRemotePath(const underpassconfi
 
     double ratio = (delta.total_seconds() / 60.0) / (closest_next.first - closest_prev.first);
 
-    boost::posix_time::time_duration delta_target = config.start_time - closest_prev.second;
+    boost::posix_time::time_duration delta_target = time - closest_prev.second;
     int target_int = closest_prev.first + (delta_target.total_seconds() / 60.0 / ratio);
 
     double n = target_int/1000000.0;
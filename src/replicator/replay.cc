@@ -0,0 +1,167 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+
+#include "replicator/replay.hh"
+#include "replicator/backfill.hh"
+#include "replicator/threads.hh"
+#include "utils/log.hh"
+#include "utils/metrics.hh"
+
+using namespace logger;
+
+/// \namespace replay
+namespace replay {
+
+ReplayPlanet::ReplayPlanet(const std::string &_root)
+{
+    root = _root;
+    domain = "replay";
+}
+
+std::string
+ReplayPlanet::localPath(const replication::RemoteURL &remote) const
+{
+    std::string path = root + "/" + remote.filespec;
+    if (boost::filesystem::exists(path)) {
+        return path;
+    }
+    std::vector<std::string> parts;
+    boost::split(parts, remote.filespec, boost::is_any_of("/"));
+    if (parts.size() < 3) {
+        return path;
+    }
+    auto it = parts.end() - 3;
+    return root + "/" + *it + "/" + *(it + 1) + "/" + *(it + 2);
+}
+
+replication::RequestedFile
+ReplayPlanet::downloadFile(const std::string &url, const std::string &destdir_base)
+{
+    replication::RemoteURL remote(url);
+    std::string path = localPath(remote);
+    if (!boost::filesystem::exists(path)) {
+        log_debug("%1% isn't in the replay", remote.filespec);
+        replication::RequestedFile file;
+        file.status = replication::reqfile_t::remoteNotFound;
+        return file;
+    }
+    return readFile(path);
+}
+
+Replay::Replay(const underpassconfig::UnderpassConfig &_config)
+{
+    config = _config;
+}
+
+bool
+Replay::scan(void)
+{
+    first = -1;
+    last = -1;
+    if (!boost::filesystem::is_directory(config.replay)) {
+        log_error("%1% isn't a directory", config.replay);
+        return false;
+    }
+    boost::filesystem::recursive_directory_iterator it(config.replay), eod;
+    for (; it != eod; ++it) {
+        const auto &path = it->path();
+        if (!boost::algorithm::ends_with(path.filename().string(), ".osc.gz")) {
+            continue;
+        }
+        try {
+            long index = std::stol(path.filename().string());
+            long minor = std::stol(path.parent_path().filename().string());
+            long major = std::stol(path.parent_path().parent_path().filename().string());
+            long sequence = major * 1000000 + minor * 1000 + index;
+            first = (first < 0) ? sequence : std::min(first, sequence);
+            last = std::max(last, sequence);
+        } catch (const std::exception &e) {
+            log_debug("Not a replication file: %1%", path.string());
+        }
+    }
+    return first >= 0;
+}
+
+bool
+Replay::start(const multipolygon_t &poly, long from)
+{
+    if (!scan()) {
+        log_error("No replication files to replay in %1%", config.replay);
+        return false;
+    }
+    if (from > 0) {
+        first = from;
+    }
+    log_info("Replaying %1% to %2% from %3%", first, last, config.replay);
+
+    // Like with a starting URL, the monitoring thread starts with the
+    // file after this one, so the very first file of the planet can't
+    // be replayed.
+    std::string url = "https://replay/replication/" +
+        replication::StateFile::freq_to_string(config.frequency) + "/000/000/000.osc.gz";
+    auto remote = std::make_shared<replication::RemoteURL>(url);
+    backfill::Backfill::seek(*remote, std::max(first - 1, 0L));
+
+    auto started = std::chrono::steady_clock::now();
+    replicatorthreads::startMonitorChanges(remote, poly, config);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+
+    std::cout << report(elapsed.count()) << std::flush;
+    return true;
+}
+
+std::string
+Replay::report(double seconds) const
+{
+    auto files = replicatorthreads::stageHistogram("parse").count();
+    std::string out = (boost::format("Replayed %d files in %.3f seconds, %.2f files per second\n")
+                       % files % seconds % (seconds > 0 ? files / seconds : 0)).str();
+    out += (boost::format("%-12s %8s %12s %10s %10s\n")
+            % "stage" % "count" % "total (s)" % "mean (ms)" % "p99 (ms)").str();
+    for (const auto &stage: replicatorthreads::stages) {
+        auto &histogram = replicatorthreads::stageHistogram(stage);
+        auto count = histogram.count();
+        double total = histogram.sum() * histogram.scale;
+        out += (boost::format("%-12s %8d %12.3f %10.3f %10.3f\n")
+                % stage % count % total % (count ? total * 1000 / count : 0)
+                % (histogram.quantile(0.99) * histogram.scale * 1000)).str();
+    }
+    return out;
+}
+
+} // namespace replay
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,97 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __REPLAY_HH__
+#define __REPLAY_HH__
+
+/// \file replay.hh
+/// \brief Run the replicator over a local tree of replication files
+///
+/// The files are laid out like on the planet server, as
+/// major/minor/index.osc.gz with their .state.txt files. They go
+/// through the same monitoring loop as downloaded files, and the SQL
+/// is either written to a scratch database or discarded, which gives
+/// a repeatable benchmark of the whole pipeline without a network.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <memory>
+#include <string>
+
+#include "replicator/replication.hh"
+#include "underpassconfig.hh"
+
+/// \namespace replay
+namespace replay {
+
+/// \class ReplayPlanet
+/// \brief A planet server whose files are read from a local directory
+class ReplayPlanet : public replication::Planet {
+  public:
+    /// Read the files under \a root, which doesn't connect to anything
+    ReplayPlanet(const std::string &root);
+
+    using replication::Planet::downloadFile;
+    /// Read the file for \a url, or return remoteNotFound at the end
+    /// of the tree
+    replication::RequestedFile downloadFile(const std::string &url, const std::string &destdir_base) override;
+
+    /// The local path of the file for \a remote. Both the
+    /// major/minor/index layout and a copy of the server's
+    /// replication/minute/major/minor/index layout are found.
+    std::string localPath(const replication::RemoteURL &remote) const;
+
+    std::string root;           ///< The top of the tree
+};
+
+/// \class Replay
+/// \brief Replay all the change files in a directory and time it
+class Replay {
+  public:
+    Replay(const underpassconfig::UnderpassConfig &config);
+    ~Replay(void){};
+
+    /// Find the first and last change file in the tree
+    bool scan(void);
+
+    /// Process all the files from \a first, or the first one in the
+    /// tree if it's 0, and print the time spent in each stage
+    bool start(const multipolygon_t &poly, long first = 0);
+
+    /// The time spent in each stage, as a table
+    std::string report(double seconds) const;
+
+    long first = -1;            ///< The sequence of the first file
+    long last = -1;             ///< The sequence of the last file
+
+  private:
+    underpassconfig::UnderpassConfig config;
+};
+
+} // namespace replay
+
+#endif // EOF __REPLAY_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
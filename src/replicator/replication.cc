@@ -28,6 +28,7 @@
 #include <exception>
 #include <filesystem>
 #include <iostream>
+#include <map>
 #include <regex>
 #include <string>
 #include <utility>
@@ -83,10 +84,39 @@ using tcp = net::ip::tcp;         // from <boost/asio/ip/tcp.hpp>
 std::mutex db_mutex;
 
 #include "utils/log.hh"
+#include "utils/metrics.hh"
 using namespace logger;
 
 namespace replication {
 
+namespace {
+
+/// The download metrics of a server
+struct DownloadMetrics {
+    explicit DownloadMetrics(const std::string &server)
+        : seconds(metrics::Registry::getDefaultInstance().histogram("underpass_download_seconds",
+              "Time to download a replication file", {{"server", server}}, 1e-6)),
+          bytes(metrics::Registry::getDefaultInstance().counter("underpass_download_bytes_total",
+              "Bytes of replication files downloaded", {{"server", server}})) {}
+    metrics::Histogram &seconds;
+    metrics::Counter &bytes;
+};
+
+/// The download metrics of a \a server, looked up once per thread
+/// as the registry takes a lock
+DownloadMetrics &
+downloadMetrics(const std::string &server)
+{
+    thread_local std::map<std::string, DownloadMetrics> cached;
+    auto found = cached.find(server);
+    if (found == cached.end()) {
+        found = cached.emplace(server, DownloadMetrics(server)).first;
+    }
+    return found->second;
+}
+
+} // anonymous namespace
+
 /// Parse the two state files for a replication file, from
 /// disk or memory.
 
@@ -263,14 +293,14 @@ Planet::getLinks(GumboNode *node, std::shared_ptr<std::vector<std::string>> &lin
 }
 
 std::istringstream
-Planet::processData(const std::string &dest, std::vector<unsigned char> &data)
+Planet::processData(const std::string &dest, const unsigned char *data, std::size_t size)
 {
     std::istringstream xml;
     try {
         {   // Scope to deallocate buffers
             boost::iostreams::filtering_streambuf<boost::iostreams::input> inbuf;
             inbuf.push(boost::iostreams::gzip_decompressor());
-            boost::iostreams::array_source arrs{reinterpret_cast<char const *>(data.data()), data.size()};
+            boost::iostreams::array_source arrs{reinterpret_cast<char const *>(data), size};
             inbuf.push(arrs);
             std::istream instream(&inbuf);
             xml.str(std::string{std::istreambuf_iterator<char>(instream), {}});
@@ -292,17 +322,31 @@ Planet::downloadFile(const std::string &url, const std::string &destdir_base)
     RequestedFile file;
     std::string local_file_path = destdir_base + remote.filespec;
 
+    std::shared_ptr<mirror::Mirror> cache;
+    if (use_mirror) {
+        cache = getMirror(remote);
+        if (cache->read(remote.sequence(), file.mapped)) {
+            file.status = reqfile_t::success;
+            return file;
+        }
+    }
+
     if (std::filesystem::exists(local_file_path)) {
         file = readFile(local_file_path);
         // If local file doesn't work, remove it
         if (file.status == reqfile_t::localError) {
             boost::filesystem::remove(local_file_path);
+        } else if (cache) {
+            // Import files cached before mirror mode was enabled
+            cache->write(remote.sequence(), file.bytes(), file.size());
         }
         return file;
     }
 
     file.data = std::make_shared<std::vector<unsigned char>>();
 
+    auto started = std::chrono::steady_clock::now();
+
     // The io_context is required for all I/O
     boost::asio::io_context ioc;
 
@@ -377,6 +421,9 @@ Planet::downloadFile(const std::string &url, const std::string &destdir_base)
             if (!is_gzipped) {
                 file.data->push_back('\n');
             }
+            auto &metrics = downloadMetrics(remote.domain);
+            metrics.seconds.record(std::chrono::steady_clock::now() - started);
+            metrics.bytes.add(parser.get().body().size());
         }
 
     } catch (boost::system::system_error ex) {
@@ -392,49 +439,68 @@ Planet::downloadFile(const std::string &url, const std::string &destdir_base)
         ec = {};
     }
 
+    file.status = reqfile_t::success;
 #ifdef USE_CACHE
     if (file.data->size() > 0) {
-        writeFile(remote, file.data);
+        if (!writeFile(remote, file.data)) {
+            file.status = reqfile_t::corrupted;
+        }
     } else {
         log_error("%1% does not exist!", remote.filespec);
     }
+#else
+    if (use_mirror && !writeFile(remote, file.data)) {
+        file.status = reqfile_t::corrupted;
+    }
 #endif
-    file.status = reqfile_t::success;
     return file;
 }
 
 RequestedFile
 Planet::readFile(std::string &filespec) {
     log_debug("Reading cached file: %1%", filespec);
-    // Since we want to read in the entire file so it can be
-    // decompressed, blow off C++ streaming and just load the
-    // entire thing.
-    int size = 0;
+    // Since we want the entire file so it can be decompressed,
+    // blow off C++ streaming and map the file into memory
+    // instead of copying it into a buffer.
     RequestedFile file;
-    file.data = std::make_shared<std::vector<unsigned char>>();
-    try {
-        size = boost::filesystem::file_size(filespec);
-    } catch (const std::exception &ex) {
-        log_error("File %1% doesn't exist but should!: %2%", filespec, ex.what());
+    if (!boost::filesystem::exists(filespec)) {
+        log_error("File %1% doesn't exist but should!", filespec);
         file.status = reqfile_t::localError;
         return file;
     }
-
-    file.data->reserve(size);
-    file.data->resize(size);
-    int fd = open(filespec.c_str(), O_RDONLY);
-    char *buf = new char[size];
-    //memset(buf, 0, size);
-    read(fd, buf, size);
-    // FIXME: it would be nice to avoid this copy
-    std::copy(buf, buf + size, file.data->begin());
-    delete buf;
-    close(fd);
+    auto mapping = std::make_shared<mirror::MappedFile>(filespec);
+    if (!mapping->isValid() || mapping->size() == 0) {
+        file.status = reqfile_t::localError;
+        return file;
+    }
+    file.mapped.file = mapping;
+    file.mapped.size = mapping->size();
     file.status = reqfile_t::success;
     return file;
 }
 
-void Planet::writeFile(RemoteURL &remote, std::shared_ptr<std::vector<unsigned char>> data) {
+std::shared_ptr<mirror::Mirror>
+Planet::getMirror(const RemoteURL &remote)
+{
+    // Files are named like 000/001/633.osc.gz, and each kind of
+    // file for each frequency gets it's own mirror.
+    auto name = remote.filespec.substr(remote.filespec.rfind('/') + 1);
+    return getMirror(remote, name.substr(name.find('.') + 1));
+}
+
+std::shared_ptr<mirror::Mirror>
+Planet::getMirror(const RemoteURL &remote, const std::string &kind)
+{
+    std::string directory = remote.destdir_base + remote.datadir + "/" +
+        StateFile::freq_to_string(remote.frequency);
+    return mirror::Mirror::open(directory, kind);
+}
+
+bool
+Planet::writeFile(RemoteURL &remote, std::shared_ptr<std::vector<unsigned char>> data) {
+    if (use_mirror) {
+        return getMirror(remote)->write(remote.sequence(), data->data(), data->size());
+    }
     std::string local_file_path = remote.destdir_base + remote.destdir;
     try {
         if (!boost::filesystem::exists(local_file_path)) {
@@ -449,6 +515,7 @@ void Planet::writeFile(RemoteURL &remote, std::shared_ptr<std::vector<unsigned c
     myfile.flush();
     myfile.close();
     log_debug("Wrote downloaded file %1% to disk from %2%", remote.destdir_base + remote.filespec, remote.domain);
+    return true;
 }
 
 Planet::~Planet(void)
@@ -62,6 +62,7 @@ namespace ssl = boost::asio::ssl; // from <boost/asio/ssl.hpp>
 using boost::format;
 
 #include "osm/changeset.hh"
+#include "replicator/mirror.hh"
 
 namespace net = boost::asio;      // from <boost/asio.hpp>
 namespace ssl = boost::asio::ssl; // from <boost/asio/ssl.hpp>
@@ -249,9 +250,27 @@ typedef enum {
 
 /// \class RequestedFile
 /// \brief Represents a requested file that could be downloaded or read from cache
+///
+/// Downloaded files are stored in data, while files read from the disk
+/// cache or the mirror are a view of a memory mapping, so use bytes()
+/// and size() to access the contents.
 struct RequestedFile {
     std::shared_ptr<std::vector<unsigned char>> data;
+    mirror::MappedView mapped; ///< Set when the file is memory mapped
     reqfile_t status = reqfile_t::none;
+
+    const unsigned char *bytes(void) const {
+        if (mapped.file) {
+            return mapped.data();
+        }
+        return data ? data->data() : nullptr;
+    };
+    std::size_t size(void) const {
+        if (mapped.file) {
+            return mapped.size;
+        }
+        return data ? data->size() : 0;
+    };
 };
 
 /// \class Planet
@@ -261,7 +280,7 @@ class Planet {
     Planet(void);
     // Planet(const std::string &planet) { pserver = planet; };
     Planet(const RemoteURL &url);
-    ~Planet(void);
+    virtual ~Planet(void);
 
     /// Connect to a planet server
     bool connectServer(const RemoteURL & remote) { return connectServer(remote.domain); }
@@ -278,13 +297,19 @@ class Planet {
     }
 
     /// Process the downloaded file, which require decompressing it
-    std::istringstream processData(const std::string &dest, std::vector<unsigned char> &data);
+    std::istringstream processData(const std::string &dest, std::vector<unsigned char> &data) {
+        return processData(dest, data.data(), data.size());
+    };
+    std::istringstream processData(const std::string &dest, const RequestedFile &file) {
+        return processData(dest, file.bytes(), file.size());
+    };
+    std::istringstream processData(const std::string &dest, const unsigned char *data, std::size_t size);
 
     /// \brief downloadFile downloads a file from planet
     /// \param file the full URL or the path part of the URL (such as:
     /// "/replication/changesets/000/001/633.osm.gz"), the host part is taken from remote.domain.
     /// \return RequestedFile object, which includes data and status
-    RequestedFile downloadFile(const std::string &file, const std::string &destdir_base);
+    virtual RequestedFile downloadFile(const std::string &file, const std::string &destdir_base);
     RequestedFile downloadFile(const RemoteURL &remote) {
         std::string str = "https://" + remote.domain + "/" + remote.filespec;
         return downloadFile(str, remote.destdir_base);
@@ -292,14 +317,21 @@ class Planet {
 
     /// \brief readFile read a file from disk cache
     /// \param filespec the full path (such as: "/replication/changesets/000/001/633.osm.gz")
-    /// \return RequestedFile object, which includes data and status
+    /// \return RequestedFile object, which includes the mapped file and status
     RequestedFile readFile(std::string &filespec);
 
-    /// \brief writeFile save a remote file to disk cache
+    /// \brief writeFile save a remote file to disk cache, or to the
+    /// mirror when mirror mode is enabled
     /// \param remote RemoteURL object, which has destination directory and filename
     /// \param data File data
-    /// \return void
-    void writeFile(RemoteURL &remote, std::shared_ptr<std::vector<unsigned char>> data);
+    /// \return false if the file was rejected by the mirror
+    bool writeFile(RemoteURL &remote, std::shared_ptr<std::vector<unsigned char>> data);
+
+    /// \brief getMirror returns the mirror holding files like \a remote
+    std::shared_ptr<mirror::Mirror> getMirror(const RemoteURL &remote);
+    /// \brief getMirror returns the mirror holding another \a kind of
+    /// file derived from files like \a remote
+    std::shared_ptr<mirror::Mirror> getMirror(const RemoteURL &remote, const std::string &kind);
 
     /// Dump internal data to the terminal, used only for debugging
     void dump(void);
@@ -315,6 +347,7 @@ class Planet {
     int port = 443;   ///< Network port on the server, note SSL only allowed
     int version = 11; ///< HTTP version
     std::string domain; ///< The domain used for this network connection
+    bool use_mirror = false; ///< Keep downloads in an indexed local mirror
 
     // These are for the boost::asio data stream
     boost::asio::io_context ioc;
@@ -26,6 +26,8 @@
 #include <fstream>
 #include <iostream>
 #include <iterator>
+#include <array>
+#include <map>
 #include <mutex>
 #include <range/v3/all.hpp>
 #include <string>
@@ -73,13 +75,21 @@ using tcp = net::ip::tcp;         // from <boost/asio/ip/tcp.hpp>
 
 #include "osm/osmobjects.hh"
 #include "replicator/threads.hh"
+#include "replicator/events.hh"
 #include "utils/log.hh"
+#include "utils/metrics.hh"
 #include "osm/changeset.hh"
 #include "osm/osmchange.hh"
+#include "osm/binarychange.hh"
+#include "osm/changebatch.hh"
+#include "stats/hashtags.hh"
 #include "stats/querystats.hh"
+#include "stats/statsaggregator.hh"
 #include "validate/queryvalidate.hh"
 #include "validate/validate.hh"
+#include "validate/validatecache.hh"
 #include "replicator/replication.hh"
+#include "replicator/replay.hh"
 #include "raw/queryraw.hh"
 #include <jemalloc/jemalloc.h>
 #include "data/pq.hh"
@@ -126,6 +136,101 @@ getClosest(std::shared_ptr<std::vector<ReplicationTask>> tasks, ptime now) {
     return std::make_shared<ReplicationTask>(closest);
 }
 
+const std::vector<std::string> stages = {
+    "download", "inflate", "parse", "geometries", "filter", "stats", "raw", "validate", "write"
+};
+
+metrics::Histogram &
+stageHistogram(const std::string &stage)
+{
+    // Looked up once, as the registry takes a lock
+    static const auto histograms = [] {
+        std::map<std::string, metrics::Histogram *> histograms;
+        for (const auto &name: stages) {
+            histograms[name] = &metrics::Registry::getDefaultInstance().histogram("underpass_stage_seconds",
+                "Time spent in each stage of processing an osmChange file", {{"stage", name}}, 1e-6);
+        }
+        return histograms;
+    }();
+    return *histograms.at(stage);
+}
+
+namespace {
+
+/// The source of the osmChange files, a planet server or a local tree
+std::shared_ptr<replication::Planet>
+makePlanet(const replication::RemoteURL &remote, const UnderpassConfig &config)
+{
+    if (!config.replay.empty()) {
+        return std::make_shared<replay::ReplayPlanet>(config.replay);
+    }
+    auto planet = std::make_shared<replication::Planet>(remote);
+    planet->use_mirror = config.mirror;
+    return planet;
+}
+
+/// The metrics of a replication stream, looked up once per monitor thread
+struct StreamMetrics {
+    explicit StreamMetrics(const std::string &stream)
+        : bytes(metrics::Registry::getDefaultInstance().counter("underpass_sql_bytes_total",
+              "Bytes of SQL written to the database", {{"stream", stream}})),
+          apply(metrics::Registry::getDefaultInstance().histogram("underpass_sql_apply_seconds",
+              "Time to write a batch of replication files to the database", {{"stream", stream}}, 1e-6)),
+          lag(metrics::Registry::getDefaultInstance().gauge("underpass_replication_lag_seconds",
+              "Time since the newest replicated data", {{"stream", stream}})) {}
+    metrics::Counter &bytes;
+    metrics::Histogram &apply;
+    metrics::Gauge &lag;
+};
+
+/// Write the queries of a batch of files, counting their size and time
+void
+applyQueries(std::shared_ptr<Pq> &db, const std::string &queries, StreamMetrics &stream)
+{
+    stream.bytes.add(queries.size());
+    metrics::Timer timer(stream.apply);
+    db->query(queries);
+}
+
+/// Set how far behind the newest replicated data is
+void
+setLag(const ReplicationTask &task, ptime now, StreamMetrics &stream)
+{
+    if (task.timestamp != not_a_date_time) {
+        stream.lag.set((now - task.timestamp).total_seconds());
+    }
+}
+
+/// Count the objects of each type and action in a file
+void
+countObjects(const osmchange::ChangeBatch::Columns &columns, const std::string &type)
+{
+    std::array<std::uint64_t, 4> counts = {0, 0, 0, 0};
+    for (auto action: columns.actions) {
+        counts[action]++;
+    }
+    // Looked up once for each type, as the registry takes a lock
+    static const auto counters = [] {
+        static const std::array<std::string, 4> actions = {"none", "create", "modify", "delete"};
+        std::map<std::string, std::array<metrics::Counter *, 4>> counters;
+        for (const auto &name: {"node", "way", "relation"}) {
+            for (std::size_t i = 0; i < actions.size(); i++) {
+                counters[name][i] = &metrics::Registry::getDefaultInstance().counter("underpass_objects_total",
+                    "OSM objects in the replication files", {{"type", name}, {"action", actions[i]}});
+            }
+        }
+        return counters;
+    }();
+    const auto &typeCounters = counters.at(type);
+    for (std::size_t i = 0; i < counts.size(); i++) {
+        if (counts[i]) {
+            typeCounters[i]->add(counts[i]);
+        }
+    }
+}
+
+} // anonymous namespace
+
 // Starting with this URL, download the file, incrementing
 void
 startMonitorChangesets(std::shared_ptr<replication::RemoteURL> &remote,
@@ -146,7 +251,10 @@ startMonitorChangesets(std::shared_ptr<replication::RemoteURL> &remote,
         log_debug("Connected to database: %1%", config.underpass_db_url);
     }
     auto querystats = std::make_shared<QueryStats>(db);
+    // Every file is filtered with the same boundary
+    const geoutil::PreparedArea area(poly);
 
+    StreamMetrics streamMetrics("changeset");
     int cores = config.concurrency;
 
     // Support multiple OSM planet servers
@@ -161,6 +269,7 @@ startMonitorChangesets(std::shared_ptr<replication::RemoteURL> &remote,
     while (i <= cores/4) {
         std::rotate(servers.begin(), servers.begin()+1, servers.end());
         auto replicationPlanet = std::make_shared<replication::Planet>(*remote);
+        replicationPlanet->use_mirror = config.mirror;
         planets.push_back(replicationPlanet);
         i++;
     }
@@ -190,7 +299,7 @@ startMonitorChangesets(std::shared_ptr<replication::RemoteURL> &remote,
             auto task = boost::bind(threadChangeSet,
                 new_remote,
                 std::ref(planets.front()),
-                std::ref(poly),
+                std::cref(area),
                 std::ref(tasks),
                 std::ref(querystats)
             );
@@ -200,10 +309,11 @@ startMonitorChangesets(std::shared_ptr<replication::RemoteURL> &remote,
             remote->updateDomain(planets.front()->domain);
         }
         pool.join();
-        db->query(allTasksQueries(tasks));
+        applyQueries(db, allTasksQueries(tasks), streamMetrics);
 
         ptime now  = boost::posix_time::second_clock::universal_time();
         last_task = getClosest(tasks, now);
+        setLag(*last_task, now, streamMetrics);
         if (last_task->timestamp != not_a_date_time) {
             closest.url = std::string(last_task->url);
             closest.timestamp = ptime(last_task->timestamp);
@@ -266,8 +376,11 @@ startMonitorChanges(std::shared_ptr<replication::RemoteURL> &remote,
 #ifdef MEMORY_DEBUG
     size_t sz, active1, active2;
 #endif    // JEMALLOC memory debugging
+    // Without a connection the queries are generated, then discarded
     auto db = std::make_shared<Pq>();
-    if (!db->connect(config.underpass_db_url)) {
+    if (config.discard) {
+        log_info("Discarding the SQL, nothing is written to the database");
+    } else if (!db->connect(config.underpass_db_url)) {
         log_error("Could not connect to Underpass DB, aborting monitoring thread!");
         return;
     } else {
@@ -276,7 +389,19 @@ startMonitorChanges(std::shared_ptr<replication::RemoteURL> &remote,
     auto querystats = std::make_shared<QueryStats>(db);
     auto queryvalidate = std::make_shared<QueryValidate>(db);
     auto queryraw = std::make_shared<QueryRaw>(db);
+    // The references are read once, then kept up to date from the files
+    if (config.refindex && !config.disable_raw && db->isOpen()) {
+        queryraw->nodeWays = std::make_shared<RefIndex>();
+        queryraw->nodeWays->load(*db, "way_refs", "node_id", "way_id");
+        queryraw->wayRelations = std::make_shared<RefIndex>();
+        queryraw->wayRelations->load(*db, "rel_refs", "way_id", "rel_id");
+    }
+    if (config.waycache && !config.disable_raw) {
+        queryraw->wayCache = std::make_shared<WayCache>(config.waycache << 20);
+    }
+    auto validatecache = std::make_shared<validatecache::ValidateCache>();
 
+    StreamMetrics streamMetrics("osmchange");
     int cores = config.concurrency;
 
     // Support multiple OSM planet servers
@@ -290,8 +415,7 @@ startMonitorChanges(std::shared_ptr<replication::RemoteURL> &remote,
     int i = 0;
     while (i <= cores/4) {
         std::rotate(servers.begin(), servers.begin()+1, servers.end());
-        auto replicationPlanet = std::make_shared<replication::Planet>(*remote);
-        planets.push_back(replicationPlanet);
+        planets.push_back(makePlanet(*remote, config));
         i++;
     }
 
@@ -304,6 +428,12 @@ startMonitorChanges(std::shared_ptr<replication::RemoteURL> &remote,
     bool monitoring = true;
     auto underpassConfig = std::make_shared<UnderpassConfig>(config);
     int concurrentTasks = cores*2;
+    statsaggregator::StatsAggregator aggregator;
+    // Shared with the metrics endpoint, which serves the recent events
+    auto &publisher = events::Publisher::getDefaultInstance();
+    if (!config.events.empty() && !publisher.open(config.events)) {
+        return;
+    }
 
     while (monitoring) {
         auto tasks = std::make_shared<std::vector<ReplicationTask>>(concurrentTasks);
@@ -330,7 +460,8 @@ startMonitorChanges(std::shared_ptr<replication::RemoteURL> &remote,
                 std::ref(queryvalidate),
                 std::ref(queryraw),
                 underpassConfig,
-                concurrentTasks - i
+                concurrentTasks - i,
+                validatecache
             };
 
             auto task = boost::bind(threadOsmChange, osmChangeTask);
@@ -339,10 +470,38 @@ startMonitorChanges(std::shared_ptr<replication::RemoteURL> &remote,
             boost::asio::post(pool, task);
         } while (--i);
         pool.join();
-        db->query(allTasksQueries(tasks));
+
+        // Changesets spanning several files are written once they close
+        for (auto it = tasks->begin(); it != tasks->end(); ++it) {
+            if (it->stats) {
+                aggregator.merge(*it->stats, it->sequence, it->timestamp);
+            }
+        }
+        // The tile servers are told which tiles changed when the
+        // batch is committed
+        tiles::TileSet dirty;
+        for (auto it = tasks->begin(); it != tasks->end(); ++it) {
+            dirty.add(it->dirty);
+        }
+        dirty.coarsen(tiles::TileSet::maxNotify);
+        {
+            metrics::Timer timer(stageHistogram("write"));
+            applyQueries(db, allTasksQueries(tasks) + querystats->applyChanges(aggregator.flush())
+                         + (dirty.empty() ? "" : dirty.notify()), streamMetrics);
+        }
+        // The files are in order, and the publisher never waits
+        for (auto it = tasks->begin(); it != tasks->end(); ++it) {
+            publisher.publish(std::move(it->events));
+            validatecache->update(it->validated);
+            if (queryraw->wayCache) {
+                queryraw->wayCache->update(it->ways);
+            }
+            queryraw->updateRefs(it->refs);
+        }
 
         ptime now  = boost::posix_time::second_clock::universal_time();
         last_task = getClosest(tasks, now);
+        setLag(*last_task, now, streamMetrics);
         if (last_task->timestamp != not_a_date_time) {
             closest.url = std::string(last_task->url);
             closest.timestamp = ptime(last_task->timestamp);
@@ -350,6 +509,13 @@ startMonitorChanges(std::shared_ptr<replication::RemoteURL> &remote,
                 monitoring = false;
             }
         }
+        // A replay ends with the first batch past the end of the tree
+        if (!config.replay.empty()) {
+            monitoring = std::any_of(tasks->begin(), tasks->end(), [](const ReplicationTask &task) {
+                return task.status == reqfile_t::success;
+            });
+            continue;
+        }
         // Check if caught up with now
         if (!caughtUpWithNow) {
             boost::posix_time::time_duration delta_closest = now - closest.timestamp;
@@ -369,13 +535,19 @@ startMonitorChanges(std::shared_ptr<replication::RemoteURL> &remote,
             }
         }
     }
+
+    auto stats = querystats->applyChanges(aggregator.flushAll());
+    if (!stats.empty()) {
+        db->query(stats);
+    }
+    publisher.close();
 }
 
 // This parses the changeset file into changesets
 void
 threadChangeSet(std::shared_ptr<replication::RemoteURL> &remote,
         std::shared_ptr<replication::Planet> &planet,
-        const multipolygon_t &poly,
+        const geoutil::PreparedArea &area,
         std::shared_ptr<std::vector<ReplicationTask>> tasks,
         std::shared_ptr<QueryStats> &querystats)
 {
@@ -390,19 +562,26 @@ threadChangeSet(std::shared_ptr<replication::RemoteURL> &remote,
     if (file.status == reqfile_t::success) {
         auto changeset = std::make_unique<changesets::ChangeSetFile>();
         log_debug("Processing ChangeSet: %1%", remote->filespec);
-        auto xml = planet->processData(remote->filespec, *file.data);
+        auto xml = planet->processData(remote->filespec, file);
         std::istream& input(xml);
-        changeset->readXML(input);
+        {
+            static auto &parseTime = metrics::Registry::getDefaultInstance().histogram("underpass_parse_seconds",
+                "Time to parse a replication file", {{"format", "changeset"}}, 1e-6);
+            metrics::Timer timer(parseTime);
+            changeset->readXML(input);
+        }
         if (changeset->last_closed_at != not_a_date_time) {
             task.timestamp = changeset->last_closed_at;
         } else if (changeset->changes.size() && changeset->changes.back()->created_at != not_a_date_time) {
             task.timestamp = changeset->changes.back()->created_at;
         }
         log_debug("ChangeSet last_closed_at: %1%", task.timestamp);
-        changeset->areaFilter(poly);
-        for (auto cit = std::begin(changeset->changes); cit != std::end(changeset->changes); ++cit) {
-            task.query += querystats->applyChange(*cit->get());
+        changeset->areaFilter(area);
+        auto &activity = hashtags::Activity::getDefaultInstance();
+        for (const auto &change: changeset->changes) {
+            activity.add(*change);
         }
+        task.query += querystats->applyChanges(changeset->changes);
     }
     const std::lock_guard<std::mutex> lock(tasks_changeset_mutex);
     tasks->push_back(task);
@@ -423,6 +602,7 @@ threadOsmChange(OsmChangeTask osmChangeTask)
     auto queryraw = osmChangeTask.queryraw;
     auto config = osmChangeTask.config;
     auto taskIndex = osmChangeTask.taskIndex;
+    auto validatecache = osmChangeTask.validatecache;
 
     auto osmchanges = std::make_shared<osmchange::OsmChangeFile>();
 #ifdef TIMING_DEBUG
@@ -431,30 +611,65 @@ threadOsmChange(OsmChangeTask osmChangeTask)
     log_debug("Processing OsmChange: %1%", remote->filespec);
     ReplicationTask task;
     task.url = remote->subpath;
-    auto file = planet->downloadFile(*remote.get());
+    task.sequence = remote->sequence();
+
+    // A file parsed before is decoded from the binary mirror
+    // instead, which skips both inflating and parsing the XML.
+    std::shared_ptr<mirror::Mirror> encoded;
+    bool decoded = false;
+    if (planet->use_mirror) {
+        encoded = planet->getMirror(*remote.get(), "oscb");
+        mirror::MappedView view;
+        if (encoded->read(remote->sequence(), view)) {
+            decoded = osmchange::BinaryChangeFile::decode(view.data(), view.size, *osmchanges);
+            if (!decoded) {
+                osmchanges = std::make_shared<osmchange::OsmChangeFile>();
+            } else if (osmchanges->changes.size() > 0) {
+                task.timestamp = osmchanges->changes.back()->final_entry;
+            }
+        }
+    }
+    replication::RequestedFile file;
+    if (decoded) {
+        file.status = replication::success;
+    } else {
+        metrics::Timer timer(stageHistogram("download"));
+        file = planet->downloadFile(*remote.get());
+    }
     task.status = file.status;
 
     // Read OsmChange
-    if (file.status == replication::success) {
+    if (file.status == replication::success && !decoded) {
         try {
-            std::istringstream changes_xml;
+            std::string changes_xml;
             // Scope to deallocate buffers
             {
+                metrics::Timer timer(stageHistogram("inflate"));
                 boost::iostreams::filtering_streambuf<boost::iostreams::input> inbuf;
                 inbuf.push(boost::iostreams::gzip_decompressor());
-                boost::iostreams::array_source arrs{reinterpret_cast<char const *>(file.data->data()), file.data->size()};
+                boost::iostreams::array_source arrs{reinterpret_cast<char const *>(file.bytes()), file.size()};
                 inbuf.push(arrs);
                 std::istream instream(&inbuf);
-                changes_xml.str(std::string{std::istreambuf_iterator<char>(instream), {}});
+                changes_xml.assign(std::istreambuf_iterator<char>(instream), {});
             }
 
             try {
                 osmchanges->nodecache.clear();
-                osmchanges->readXML(changes_xml);
+                {
+                    static auto &parseTime = metrics::Registry::getDefaultInstance().histogram("underpass_parse_seconds",
+                        "Time to parse a replication file", {{"format", "osc"}}, 1e-6);
+                    metrics::Timer timer(parseTime);
+                    metrics::Timer stage(stageHistogram("parse"));
+                    osmchanges->readXML(changes_xml.data(), changes_xml.size());
+                }
                 if (osmchanges->changes.size() > 0) {
                     task.timestamp = osmchanges->changes.back()->final_entry;
                     log_debug("OsmChange final_entry: %1%", task.timestamp);
                 }
+                if (encoded) {
+                    auto data = osmchange::BinaryChangeFile::encode(*osmchanges);
+                    encoded->write(remote->sequence(), reinterpret_cast<const unsigned char *>(data.data()), data.size());
+                }
             } catch (std::exception &e) {
                 log_error("Couldn't parse: %1%", remote->filespec);
                 boost::filesystem::remove(remote->filespec);
@@ -472,22 +687,40 @@ threadOsmChange(OsmChangeTask osmChangeTask)
     //   or created ways and also ways affected by modified nodes
     // - Add indirectly modified ways to osmchanges
     // - Build ways geometries using nodecache
-    // - Build relation multipolyon geometries
+    // - Build relation geometries, in this thread as the files are
+    //   processed in parallel
     if (!config->disable_raw) {
-        queryraw->buildGeometries(osmchanges, poly);
+        metrics::Timer timer(stageHistogram("geometries"));
+        queryraw->buildGeometries(osmchanges, poly, &task.dirty, &task.ways, &task.refs);
     }
 
+    // All the passes below run over a columnar copy of the changes
+    osmchange::ChangeBatch batch(*osmchanges);
+    countObjects(batch.nodes, "node");
+    countObjects(batch.ways, "way");
+    countObjects(batch.relations, "relation");
+
     // Filter data by priority polygon
-    osmchanges->areaFilter(poly);
+    {
+        metrics::Timer timer(stageHistogram("filter"));
+        batch.areaFilter(poly);
+    }
+
+    // The tiles of the objects written below
+    if (!config->disable_validation || !config->disable_raw) {
+        batch.bounds(task.dirty);
+    }
+    bool publish = !config->events.empty() && file.status == replication::success;
+    if (publish) {
+        events::objects(task.events, batch);
+    }
 
     // Collect stats
     if (!config->disable_stats) {
-        auto stats = osmchanges->collectStats(poly);
-        for (auto it = std::begin(*stats); it != std::end(*stats); ++it) {
-            if (it->second->added.size() == 0 && it->second->modified.size() == 0) {
-                continue;
-            }
-            task.query += querystats->applyChange(*it->second);
+        metrics::Timer timer(stageHistogram("stats"));
+        task.stats = batch.collectStats(poly);
+        if (publish && task.stats) {
+            events::changesets(task.events, *task.stats);
         }
     }
 
@@ -498,90 +731,97 @@ threadOsmChange(OsmChangeTask osmChangeTask)
 
     // Raw data and validation
     if (!config->disable_validation || !config->disable_raw) {
-        for (auto it = std::begin(osmchanges->changes); it != std::end(osmchanges->changes); ++it) {
-            osmchange::OsmChange *change = it->get();
+        metrics::Timer timer(stageHistogram("raw"));
+        for (std::size_t k = 0; k + 1 < batch.nodes.changes.size(); k++) {
 
             // Nodes
-            for (auto nit = std::begin(change->nodes); nit != std::end(change->nodes); ++nit) {
-                osmobjects::OsmNode *node = nit->get();
-
-                if (!node->priority) {
+            for (auto i = batch.nodes.changes[k]; i < batch.nodes.changes[k + 1]; i++) {
+                if (!batch.nodes.priority[i]) {
                     continue;
                 }
 
                 // Remove deleted nodes from validation table
-                if (!config->disable_validation && node->action == osmobjects::remove) {
-                    removed_nodes->push_back(node->id);
+                if (!config->disable_validation && batch.nodes.actions[i] == osmobjects::remove) {
+                    removed_nodes->push_back(batch.nodes.ids[i]);
                 }
 
                 //  Update nodes, ignore new ones outside priority area
                 if (!config->disable_raw) {
-                    task.query += queryraw->applyChange(*node);
+                    task.query += queryraw->applyChange(*batch.nodes.objects[i]);
                 }
             }
 
             // Ways
-            for (auto wit = std::begin(change->ways); wit != std::end(change->ways); ++wit) {
-                osmobjects::OsmWay *way = wit->get();
-
-                if (way->action != osmobjects::remove && !way->priority) {
+            for (auto i = batch.ways.changes[k]; i < batch.ways.changes[k + 1]; i++) {
+                if (batch.ways.actions[i] != osmobjects::remove && !batch.ways.priority[i]) {
                     continue;
                 }
 
                 // Remove deleted ways from validation table
-                if (!config->disable_validation && way->action == osmobjects::remove) {
-                    removed_ways->push_back(way->id);
+                if (!config->disable_validation && batch.ways.actions[i] == osmobjects::remove) {
+                    removed_ways->push_back(batch.ways.ids[i]);
                 }
 
                 //  Update ways, ignore new ones outside priority area
                 if (!config->disable_raw) {
-                    task.query += queryraw->applyChange(*way);
+                    task.query += queryraw->applyChange(*batch.ways.objects[i]);
                 }
             }
 
-            // // Relations
-            // for (auto rit = std::begin(change->relations); rit != std::end(change->relations); ++rit) {
-            //     osmobjects::OsmRelation *relation = rit->get();
-
-            //     if (relation->action != osmobjects::remove && !relation->priority) {
-            //         continue;
-            //     }
-            //     // Remove deleted relations from validation table
-            //     if (!config->disable_validation && relation->action == osmobjects::remove) {
-            //         removed_relations->push_back(relation->id);
-            //     }
+            // Relations
+            for (auto i = batch.relations.changes[k]; i < batch.relations.changes[k + 1]; i++) {
+                if (batch.relations.actions[i] != osmobjects::remove && !batch.relations.priority[i]) {
+                    continue;
+                }
 
-            //     //  Update relations, ignore new ones outside priority area
-            //     if (!config->disable_raw) {
-            //         task.query += queryraw->applyChange(*relation);
-            //     }
-            // }
+                //  Update relations, ignore new ones outside priority area
+                if (!config->disable_raw) {
+                    task.query += queryraw->applyChange(*batch.relations.objects[i]);
+                }
+            }
 
         }
     }
 
     // // Update validation table
     if (!config->disable_validation) {
+        metrics::Timer timer(stageHistogram("validate"));
+
+        // The results for all objects are written with one upsert
+        ValidationBatch validation(queryvalidate->dbconn);
 
         // Validate ways
-        auto wayval = osmchanges->validateWays(poly, plugin);
-        queryvalidate->ways(wayval, task.query, validation_removals);
+        auto wayval = batch.validateWays(poly, plugin, validatecache, &task.validated);
+        queryvalidate->ways(wayval, validation, validation_removals);
 
         // Validate nodes
-        auto nodeval = osmchanges->validateNodes(poly, plugin);
-        queryvalidate->nodes(nodeval, task.query, validation_removals);
+        auto nodeval = batch.validateNodes(poly, plugin, validatecache, &task.validated);
+        queryvalidate->nodes(nodeval, validation, validation_removals);
+        task.query += validation.query();
+        if (publish) {
+            events::validation(task.events, *wayval);
+            events::validation(task.events, *nodeval);
+        }
 
         // Validate relations
         // task.query += queryvalidate->rels(wayval, task.query, validation_removals);
 
-        // Remove validation entries for removed objects
+        // Remove validation entries for removed objects. A backfill
+        // does this once all the ranges are done, using the removal
+        // versions, as the objects may come back in a later range.
         task.query += queryvalidate->updateValidation(validation_removals);
-        task.query += queryvalidate->updateValidation(removed_nodes);
-        task.query += queryvalidate->updateValidation(removed_ways);
+        if (!config->backfill) {
+            task.query += queryvalidate->updateValidation(removed_nodes);
+            task.query += queryvalidate->updateValidation(removed_ways);
+        }
         // task.query += queryvalidate->updateValidation(removed_relations);
 
     }
 
+    if (publish) {
+        events::commit(task.events, task.url, task.timestamp);
+    }
+
     const std::lock_guard<std::mutex> lock(tasks_change_mutex);
     (*tasks)[taskIndex] = task;
 
@@ -70,9 +70,14 @@ using tcp = net::ip::tcp;
 #include "replicator/replication.hh"
 #include "underpassconfig.hh"
 #include "stats/querystats.hh"
+#include "stats/statsaggregator.hh"
 #include "validate/queryvalidate.hh"
 #include "raw/queryraw.hh"
 #include "validate/validate.hh"
+#include "validate/validatecache.hh"
+#include "utils/metrics.hh"
+#include "utils/preparedarea.hh"
+#include "utils/tiles.hh"
 #include <ogr_geometry.h>
 
 using namespace queryvalidate;
@@ -94,9 +99,27 @@ namespace replicatorthreads {
 /// \brief Represents a replication task
 struct ReplicationTask {
     std::string url;
+    long sequence = 0;           ///< The sequence number of the file
     ptime timestamp = not_a_date_time;
     replication::reqfile_t status = replication::reqfile_t::none;
     std::string query = "";
+    /// The changeset statistics, which are summed over several files
+    /// before they're written
+    std::shared_ptr<statsaggregator::statsmap_t> stats;
+    /// The tiles of the objects written, sent to tile servers once
+    /// the batch is committed
+    tiles::TileSet dirty;
+    /// The events of the file, published once the batch is committed
+    std::string events;
+    /// The objects validated, added to the validation cache once the
+    /// batch is committed
+    std::vector<validatecache::ValidateCache::Validated> validated;
+    /// The ways written, added to the way cache once the batch is
+    /// committed
+    std::vector<osmobjects::OsmWay> ways;
+    /// The references of the ways and relations written, added to the
+    /// reference indexes once the batch is committed
+    queryraw::RefUpdates refs;
 };
 
 /// This monitors the planet server for new changesets files.
@@ -113,7 +136,7 @@ startMonitorChangesets(std::shared_ptr<replication::RemoteURL> &remote,
 void
 threadChangeSet(std::shared_ptr<replication::RemoteURL> &remote,
     std::shared_ptr<replication::Planet> &planet,
-    const multipolygon_t &poly,
+    const geoutil::PreparedArea &area,
     std::shared_ptr<std::vector<ReplicationTask>> tasks,
     std::shared_ptr<QueryStats> &querystats
 );
@@ -138,11 +161,20 @@ struct OsmChangeTask {
         std::shared_ptr<QueryRaw> queryraw;
         std::shared_ptr<UnderpassConfig> config;
         const int taskIndex;
+        /// Skips validating unchanged objects, if set. A backfill doesn't
+        /// use it, as it's often run to validate again.
+        std::shared_ptr<validatecache::ValidateCache> validatecache;
 };
 
 /// Updates the tables from a changeset file
 void threadOsmChange(OsmChangeTask osmChangeTask);
 
+/// The stages of processing an osmChange file, in order
+extern const std::vector<std::string> stages;
+
+/// The time spent in a \a stage of processing the osmChange files
+metrics::Histogram &stageHistogram(const std::string &stage);
+
 static std::mutex tasks_change_mutex;
 static std::mutex tasks_changeset_mutex;
 
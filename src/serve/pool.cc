@@ -0,0 +1,105 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include "serve/pool.hh"
+#include "data/pq.hh"
+#include "utils/log.hh"
+
+using namespace logger;
+
+/// \namespace serve
+namespace serve {
+
+bool
+Pool::connect(const std::string &_dburl, std::size_t size, setup_t _setup)
+{
+    dburl = _dburl;
+    setup = _setup;
+    for (std::size_t i = 0; i < size; i++) {
+        auto connection = open();
+        if (!connection) {
+            return false;
+        }
+        const std::lock_guard<std::mutex> lock(mutex);
+        idle.push_back(connection);
+        connections++;
+    }
+    return true;
+}
+
+std::shared_ptr<pqxx::connection>
+Pool::open(void)
+{
+    // Pq parses the same database URLs as the replicator
+    pq::Pq db;
+    if (!db.connect(dburl)) {
+        return nullptr;
+    }
+    try {
+        if (setup) {
+            setup(*db.sdb);
+        }
+    } catch (const std::exception &e) {
+        log_error("Couldn't prepare the statements: %1%", e.what());
+        return nullptr;
+    }
+    return db.sdb;
+}
+
+Pool::Lease
+Pool::acquire(void)
+{
+    std::shared_ptr<pqxx::connection> connection;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        available.wait(lock, [this] { return !idle.empty(); });
+        connection = idle.back();
+        idle.pop_back();
+    }
+    if (!connection->is_open()) {
+        log_error("Reconnecting to the database");
+        auto reopened = open();
+        if (reopened) {
+            connection = reopened;
+        }
+    }
+    return Lease(*this, connection);
+}
+
+void
+Pool::release(std::shared_ptr<pqxx::connection> connection)
+{
+    {
+        const std::lock_guard<std::mutex> lock(mutex);
+        idle.push_back(std::move(connection));
+    }
+    available.notify_one();
+}
+
+} // namespace serve
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,104 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __POOL_HH__
+#define __POOL_HH__
+
+/// \file pool.hh
+/// \brief A pool of database connections shared by the request threads
+///
+/// Each connection has the statements prepared once when it's opened,
+/// so a request only sends the parameters.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <pqxx/pqxx>
+
+/// \namespace serve
+namespace serve {
+
+/// \class Pool
+/// \brief A fixed number of connections, lent to one request at a time
+class Pool {
+  public:
+    /// Called on each new connection, to prepare the statements
+    typedef std::function<void(pqxx::connection &)> setup_t;
+
+    /// \class Lease
+    /// \brief A connection, which goes back to the pool when destroyed
+    class Lease {
+      public:
+        Lease(Pool &pool, std::shared_ptr<pqxx::connection> connection)
+            : pool(pool), connection(std::move(connection)) {};
+        Lease(const Lease &) = delete;
+        Lease(Lease &&lease) : pool(lease.pool), connection(std::move(lease.connection)) {};
+        ~Lease(void) {
+            if (connection) {
+                pool.release(std::move(connection));
+            }
+        };
+        pqxx::connection &operator*(void) { return *connection; };
+        pqxx::connection *operator->(void) { return connection.get(); };
+
+      private:
+        Pool &pool;
+        std::shared_ptr<pqxx::connection> connection;
+    };
+
+    /// Open \a size connections to \a dburl, which is in the same
+    /// form as for the replicator
+    bool connect(const std::string &dburl, std::size_t size, setup_t setup);
+
+    /// Wait for an idle connection. A connection that was closed is
+    /// opened again first.
+    Lease acquire(void);
+
+    /// The number of connections
+    std::size_t size(void) const { return connections; };
+
+  private:
+    /// Open one connection and prepare its statements
+    std::shared_ptr<pqxx::connection> open(void);
+    void release(std::shared_ptr<pqxx::connection> connection);
+
+    std::mutex mutex;
+    std::condition_variable available;
+    std::vector<std::shared_ptr<pqxx::connection>> idle; ///< The connections not lent
+    std::string dburl;
+    setup_t setup;
+    std::size_t connections = 0;
+};
+
+} // namespace serve
+
+#endif // EOF __POOL_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
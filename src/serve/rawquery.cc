@@ -0,0 +1,476 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <map>
+#include <set>
+#include <sstream>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/format.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include "serve/rawquery.hh"
+#include "utils/log.hh"
+
+using namespace logger;
+
+/// \namespace serve
+namespace serve {
+
+namespace {
+
+/// The statuses in the validation table
+const std::set<std::string> validStatuses = {
+    "notags", "complete", "incomplete", "badvalue", "correct",
+    "badgeom", "orphan", "overlapping", "duplicate"
+};
+
+/// The type shown in the properties, like the Python API
+std::string
+geoType(const std::string &table)
+{
+    if (table == "ways_poly") {
+        return "Polygon";
+    } else if (table == "ways_line") {
+        return "LineString";
+    }
+    return "Node";
+}
+
+/// The joins and filters shared by all the queries. The parameters
+/// are $1 area, $2 keys, $3 values, $4 hashtag, $5 dateFrom,
+/// $6 dateTo and $7 status, and are ignored when they're null.
+std::string
+filters(const std::string &table)
+{
+    boost::format fmt(
+        " FROM %s AS t"
+        " LEFT JOIN changesets AS c ON c.id = t.changeset"
+        " LEFT JOIN LATERAL (SELECT status FROM validation"
+        "   WHERE validation.osm_id = t.osm_id AND ($7::text IS NULL OR validation.status = $7::status)"
+        "   LIMIT 1) AS v ON true"
+        " WHERE ($1::text IS NULL OR ST_Intersects(t.geom, ST_GeomFromText('MULTIPOLYGON(((' || $1 || ')))', 4326)))"
+        " AND (cardinality($2::text[]) = 0 OR EXISTS (SELECT 1 FROM unnest($2::text[], $3::text[]) AS f(k, v)"
+        "   WHERE (f.v = '' AND t.tags ? f.k) OR (f.v <> '' AND t.tags->>f.k ~* ('^' || f.v))))"
+        " AND ($4::text IS NULL OR $4 = ANY (c.hashtags))"
+        " AND ($5::timestamptz IS NULL OR c.created_at >= $5::timestamptz)"
+        " AND ($6::timestamptz IS NULL OR c.created_at <= $6::timestamptz)"
+        " AND ($7::text IS NULL OR v.status IS NOT NULL)");
+    fmt % table;
+    return fmt.str();
+}
+
+/// Append \a value as a JSON string
+void
+jsonString(std::string &out, const std::string &value)
+{
+    out += '"';
+    for (char c: value) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    out += (boost::format("\\u%04x") % static_cast<int>(c)).str();
+                } else {
+                    out += c;
+                }
+        }
+    }
+    out += '"';
+}
+
+/// Parse a number, returns false if it's not one
+bool
+number(const std::string &value, long &result)
+{
+    try {
+        std::size_t end;
+        result = std::stol(value, &end);
+        return end == value.size();
+    } catch (const std::exception &) {
+        return false;
+    }
+}
+
+/// The decoded parameters in the query string of \a target
+std::map<std::string, std::string>
+queryParams(const std::string &target)
+{
+    std::map<std::string, std::string> params;
+    auto query = target.find('?');
+    if (query == std::string::npos) {
+        return params;
+    }
+    std::string args = target.substr(query + 1);
+    std::vector<std::string> pairs;
+    boost::split(pairs, args, boost::is_any_of("&"));
+    for (const auto &pair: pairs) {
+        auto pos = pair.find('=');
+        if (pos != std::string::npos) {
+            params[RawQuery::urlDecode(pair.substr(0, pos))] = RawQuery::urlDecode(pair.substr(pos + 1));
+        }
+    }
+    return params;
+}
+
+/// Read z/x/y from the end of a path of \a size parts ending in
+/// .mvt. Returns false without an \a error if it's not that path.
+bool
+tileAddress(const std::string &target, std::size_t size, int &z, int &x, int &y, std::string &error)
+{
+    auto path = target.substr(0, target.find('?'));
+    std::vector<std::string> parts;
+    boost::split(parts, path, boost::is_any_of("/"));
+    if (parts.size() != size || !boost::algorithm::ends_with(parts.back(), ".mvt")) {
+        return false;
+    }
+    parts.back().resize(parts.back().size() - 4);
+    long values[3];
+    for (int i = 0; i < 3; i++) {
+        if (!number(parts[size - 3 + i], values[i])) {
+            error = "Not a tile";
+            return false;
+        }
+    }
+    if (values[0] < 0 || values[0] > 22 || values[1] < 0 || values[2] < 0 ||
+        values[1] >= (1L << values[0]) || values[2] >= (1L << values[0])) {
+        error = "Not a tile";
+        return false;
+    }
+    z = values[0];
+    x = values[1];
+    y = values[2];
+    return true;
+}
+
+} // anonymous namespace
+
+const std::vector<std::string> RawQuery::tables = {"nodes", "ways_poly", "ways_line"};
+
+std::string
+RawRequest::tableFor(const std::string &kind)
+{
+    if (kind == "polygons") {
+        return "ways_poly";
+    } else if (kind == "lines") {
+        return "ways_line";
+    } else if (kind == "nodes") {
+        return "nodes";
+    }
+    return "";
+}
+
+void
+RawRequest::setTags(const std::string &tags)
+{
+    keys.clear();
+    values.clear();
+    std::vector<std::string> items;
+    boost::split(items, tags, boost::is_any_of(","));
+    for (const auto &item: items) {
+        if (item.empty()) {
+            continue;
+        }
+        auto pos = item.find('=');
+        keys.push_back(item.substr(0, pos));
+        values.push_back(pos == std::string::npos ? "" : item.substr(pos + 1));
+    }
+}
+
+bool
+RawRequest::parse(const std::string &target, const std::string &body, std::string &error)
+{
+    auto params = queryParams(target);
+    if (!body.empty()) {
+        try {
+            std::istringstream stream(body);
+            boost::property_tree::ptree tree;
+            boost::property_tree::read_json(stream, tree);
+            for (const auto &child: tree) {
+                // Nested values, like arrays, aren't filters
+                if (child.second.empty()) {
+                    params[child.first] = child.second.data();
+                }
+            }
+        } catch (const std::exception &e) {
+            error = "The body isn't valid JSON";
+            return false;
+        }
+    }
+
+    auto path = target.substr(0, target.find('?'));
+    std::vector<std::string> parts;
+    boost::split(parts, path, boost::is_any_of("/"));
+    if (parts.size() >= 3) {
+        table = tableFor(parts[2]);
+    }
+    if (table.empty()) {
+        error = "Unknown feature type";
+        return false;
+    }
+
+    // The Python API sends null or an empty string for unused filters
+    auto get = [&params](const std::string &name) -> std::optional<std::string> {
+        auto it = params.find(name);
+        if (it == params.end() || it->second.empty() || it->second == "null") {
+            return std::nullopt;
+        }
+        return it->second;
+    };
+    area = get("area");
+    hashtag = get("hashtag");
+    dateFrom = get("dateFrom");
+    dateTo = get("dateTo");
+    status = get("status");
+    if (status && validStatuses.count(*status) == 0) {
+        error = "Unknown status " + *status;
+        return false;
+    }
+    if (auto tags = get("tags")) {
+        setTags(*tags);
+    }
+    if (auto value = get("format")) {
+        format = *value;
+        if (format != "geojson" && format != "fgb") {
+            error = "Unknown format " + format;
+            return false;
+        }
+    }
+    long value;
+    if (auto cursor = get("after")) {
+        if (!number(*cursor, value) || value < 0) {
+            error = "The cursor must be an osm_id";
+            return false;
+        }
+        after = value;
+    }
+    if (auto size = get("limit")) {
+        if (!number(*size, value) || value < 1) {
+            error = "The limit must be a positive number";
+            return false;
+        }
+        limit = std::min<long>(value, maxLimit);
+    }
+    return true;
+}
+
+std::string
+RawRequest::statement(void) const
+{
+    return "raw_" + table + "_" + format;
+}
+
+bool
+TileRequest::parse(const std::string &target, std::string &error)
+{
+    // /raw/<kind>/<z>/<x>/<y>.mvt, followed by the filters
+    if (!tileAddress(target, 6, z, x, y, error)) {
+        return false;
+    }
+    // The filters are the same as for a page of features
+    return filters.parse(target, "", error);
+}
+
+std::string
+TileRequest::statement(void) const
+{
+    return "raw_" + filters.table + "_mvt";
+}
+
+bool
+ValidationTile::parse(const std::string &target, std::string &error)
+{
+    // /validation/<z>/<x>/<y>.mvt?status=badgeom,badvalue
+    if (!tileAddress(target, 5, z, x, y, error)) {
+        return false;
+    }
+    statuses.clear();
+    std::vector<std::string> items;
+    boost::split(items, queryParams(target)["status"], boost::is_any_of(","));
+    for (const auto &item: items) {
+        if (item.empty()) {
+            continue;
+        }
+        if (validStatuses.count(item) == 0) {
+            error = "Unknown status " + item;
+            return false;
+        }
+        statuses.push_back(item);
+    }
+    return true;
+}
+
+std::string
+RawQuery::features(const std::string &table, const std::string &format)
+{
+    if (format == "fgb") {
+        // FlatGeobuf is a binary format, which PostGIS builds for the
+        // whole page at once
+        boost::format fmt("SELECT ST_AsFlatGeobuf(q, true, 'geom'), max(q.osm_id), count(*) FROM ("
+                          "SELECT t.osm_id, t.timestamp, t.tags::text AS tags, v.status::text AS status,"
+                          " c.hashtags::text AS hashtags, c.editor, c.created_at, t.geom"
+                          "%s AND t.osm_id > $8 ORDER BY t.osm_id LIMIT $9) AS q");
+        fmt % filters(table);
+        return fmt.str();
+    }
+    boost::format fmt("SELECT t.osm_id, ST_AsGeoJSON(t.geom),"
+                      " jsonb_build_object('type', '%s', 'id', t.osm_id, 'timestamp', t.timestamp, 'tags', t.tags,"
+                      " 'status', v.status, 'hashtags', c.hashtags, 'editor', c.editor, 'created_at', c.created_at)::text"
+                      "%s AND t.osm_id > $8 ORDER BY t.osm_id LIMIT $9");
+    fmt % geoType(table) % filters(table);
+    return fmt.str();
+}
+
+std::string
+RawQuery::tile(const std::string &table)
+{
+    boost::format fmt("SELECT ST_AsMVT(q, '%s', 4096, 'geom') FROM ("
+                      "SELECT t.osm_id, t.tags::text AS tags, v.status::text AS status,"
+                      " ST_AsMVTGeom(ST_Transform(t.geom, 3857), ST_TileEnvelope($8, $9, $10), 4096, 64, true) AS geom"
+                      "%s AND t.geom && ST_Transform(ST_TileEnvelope($8, $9, $10), 4326)) AS q");
+    fmt % table % filters(table);
+    return fmt.str();
+}
+
+std::string
+RawQuery::validationTile(void)
+{
+    // One feature for each status of a building
+    return "SELECT ST_AsMVT(q, 'validation', 4096, 'geom') FROM ("
+        "SELECT v.osm_id, v.status::text AS status, array_to_string(v.values, ',') AS values,"
+        " v.timestamp, ST_AsMVTGeom(ST_Transform(t.geom, 3857), ST_TileEnvelope($1, $2, $3), 4096, 64, true) AS geom"
+        " FROM ways_poly AS t JOIN validation AS v ON v.osm_id = t.osm_id"
+        " WHERE t.geom && ST_Transform(ST_TileEnvelope($1, $2, $3), 4326)"
+        " AND (cardinality($4::text[]) = 0 OR v.status::text = ANY ($4::text[]))) AS q";
+}
+
+void
+RawQuery::prepare(pqxx::connection &connection)
+{
+    connection.prepare("validation_mvt", validationTile());
+    for (const auto &table: tables) {
+        connection.prepare("raw_" + table + "_geojson", features(table, "geojson"));
+        connection.prepare("raw_" + table + "_fgb", features(table, "fgb"));
+        connection.prepare("raw_" + table + "_mvt", tile(table));
+    }
+}
+
+pqxx::result
+RawQuery::run(pqxx::transaction_base &txn, const RawRequest &request)
+{
+    return txn.exec_prepared(request.statement(), request.area, arrayLiteral(request.keys),
+                             arrayLiteral(request.values), request.hashtag, request.dateFrom,
+                             request.dateTo, request.status, request.after, request.limit);
+}
+
+pqxx::result
+RawQuery::run(pqxx::transaction_base &txn, const TileRequest &request)
+{
+    const auto &filters = request.filters;
+    return txn.exec_prepared(request.statement(), filters.area, arrayLiteral(filters.keys),
+                             arrayLiteral(filters.values), filters.hashtag, filters.dateFrom,
+                             filters.dateTo, filters.status, request.z, request.x, request.y);
+}
+
+pqxx::result
+RawQuery::run(pqxx::transaction_base &txn, const ValidationTile &request)
+{
+    return txn.exec_prepared("validation_mvt", request.z, request.x, request.y,
+                             arrayLiteral(request.statuses));
+}
+
+void
+RawQuery::feature(std::string &out, const pqxx::row &row)
+{
+    out += "{\"type\":\"Feature\",\"id\":";
+    out += row[0].c_str();
+    out += ",\"geometry\":";
+    out += row[1].is_null() ? "null" : row[1].c_str();
+    out += ",\"properties\":";
+    out += row[2].c_str();
+    out += "}";
+}
+
+std::string
+RawQuery::header(long next)
+{
+    std::string out = "{\"type\":\"FeatureCollection\",\"next\":";
+    out += next ? std::to_string(next) : "null";
+    out += ",\"features\":[";
+    return out;
+}
+
+std::string
+RawQuery::quote(const std::string &value)
+{
+    std::string out;
+    jsonString(out, value);
+    return out;
+}
+
+std::string
+RawQuery::arrayLiteral(const std::vector<std::string> &values)
+{
+    std::string out = "{";
+    for (const auto &value: values) {
+        if (out.size() > 1) {
+            out += ',';
+        }
+        jsonString(out, value);
+    }
+    out += '}';
+    return out;
+}
+
+std::string
+RawQuery::urlDecode(const std::string &value)
+{
+    std::string out;
+    for (std::size_t i = 0; i < value.size(); i++) {
+        if (value[i] == '+') {
+            out += ' ';
+        } else if (value[i] == '%' && i + 2 < value.size() &&
+                   std::isxdigit(value[i + 1]) && std::isxdigit(value[i + 2])) {
+            out += static_cast<char>(std::stoi(value.substr(i + 1, 2), nullptr, 16));
+            i += 2;
+        } else {
+            out += value[i];
+        }
+    }
+    return out;
+}
+
+} // namespace serve
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,160 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __RAWQUERY_HH__
+#define __RAWQUERY_HH__
+
+/// \file rawquery.hh
+/// \brief Prepared queries for the raw tables, as served by the REST API
+///
+/// These are the queries of python/dbapi/api/raw.py, with the filters
+/// passed as parameters and the pages following the osm_id of the
+/// last object instead of an offset. The rows are returned one by one
+/// and assembled into a FeatureCollection while they're sent.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <optional>
+#include <string>
+#include <vector>
+#include <pqxx/pqxx>
+
+/// \namespace serve
+namespace serve {
+
+/// \struct RawRequest
+/// \brief The filters and page of a request for raw features
+struct RawRequest {
+    static const int defaultLimit = 500;   ///< Objects in a page if not given
+    static const int maxLimit = 10000;     ///< The largest page
+
+    std::string table;                     ///< nodes, ways_poly or ways_line
+    std::string format = "geojson";        ///< geojson or fgb
+    std::optional<std::string> area;       ///< Coordinates of a polygon, "lon lat,lon lat,..."
+    std::vector<std::string> keys;         ///< Tag keys, any of them matches
+    std::vector<std::string> values;       ///< Value prefixes, empty for any value
+    std::optional<std::string> hashtag;    ///< A hashtag of the changeset
+    std::optional<std::string> dateFrom;   ///< Changesets created since
+    std::optional<std::string> dateTo;     ///< Changesets created until
+    std::optional<std::string> status;     ///< A validation status
+    long after = 0;                        ///< The last osm_id of the previous page
+    int limit = defaultLimit;              ///< Objects in a page
+
+    /// The table for a path like /raw/polygons, or an empty string
+    static std::string tableFor(const std::string &kind);
+
+    /// Read the filters from the query string of \a target, or from
+    /// the JSON \a body of a POST. Returns false with the reason in
+    /// \a error if one of them is invalid.
+    bool parse(const std::string &target, const std::string &body, std::string &error);
+
+    /// Set the tag filters from "key=value,key,..."
+    void setTags(const std::string &tags);
+
+    /// The name of the prepared statement for this table and format
+    std::string statement(void) const;
+};
+
+/// \struct TileRequest
+/// \brief A vector tile of raw features, like /raw/polygons/14/8192/5461.mvt
+struct TileRequest {
+    RawRequest filters;                    ///< The same filters as for features
+    int z = 0;
+    int x = 0;
+    int y = 0;
+
+    /// Parse the path, returns false if it's not a tile
+    bool parse(const std::string &target, std::string &error);
+
+    /// The name of the prepared statement for the table
+    std::string statement(void) const;
+};
+
+/// \struct ValidationTile
+/// \brief A vector tile of the buildings with a validation status,
+/// like /validation/14/8192/5461.mvt?status=badgeom,badvalue
+struct ValidationTile {
+    std::vector<std::string> statuses;     ///< Any of these, or all if empty
+    int z = 0;
+    int x = 0;
+    int y = 0;
+
+    /// Parse the path, returns false if it's not a tile
+    bool parse(const std::string &target, std::string &error);
+};
+
+/// \class RawQuery
+/// \brief The SQL of the prepared statements and how rows are sent
+class RawQuery {
+  public:
+    /// The tables served
+    static const std::vector<std::string> tables;
+
+    /// Prepare the statements for all the tables on a connection
+    static void prepare(pqxx::connection &connection);
+
+    /// The SQL for a page of \a table in \a format
+    static std::string features(const std::string &table, const std::string &format);
+
+    /// The SQL for a vector tile of \a table
+    static std::string tile(const std::string &table);
+
+    /// The SQL for a vector tile of the validation results
+    static std::string validationTile(void);
+
+    /// Run the query for a page
+    static pqxx::result run(pqxx::transaction_base &txn, const RawRequest &request);
+
+    /// Run the query for a tile
+    static pqxx::result run(pqxx::transaction_base &txn, const TileRequest &request);
+
+    /// Run the query for a tile of validation results
+    static pqxx::result run(pqxx::transaction_base &txn, const ValidationTile &request);
+
+    /// Append the feature for a row, which has the osm_id, the
+    /// geometry and the properties as JSON
+    static void feature(std::string &out, const pqxx::row &row);
+
+    /// The beginning of a FeatureCollection. \a next is the cursor of
+    /// the next page, or 0 when this is the last one.
+    static std::string header(long next);
+    /// The end of a FeatureCollection
+    static std::string footer(void) { return "]}\n"; };
+
+    /// Quote a string for JSON
+    static std::string quote(const std::string &value);
+
+    /// Quote strings as a PostgreSQL array literal
+    static std::string arrayLiteral(const std::vector<std::string> &values);
+
+    /// Decode %XX and + in a query string
+    static std::string urlDecode(const std::string &value);
+};
+
+} // namespace serve
+
+#endif // EOF __RAWQUERY_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,420 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <optional>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+
+#include "serve/server.hh"
+#include "serve/rawquery.hh"
+#include "utils/log.hh"
+#include "utils/metrics.hh"
+
+using namespace logger;
+
+namespace beast = boost::beast;   // from <boost/beast.hpp>
+namespace http = beast::http;     // from <boost/beast/http.hpp>
+namespace net = boost::asio;      // from <boost/asio.hpp>
+using tcp = net::ip::tcp;         // from <boost/asio/ip/tcp.hpp>
+
+/// \namespace serve
+namespace serve {
+
+struct Server::Impl {
+    net::io_context ioc;
+    tcp::acceptor acceptor{ioc};
+    std::vector<std::thread> workers;
+};
+
+namespace {
+
+/// The size of the chunks a FeatureCollection is sent in
+const std::size_t chunkSize = 64 * 1024;
+
+/// The largest body of a POST
+const std::size_t bodyLimit = 1024 * 1024;
+
+/// How long a connection may stay idle
+const std::chrono::seconds idleTimeout(30);
+
+metrics::Histogram &
+requestHistogram(const std::string &kind)
+{
+    return metrics::Registry::getDefaultInstance().histogram(
+        "underpass_serve_request_seconds", "Time to answer a request", {{"kind", kind}});
+}
+
+/// One connection, which can send several requests
+class Session : public std::enable_shared_from_this<Session> {
+  public:
+    Session(tcp::socket socket, Pool &pool, const std::string &origin, TileCache *cache)
+        : stream(std::move(socket)), pool(pool), origin(origin), cache(cache) {};
+
+    void run(void) { read(); };
+
+  private:
+    void read(void) {
+        parser.emplace();
+        parser->body_limit(bodyLimit);
+        stream.expires_after(idleTimeout);
+        auto self = shared_from_this();
+        http::async_read(stream, buffer, *parser,
+                         [self](beast::error_code ec, std::size_t) { self->respond(ec); });
+    };
+
+    void respond(beast::error_code ec) {
+        if (ec) {
+            close();
+            return;
+        }
+        request = parser->release();
+        keepAlive = request.keep_alive();
+        stream.expires_never();
+        std::string target(request.target());
+        std::string path = target.substr(0, target.find('?'));
+
+        if (request.method() == http::verb::options) {
+            auto response = make<http::empty_body>(http::status::no_content);
+            response->set(http::field::access_control_allow_methods, "GET, POST, OPTIONS");
+            response->set(http::field::access_control_allow_headers, "Content-Type");
+            send(response);
+            return;
+        }
+        if (request.method() != http::verb::get && request.method() != http::verb::post) {
+            error(http::status::method_not_allowed, "Only GET and POST are supported");
+            return;
+        }
+        if (path == "/") {
+            text(http::status::ok, "{\"message\":\"Underpass API\"}\n", "application/json");
+            return;
+        }
+        std::string reason;
+        if (boost::algorithm::starts_with(path, "/validation/")) {
+            ValidationTile tile;
+            if (!tile.parse(target, reason)) {
+                error(reason.empty() ? http::status::not_found : http::status::bad_request,
+                      reason.empty() ? "Not found" : reason);
+                return;
+            }
+            sendTile(target, tile.z, tile.x, tile.y, [&tile](pqxx::transaction_base &txn) {
+                return RawQuery::run(txn, tile);
+            });
+            return;
+        }
+        if (!boost::algorithm::starts_with(path, "/raw/")) {
+            error(http::status::not_found, "Not found");
+            return;
+        }
+        if (boost::algorithm::ends_with(path, ".mvt")) {
+            TileRequest tile;
+            if (!tile.parse(target, reason)) {
+                error(reason.empty() ? http::status::not_found : http::status::bad_request,
+                      reason.empty() ? "Not found" : reason);
+                return;
+            }
+            sendTile(target, tile.z, tile.x, tile.y, [&tile](pqxx::transaction_base &txn) {
+                return RawQuery::run(txn, tile);
+            });
+            return;
+        }
+
+        RawRequest raw;
+        if (!raw.parse(target, request.body(), reason)) {
+            error(http::status::bad_request, reason);
+            return;
+        }
+        metrics::Timer timer(requestHistogram(raw.format));
+        auto result = query([&raw](pqxx::transaction_base &txn) { return RawQuery::run(txn, raw); });
+        if (!result) {
+            return;
+        }
+        if (raw.format == "fgb") {
+            // One row with the FlatGeobuf, the last osm_id and the
+            // number of objects in the page
+            auto row = (*result)[0];
+            std::string bytes;
+            if (!row[0].is_null()) {
+                auto data = row[0].as<std::basic_string<std::byte>>();
+                bytes.assign(reinterpret_cast<const char *>(data.data()), data.size());
+            }
+            std::optional<long> next;
+            if (row[2].as<long>() == raw.limit) {
+                next = row[1].as<long>();
+            }
+            binary(bytes, "application/octet-stream", next);
+            return;
+        }
+        rows = std::move(*result);
+        position = 0;
+        long next = 0;
+        if (rows.size() == raw.limit) {
+            next = rows[rows.size() - 1][0].as<long>();
+        }
+        streamFeatures(next);
+    };
+
+    /// Send a tile from the cache, or from the query \a run
+    template <typename Run>
+    void sendTile(const std::string &key, int z, long x, long y, Run run) {
+        metrics::Timer timer(requestHistogram("mvt"));
+        std::string tile;
+        if (cache && cache->get(key, tile)) {
+            binary(tile, "application/vnd.mapbox-vector-tile");
+            return;
+        }
+        // A change committed while querying is only known afterwards
+        std::uint64_t generation = cache ? cache->generation() : 0;
+        std::optional<pqxx::result> result = query(run);
+        if (!result) {
+            return;
+        }
+        if (!result->empty() && !(*result)[0][0].is_null()) {
+            auto bytes = (*result)[0][0].as<std::basic_string<std::byte>>();
+            tile.assign(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+        }
+        if (cache) {
+            cache->put(key, z, x, y, tile, generation);
+        }
+        binary(tile, "application/vnd.mapbox-vector-tile");
+    };
+
+    /// Run a query on a pooled connection. On an error the response
+    /// has been sent, and nothing is returned.
+    template <typename Run>
+    std::optional<pqxx::result> query(Run run) {
+        try {
+            auto connection = pool.acquire();
+            pqxx::nontransaction txn(*connection);
+            return run(txn);
+        } catch (const pqxx::broken_connection &e) {
+            log_error("Lost the database connection: %1%", e.what());
+            error(http::status::service_unavailable, "The database isn't available");
+        } catch (const pqxx::data_exception &e) {
+            // Like an invalid date, or a polygon that isn't closed
+            error(http::status::bad_request, e.what());
+        } catch (const std::exception &e) {
+            log_error("Couldn't query the raw tables: %1%", e.what());
+            error(http::status::internal_server_error, "The query failed");
+        }
+        return std::nullopt;
+    };
+
+    template <typename Body>
+    std::shared_ptr<http::response<Body>> make(http::status status) {
+        auto response = std::make_shared<http::response<Body>>(status, request.version());
+        response->set(http::field::server, "underpass-serve");
+        response->set(http::field::access_control_allow_origin, origin);
+        response->set(http::field::access_control_expose_headers, "X-Next-Cursor");
+        response->keep_alive(keepAlive);
+        return response;
+    };
+
+    template <typename Body>
+    void send(std::shared_ptr<http::response<Body>> response) {
+        response->prepare_payload();
+        auto self = shared_from_this();
+        http::async_write(stream, *response, [self, response](beast::error_code ec, std::size_t) {
+            self->done(ec);
+        });
+    };
+
+    void text(http::status status, const std::string &body, const std::string &type) {
+        auto response = make<http::string_body>(status);
+        response->set(http::field::content_type, type);
+        response->body() = body;
+        send(response);
+    };
+
+    void error(http::status status, const std::string &reason) {
+        text(status, "{\"error\":" + RawQuery::quote(reason) + "}\n", "application/json");
+    };
+
+    void binary(const std::string &bytes, const std::string &type,
+                std::optional<long> next = std::nullopt) {
+        auto response = make<http::string_body>(http::status::ok);
+        response->set(http::field::content_type, type);
+        if (next) {
+            response->set("X-Next-Cursor", std::to_string(*next));
+        }
+        response->body() = bytes;
+        send(response);
+    };
+
+    /// Send the header, then the features in chunks as they're encoded
+    void streamFeatures(long next) {
+        head.emplace(http::status::ok, request.version());
+        head->set(http::field::server, "underpass-serve");
+        head->set(http::field::content_type, "application/geo+json");
+        head->set(http::field::access_control_allow_origin, origin);
+        head->set(http::field::access_control_expose_headers, "X-Next-Cursor");
+        if (next) {
+            head->set("X-Next-Cursor", std::to_string(next));
+        }
+        head->keep_alive(keepAlive);
+        head->chunked(true);
+        serializer.emplace(*head);
+        pending = RawQuery::header(next);
+        auto self = shared_from_this();
+        http::async_write_header(stream, *serializer, [self](beast::error_code ec, std::size_t) {
+            self->chunk(ec);
+        });
+    };
+
+    void chunk(beast::error_code ec) {
+        if (ec) {
+            close();
+            return;
+        }
+        auto self = shared_from_this();
+        if (position > rows.size()) {
+            rows = pqxx::result();
+            net::async_write(stream, http::make_chunk_last(),
+                             [self](beast::error_code ec, std::size_t) { self->done(ec); });
+            return;
+        }
+        if (position > 0) {
+            pending.clear();
+        }
+        while (position < rows.size() && pending.size() < chunkSize) {
+            if (position > 0) {
+                pending += ',';
+            }
+            RawQuery::feature(pending, rows[position++]);
+        }
+        if (position == rows.size()) {
+            pending += RawQuery::footer();
+            position++;
+        }
+        net::async_write(stream, http::make_chunk(net::buffer(pending)),
+                         [self](beast::error_code ec, std::size_t) { self->chunk(ec); });
+    };
+
+    void done(beast::error_code ec) {
+        if (ec || !keepAlive) {
+            close();
+            return;
+        }
+        read();
+    };
+
+    void close(void) {
+        beast::error_code ec;
+        stream.socket().shutdown(tcp::socket::shutdown_send, ec);
+    };
+
+    beast::tcp_stream stream;
+    Pool &pool;
+    const std::string &origin;
+    TileCache *cache;
+    beast::flat_buffer buffer;
+    std::optional<http::request_parser<http::string_body>> parser;
+    http::request<http::string_body> request;
+    bool keepAlive = false;
+    pqxx::result rows;             ///< The features being sent
+    pqxx::result::size_type position = 0;
+    std::string pending;           ///< The chunk being sent
+    std::optional<http::response<http::empty_body>> head;
+    std::optional<http::response_serializer<http::empty_body>> serializer;
+};
+
+} // anonymous namespace
+
+Server::Server(Pool &pool, const std::string &origin, TileCache *cache)
+    : pool(pool), origin(origin), cache(cache)
+{
+}
+
+Server::~Server(void)
+{
+    stop();
+}
+
+bool
+Server::start(unsigned short port, const std::string &address, unsigned int threads)
+{
+    stop();
+    impl = std::make_unique<Impl>();
+    try {
+        tcp::endpoint endpoint{net::ip::make_address(address), port};
+        impl->acceptor.open(endpoint.protocol());
+        impl->acceptor.set_option(net::socket_base::reuse_address(true));
+        impl->acceptor.bind(endpoint);
+        impl->acceptor.listen();
+        listening = impl->acceptor.local_endpoint().port();
+    } catch (const boost::system::system_error &ex) {
+        log_error("Couldn't listen on %1%:%2%: %3%", address, port, ex.what());
+        impl.reset();
+        return false;
+    }
+    accept();
+    // The queries block, so each thread answers one request at a time
+    for (unsigned int i = 0; i < std::max(threads, 1U); i++) {
+        impl->workers.emplace_back([this] { impl->ioc.run(); });
+    }
+    log_info("Serving the raw tables on http://%1%:%2%/raw", address, listening);
+    return true;
+}
+
+void
+Server::stop(void)
+{
+    if (!impl) {
+        return;
+    }
+    impl->ioc.stop();
+    for (auto &worker: impl->workers) {
+        worker.join();
+    }
+    impl.reset();
+    listening = 0;
+}
+
+void
+Server::accept(void)
+{
+    impl->acceptor.async_accept(net::make_strand(impl->ioc),
+                                [this](beast::error_code ec, tcp::socket socket) {
+        if (ec == net::error::operation_aborted) {
+            return;
+        }
+        if (!ec) {
+            std::make_shared<Session>(std::move(socket), pool, origin, cache)->run();
+        }
+        accept();
+    });
+}
+
+} // namespace serve
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
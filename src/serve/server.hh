@@ -0,0 +1,82 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __SERVER_HH__
+#define __SERVER_HH__
+
+/// \file server.hh
+/// \brief The HTTP server of underpass-serve
+///
+/// This answers the same /raw requests as the Python REST API. The
+/// connections are accepted on one thread, and each request then runs
+/// on a pool of threads, which share the database connections.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <memory>
+#include <string>
+
+#include "serve/pool.hh"
+#include "serve/tilecache.hh"
+
+/// \namespace serve
+namespace serve {
+
+/// \class Server
+/// \brief Serves the raw tables as GeoJSON, FlatGeobuf and vector tiles,
+/// and the validation results as vector tiles
+class Server {
+  public:
+    /// \a origin is sent in Access-Control-Allow-Origin. Vector tiles
+    /// are kept in \a cache, if there's one.
+    Server(Pool &pool, const std::string &origin = "*", TileCache *cache = nullptr);
+    ~Server(void);
+
+    /// Start listening, with port 0 picking a free port. Requests are
+    /// handled by \a threads threads.
+    bool start(unsigned short port, const std::string &address = "127.0.0.1",
+               unsigned int threads = 4);
+    /// Stop listening, and wait for the current requests
+    void stop(void);
+    /// The port it's listening on
+    unsigned short port(void) const { return listening; };
+
+  private:
+    /// Wait for the next connection
+    void accept(void);
+
+    Pool &pool;
+    std::string origin;
+    TileCache *cache;
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+    unsigned short listening = 0;
+};
+
+} // namespace serve
+
+#endif // EOF __SERVER_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
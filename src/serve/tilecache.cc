@@ -0,0 +1,303 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <fstream>
+#include <iterator>
+
+#include <boost/filesystem.hpp>
+#include <pqxx/pqxx>
+
+#include "serve/tilecache.hh"
+#include "data/pq.hh"
+#include "utils/log.hh"
+#include "utils/metrics.hh"
+
+using namespace logger;
+
+/// \namespace serve
+namespace serve {
+
+namespace {
+
+metrics::Counter &
+lookups(const std::string &result)
+{
+    return metrics::Registry::getDefaultInstance().counter(
+        "underpass_tile_cache_lookups_total", "Lookups in the tile cache", {{"result", result}});
+}
+
+} // anonymous namespace
+
+TileCache::TileCache(std::size_t _memory, const std::string &_directory, std::size_t _disk,
+                     std::chrono::seconds _maxAge)
+    : directory(_directory), maxAge(_maxAge)
+{
+    memory.max = _memory;
+    if (!directory.empty()) {
+        disk.max = _disk;
+        // Tiles left by a previous run may have changed since
+        boost::filesystem::create_directories(directory);
+        boost::filesystem::directory_iterator it(directory), eod;
+        for (; it != eod; ++it) {
+            if (it->path().extension() == ".mvt") {
+                boost::filesystem::remove(it->path());
+            }
+        }
+    }
+}
+
+bool
+TileCache::expired(const Entry &entry) const
+{
+    return maxAge.count() > 0 && std::chrono::steady_clock::now() - entry.created > maxAge;
+}
+
+void
+TileCache::erase(Level &level, std::list<Entry>::iterator it)
+{
+    if (!it->path.empty()) {
+        boost::system::error_code ec;
+        boost::filesystem::remove(it->path, ec);
+    }
+    level.bytes -= it->size;
+    level.index.erase(it->key);
+    level.lru.erase(it);
+}
+
+void
+TileCache::evict(void)
+{
+    while (memory.bytes > memory.max && !memory.lru.empty()) {
+        auto oldest = std::prev(memory.lru.end());
+        if (disk.max > 0 && oldest->size <= disk.max) {
+            Entry entry = *oldest;
+            entry.path = directory + "/" + std::to_string(++serial) + ".mvt";
+            std::ofstream out(entry.path, std::ios::binary);
+            out.write(entry.data.data(), entry.data.size());
+            if (out) {
+                entry.data.clear();
+                entry.data.shrink_to_fit();
+                disk.lru.push_front(std::move(entry));
+                disk.index[disk.lru.front().key] = disk.lru.begin();
+                disk.bytes += disk.lru.front().size;
+            } else {
+                log_error("Couldn't write the tile %1%", entry.path);
+            }
+        }
+        erase(memory, oldest);
+    }
+    while (disk.bytes > disk.max && !disk.lru.empty()) {
+        erase(disk, std::prev(disk.lru.end()));
+    }
+}
+
+bool
+TileCache::get(const std::string &key, std::string &tile)
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    auto found = memory.index.find(key);
+    if (found != memory.index.end()) {
+        if (expired(*found->second)) {
+            erase(memory, found->second);
+        } else {
+            memory.lru.splice(memory.lru.begin(), memory.lru, found->second);
+            tile = found->second->data;
+            lookups("hit").add();
+            return true;
+        }
+    }
+    found = disk.index.find(key);
+    if (found != disk.index.end()) {
+        auto it = found->second;
+        std::ifstream in(it->path, std::ios::binary);
+        if (!expired(*it) && in) {
+            tile.assign(std::istreambuf_iterator<char>(in), {});
+            // Used again, so it goes back to memory
+            Entry entry = *it;
+            entry.data = tile;
+            entry.path.clear();
+            erase(disk, it);
+            memory.lru.push_front(std::move(entry));
+            memory.index[key] = memory.lru.begin();
+            memory.bytes += tile.size();
+            evict();
+            lookups("hit").add();
+            return true;
+        }
+        erase(disk, it);
+    }
+    lookups("miss").add();
+    return false;
+}
+
+std::uint64_t
+TileCache::generation(void) const
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    return invalidations;
+}
+
+void
+TileCache::put(const std::string &key, int z, long x, long y, const std::string &tile, std::uint64_t since)
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    bool stale = since < horizon;
+    for (auto it = recent.rbegin(); it != recent.rend() && it->first > since && !stale; ++it) {
+        stale = it->second.covers(z, x, y);
+    }
+    if (stale) {
+        static auto &staleTiles = metrics::Registry::getDefaultInstance().counter("underpass_tile_cache_stale_total",
+            "Tiles not cached as they changed while being queried");
+        staleTiles.add();
+        return;
+    }
+    for (auto level: {&memory, &disk}) {
+        auto found = level->index.find(key);
+        if (found != level->index.end()) {
+            erase(*level, found->second);
+        }
+    }
+    memory.lru.push_front(Entry{key, z, x, y, tile, "", tile.size(), std::chrono::steady_clock::now()});
+    memory.index[key] = memory.lru.begin();
+    memory.bytes += tile.size();
+    evict();
+}
+
+std::size_t
+TileCache::invalidate(const tiles::TileSet &dirty)
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    recent.emplace_back(++invalidations, dirty);
+    if (recent.size() > maxRecent) {
+        horizon = recent.front().first;
+        recent.pop_front();
+    }
+    std::size_t count = 0;
+    for (auto level: {&memory, &disk}) {
+        for (auto it = level->lru.begin(); it != level->lru.end();) {
+            auto next = std::next(it);
+            if (dirty.covers(it->z, it->x, it->y)) {
+                erase(*level, it);
+                count++;
+            }
+            it = next;
+        }
+    }
+    static auto &invalidated = metrics::Registry::getDefaultInstance().counter("underpass_tile_cache_invalidated_total",
+        "Tiles dropped from the cache after they changed");
+    invalidated.add(count);
+    return count;
+}
+
+void
+TileCache::clear(void)
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    // Everything may have changed
+    horizon = ++invalidations;
+    recent.clear();
+    for (auto level: {&memory, &disk}) {
+        while (!level->lru.empty()) {
+            erase(*level, level->lru.begin());
+        }
+    }
+}
+
+std::size_t
+TileCache::size(void) const
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    return memory.lru.size() + disk.lru.size();
+}
+
+namespace {
+
+/// Drops the tiles sent by the replicator
+class Receiver : public pqxx::notification_receiver {
+  public:
+    Receiver(pqxx::connection &connection, TileCache &cache)
+        : pqxx::notification_receiver(connection, tiles::channel), cache(cache) {};
+
+    void operator()(const std::string &payload, int) override {
+        tiles::TileSet dirty;
+        if (!dirty.parse(payload)) {
+            log_error("Not a list of tiles: %1%", payload);
+            return;
+        }
+        auto count = cache.invalidate(dirty);
+        log_debug("Dropped %1% tiles for %2% changed tiles at zoom %3%", count, dirty.size(), dirty.zoom());
+    };
+
+  private:
+    TileCache &cache;
+};
+
+} // anonymous namespace
+
+void
+Invalidator::start(const std::string &_dburl)
+{
+    stop();
+    dburl = _dburl;
+    running = true;
+    thread = std::thread([this] { run(); });
+}
+
+void
+Invalidator::stop(void)
+{
+    running = false;
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+void
+Invalidator::run(void)
+{
+    while (running) {
+        pq::Pq db;
+        if (!db.connect(dburl)) {
+            std::this_thread::sleep_for(std::chrono::seconds(5));
+            continue;
+        }
+        // Changes may have been missed while disconnected
+        cache.clear();
+        try {
+            Receiver receiver(*db.sdb, cache);
+            while (running) {
+                db.sdb->await_notification(1, 0);
+            }
+        } catch (const std::exception &e) {
+            log_error("Lost the connection for the changed tiles: %1%", e.what());
+        }
+    }
+}
+
+} // namespace serve
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,151 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __TILECACHE_HH__
+#define __TILECACHE_HH__
+
+/// \file tilecache.hh
+/// \brief A cache of vector tiles, emptied as the replicator writes
+///
+/// Tiles are kept in memory, and optionally moved to a directory when
+/// they're evicted. After each batch the replicator sends the tiles it
+/// changed, and only those are dropped.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "utils/tiles.hh"
+
+/// \namespace serve
+namespace serve {
+
+/// \class TileCache
+/// \brief A least recently used cache of tiles, keyed by the request
+class TileCache {
+  public:
+    /// Keep \a memory bytes of tiles in memory, and \a disk bytes in
+    /// \a directory. Tiles older than \a maxAge are not used, unless
+    /// it's 0.
+    TileCache(std::size_t memory, const std::string &directory = "", std::size_t disk = 0,
+              std::chrono::seconds maxAge = std::chrono::seconds(0));
+
+    /// Look for the tile of a request, which includes z/x/y and the
+    /// query string
+    bool get(const std::string &key, std::string &tile);
+    /// The number of invalidations so far, to get before querying a
+    /// tile and give to put()
+    std::uint64_t generation(void) const;
+    /// Add the tile \a z/\a x/\a y of a request, queried after
+    /// generation() returned \a since. It's not added if an invalidation
+    /// covering it ran since, as it may have been queried before the change.
+    void put(const std::string &key, int z, long x, long y, const std::string &tile, std::uint64_t since);
+
+    /// Drop the tiles covered by \a dirty, returns how many
+    std::size_t invalidate(const tiles::TileSet &dirty);
+    /// Drop all the tiles
+    void clear(void);
+
+    /// The number of tiles in memory and on disk
+    std::size_t size(void) const;
+
+  private:
+    struct Entry {
+        std::string key;
+        int z;
+        long x;
+        long y;
+        std::string data;        ///< The tile, if it's in memory
+        std::string path;        ///< The file, if it's on disk
+        std::size_t size;
+        std::chrono::steady_clock::time_point created;
+    };
+    /// \struct Level
+    /// \brief The memory or the disk, with the most recent tile first
+    struct Level {
+        std::list<Entry> lru;
+        std::unordered_map<std::string, std::list<Entry>::iterator> index;
+        std::size_t bytes = 0;
+        std::size_t max = 0;
+    };
+
+    /// Remove an entry, and its file
+    void erase(Level &level, std::list<Entry>::iterator it);
+    /// Evict the oldest tiles in memory to disk
+    void evict(void);
+    bool expired(const Entry &entry) const;
+
+    /// The most invalidations remembered for put()
+    static const std::size_t maxRecent = 256;
+
+    mutable std::mutex mutex;
+    Level memory;
+    Level disk;
+    std::string directory;
+    std::chrono::seconds maxAge;
+    std::uint64_t serial = 0;    ///< Names the files
+    std::uint64_t invalidations = 0;    ///< The current generation
+    /// The latest invalidations, oldest first, with their generation
+    std::deque<std::pair<std::uint64_t, tiles::TileSet>> recent;
+    /// Tiles queried before this generation are never added, as the
+    /// invalidations since aren't all remembered
+    std::uint64_t horizon = 0;
+};
+
+/// \class Invalidator
+/// \brief Listens for the tiles changed by the replicator
+class Invalidator {
+  public:
+    Invalidator(TileCache &cache) : cache(cache) {};
+    ~Invalidator(void) { stop(); };
+
+    /// Start listening on the database at \a dburl
+    void start(const std::string &dburl);
+    /// Stop listening
+    void stop(void);
+
+  private:
+    /// Listen until stopped, connecting again when the connection is lost
+    void run(void);
+
+    TileCache &cache;
+    std::string dburl;
+    std::atomic<bool> running = false;
+    std::thread thread;
+};
+
+} // namespace serve
+
+#endif // EOF __TILECACHE_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
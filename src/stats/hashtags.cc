@@ -0,0 +1,495 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <mutex>
+
+#include <boost/format.hpp>
+
+#include "osm/changeset.hh"
+#include "osm/xmlscan.hh"
+#include "stats/hashtags.hh"
+
+using namespace boost::posix_time;
+
+/// \namespace hashtags
+namespace hashtags {
+
+namespace {
+
+/// The ASCII characters that end a hashtag
+constexpr std::array<bool, 128>
+asciiDelimiters(void)
+{
+    std::array<bool, 128> table{};
+    for (int c = 0; c <= 0x20; c++) {
+        table[c] = true;
+    }
+    table[0x7f] = true;
+    for (const char *c = "'!\"#$%()*,./:;<=>?@[]^`{|}~"; *c; c++) {
+        table[static_cast<unsigned char>(*c)] = true;
+    }
+    return table;
+}
+
+constexpr std::array<bool, 128> delimiters = asciiDelimiters();
+
+/// Decode the code point at \a p, and move past it. An invalid
+/// sequence is one byte, and returns -1.
+long
+decode(const char *&p, const char *end)
+{
+    auto byte = static_cast<unsigned char>(*p++);
+    if (byte < 0x80) {
+        return byte;
+    }
+    int length = 0;
+    long cp = 0;
+    if ((byte & 0xe0) == 0xc0) {
+        length = 1;
+        cp = byte & 0x1f;
+    } else if ((byte & 0xf0) == 0xe0) {
+        length = 2;
+        cp = byte & 0x0f;
+    } else if ((byte & 0xf8) == 0xf0) {
+        length = 3;
+        cp = byte & 0x07;
+    } else {
+        return -1;
+    }
+    if (end - p < length) {
+        return -1;
+    }
+    for (int i = 0; i < length; i++) {
+        auto next = static_cast<unsigned char>(p[i]);
+        if ((next & 0xc0) != 0x80) {
+            return -1;
+        }
+        cp = (cp << 6) | (next & 0x3f);
+    }
+    p += length;
+    return cp;
+}
+
+/// Does the code point end a hashtag. Besides ASCII, this is the
+/// whitespace and the general and supplemental punctuation blocks.
+bool
+isDelimiter(long cp)
+{
+    if (cp < 0) {
+        return true;
+    } else if (cp < 0x80) {
+        return delimiters[cp];
+    }
+    return cp == 0xa0 || cp == 0x1680 || (cp >= 0x2000 && cp <= 0x206f)
+        || (cp >= 0x2e00 && cp <= 0x2e7f) || cp == 0x3000 || cp == 0xfeff;
+}
+
+/// Is the code point whitespace around an item of a list
+bool
+isSpace(long cp)
+{
+    return cp == ' ' || (cp >= 0x09 && cp <= 0x0d) || cp == 0xa0 || cp == 0x1680
+        || (cp >= 0x2000 && cp <= 0x200b) || cp == 0x3000 || cp == 0xfeff;
+}
+
+/// The simple case folding of a code point
+long
+foldCase(long cp)
+{
+    if (cp >= 'A' && cp <= 'Z') {
+        return cp + 0x20;
+    } else if (cp < 0xc0) {
+        return cp;
+    } else if (cp <= 0xde) {
+        return cp == 0xd7 ? cp : cp + 0x20;
+    } else if (cp >= 0x100 && cp <= 0x17e) {
+        // Latin Extended-A alternates upper and lower case
+        if (cp == 0x130) {
+            return 'i';
+        } else if (cp == 0x178) {
+            return 0xff;
+        } else if (cp < 0x138 || (cp >= 0x14a && cp < 0x178)) {
+            return cp % 2 ? cp : cp + 1;
+        } else if ((cp >= 0x139 && cp <= 0x148) || cp >= 0x179) {
+            return cp % 2 ? cp + 1 : cp;
+        }
+    } else if (cp >= 0x386 && cp <= 0x38f) {
+        // The Greek capitals with tonos
+        switch (cp) {
+          case 0x386: return 0x3ac;
+          case 0x388: case 0x389: case 0x38a: return cp + 0x25;
+          case 0x38c: return 0x3cc;
+          case 0x38e: case 0x38f: return cp + 0x3f;
+          default: return cp;
+        }
+    } else if (cp >= 0x391 && cp <= 0x3ab && cp != 0x3a2) {
+        return cp + 0x20;
+    } else if (cp == 0x3c2) {
+        return 0x3c3;
+    } else if (cp >= 0x410 && cp <= 0x42f) {
+        return cp + 0x20;
+    } else if (cp >= 0x400 && cp <= 0x40f) {
+        return cp + 0x50;
+    }
+    return cp;
+}
+
+/// Append \a value as a JSON string
+void
+quote(std::string &out, const std::string &value)
+{
+    out += '"';
+    for (char c: value) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out += (boost::format("\\u%04x") % static_cast<int>(c)).str();
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+} // anonymous namespace
+
+void
+scanComment(std::string_view text, std::vector<std::string> &tags)
+{
+    const char *p = text.data();
+    const char *end = p + text.size();
+    while (p < end) {
+        // A # can't be part of a multibyte character
+        const char *hash = static_cast<const char *>(std::memchr(p, '#', end - p));
+        if (hash == nullptr) {
+            break;
+        }
+        const char *start = hash + 1;
+        const char *stop = start;
+        std::size_t length = 0;
+        while (stop < end) {
+            const char *next = stop;
+            if (isDelimiter(decode(next, end))) {
+                break;
+            }
+            stop = next;
+            length++;
+        }
+        if (length >= 3) {
+            tags.emplace_back(start, stop - start);
+        }
+        p = stop;
+    }
+}
+
+void
+scanList(std::string_view text, std::vector<std::string> &tags)
+{
+    const char *p = text.data();
+    const char *end = p + text.size();
+    while (p < end) {
+        // Skip the separators and the whitespace before the item
+        while (p < end) {
+            const char *next = p;
+            long cp = decode(next, end);
+            if (cp != ';' && cp != '#' && !isSpace(cp)) {
+                break;
+            }
+            p = next;
+        }
+        const char *start = p;
+        // The item ends at the next separator, without its trailing
+        // whitespace
+        const char *stop = p;
+        while (p < end && *p != ';' && *p != '#') {
+            long cp = decode(p, end);
+            if (!isSpace(cp)) {
+                stop = p;
+            }
+        }
+        if (stop > start) {
+            tags.emplace_back(start, stop - start);
+        }
+    }
+}
+
+std::string
+fold(std::string_view tag)
+{
+    std::string folded;
+    folded.reserve(tag.size());
+    const char *p = tag.data();
+    const char *end = p + tag.size();
+    while (p < end) {
+        const char *start = p;
+        long cp = decode(p, end);
+        if (cp < 0) {
+            folded.append(start, p - start);
+        } else if (cp < 0x80) {
+            folded.push_back(static_cast<char>(foldCase(cp)));
+        } else {
+            xmlscan::appendUTF8(folded, foldCase(cp));
+        }
+    }
+    return folded;
+}
+
+Activity::Activity(time_duration bucket, std::size_t count, std::size_t limit)
+    : seconds(std::max<long>(1, bucket.total_seconds())), window(std::max<std::size_t>(1, count)),
+      limit(std::min<std::size_t>(std::max<std::size_t>(1, limit), none))
+{
+}
+
+Activity &
+Activity::getDefaultInstance(void)
+{
+    static Activity activity;
+    return activity;
+}
+
+long
+Activity::slot(ptime when) const
+{
+    static const ptime epoch(boost::gregorian::date(1970, 1, 1));
+    return (when - epoch).total_seconds() / seconds;
+}
+
+Activity::id_t
+Activity::intern(std::string_view hashtag)
+{
+    std::string folded = fold(hashtag.substr(std::min(hashtag.find_first_not_of('#'), hashtag.size())));
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        auto found = ids.find(folded);
+        if (found != ids.end()) {
+            return found->second;
+        }
+    }
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto found = ids.find(folded);
+    if (found != ids.end()) {
+        return found->second;
+    }
+    if (names.size() >= limit && unused.empty() && reclaimed < latest) {
+        reclaim();
+    }
+    id_t id;
+    if (!unused.empty()) {
+        id = unused.back();
+        unused.pop_back();
+        names[id] = folded;
+        buckets[id].assign(window, Bucket());
+    } else if (names.size() < limit) {
+        id = static_cast<id_t>(names.size());
+        names.push_back(folded);
+        buckets.emplace_back(window);
+    } else {
+        return none;
+    }
+    ids.emplace(std::move(folded), id);
+    return id;
+}
+
+void
+Activity::reclaim(void)
+{
+    for (id_t id = 0; id < names.size(); id++) {
+        if (!names[id].empty() && sum(id, latest).changesets == 0) {
+            ids.erase(names[id]);
+            names[id].clear();
+            unused.push_back(id);
+        }
+    }
+    reclaimed = latest;
+}
+
+bool
+Activity::find(std::string_view hashtag, id_t &id) const
+{
+    std::string folded = fold(hashtag.substr(std::min(hashtag.find_first_not_of('#'), hashtag.size())));
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto found = ids.find(folded);
+    if (found == ids.end()) {
+        return false;
+    }
+    id = found->second;
+    return true;
+}
+
+std::string
+Activity::name(id_t id) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return id < names.size() ? names[id] : std::string();
+}
+
+std::size_t
+Activity::size(void) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ids.size();
+}
+
+void
+Activity::add(id_t id, ptime when, std::uint64_t changes)
+{
+    if (when.is_special()) {
+        return;
+    }
+    long now = slot(when);
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    if (id >= buckets.size() || now < 0 || now <= latest - static_cast<long>(window)) {
+        return;
+    }
+    auto &bucket = buckets[id][now % window];
+    if (bucket.slot > now) {
+        return;
+    } else if (bucket.slot < now) {
+        bucket = Bucket();
+        bucket.slot = now;
+    }
+    bucket.changesets++;
+    bucket.changes += changes;
+    latest = std::max(latest, now);
+}
+
+void
+Activity::add(const changesets::ChangeSet &change)
+{
+    if (change.open || change.closed_at.is_special() || change.hashtags.empty()) {
+        return;
+    }
+    // The files overlap, so a changeset can be in several of them
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        if (pruned < latest) {
+            for (auto it = changesets.begin(); it != changesets.end();) {
+                if (it->second <= latest - static_cast<long>(window)) {
+                    it = changesets.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            pruned = latest;
+        }
+        if (!changesets.emplace(change.id, slot(change.closed_at)).second) {
+            return;
+        }
+    }
+    // Spellings only differing by case are counted once
+    std::vector<id_t> used;
+    for (const auto &hashtag: change.hashtags) {
+        auto id = intern(hashtag);
+        if (id != none) {
+            used.push_back(id);
+        }
+    }
+    std::sort(used.begin(), used.end());
+    used.erase(std::unique(used.begin(), used.end()), used.end());
+    for (auto id: used) {
+        add(id, change.closed_at, std::max(change.num_changes, 0));
+    }
+}
+
+Count
+Activity::sum(id_t id, long now) const
+{
+    Count count;
+    count.hashtag = names[id];
+    for (const auto &bucket: buckets[id]) {
+        if (bucket.slot <= now && bucket.slot > now - static_cast<long>(window)) {
+            count.changesets += bucket.changesets;
+            count.changes += bucket.changes;
+        }
+    }
+    return count;
+}
+
+Count
+Activity::count(id_t id, ptime now) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    if (id >= names.size()) {
+        return Count();
+    }
+    return sum(id, now.is_special() ? latest : slot(now));
+}
+
+std::vector<Count>
+Activity::top(std::size_t limit, ptime now) const
+{
+    std::vector<Count> counts;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        long last = now.is_special() ? latest : slot(now);
+        for (id_t id = 0; id < names.size(); id++) {
+            if (names[id].empty()) {
+                continue;
+            }
+            auto count = sum(id, last);
+            if (count.changesets > 0) {
+                counts.push_back(std::move(count));
+            }
+        }
+    }
+    auto order = [](const Count &a, const Count &b) {
+        if (a.changesets != b.changesets) {
+            return a.changesets > b.changesets;
+        } else if (a.changes != b.changes) {
+            return a.changes > b.changes;
+        }
+        return a.hashtag < b.hashtag;
+    };
+    limit = std::min(limit, counts.size());
+    std::partial_sort(counts.begin(), counts.begin() + limit, counts.end(), order);
+    counts.resize(limit);
+    return counts;
+}
+
+std::string
+Activity::json(std::size_t limit) const
+{
+    std::string out = "[";
+    for (const auto &count: top(limit)) {
+        if (out.size() > 1) {
+            out += ',';
+        }
+        out += "{\"hashtag\":";
+        quote(out, count.hashtag);
+        out += (boost::format(",\"changesets\":%d,\"changes\":%d}") % count.changesets % count.changes).str();
+    }
+    out += "]";
+    return out;
+}
+
+} // namespace hashtags
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,155 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __HASHTAGS_HH__
+#define __HASHTAGS_HH__
+
+/// \file hashtags.hh
+/// \brief Find the hashtags of changesets, and count their recent use
+///
+/// Hashtags come from the hashtags tag of a changeset, or from its
+/// comment for older editors. The scanners read the UTF-8 text once,
+/// with a table of the ASCII delimiters. The hashtags used are kept
+/// by ID, with counts over a rolling window, so the most active ones
+/// are known without querying the changesets table.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "boost/date_time/posix_time/posix_time.hpp"
+
+// Forward declaration
+namespace changesets {
+class ChangeSet;
+};
+
+/// \namespace hashtags
+namespace hashtags {
+
+/// Append the hashtags in free text, like a changeset comment. A
+/// hashtag starts with # and ends at whitespace or punctuation other
+/// than - _ + and &, like in iD. Ones shorter than 3 characters are
+/// usually typos, and are skipped.
+void scanComment(std::string_view text, std::vector<std::string> &tags);
+
+/// Append the hashtags of a list separated by ; like the hashtags tag.
+/// The # of each one is optional.
+void scanList(std::string_view text, std::vector<std::string> &tags);
+
+/// Fold the case of a hashtag, so the spellings of one only differing
+/// by case are the same. This covers Latin, Greek and Cyrillic.
+std::string fold(std::string_view tag);
+
+/// The use of a hashtag over the window
+struct Count {
+    std::string hashtag;         ///< The folded hashtag
+    std::uint64_t changesets = 0; ///< The changesets closed with it
+    std::uint64_t changes = 0;   ///< The changes in those changesets
+};
+
+/// \class Activity
+/// \brief Hashtags by ID, and how much they were used lately
+///
+/// The counts are kept in buckets of time for each hashtag, in a ring
+/// covering the window. Time is the closing time of the changesets, so
+/// catching up counts like following the minutely files does. It can
+/// be shared by threads. Once there are too many hashtags, the IDs of
+/// the ones not used in the window are given to new ones.
+class Activity {
+  public:
+    typedef std::uint32_t id_t;
+    /// The ID of a hashtag that couldn't be added, which isn't counted
+    static constexpr id_t none = UINT32_MAX;
+
+    /// Count over \a buckets of \a bucket each, for up to \a limit
+    /// hashtags
+    Activity(boost::posix_time::time_duration bucket = boost::posix_time::hours(1), std::size_t buckets = 24,
+             std::size_t limit = 100000);
+
+    /// The instance the replicator records to
+    static Activity &getDefaultInstance(void);
+
+    /// The ID of a hashtag, with or without its #, adding it if it's
+    /// new. Hashtags are folded first. It's none when there are \a limit
+    /// hashtags used in the window already.
+    id_t intern(std::string_view hashtag);
+    /// Find the ID of a hashtag without adding it
+    bool find(std::string_view hashtag, id_t &id) const;
+    /// The folded hashtag of an ID
+    std::string name(id_t id) const;
+    /// The number of hashtags kept
+    std::size_t size(void) const;
+
+    /// Count a changeset with \a changes using a hashtag at \a when
+    void add(id_t id, boost::posix_time::ptime when, std::uint64_t changes = 0);
+    /// Count the hashtags of a closed changeset. Open ones are counted
+    /// once they're closed, and each one only once in the window.
+    void add(const changesets::ChangeSet &change);
+
+    /// The use of a hashtag over the window ending at \a now, which by
+    /// default is the latest time counted
+    Count count(id_t id, boost::posix_time::ptime now = boost::posix_time::not_a_date_time) const;
+    /// The \a limit hashtags used by the most changesets
+    std::vector<Count> top(std::size_t limit, boost::posix_time::ptime now = boost::posix_time::not_a_date_time) const;
+    /// The top hashtags as a JSON array
+    std::string json(std::size_t limit) const;
+
+  private:
+    struct Bucket {
+        long slot = -1;          ///< The bucket of time counted in it
+        std::uint64_t changesets = 0;
+        std::uint64_t changes = 0;
+    };
+    long slot(boost::posix_time::ptime when) const;
+    Count sum(id_t id, long now) const;
+    /// Free the IDs of the hashtags not used in the window
+    void reclaim(void);
+
+    const long seconds;          ///< The length of a bucket
+    const std::size_t window;    ///< The buckets kept for each hashtag
+    const std::size_t limit;     ///< The most hashtags kept
+    mutable std::shared_mutex mutex;
+    std::unordered_map<std::string, id_t> ids;
+    std::vector<std::string> names;           ///< By ID, empty if free
+    std::vector<std::vector<Bucket>> buckets; ///< By ID, a ring of window buckets
+    std::vector<id_t> unused;    ///< The free IDs
+    long latest = -1;            ///< The latest bucket counted in
+    long reclaimed = -1;         ///< The latest bucket when IDs were freed
+    /// The bucket of the changesets counted in the window, by ID
+    std::unordered_map<long, long> changesets;
+    long pruned = -1;            ///< The latest bucket when they were pruned
+};
+
+} // namespace hashtags
+
+#endif // EOF __HASHTAGS_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
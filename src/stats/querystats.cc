@@ -59,6 +59,90 @@ using namespace logger;
 /// \namespace querystats
 namespace querystats {
 
+namespace {
+
+/// The bounding box of a changeset as EWKT. Very short lines or POIs
+/// are expanded so they have a bounding box big enough for Postgis to use.
+std::string
+bboxEWKT(const changesets::ChangeSet &change)
+{
+    // Store the current values as they can get changed
+    double min_lat = change.min_lat;
+    double max_lat = change.max_lat;
+    double min_lon = change.min_lon;
+    double max_lon = change.max_lon;
+
+    const double fudge{0.0001};
+
+    // A changeset with a single node in it doesn't draw a line
+    if (change.max_lon < 0 && change.min_lat < 0) {
+        min_lat = change.min_lat + (fudge / 2);
+        max_lat = change.max_lat + (fudge / 2);
+        min_lon = change.min_lon - (fudge / 2);
+        max_lon = change.max_lon - (fudge / 2);
+    }
+
+    // Not a line
+    if (max_lon == min_lon || max_lat == min_lat) {
+        min_lat = change.min_lat + (fudge / 2);
+        max_lat = change.max_lat + (fudge / 2);
+        min_lon = change.min_lon - (fudge / 2);
+        max_lon = change.max_lon - (fudge / 2);
+    }
+
+    // Single point
+    if (max_lon < 0 && min_lat < 0) {
+        min_lat = change.min_lat + (fudge / 2);
+        max_lat = change.max_lat + (fudge / 2);
+        min_lon = change.min_lon - (fudge / 2);
+        max_lon = change.max_lon - (fudge / 2);
+    }
+
+    std::string ewkt = "SRID=4326;POLYGON((";
+    // Upper left
+    ewkt += std::to_string(max_lon) + "  ";
+    ewkt += std::to_string(max_lat) + ",";
+    // Upper right
+    ewkt += std::to_string(min_lon) + "  ";
+    ewkt += std::to_string(max_lat) + ",";
+    // Lower right
+    ewkt += std::to_string(min_lon) + "  ";
+    ewkt += std::to_string(min_lat) + ",";
+    // Lower left
+    ewkt += std::to_string(max_lon) + "  ";
+    ewkt += std::to_string(min_lat) + ",";
+    // Close the polygon
+    ewkt += std::to_string(max_lon) + "  ";
+    ewkt += std::to_string(max_lat) + "))";
+
+    return ewkt;
+}
+
+/// Append an element to the contents of an ARRAY[] constructor
+void
+addElement(std::string &array, const std::string &element)
+{
+    if (!array.empty()) {
+        array += ",";
+    }
+    array += element;
+}
+
+/// An expression for the counts in the hstore \a column of a changeset
+/// plus the ones of its files not added before
+std::string
+addFiles(const std::string &column)
+{
+    boost::format fmt("(SELECT hstore(array_agg(key), array_agg(total::text)) FROM"
+                      " (SELECT key, sum(value::numeric) AS total FROM"
+                      " (SELECT * FROM each(changesets.%1%) UNION ALL SELECT e.* FROM fresh AS f, each(f.%1%) AS e"
+                      " WHERE f.changeset = changesets.id) AS counts GROUP BY key) AS totals)");
+    fmt % column;
+    return fmt.str();
+}
+
+} // anonymous namespace
+
 QueryStats::QueryStats(void) {}
 
 QueryStats::QueryStats(std::shared_ptr<Pq> db) {
@@ -198,57 +282,9 @@ QueryStats::applyChange(const changesets::ChangeSet &change) const
         query += ",\'" + change.source += "\'";
     }
 
-    // Store the current values as they can get changed to expand very short
-    // lines or POIs so they have a bounding box big enough for Postgis to use.
-    double min_lat = change.min_lat;
-    double max_lat = change.max_lat;
-    double min_lon = change.min_lon;
-    double max_lon = change.max_lon;
-
-    const double fudge{0.0001};
-
-    // A changeset with a single node in it doesn't draw a line
-    if (change.max_lon < 0 && change.min_lat < 0) {
-        min_lat = change.min_lat + (fudge / 2);
-        max_lat = change.max_lat + (fudge / 2);
-        min_lon = change.min_lon - (fudge / 2);
-        max_lon = change.max_lon - (fudge / 2);
-    }
-
-    // Not a line
-    if (max_lon == min_lon || max_lat == min_lat) {
-        min_lat = change.min_lat + (fudge / 2);
-        max_lat = change.max_lat + (fudge / 2);
-        min_lon = change.min_lon - (fudge / 2);
-        max_lon = change.max_lon - (fudge / 2);
-    }
-
-    // Single point
-    if (max_lon < 0 && min_lat < 0) {
-        min_lat = change.min_lat + (fudge / 2);
-        max_lat = change.max_lat + (fudge / 2);
-        min_lon = change.min_lon - (fudge / 2);
-        max_lon = change.max_lon - (fudge / 2);
-    }
-
     // Changeset bounding box
-    std::string bbox;
-    bbox += ", ST_MULTI(ST_GeomFromEWKT(\'SRID=4326;POLYGON((";
-    // Upper left
-    bbox += std::to_string(max_lon) + "  ";
-    bbox += std::to_string(max_lat) + ",";
-    // Upper right
-    bbox += std::to_string(min_lon) + "  ";
-    bbox += std::to_string(max_lat) + ",";
-    // Lower right
-    bbox += std::to_string(min_lon) + "  ";
-    bbox += std::to_string(min_lat) + ",";
-    // Lower left
-    bbox += std::to_string(max_lon) + "  ";
-    bbox += std::to_string(min_lat) + ",";
-    // Close the polygon
-    bbox += std::to_string(max_lon) + "  ";
-    bbox += std::to_string(max_lat) + ")";
+    std::string bbox = ", ST_MULTI(ST_GeomFromEWKT(\'" + bboxEWKT(change);
+    bbox.erase(bbox.size() - 1);
     query += bbox;
 
     query += ")\')";
@@ -276,6 +312,167 @@ QueryStats::applyChange(const changesets::ChangeSet &change) const
 
 }
 
+std::string
+QueryStats::applyChanges(const statsaggregator::flushed_t &stats) const
+{
+#ifdef TIMING_DEBUG_X
+    boost::timer::auto_cpu_timer timer("applyChanges(statistics): took %w seconds\n");
+#endif
+    // One array per column, which unnest() turns back into rows
+    std::string ids, uids, closed;
+    std::string changesets, files, added, modified;
+    for (const auto &[id, parts]: stats) {
+        ptime closed_at = not_a_date_time;
+        long uid = 0;
+        std::vector<std::array<std::string, 3>> rows;
+        for (const auto &[file, change]: parts) {
+            if (change->closed_at != not_a_date_time &&
+                (closed_at == not_a_date_time || change->closed_at > closed_at)) {
+                closed_at = change->closed_at;
+            }
+            uid = change->uid;
+            std::string columns[2];
+            int column = 0;
+            for (const auto *values: {&change->added, &change->modified}) {
+                std::string keys, counts;
+                for (const auto &value: *values) {
+                    if (value.second > 0) {
+                        addElement(keys, "'" + dbconn->escapedString(value.first) + "'");
+                        addElement(counts, "'" + std::to_string(value.second) + "'");
+                    }
+                }
+                if (keys.empty()) {
+                    columns[column++] = "NULL";
+                } else {
+                    columns[column++] = "hstore(ARRAY[" + keys + "],ARRAY[" + counts + "])";
+                }
+            }
+            if (columns[0] != "NULL" || columns[1] != "NULL") {
+                rows.push_back({std::to_string(file), columns[0], columns[1]});
+            }
+        }
+        if (rows.empty() || closed_at == not_a_date_time) {
+            continue;
+        }
+        addElement(ids, std::to_string(id));
+        addElement(uids, std::to_string(uid));
+        addElement(closed, "'" + to_simple_string(closed_at) + "'");
+        for (const auto &row: rows) {
+            addElement(changesets, std::to_string(id));
+            addElement(files, row[0]);
+            addElement(added, row[1]);
+            addElement(modified, row[2]);
+        }
+    }
+    if (ids.empty()) {
+        return "";
+    }
+
+    // Some of the data field in the changset come from a different file,
+    // which may not be downloaded yet. Writing the changesets first
+    // locks their rows, so the totals below see the files added by
+    // any other transaction holding them before.
+    ptime now = boost::posix_time::microsec_clock::universal_time();
+    std::string query = "INSERT INTO changesets (id, uid, closed_at, updated_at)";
+    query += " SELECT id, uid, closed_at, '" + to_simple_string(now) + "'::timestamptz FROM unnest(";
+    query += "ARRAY[" + ids + "]::int8[], ";
+    query += "ARRAY[" + uids + "]::int8[], ";
+    query += "ARRAY[" + closed + "]::timestamptz[]";
+    query += ") AS stats(id, uid, closed_at)";
+    query += " ON CONFLICT (id) DO UPDATE SET closed_at = GREATEST(changesets.closed_at, EXCLUDED.closed_at),";
+    query += " updated_at = EXCLUDED.updated_at;";
+
+    // The sequence numbers of the files already added are kept with
+    // the changeset, so a file processed again isn't counted twice.
+    query += "WITH parts AS (SELECT * FROM unnest(";
+    query += "ARRAY[" + changesets + "]::int8[], ";
+    query += "ARRAY[" + files + "]::int8[], ";
+    query += "ARRAY[" + added + "]::hstore[], ";
+    query += "ARRAY[" + modified + "]::hstore[]";
+    query += ") AS stats(changeset, file, added, modified)),";
+    query += " fresh AS (SELECT parts.* FROM parts JOIN changesets ON changesets.id = parts.changeset";
+    query += " WHERE NOT parts.file = ANY(changesets.files))";
+    query += " UPDATE changesets SET added = " + addFiles("added");
+    query += ", modified = " + addFiles("modified");
+    query += ", files = changesets.files || additions.files";
+    query += " FROM (SELECT changeset, array_agg(file) AS files FROM fresh GROUP BY changeset) AS additions";
+    query += " WHERE changesets.id = additions.changeset";
+
+    return query + ";";
+}
+
+std::string
+QueryStats::applyChanges(const std::list<std::shared_ptr<changesets::ChangeSet>> &changes) const
+{
+#ifdef TIMING_DEBUG_X
+    boost::timer::auto_cpu_timer timer("applyChanges(changeset): took %w seconds\n");
+#endif
+    // A row can only be updated once per statement, so if a changeset
+    // appears more than once the last one wins, like separate queries.
+    std::map<long, const changesets::ChangeSet *> rows;
+    for (const auto &change: changes) {
+        rows[change->id] = change.get();
+    }
+    if (rows.empty()) {
+        return "";
+    }
+
+    // One array per column, which unnest() turns back into rows. The
+    // hashtags are text[] each, which can't be nested in an array
+    // without unnest() flattening it, so they are passed as array
+    // literals and cast back.
+    std::string ids, editors, uids, created, closed, hashtags, sources, bboxes;
+    for (const auto &[id, change]: rows) {
+        addElement(ids, std::to_string(change->id));
+        addElement(editors, "'" + dbconn->escapedString(change->editor) + "'");
+        addElement(uids, std::to_string(change->uid));
+        addElement(created, "'" + to_simple_string(change->created_at) + "'");
+        if (change->closed_at != not_a_date_time) {
+            addElement(closed, "'" + to_simple_string(change->closed_at) + "'");
+        } else {
+            addElement(closed, "'" + to_simple_string(change->created_at) + "'");
+        }
+        if (change->hashtags.size() > 0) {
+            std::string literal;
+            for (const auto &hashtag: std::as_const(change->hashtags)) {
+                auto ht{hashtag};
+                boost::algorithm::replace_all(ht, "\"", "&quot;");
+                boost::algorithm::replace_all(ht, "\\", "\\\\");
+                addElement(literal, "\"" + ht + "\"");
+            }
+            addElement(hashtags, "'{" + dbconn->escapedString(literal) + "}'");
+        } else {
+            addElement(hashtags, "NULL");
+        }
+        // The source field is not always present
+        if (!change->source.empty()) {
+            addElement(sources, "'" + dbconn->escapedString(change->source) + "'");
+        } else {
+            addElement(sources, "NULL");
+        }
+        addElement(bboxes, "'" + bboxEWKT(*change) + "'");
+    }
+
+    ptime now = boost::posix_time::microsec_clock::universal_time();
+    std::string query = "INSERT INTO changesets (id, editor, uid, created_at, closed_at, updated_at, hashtags, source, bbox)";
+    query += " SELECT id, editor, uid, created_at, closed_at, '" + to_simple_string(now) + "'::timestamptz,";
+    query += " hashtags::text[], source, ST_MULTI(ST_GeomFromEWKT(bbox)) FROM unnest(";
+    query += "ARRAY[" + ids + "]::int8[], ";
+    query += "ARRAY[" + editors + "]::text[], ";
+    query += "ARRAY[" + uids + "]::int8[], ";
+    query += "ARRAY[" + created + "]::timestamptz[], ";
+    query += "ARRAY[" + closed + "]::timestamptz[], ";
+    query += "ARRAY[" + hashtags + "]::text[], ";
+    query += "ARRAY[" + sources + "]::text[], ";
+    query += "ARRAY[" + bboxes + "]::text[]";
+    query += ") AS changes(id, editor, uid, created_at, closed_at, hashtags, source, bbox)";
+    query += " ON CONFLICT (id) DO UPDATE SET editor = EXCLUDED.editor,";
+    query += " created_at = EXCLUDED.created_at, updated_at = EXCLUDED.updated_at,";
+    query += " hashtags = EXCLUDED.hashtags, bbox = EXCLUDED.bbox;";
+
+    return query;
+}
+
 } // namespace querystats
 
 // local Variables:
@@ -35,6 +35,8 @@
 #include <algorithm>
 #include <array>
 #include <iostream>
+#include <list>
+#include <map>
 #include <memory>
 #include <string>
 #include <vector>
@@ -47,6 +49,7 @@ using namespace boost::gregorian;
 #include "osm/changeset.hh"
 #include "osm/osmchange.hh"
 #include "data/pq.hh"
+#include "stats/statsaggregator.hh"
 
 using namespace pq;
 
@@ -77,6 +80,14 @@ class QueryStats {
     std::string applyChange(const changesets::ChangeSet &change) const;
     /// Build query for processed OsmChange
     std::string applyChange(const osmchange::ChangeStats &change) const;
+    /// Build a single query for all the processed ChangeSets in a file
+    std::string applyChanges(const std::list<std::shared_ptr<changesets::ChangeSet>> &changes) const;
+    /// Build a single query for the statistics of many changesets. The
+    /// counts of each file are added to the changeset, and the sequence
+    /// number of the file is kept in its files column, so writing the
+    /// same files again doesn't count them twice. Changesets with no
+    /// added or modified features are skipped.
+    std::string applyChanges(const statsaggregator::flushed_t &stats) const;
     // Database connection, used for escape strings
     std::shared_ptr<Pq> dbconn;
 };
@@ -0,0 +1,107 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+/// \file statsaggregator.cc
+/// \brief Merge changeset statistics across replication files
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <map>
+#include <memory>
+
+#include "stats/statsaggregator.hh"
+#include "utils/log.hh"
+
+using namespace logger;
+
+/// \namespace statsaggregator
+namespace statsaggregator {
+
+StatsAggregator::StatsAggregator(time_duration idle, time_duration window)
+    : idle(idle), window(window), now(not_a_date_time)
+{
+}
+
+void
+StatsAggregator::merge(const statsmap_t &stats, long sequence, ptime timestamp)
+{
+    if (timestamp != not_a_date_time && (now == not_a_date_time || timestamp > now)) {
+        now = timestamp;
+    }
+    for (const auto &[id, change]: stats) {
+        auto found = pending.find(id);
+        if (found == pending.end()) {
+            Entry entry;
+            entry.closed_at = not_a_date_time;
+            entry.first_seen = timestamp != not_a_date_time ? timestamp : now;
+            found = pending.emplace(id, entry).first;
+        }
+        auto &entry = found->second;
+        if (entry.closed_at == not_a_date_time ||
+            (change->closed_at != not_a_date_time && change->closed_at > entry.closed_at)) {
+            entry.closed_at = change->closed_at;
+        }
+        // Copy it, as the caller may still use the statistics. The same
+        // file processed again replaces the statistics it had
+        entry.files[sequence] = std::make_shared<osmchange::ChangeStats>(*change);
+    }
+}
+
+flushed_t
+StatsAggregator::flush(void)
+{
+    flushed_t flushed;
+    if (now == not_a_date_time) {
+        return flushed;
+    }
+    for (auto it = pending.begin(); it != pending.end();) {
+        const auto &entry = it->second;
+        bool closed = entry.closed_at != not_a_date_time && entry.closed_at + idle < now;
+        bool aged = entry.first_seen == not_a_date_time || entry.first_seen + window < now;
+        if (closed || aged) {
+            flushed.emplace(it->first, entry.files);
+            it = pending.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    log_debug("Flushing %1% changesets, %2% pending", flushed.size(), pending.size());
+    return flushed;
+}
+
+flushed_t
+StatsAggregator::flushAll(void)
+{
+    flushed_t flushed;
+    for (const auto &[id, entry]: pending) {
+        flushed.emplace(id, entry.files);
+    }
+    pending.clear();
+    return flushed;
+}
+
+} // namespace statsaggregator
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
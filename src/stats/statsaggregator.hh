@@ -0,0 +1,106 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __STATSAGGREGATOR_HH__
+#define __STATSAGGREGATOR_HH__
+
+/// \file statsaggregator.hh
+/// \brief Merge changeset statistics across replication files
+///
+/// A changeset is often uploaded over several minutely files, and
+/// each file only has the statistics for its part of it. These are
+/// kept in memory and summed until the changeset looks closed, so
+/// most changesets are written to the database once.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <map>
+#include <memory>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+using namespace boost::posix_time;
+
+#include "osm/osmchange.hh"
+
+/// \namespace statsaggregator
+namespace statsaggregator {
+
+/// The statistics for each changeset, like osmchange::ChangeBatch::collectStats()
+typedef std::map<long, std::shared_ptr<osmchange::ChangeStats>> statsmap_t;
+
+/// The statistics of one changeset in each file, by the sequence number
+/// of the file
+typedef std::map<long, std::shared_ptr<osmchange::ChangeStats>> filestats_t;
+
+/// The flushed changesets, with their statistics in each file
+typedef std::map<long, filestats_t> flushed_t;
+
+/// \class StatsAggregator
+/// \brief A sliding window of changeset statistics
+///
+/// Time here is the timestamp of the replication files, not the clock,
+/// so a backfill ages changesets out the same way as live data. Since
+/// a changeset can still be flushed before it's complete, and a file
+/// can be processed again by a replay, the statistics are kept for each
+/// file. querystats::QueryStats::applyChanges() then only adds the ones
+/// of the files not added before.
+class StatsAggregator {
+  public:
+    /// Changesets are flushed once no edits to them have been seen for
+    /// \a idle, or when they were first seen more than \a window ago.
+    StatsAggregator(time_duration idle = minutes(10), time_duration window = minutes(60));
+
+    /// Add the statistics from the file with the sequence number
+    /// \a sequence and the timestamp \a timestamp
+    void merge(const statsmap_t &stats, long sequence, ptime timestamp);
+
+    /// Remove and return the changesets that closed or aged out
+    flushed_t flush(void);
+
+    /// Remove and return all the changesets
+    flushed_t flushAll(void);
+
+    /// The number of changesets waiting to be flushed
+    std::size_t size(void) const { return pending.size(); };
+
+  private:
+    /// A changeset waiting to be flushed
+    struct Entry {
+        filestats_t files;  ///< The statistics in each file
+        ptime closed_at;    ///< The newest closing time in all files
+        ptime first_seen;   ///< The file it first appeared in
+    };
+
+    time_duration idle;                    ///< Time without edits before a changeset is closed
+    time_duration window;                  ///< Longest time a changeset is held
+    ptime now;                             ///< The newest file timestamp merged
+    std::map<long, Entry> pending;         ///< Changesets not flushed yet
+};
+
+} // namespace statsaggregator
+
+#endif // EOF __STATSAGGREGATOR_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,253 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+/// \file bench.cc
+/// \brief Benchmarks of the passes over a replication file
+///
+/// Each pass runs over every .osc file in the testsuite, and over
+/// generated files the size of real replication files. Run it with
+/// "make bench", which writes the results to bench.json so they can be
+/// compared across commits with Google Benchmark's compare.py.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
+#include "data/pq.hh"
+#include "osm/changebatch.hh"
+#include "osm/osmchange.hh"
+#include "raw/queryraw.hh"
+#include "stats/statsconfig.hh"
+#include "utils/geoutil.hh"
+#include "utils/log.hh"
+#include "validate/defaultvalidation.hh"
+#include "synthetic.hh"
+
+using namespace logger;
+using namespace osmchange;
+
+namespace {
+
+/// An osmChange file to run the benchmarks on
+struct Input {
+    std::string name;                    ///< Shown in the benchmark name
+    std::string xml;                     ///< The file
+};
+
+multipolygon_t boundary;                 ///< The priority area
+std::shared_ptr<Validate> plugin;        ///< The validation, if configured
+
+/// A parsed file with the geometries of its ways, and its batch
+struct Parsed {
+    explicit Parsed(const Input &input) {
+        osc.readXML(input.xml.data(), input.xml.size());
+        osc.buildGeometriesFromNodeCache();
+        batch = std::make_unique<ChangeBatch>(osc);
+        batch->areaFilter(boundary);
+    };
+    OsmChangeFile osc;
+    std::unique_ptr<ChangeBatch> batch;
+};
+
+void
+readXML(benchmark::State &state, const Input *input)
+{
+    for (auto _: state) {
+        OsmChangeFile osc;
+        osc.readXML(input->xml.data(), input->xml.size());
+        benchmark::DoNotOptimize(osc.changes.size());
+    }
+    state.SetBytesProcessed(state.iterations() * input->xml.size());
+}
+
+void
+areaFilter(benchmark::State &state, const Input *input)
+{
+    Parsed parsed(*input);
+    auto &batch = *parsed.batch;
+    for (auto _: state) {
+        batch.areaFilter(boundary);
+    }
+    state.SetItemsProcessed(state.iterations() *
+                            (batch.nodes.size() + batch.ways.size() + batch.relations.size()));
+}
+
+void
+collectStats(benchmark::State &state, const Input *input)
+{
+    Parsed parsed(*input);
+    for (auto _: state) {
+        auto stats = parsed.batch->collectStats(boundary);
+        benchmark::DoNotOptimize(stats->size());
+    }
+    state.SetItemsProcessed(state.iterations() * parsed.batch->ways.size());
+}
+
+void
+validateWays(benchmark::State &state, const Input *input)
+{
+    if (!plugin) {
+        state.SkipWithError("The validation configuration isn't installed");
+        return;
+    }
+    Parsed parsed(*input);
+    for (auto _: state) {
+        auto results = parsed.batch->validateWays(boundary, plugin);
+        benchmark::DoNotOptimize(results->size());
+    }
+    state.SetItemsProcessed(state.iterations() * parsed.batch->ways.size());
+}
+
+// This only generates the SQL, there is no database
+void
+applyChange(benchmark::State &state, const Input *input)
+{
+    Parsed parsed(*input);
+    auto &batch = *parsed.batch;
+    queryraw::QueryRaw queryraw(std::make_shared<Pq>());
+    std::size_t bytes = 0;
+    for (auto _: state) {
+        bytes = 0;
+        for (auto node: batch.nodes.objects) {
+            bytes += queryraw.applyChange(*node).size();
+        }
+        for (auto way: batch.ways.objects) {
+            bytes += queryraw.applyChange(*way).size();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * (batch.nodes.size() + batch.ways.size()));
+    state.counters["sql_bytes"] = bytes;
+}
+
+/// Read all the osmChange files in the testsuite
+void
+readTestData(const std::string &dir, std::vector<Input> &inputs)
+{
+    std::vector<boost::filesystem::path> files;
+    boost::filesystem::recursive_directory_iterator it(dir), eod;
+    for (; it != eod; ++it) {
+        if (it->path().extension() == ".osc") {
+            files.push_back(it->path());
+        }
+    }
+    std::sort(files.begin(), files.end());
+    for (const auto &file: files) {
+        std::ifstream stream(file.string());
+        std::string name = file.string().substr(dir.size() + 1);
+        inputs.push_back({name, std::string{std::istreambuf_iterator<char>(stream), {}}});
+    }
+}
+
+} // anonymous namespace
+
+int
+main(int argc, char *argv[])
+{
+    setlocale(LC_NUMERIC, "C");
+
+    // Our own options are removed before Google Benchmark sees them
+    std::string sizes = "minutely,hourly";
+    std::string generate;
+    int kept = 1;
+    for (int i = 1; i < argc; i++) {
+        if (std::strncmp(argv[i], "--sizes=", 8) == 0) {
+            sizes = argv[i] + 8;
+        } else if (std::strncmp(argv[i], "--generate=", 11) == 0) {
+            generate = argv[i] + 11;
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+
+    geoutil::GeoUtil geou;
+    std::string priority = SRCDIR;
+    priority += "/config/priority.geojson";
+    if (!geou.readFile(priority)) {
+        std::cerr << "Couldn't read " << priority << std::endl;
+        return 1;
+    }
+    boundary = geou.boundary;
+
+    // Write a synthetic file, to use it elsewhere
+    if (!generate.empty()) {
+        auto objects = synthetic::objects(generate);
+        if (objects == 0) {
+            std::cerr << "Use minutely, hourly or daily with --generate" << std::endl;
+            return 1;
+        }
+        std::cout << synthetic::osmChange(objects, boundary);
+        return 0;
+    }
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+
+    statsconfig::StatsConfig::setConfigurationFile(std::string(SRCDIR) + "/config/stats/statistics.yaml");
+    try {
+        plugin = std::make_shared<defaultvalidation::DefaultValidation>();
+        plugin->loadConfig(std::string(SRCDIR) + "/config/validate");
+    } catch (const std::exception &e) {
+        std::cerr << "Not benchmarking validation: " << e.what() << std::endl;
+        plugin.reset();
+    }
+
+    std::vector<Input> inputs;
+    readTestData(std::string(DATADIR) + "/testsuite/testdata", inputs);
+    std::vector<std::string> frequencies;
+    boost::split(frequencies, sizes, boost::is_any_of(","));
+    for (const auto &frequency: frequencies) {
+        auto objects = synthetic::objects(frequency);
+        if (objects > 0) {
+            inputs.push_back({"synthetic/" + frequency, synthetic::osmChange(objects, boundary)});
+        }
+    }
+
+    for (const auto &input: inputs) {
+        benchmark::RegisterBenchmark(("readXML/" + input.name).c_str(), readXML, &input);
+        benchmark::RegisterBenchmark(("areaFilter/" + input.name).c_str(), areaFilter, &input);
+        benchmark::RegisterBenchmark(("collectStats/" + input.name).c_str(), collectStats, &input);
+        benchmark::RegisterBenchmark(("validateWays/" + input.name).c_str(), validateWays, &input);
+        benchmark::RegisterBenchmark(("applyChange/" + input.name).c_str(), applyChange, &input);
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,220 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+/// \file synthetic.cc
+/// \brief Generate osmChange files of the size of replication files
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <boost/format.hpp>
+#include <boost/geometry.hpp>
+
+#include "synthetic.hh"
+
+/// \namespace synthetic
+namespace synthetic {
+
+namespace {
+
+const char *buildings[] = {"yes", "house", "residential", "school", "commercial"};
+const char *highways[] = {"residential", "service", "track", "path", "unclassified"};
+const char *amenities[] = {"school", "clinic", "place_of_worship", "marketplace", "water_point"};
+
+/// Writes the objects of one changeset
+class Writer {
+  public:
+    Writer(std::string &out, long changeset, const std::string &timestamp)
+        : out(out), changeset(changeset), timestamp(timestamp) {};
+
+    void node(long id, int version, double lat, double lon, const std::string &tags = "") {
+        out += (boost::format("  <node id=\"%d\" version=\"%d\" timestamp=\"%s\" uid=\"%d\" user=\"mapper%d\" changeset=\"%d\" lat=\"%.7f\" lon=\"%.7f\"")
+                % id % version % timestamp % (changeset % 997) % (changeset % 997) % changeset % lat % lon).str();
+        out += tags.empty() ? "/>\n" : ">\n" + tags + "  </node>\n";
+    };
+
+    void way(long id, int version, const std::vector<long> &refs, const std::string &tags) {
+        out += (boost::format("  <way id=\"%d\" version=\"%d\" timestamp=\"%s\" uid=\"%d\" user=\"mapper%d\" changeset=\"%d\">\n")
+                % id % version % timestamp % (changeset % 997) % (changeset % 997) % changeset).str();
+        for (auto ref: refs) {
+            out += "   <nd ref=\"" + std::to_string(ref) + "\"/>\n";
+        }
+        out += tags + "  </way>\n";
+    };
+
+    void relation(long id, long outer, long inner) {
+        out += (boost::format("  <relation id=\"%d\" version=\"1\" timestamp=\"%s\" uid=\"%d\" user=\"mapper%d\" changeset=\"%d\">\n")
+                % id % timestamp % (changeset % 997) % (changeset % 997) % changeset).str();
+        out += "   <member type=\"way\" ref=\"" + std::to_string(outer) + "\" role=\"outer\"/>\n";
+        out += "   <member type=\"way\" ref=\"" + std::to_string(inner) + "\" role=\"inner\"/>\n";
+        out += tag("type", "multipolygon") + tag("building", "yes") + "  </relation>\n";
+    };
+
+    static std::string tag(const std::string &key, const std::string &value) {
+        return "   <tag k=\"" + key + "\" v=\"" + value + "\"/>\n";
+    };
+
+  private:
+    std::string &out;
+    long changeset;
+    std::string timestamp;
+};
+
+} // anonymous namespace
+
+std::size_t
+objects(const std::string &frequency)
+{
+    if (frequency == "minutely") {
+        return 5000;
+    } else if (frequency == "hourly") {
+        return 100000;
+    } else if (frequency == "daily") {
+        return 1000000;
+    }
+    return 0;
+}
+
+std::string
+osmChange(std::size_t objects, const multipolygon_t &area, unsigned int seed)
+{
+    std::mt19937 random(seed);
+
+    // Part of the objects are around the bounding box, outside of it
+    boost::geometry::model::box<point_t> bbox(point_t(-180, -85), point_t(180, 85));
+    if (!area.empty()) {
+        boost::geometry::envelope(area, bbox);
+    }
+    double width = bbox.max_corner().get<0>() - bbox.min_corner().get<0>();
+    double height = bbox.max_corner().get<1>() - bbox.min_corner().get<1>();
+    std::uniform_real_distribution<double> lons(std::max(bbox.min_corner().get<0>() - width / 8, -180.0),
+                                                std::min(bbox.max_corner().get<0>() + width / 8, 180.0));
+    std::uniform_real_distribution<double> lats(std::max(bbox.min_corner().get<1>() - height / 8, -85.0),
+                                                std::min(bbox.max_corner().get<1>() + height / 8, 85.0));
+    std::uniform_int_distribution<int> percent(0, 99);
+    std::uniform_int_distribution<int> pick(0, 4);
+
+    long nodeid = 10000000000;
+    long wayid = 1000000000;
+    long relationid = 10000000;
+    long changeset = 100000000;
+    std::vector<std::pair<long, point_t>> created;
+
+    std::string out = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<osmChange version=\"0.6\" generator=\"underpass-bench\">\n";
+    std::size_t count = 0;
+    int second = 0;
+    while (count < objects) {
+        auto timestamp = (boost::format("2023-06-01T%02d:%02d:%02dZ")
+                          % ((second / 3600) % 24) % ((second / 60) % 60) % (second % 60)).str();
+        second++;
+        Writer writer(out, changeset++, timestamp);
+        double lon = lons(random);
+        double lat = lats(random);
+
+        // Most changesets add something, the others modify or delete
+        // some of the nodes added before.
+        int kind = percent(random);
+        if (kind < 45 || created.empty()) {
+            // A building, sometimes with a courtyard
+            out += " <create>\n";
+            const double size = 0.0002;
+            std::vector<long> refs;
+            for (int corner = 0; corner < 4; corner++) {
+                double x = lon + ((corner == 1 || corner == 2) ? size : 0);
+                double y = lat + ((corner >= 2) ? size : 0);
+                writer.node(nodeid, 1, y, x);
+                created.emplace_back(nodeid, point_t(x, y));
+                refs.push_back(nodeid++);
+            }
+            refs.push_back(refs.front());
+            long outer = wayid;
+            writer.way(wayid++, 1, refs, Writer::tag("building", buildings[pick(random)]));
+            count += 5;
+            if (percent(random) < 5) {
+                std::vector<long> inner;
+                for (int corner = 0; corner < 4; corner++) {
+                    double x = lon + size / 4 + ((corner == 1 || corner == 2) ? size / 2 : 0);
+                    double y = lat + size / 4 + ((corner >= 2) ? size / 2 : 0);
+                    writer.node(nodeid, 1, y, x);
+                    inner.push_back(nodeid++);
+                }
+                inner.push_back(inner.front());
+                writer.way(wayid, 1, inner, "");
+                writer.relation(relationid++, outer, wayid++);
+                count += 6;
+            }
+            out += " </create>\n";
+        } else if (kind < 65) {
+            // A highway
+            out += " <create>\n";
+            std::vector<long> refs;
+            int length = 3 + pick(random);
+            for (int i = 0; i < length; i++) {
+                writer.node(nodeid, 1, lat + i * 0.0003, lon + (i % 2) * 0.0002);
+                refs.push_back(nodeid++);
+            }
+            writer.way(wayid++, 1, refs, Writer::tag("highway", highways[pick(random)]));
+            out += " </create>\n";
+            count += length + 1;
+        } else if (kind < 75) {
+            // A POI
+            out += " <create>\n";
+            writer.node(nodeid++, 1, lat, lon, Writer::tag("amenity", amenities[pick(random)]) +
+                        Writer::tag("name", "Place " + std::to_string(count)));
+            out += " </create>\n";
+            count++;
+        } else if (kind < 95) {
+            // Move some nodes
+            out += " <modify>\n";
+            std::uniform_int_distribution<std::size_t> which(0, created.size() - 1);
+            for (int i = 0; i < 3; i++) {
+                const auto &node = created[which(random)];
+                writer.node(node.first, 2, node.second.get<1>() + 0.00001, node.second.get<0>() + 0.00001);
+            }
+            out += " </modify>\n";
+            count += 3;
+        } else {
+            // Delete a node
+            out += " <delete>\n";
+            std::uniform_int_distribution<std::size_t> which(0, created.size() - 1);
+            const auto &node = created[which(random)];
+            writer.node(node.first, 2, node.second.get<1>(), node.second.get<0>());
+            out += " </delete>\n";
+            count++;
+        }
+    }
+    out += "</osmChange>\n";
+    return out;
+}
+
+} // namespace synthetic
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
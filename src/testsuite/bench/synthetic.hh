@@ -0,0 +1,61 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#ifndef __SYNTHETIC_HH__
+#define __SYNTHETIC_HH__
+
+/// \file synthetic.hh
+/// \brief Generate osmChange files of the size of replication files
+///
+/// The files in the testsuite are tiny, so the benchmarks also run on
+/// generated files the size of a minutely, hourly or daily diff. The
+/// same seed always gives the same file, so results can be compared
+/// across commits.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <string>
+
+#include "osm/osmobjects.hh"
+
+/// \namespace synthetic
+namespace synthetic {
+
+/// The number of objects in a diff of the \a frequency, which is
+/// minutely, hourly or daily. Returns 0 for anything else.
+std::size_t objects(const std::string &frequency);
+
+/// Generate an osmChange file with about \a objects objects, spread
+/// over the bounding box of \a area and around it. New buildings,
+/// highways and POIs are mixed with modified and deleted nodes, in the
+/// proportions of a typical replication file.
+std::string osmChange(std::size_t objects, const multipolygon_t &area, unsigned int seed = 1);
+
+} // namespace synthetic
+
+#endif // EOF __SYNTHETIC_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
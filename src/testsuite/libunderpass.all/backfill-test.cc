@@ -0,0 +1,102 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <dejagnu.h>
+#include <iostream>
+#include "replicator/backfill.hh"
+#include "raw/queryraw.hh"
+#include "replicator/replication.hh"
+#include "underpassconfig.hh"
+#include "utils/log.hh"
+
+TestState runtest;
+
+using namespace logger;
+
+/// \file backfill-test.cc
+/// \brief Test splitting a backfill into sequence ranges
+
+int
+main(int argc, char *argv[])
+{
+    // 1001 files in ranges of 100, the last one is short
+    auto ranges = backfill::Backfill::partition(5000000, 5001000, 100);
+    if (ranges.size() == 11 && ranges.front().first == 5000000 && ranges.front().last == 5000099 &&
+        ranges.back().first == 5001000 && ranges.back().last == 5001000) {
+        runtest.pass("Backfill::partition()");
+    } else {
+        runtest.fail("Backfill::partition()");
+    }
+
+    // Ranges must cover every file exactly once
+    long expected = 5000000;
+    bool contiguous = true;
+    for (auto it = ranges.begin(); it != ranges.end(); ++it) {
+        contiguous &= it->first == expected && it->last >= it->first;
+        expected = it->last + 1;
+    }
+    if (contiguous && expected == 5001001) {
+        runtest.pass("Backfill::partition() is contiguous");
+    } else {
+        runtest.fail("Backfill::partition() is contiguous");
+    }
+
+    if (backfill::Backfill::partition(10, 9, 100).empty()) {
+        runtest.pass("Backfill::partition(empty)");
+    } else {
+        runtest.fail("Backfill::partition(empty)");
+    }
+
+    replication::RemoteURL remote("https://planet.openstreetmap.org/replication/minute/000/001/999.osc.gz");
+    backfill::Backfill::seek(remote, 5001002);
+    if (remote.subpath == "005/001/002" && remote.sequence() == 5001002 &&
+        remote.filespec == "replication/minute/005/001/002.osc.gz") {
+        runtest.pass("Backfill::seek()");
+    } else {
+        runtest.fail("Backfill::seek()");
+    }
+
+    underpassconfig::UnderpassConfig config;
+    backfill::Backfill backfiller(config);
+    auto query = backfiller.reconcile();
+    if (query.find("DELETE FROM nodes AS o USING backfill_removals") != std::string::npos &&
+        query.find("o.version < r.version") != std::string::npos &&
+        query.find("DROP TABLE backfill_removals;") != std::string::npos) {
+        runtest.pass("Backfill::reconcile()");
+    } else {
+        runtest.fail("Backfill::reconcile()");
+    }
+
+    // The ways are rebuilt in both tables, with their nodes in order
+    queryraw::QueryRaw queryraw;
+    query = queryraw.buildTouchedWaysQuery();
+    if (query.find("UPDATE ways_poly AS w") != std::string::npos &&
+        query.find("UPDATE ways_line AS w") != std::string::npos &&
+        query.find("ST_MakeLine(n.geom ORDER BY r.pos)") != std::string::npos &&
+        query.find("FROM backfill_touched WHERE type = 'way'") != std::string::npos) {
+        runtest.pass("QueryRaw::buildTouchedWaysQuery()");
+    } else {
+        runtest.fail("QueryRaw::buildTouchedWaysQuery()");
+    }
+}
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,111 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <dejagnu.h>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <boost/filesystem.hpp>
+#include "osm/binarychange.hh"
+#include "osm/osmchange.hh"
+#include "utils/log.hh"
+#include "samechanges.hh"
+
+TestState runtest;
+
+using namespace logger;
+using namespace osmchange;
+using namespace osmobjects;
+
+/// \file binarychange-test.cc
+/// \brief Test encoding and decoding parsed OsmChange files
+
+int
+main(int argc, char *argv[])
+{
+    logger::LogFile &dbglogfile = logger::LogFile::getDefaultInstance();
+    dbglogfile.setWriteDisk(true);
+    dbglogfile.setLogFilename("binarychange-test.log");
+    dbglogfile.setVerbosity(3);
+
+    std::string testdata = DATADIR;
+    testdata += "/testsuite/testdata/";
+    std::vector<std::string> files = {
+        "test_change.osc",
+        "test_multipolygon.osc",
+        "test_stats.osc",
+        "hashtags-test.osc"
+    };
+
+    for (auto it = files.begin(); it != files.end(); ++it) {
+        OsmChangeFile xml;
+        xml.readChanges(testdata + *it);
+        auto data = BinaryChangeFile::encode(xml);
+        OsmChangeFile decoded;
+        auto bytes = reinterpret_cast<const unsigned char *>(data.data());
+        if (BinaryChangeFile::decode(bytes, data.size(), decoded) && sameChanges(xml, decoded)) {
+            runtest.pass("BinaryChangeFile::decode(" + *it + ")");
+        } else {
+            runtest.fail("BinaryChangeFile::decode(" + *it + ")");
+        }
+    }
+
+    // Round trip through a file, like a replay does
+    OsmChangeFile xml;
+    xml.readChanges(testdata + "test_multipolygon.osc");
+    std::string filespec = "binarychange-test.oscb";
+    OsmChangeFile file;
+    if (BinaryChangeFile::write(xml, filespec) && file.readChanges(filespec) && sameChanges(xml, file)) {
+        runtest.pass("OsmChangeFile::readChanges(.oscb)");
+    } else {
+        runtest.fail("OsmChangeFile::readChanges(.oscb)");
+    }
+    boost::filesystem::remove(filespec);
+
+    // Corrupted data must not decode
+    auto data = BinaryChangeFile::encode(xml);
+    OsmChangeFile truncated;
+    if (!BinaryChangeFile::decode(reinterpret_cast<const unsigned char *>(data.data()), data.size() / 2, truncated)) {
+        runtest.pass("BinaryChangeFile::decode(truncated)");
+    } else {
+        runtest.fail("BinaryChangeFile::decode(truncated)");
+    }
+
+    // A count larger than its column must fail, not be allocated
+    std::string huge = data;
+    uint64_t offset;
+    std::memcpy(&offset, huge.data() + sizeof(BinaryChangeFile::magic) + BinaryChangeFile::refs * 2 * sizeof(uint64_t), sizeof(uint64_t));
+    huge.replace(offset, 8, "\xff\xff\xff\xff\xff\xff\xff\x7f", 8);
+    OsmChangeFile overflow;
+    if (!BinaryChangeFile::decode(reinterpret_cast<const unsigned char *>(huge.data()), huge.size(), overflow)) {
+        runtest.pass("BinaryChangeFile::decode(count)");
+    } else {
+        runtest.fail("BinaryChangeFile::decode(count)");
+    }
+    if (!BinaryChangeFile::isBinary(reinterpret_cast<const unsigned char *>("<?xml"), 5)) {
+        runtest.pass("BinaryChangeFile::isBinary()");
+    } else {
+        runtest.fail("BinaryChangeFile::isBinary()");
+    }
+}
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
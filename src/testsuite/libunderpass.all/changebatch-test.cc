@@ -0,0 +1,113 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <cstring>
+#include <dejagnu.h>
+#include <iostream>
+#include <string>
+#include "osm/changebatch.hh"
+#include "osm/osmchange.hh"
+#include "utils/log.hh"
+
+TestState runtest;
+
+using namespace logger;
+using namespace osmchange;
+
+/// \file changebatch-test.cc
+/// \brief Test the columnar copy of the parsed changes
+
+int
+main(int argc, char *argv[])
+{
+    logger::LogFile &dbglogfile = logger::LogFile::getDefaultInstance();
+    dbglogfile.setWriteDisk(true);
+    dbglogfile.setLogFilename("changebatch-test.log");
+    dbglogfile.setVerbosity(3);
+
+    std::string filespec = DATADIR;
+    filespec += "/testsuite/testdata/test_multipolygon.osc";
+    OsmChangeFile osc;
+    osc.readChanges(filespec);
+    ChangeBatch batch(osc);
+
+    // 6 nodes, 4 ways and 1 relation in a single change
+    if (batch.nodes.size() == 6 && batch.ways.size() == 4 && batch.relations.size() == 1 &&
+        batch.nodes.changes.size() == 2 && batch.nodes.changes.back() == 6 &&
+        batch.nodes.objects[0] == osc.changes.front()->nodes.front().get()) {
+        runtest.pass("ChangeBatch::ChangeBatch()");
+    } else {
+        runtest.fail("ChangeBatch::ChangeBatch()");
+    }
+
+    // Way refs and relation members are stored back to back
+    auto &way = *osc.changes.front()->ways.front();
+    if (batch.ways.offsets.size() == 5 && batch.ways.offsets.back() == batch.ways.refs.size() &&
+        batch.ways.offsets[1] == way.refs.size() && batch.ways.refs[0] == way.refs.front() &&
+        batch.relations.offsets.back() == 4 && batch.relations.refs[2] == 731 &&
+        batch.strings[batch.relations.roles[2]] == "inner") {
+        runtest.pass("ChangeBatch refs and members");
+    } else {
+        runtest.fail("ChangeBatch refs and members");
+    }
+
+    // Tags are interned, so equal strings get the same index
+    auto place = batch.find("place");
+    if (place != ChangeBatch::npos && batch.relations.hasKey(0, place) &&
+        batch.relations.tags[1] - batch.relations.tags[0] == 3 &&
+        batch.find("not a tag") == ChangeBatch::npos &&
+        batch.ways.users[0] == batch.relations.users[0]) {
+        runtest.pass("ChangeBatch tags");
+    } else {
+        runtest.fail("ChangeBatch tags");
+    }
+
+    // The filter updates both the columns and the objects
+    multipolygon_t poly;
+    boost::geometry::read_wkt("MULTIPOLYGON(((1.45 48.45,1.55 48.45,1.55 48.55,1.45 48.55,1.45 48.45)))", poly);
+    batch.areaFilter(poly);
+    if (!batch.nodes.priority[0] && batch.nodes.priority[2] && osc.changes.front()->nodes.front()->priority == false &&
+        batch.ways.priority[0] && batch.ways.objects[0]->priority) {
+        runtest.pass("ChangeBatch::areaFilter()");
+    } else {
+        runtest.fail("ChangeBatch::areaFilter()");
+    }
+
+    // Nodes are WKB points, and open ways linestrings
+    osc.buildGeometriesFromNodeCache();
+    auto nodes = batch.geometries(osmobjects::node);
+    auto ways = batch.geometries(osmobjects::way);
+    double lon = 0;
+    std::uint32_t type = 0, count = 0;
+    std::memcpy(&lon, &nodes.wkb[5], sizeof(lon));
+    std::memcpy(&type, &ways.wkb[1], sizeof(type));
+    std::memcpy(&count, &ways.wkb[5], sizeof(count));
+    if (nodes.offsets.size() == 7 && nodes.wkb.size() == 6 * 21 && nodes.wkb[0] == 1 && lon == 1.4 &&
+        ways.offsets.size() == 5 && ways.offsets[1] == 9 + 3 * 16 && type == 2 && count == 3 &&
+        ways.offsets.back() == ways.wkb.size() && batch.geometries(osmobjects::relation).offsets.size() == 2) {
+        runtest.pass("ChangeBatch::geometries()");
+    } else {
+        runtest.fail("ChangeBatch::geometries()");
+    }
+}
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
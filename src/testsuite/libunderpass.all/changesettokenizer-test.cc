@@ -0,0 +1,132 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <dejagnu.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "osm/changeset.hh"
+#include "osm/changesettokenizer.hh"
+#include "utils/log.hh"
+#include "utils/preparedarea.hh"
+
+TestState runtest;
+
+using namespace logger;
+using namespace changesets;
+
+/// \file changesettokenizer-test.cc
+/// \brief Test parsing changeset files, and filtering them by area
+
+/// A changeset file with \a count changesets along the equator
+std::string
+makeFile(int count)
+{
+    std::ostringstream xml;
+    xml << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+    xml << "<osm version=\"0.6\" generator=\"test\">\n";
+    for (int i = 1; i <= count; i++) {
+        xml << " <changeset id=\"" << i << "\" created_at=\"2023-01-01T00:00:00Z\"";
+        xml << " closed_at=\"2023-01-01T00:" << (i % 60 < 10 ? "0" : "") << i % 60 << ":00Z\"";
+        xml << " open=\"false\" user=\"a &amp; b\" uid=\"" << i * 10 << "\"";
+        xml << " min_lat=\"0.5\" min_lon=\"" << i % 100 << ".5\" max_lat=\"1.5\" max_lon=\"" << i % 100 << ".75\"";
+        xml << " comments_count=\"0\" changes_count=\"" << i % 7 << "\">\n";
+        xml << "  <tag k=\"comment\" v=\"Mapping #hotosm-project-" << i << " roads\"/>\n";
+        xml << "  <tag k=\"hashtags\" v=\"#missingmaps;#team" << i % 3 << "\"/>\n";
+        xml << "  <tag k=\"created_by\" v=\"JOSM/1.5\"/>\n";
+        xml << " </changeset>\n";
+    }
+    xml << "</osm>\n";
+    return xml.str();
+}
+
+int
+main(int argc, char *argv[])
+{
+    logger::LogFile &dbglogfile = logger::LogFile::getDefaultInstance();
+    dbglogfile.setWriteDisk(true);
+    dbglogfile.setLogFilename("changesettokenizer-test.log");
+    dbglogfile.setVerbosity(3);
+
+    std::string xml = makeFile(5);
+    ChangeSetFile file;
+    ChangeSetTokenizer::parse(xml.data(), xml.size(), file);
+    auto first = file.changes.front();
+    if (file.changes.size() == 5 && first->id == 1 && first->user == "a & b" && first->uid == 10
+        && first->num_changes == 1 && first->min_lon == 1.5 && first->max_lon == 1.75 && first->max_lat == 1.5
+        && first->hashtags == std::set<std::string>({"hotosm-project-1", "missingmaps", "team1"})
+        && first->editor == "JOSM/1.5" && first->comment == "Mapping #hotosm-project-1 roads"
+        && file.last_closed_at == time_from_string("2023-01-01 00:05:00")) {
+        runtest.pass("ChangeSetTokenizer::parse()");
+    } else {
+        runtest.fail("ChangeSetTokenizer::parse()");
+    }
+
+    // A large file is split, but keeps the same order
+    xml = makeFile(20000);
+    ChangeSetFile whole;
+    ChangeSetFile split;
+    bool ok = ChangeSetTokenizer::parse(xml.data(), xml.size(), whole, 1);
+    ok = ok && ChangeSetTokenizer::parse(xml.data(), xml.size(), split, 4);
+    bool same = ok && whole.changes.size() == 20000 && split.changes.size() == whole.changes.size()
+        && split.last_closed_at == whole.last_closed_at;
+    for (auto it = whole.changes.begin(), sit = split.changes.begin(); same && it != whole.changes.end(); ++it, ++sit) {
+        same = (*it)->id == (*sit)->id && (*it)->hashtags == (*sit)->hashtags;
+    }
+    if (xml.size() > 2 * ChangeSetTokenizer::chunk && same) {
+        runtest.pass("ChangeSetTokenizer::parse(threads)");
+    } else {
+        runtest.fail("ChangeSetTokenizer::parse(threads)");
+    }
+
+    std::string truncated = xml.substr(0, 200);
+    ChangeSetFile bad;
+    if (!ChangeSetTokenizer::parse(truncated.data(), truncated.size(), bad)) {
+        runtest.pass("ChangeSetTokenizer::parse(truncated)");
+    } else {
+        runtest.fail("ChangeSetTokenizer::parse(truncated)");
+    }
+
+    // A boundary with a hole, and two changesets inside the hole
+    multipolygon_t poly;
+    boost::geometry::read_wkt("MULTIPOLYGON(((0 0,0 10,10 10,10 0,0 0),(4 0.25,6 0.25,6 2,4 2,4 0.25)))", poly);
+    geoutil::PreparedArea area(poly);
+    if (area.covers(point_t(1, 1)) && !area.covers(point_t(5, 1)) && !area.covers(point_t(11, 1))
+        && area.intersects(box_t(point_t(9, 9), point_t(20, 20)))
+        && area.intersects(box_t(point_t(-1, -1), point_t(11, 11)))
+        && !area.intersects(box_t(point_t(4.5, 0.5), point_t(5.5, 1.5))) && geoutil::PreparedArea().empty()) {
+        runtest.pass("PreparedArea::intersects()");
+    } else {
+        runtest.fail("PreparedArea::intersects()");
+    }
+
+    file.areaFilter(area);
+    if (file.changes.size() == 3 && file.changes.front()->id == 1 && file.changes.back()->id == 3
+        && file.changes.front()->priority) {
+        runtest.pass("ChangeSetFile::areaFilter(PreparedArea)");
+    } else {
+        runtest.fail("ChangeSetFile::areaFilter(PreparedArea)");
+    }
+}
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,170 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <dejagnu.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <boost/algorithm/string.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/filesystem.hpp>
+
+#include "replicator/events.hh"
+#include "osm/changebatch.hh"
+#include "osm/osmchange.hh"
+#include "utils/log.hh"
+
+TestState runtest;
+
+using namespace logger;
+using namespace osmchange;
+
+/// \file events-test.cc
+/// \brief Test publishing the committed changes
+
+int
+main(int argc, char *argv[])
+{
+    logger::LogFile &dbglogfile = logger::LogFile::getDefaultInstance();
+    dbglogfile.setWriteDisk(true);
+    dbglogfile.setLogFilename("events-test.log");
+    dbglogfile.setVerbosity(3);
+
+    std::string filespec = DATADIR;
+    filespec += "/testsuite/testdata/test_multipolygon.osc";
+    OsmChangeFile osc;
+    osc.readChanges(filespec);
+    ChangeBatch batch(osc);
+    batch.areaFilter(multipolygon_t());
+
+    // Without a boundary, all the nodes and ways are written
+    std::string out;
+    events::objects(out, batch);
+    std::vector<std::string> lines;
+    boost::split(lines, out, boost::is_any_of("\n"));
+    if (lines.size() == 11 && lines.back().empty() &&
+        boost::algorithm::starts_with(lines[0], "{\"event\":\"node\",\"id\":") &&
+        boost::algorithm::starts_with(lines[6], "{\"event\":\"way\",\"id\":")) {
+        runtest.pass("events::objects()");
+    } else {
+        runtest.fail("events::objects()");
+    }
+
+    auto status = std::make_shared<ValidateStatus>();
+    status->objtype = osmobjects::way;
+    status->osm_id = 42;
+    status->version = 3;
+    status->status.insert(incomplete);
+    status->status.insert(badgeom);
+    out.clear();
+    events::validation(out, {status});
+    if (out == "{\"event\":\"validation\",\"type\":\"way\",\"id\":42,\"version\":3,\"status\":[\"badgeom\",\"incomplete\"]}\n") {
+        runtest.pass("events::validation()");
+    } else {
+        runtest.fail("events::validation()");
+    }
+
+    statsaggregator::statsmap_t stats;
+    stats[7] = std::make_shared<ChangeStats>();
+    stats[7]->uid = 9;
+    stats[7]->added["building"] = 2;
+    stats[7]->modified["highway"] = 1;
+    out.clear();
+    events::changesets(out, stats);
+    events::commit(out, "005/900/001", time_from_string("2023-05-01 10:00:00"));
+    if (out == "{\"event\":\"changeset\",\"id\":7,\"uid\":9,\"added\":{\"building\":2},\"modified\":{\"highway\":1},\"deleted\":{}}\n"
+        "{\"event\":\"file\",\"url\":\"005/900/001\",\"timestamp\":\"2023-05-01T10:00:00Z\"}\n") {
+        runtest.pass("events::changesets()");
+    } else {
+        runtest.fail("events::changesets()");
+    }
+
+    // The batches are appended to the file in order
+    auto directory = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    boost::filesystem::create_directories(directory);
+    auto path = (directory / "events.ndjson").string();
+    {
+        events::Publisher publisher;
+        publisher.open(path);
+        publisher.publish("{\"n\":1}\n");
+        publisher.publish("{\"n\":2}\n");
+    }
+    std::ifstream in(path);
+    std::string written((std::istreambuf_iterator<char>(in)), {});
+    if (written == "{\"n\":1}\n{\"n\":2}\n") {
+        runtest.pass("Publisher to a file");
+    } else {
+        runtest.fail("Publisher to a file");
+    }
+
+    // A full queue drops the batch instead of waiting
+    events::Publisher full(0);
+    full.open((directory / "full.ndjson").string());
+    full.publish("{\"n\":1}\n");
+    if (full.dropped() == 1) {
+        runtest.pass("Publisher drops when full");
+    } else {
+        runtest.fail("Publisher drops when full");
+    }
+
+    // The latest batches are kept for the metrics endpoint, up to a size
+    events::Publisher polled;
+    polled.open("metrics");
+    polled.publish("{\"n\":1}\n");
+    polled.publish("{\"n\":2}\n");
+    bool both = polled.recent() == "{\"n\":1}\n{\"n\":2}\n";
+    std::string large(events::Publisher::maxRecent, ' ');
+    large.back() = '\n';
+    polled.publish(large);
+    if (both && polled.recent() == large) {
+        runtest.pass("Publisher::recent()");
+    } else {
+        runtest.fail("Publisher::recent()");
+    }
+    polled.close();
+
+    auto socket = (directory / "events.sock").string();
+    events::Publisher publisher;
+    if (publisher.open("unix:" + socket)) {
+        boost::asio::io_context ioc;
+        boost::asio::local::stream_protocol::socket client(ioc);
+        client.connect(boost::asio::local::stream_protocol::endpoint(socket));
+        // The publisher looks for new clients when it wakes up
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        publisher.publish("{\"n\":3}\n");
+        std::string line;
+        boost::asio::read_until(client, boost::asio::dynamic_buffer(line), '\n');
+        if (line == "{\"n\":3}\n") {
+            runtest.pass("Publisher to a Unix socket");
+        } else {
+            runtest.fail("Publisher to a Unix socket");
+        }
+    } else {
+        runtest.fail("Publisher to a Unix socket");
+    }
+    publisher.close();
+    boost::filesystem::remove_all(directory);
+}
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -23,6 +23,7 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/geometry.hpp>
 #include "utils/geoutil.hh"
+#include "stats/hashtags.hh"
 
 TestState runtest;
 
@@ -55,6 +56,77 @@ main(int argc, char *argv[])
         return 1;
     }
 
+    // Punctuation ends a hashtag, but not - _ + and &, and letters
+    // outside ASCII are part of it
+    std::vector<std::string> found;
+    hashtags::scanComment("Roads for #MissingMaps, #hotosm-project-14_2+b&c. #日本語 #tôi\u2026 #ab ##x#yyy", found);
+    if (found == std::vector<std::string>({"MissingMaps", "hotosm-project-14_2+b&c", "日本語", "tôi", "yyy"})) {
+        runtest.pass("hashtags::scanComment()");
+    } else {
+        runtest.fail("hashtags::scanComment()");
+    }
+    found.clear();
+    hashtags::scanList("#missingmaps; #Team Écoles ;;#a#b", found);
+    if (found == std::vector<std::string>({"missingmaps", "Team Écoles", "a", "b"})) {
+        runtest.pass("hashtags::scanList()");
+    } else {
+        runtest.fail("hashtags::scanList()");
+    }
+    if (hashtags::fold("MissingMaps-ÉCOLES-ŁÓDŹ-ΑΘΉΝΑ-МОСКВА") == "missingmaps-écoles-łódź-αθήνα-москва") {
+        runtest.pass("hashtags::fold()");
+    } else {
+        runtest.fail("hashtags::fold()");
+    }
+
+    // Counts over the last 3 hours, where the hour of the first
+    // changeset has been reused by the last one
+    hashtags::Activity activity(hours(1), 3);
+    auto missing = activity.intern("#MissingMaps");
+    auto team = activity.intern("team");
+    ptime start = time_from_string("2023-05-01 10:30:00");
+    changesets::ChangeSet closed;
+    closed.closed_at = start;
+    closed.num_changes = 10;
+    closed.addHashtags("missingmaps");
+    closed.addHashtags("MISSINGMAPS");
+    closed.addHashtags("team");
+    activity.add(closed);
+    activity.add(missing, start + hours(1), 5);
+    activity.add(missing, start + hours(3), 1);
+    changesets::ChangeSet open = closed;
+    open.open = true;
+    activity.add(open);
+    hashtags::Activity::id_t id;
+    auto top = activity.top(10);
+    if (activity.intern("MISSINGMAPS") == missing && activity.find("Team", id) && id == team
+        && activity.size() == 2 && activity.count(missing).changesets == 2 && activity.count(missing).changes == 6
+        && activity.count(missing, start + hours(1)).changesets == 1 && activity.count(team).changesets == 0
+        && top.size() == 1 && top.front().hashtag == "missingmaps"
+        && activity.json(1) == "[{\"hashtag\":\"missingmaps\",\"changesets\":2,\"changes\":6}]") {
+        runtest.pass("hashtags::Activity");
+    } else {
+        runtest.fail("hashtags::Activity");
+    }
+
+    // A changeset in two files is counted once, and the hashtags not
+    // used in the window make room for new ones
+    hashtags::Activity small(hours(1), 2, 2);
+    closed.id = 1;
+    small.add(closed);
+    small.add(closed);
+    bool once = small.count(small.intern("missingmaps")).changesets == 1 && small.intern("other") == hashtags::Activity::none;
+    changesets::ChangeSet later;
+    later.id = 2;
+    later.closed_at = start + hours(2);
+    later.addHashtags("team");
+    small.add(later);
+    auto other = small.intern("other");
+    if (once && other != hashtags::Activity::none && !small.find("missingmaps", id) && small.name(other) == "other"
+        && small.count(other).changesets == 0 && small.size() == 2 && small.top(10).size() == 1) {
+        runtest.pass("hashtags::Activity(limit)");
+    } else {
+        runtest.fail("hashtags::Activity(limit)");
+    }
 }
 
 // local Variables:
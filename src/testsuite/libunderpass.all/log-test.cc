@@ -0,0 +1,129 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <dejagnu.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/filesystem.hpp>
+
+#include "utils/log.hh"
+
+TestState runtest;
+
+using namespace logger;
+
+/// \file log-test.cc
+/// \brief Test the queued log writer
+
+/// Counts how many times it's formatted
+struct Formatted {
+    int &count;
+};
+
+std::ostream &
+operator<<(std::ostream &out, const Formatted &formatted)
+{
+    formatted.count++;
+    return out << "formatted";
+}
+
+int
+main(int argc, char *argv[])
+{
+    auto filespec = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path()).string();
+    logger::LogFile &dbglogfile = logger::LogFile::getDefaultInstance();
+    dbglogfile.setWriteDisk(true);
+    dbglogfile.setLogFilename(filespec);
+    dbglogfile.setVerbosity(1);
+
+    // Debug messages aren't even formatted below the debug level
+    int count = 0;
+    log_debug("Not written: %1%", Formatted{count});
+    log_info("Written: %1%", Formatted{count});
+    if (count == 1) {
+        runtest.pass("log_debug() isn't formatted");
+    } else {
+        runtest.fail("log_debug() isn't formatted");
+    }
+
+    // Nor are their arguments evaluated
+    int evaluated = 0;
+    log_debug("Not written: %1%", ++evaluated);
+    if (evaluated == 0) {
+        runtest.pass("log_debug() arguments aren't evaluated");
+    } else {
+        runtest.fail("log_debug() arguments aren't evaluated");
+    }
+
+    // Many threads logging more than fits in their rings
+    dbglogfile.setVerbosity(2);
+    const int threads = 8;
+    const int messages = 5000;
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; i++) {
+        workers.push_back(std::thread([i] {
+            for (int j = 0; j < messages; j++) {
+                log_debug("thread %1% message %2%", i, j);
+            }
+        }));
+    }
+    for (auto &worker: workers) {
+        worker.join();
+    }
+    dbglogfile.flush();
+
+    std::ifstream file(filespec);
+    std::string line;
+    int lines = 0;
+    std::vector<int> next(threads, 0);
+    bool ordered = true;
+    while (std::getline(file, line)) {
+        auto pos = line.find("DEBUG: thread ");
+        if (pos == std::string::npos) {
+            continue;
+        }
+        int thread, message;
+        if (sscanf(line.c_str() + pos, "DEBUG: thread %d message %d", &thread, &message) == 2) {
+            ordered &= next[thread] == message;
+            next[thread] = message + 1;
+            lines++;
+        }
+    }
+    if (lines == threads * messages) {
+        runtest.pass("LogFile::flush() writes all messages");
+    } else {
+        runtest.fail("LogFile::flush() writes all messages");
+    }
+    if (ordered) {
+        runtest.pass("LogFile keeps the order of each thread");
+    } else {
+        runtest.fail("LogFile keeps the order of each thread");
+    }
+
+    dbglogfile.setWriteDisk(false);
+    boost::filesystem::remove(filespec);
+}
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,179 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include <dejagnu.h>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+
+#include "utils/metrics.hh"
+#include "utils/log.hh"
+
+TestState runtest;
+
+using namespace logger;
+using namespace metrics;
+
+/// Fetch a path from the endpoint, and return the whole response
+std::string
+fetch(unsigned short port, const std::string &path)
+{
+    boost::asio::io_context ioc;
+    boost::asio::ip::tcp::socket socket(ioc);
+    socket.connect({boost::asio::ip::make_address("127.0.0.1"), port});
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    boost::asio::write(socket, boost::asio::buffer(request));
+    std::string response;
+    boost::system::error_code ec;
+    boost::asio::read(socket, boost::asio::dynamic_buffer(response), ec);
+    return response;
+}
+
+int
+main(int argc, char *argv[])
+{
+    logger::LogFile &dbglogfile = logger::LogFile::getDefaultInstance();
+    dbglogfile.setWriteDisk(true);
+    dbglogfile.setLogFilename("metrics-test.log");
+    dbglogfile.setVerbosity(3);
+
+    Registry registry;
+
+    // Counts from several threads all add up
+    auto &objects = registry.counter("underpass_objects_total", "Objects", {{"type", "node"}});
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&objects] {
+            for (int i = 0; i < 100000; i++) {
+                objects.add();
+            }
+        });
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    if (objects.value() == 400000 &&
+        &registry.counter("underpass_objects_total", "Objects", {{"type", "node"}}) == &objects) {
+        runtest.pass("Counter::add(threads)");
+    } else {
+        runtest.fail("Counter::add(threads)");
+    }
+
+    // Every value lands in a bucket that holds it
+    bool ordered = true;
+    for (std::uint64_t value: {0UL, 1UL, 15UL, 16UL, 17UL, 31UL, 32UL, 1000UL, 123456789UL}) {
+        auto bucket = Histogram::bucket(value);
+        if (Histogram::lowest(bucket) > value || Histogram::lowest(bucket + 1) <= value) {
+            ordered = false;
+        }
+    }
+    if (ordered && Histogram::bucket(UINT64_MAX) == Histogram::buckets - 1) {
+        runtest.pass("Histogram::bucket()");
+    } else {
+        runtest.fail("Histogram::bucket()");
+    }
+
+    // Quantiles are within the bucket width
+    auto &latency = registry.histogram("underpass_download_seconds", "Download time",
+                                       {{"server", "planet.example.org"}}, 1e-6);
+    for (std::uint64_t i = 1; i <= 10000; i++) {
+        latency.record(i);
+    }
+    auto median = latency.quantile(0.5);
+    auto p99 = latency.quantile(0.99);
+    if (latency.count() == 10000 && latency.sum() == 50005000 &&
+        median >= 5000 && median < 5000 * 1.07 && p99 >= 9900 && p99 < 9900 * 1.07) {
+        runtest.pass("Histogram::quantile()");
+    } else {
+        runtest.fail("Histogram::quantile()");
+        std::cout << median << " " << p99 << std::endl;
+    }
+
+    // Timers record once
+    auto &parse = registry.histogram("underpass_parse_seconds", "Parse time", {}, 1e-6);
+    {
+        Timer timer(parse);
+        timer.stop();
+    }
+    if (parse.count() == 1) {
+        runtest.pass("Timer::stop()");
+    } else {
+        runtest.fail("Timer::stop()");
+    }
+
+    registry.gauge("underpass_replication_lag_seconds", "Lag", {{"stream", "osmchange"}}).set(42.5);
+    auto text = registry.text();
+    if (text.find("# TYPE underpass_objects_total counter\n") != std::string::npos &&
+        text.find("underpass_objects_total{type=\"node\"} 400000\n") != std::string::npos &&
+        text.find("underpass_download_seconds_bucket{server=\"planet.example.org\",le=\"0.016383\"} 10000\n") != std::string::npos &&
+        text.find("underpass_download_seconds_bucket{server=\"planet.example.org\",le=\"+Inf\"} 10000\n") != std::string::npos &&
+        text.find("underpass_download_seconds_bucket{server=\"planet.example.org\",le=\"0.001023\"} 1023\n") != std::string::npos &&
+        text.find("underpass_download_seconds_count{server=\"planet.example.org\"} 10000\n") != std::string::npos &&
+        text.find("underpass_download_seconds_sum{server=\"planet.example.org\"} 50.005\n") != std::string::npos &&
+        text.find("underpass_replication_lag_seconds{stream=\"osmchange\"} 42.5\n") != std::string::npos) {
+        runtest.pass("Registry::text()");
+    } else {
+        runtest.fail("Registry::text()");
+        std::cout << text;
+    }
+
+    // Label values are escaped
+    registry.counter("underpass_escaped_total", "Escaped", {{"name", "a\"b\\c"}}).add();
+    if (registry.text().find("underpass_escaped_total{name=\"a\\\"b\\\\c\"} 1\n") != std::string::npos) {
+        runtest.pass("Registry::text(escaped)");
+    } else {
+        runtest.fail("Registry::text(escaped)");
+    }
+
+    // The endpoint serves the same text
+    Endpoint endpoint(registry);
+    endpoint.route("/extra", "application/json", [] { return std::string("[1]"); });
+    if (endpoint.start(0)) {
+        auto response = fetch(endpoint.port(), "/metrics");
+        auto missing = fetch(endpoint.port(), "/nothere");
+        auto extra = fetch(endpoint.port(), "/extra");
+        if (response.find("200 OK") != std::string::npos &&
+            response.find("underpass_objects_total{type=\"node\"} 400000") != std::string::npos &&
+            missing.find("404") != std::string::npos) {
+            runtest.pass("Endpoint::start()");
+        } else {
+            runtest.fail("Endpoint::start()");
+        }
+        if (extra.find("200 OK") != std::string::npos && extra.find("application/json") != std::string::npos
+            && extra.substr(extra.size() - 3) == "[1]") {
+            runtest.pass("Endpoint::route()");
+        } else {
+            runtest.fail("Endpoint::route()");
+        }
+        endpoint.stop();
+    } else {
+        runtest.untested("Endpoint::start()");
+    }
+}
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,128 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <dejagnu.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+#include "replicator/mirror.hh"
+#include "utils/log.hh"
+
+TestState runtest;
+
+using namespace logger;
+
+/// \file mirror-test.cc
+/// \brief Test storing and serving replication files from the local mirror
+
+std::vector<unsigned char>
+gzip(const std::string &text)
+{
+    std::ostringstream out;
+    {
+        boost::iostreams::filtering_ostream gz;
+        gz.push(boost::iostreams::gzip_compressor());
+        gz.push(out);
+        gz << text;
+    }
+    auto str = out.str();
+    return std::vector<unsigned char>(str.begin(), str.end());
+}
+
+int
+main(int argc, char *argv[])
+{
+    logger::LogFile &dbglogfile = logger::LogFile::getDefaultInstance();
+    dbglogfile.setWriteDisk(true);
+    dbglogfile.setLogFilename("mirror-test.log");
+    dbglogfile.setVerbosity(3);
+
+    auto directory = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    auto first = gzip("<osmChange version=\"0.6\"></osmChange>\n");
+    auto second = gzip("<osmChange version=\"0.6\"><create/></osmChange>\n");
+
+    {
+        mirror::Mirror mirror(directory.string(), "osc.gz");
+        if (mirror.write(5001, first.data(), first.size()) && mirror.write(5002, second.data(), second.size())) {
+            runtest.pass("Mirror::write()");
+        } else {
+            runtest.fail("Mirror::write()");
+        }
+
+        // A truncated download must be rejected
+        auto truncated = second;
+        truncated.resize(truncated.size() - 4);
+        if (!mirror.write(5003, truncated.data(), truncated.size()) && !mirror.contains(5003)) {
+            runtest.pass("Mirror::write(truncated)");
+        } else {
+            runtest.fail("Mirror::write(truncated)");
+        }
+
+        mirror::MappedView view;
+        if (mirror.read(5002, view) && view.size == second.size() &&
+            std::equal(second.begin(), second.end(), view.data())) {
+            runtest.pass("Mirror::read()");
+        } else {
+            runtest.fail("Mirror::read()");
+        }
+    }
+
+    // The index must survive reopening the mirror
+    {
+        mirror::Mirror mirror(directory.string(), "osc.gz");
+        mirror::MappedView view;
+        mirror::IndexEntry entry;
+        if (mirror.size() == 2 && mirror.lookup(5002, entry) && entry.offset == first.size() &&
+            mirror.read(5001, view) && std::equal(first.begin(), first.end(), view.data())) {
+            runtest.pass("Mirror index reload");
+        } else {
+            runtest.fail("Mirror index reload");
+        }
+    }
+
+    // A file damaged on disk is dropped, and can be mirrored again
+    {
+        std::fstream pack((directory / "osc.gz.pack").string(), std::ios::in | std::ios::out | std::ios::binary);
+        pack.seekp(first.size() + 12);
+        pack.put('x');
+        pack.close();
+        mirror::Mirror mirror(directory.string(), "osc.gz");
+        mirror::MappedView view;
+        bool dropped = !mirror.read(5002, view) && !mirror.contains(5002);
+        if (dropped && mirror.write(5002, second.data(), second.size()) && mirror.read(5002, view) &&
+            std::equal(second.begin(), second.end(), view.data())) {
+            runtest.pass("Mirror::read(checksum)");
+        } else {
+            runtest.fail("Mirror::read(checksum)");
+        }
+    }
+
+    boost::filesystem::remove_all(directory);
+}
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,58 @@
+#!/usr/bin/python3
+#
+# Copyright (c) 2024 Humanitarian OpenStreetMap Team
+#
+# This file is part of Underpass.
+#
+#     Underpass is free software: you can redistribute it and/or modify
+#     it under the terms of the GNU General Public License as published by
+#     the Free Software Foundation, either version 3 of the License, or
+#     (at your option) any later version.
+#
+#     Underpass is distributed in the hope that it will be useful,
+#     but WITHOUT ANY WARRANTY; without even the implied warranty of
+#     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#     GNU General Public License for more details.
+#
+#     You should have received a copy of the GNU General Public License
+#     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+
+'''
+    Read the file of the round trip in parquet-test with pyarrow,
+    and print its rows the way the test expects them.
+
+    Usage:
+
+    python3 parquet-check.py parquet-test.parquet
+'''
+
+import sys
+
+import pyarrow as pa
+import pyarrow.parquet as pq
+
+
+def value(column, item):
+    if item is None:
+        return "null"
+    if column == "tags":
+        return "".join(f"{key}={val};" for key, val in item)
+    if column == "values":
+        return "".join(f"{val};" for val in item)
+    if column == "geom":
+        return item.hex()
+    return str(item)
+
+
+def main():
+    table = pq.read_table(sys.argv[1])
+    table = table.set_column(table.schema.get_field_index("timestamp"), "timestamp",
+                             table.column("timestamp").cast(pa.int64()))
+    columns = ["osm_id", "version", "timestamp", "user", "tags", "values", "geom"]
+    data = [table.column(name).to_pylist() for name in columns]
+    for row in zip(*data):
+        print("\t".join(value(name, item) for name, item in zip(columns, row)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,546 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <dejagnu.h>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "data/export.hh"
+#include "data/parquet.hh"
+#include "utils/log.hh"
+
+TestState runtest;
+
+using namespace logger;
+using namespace parquet;
+
+/// \file parquet-test.cc
+/// \brief Test writing the exported tables as Parquet
+
+/// Write \a rows nodes with sorted IDs and the same tags, and return
+/// the file
+std::string
+write(bool delta, bool dictionary, std::size_t rows, std::size_t groupRows = 1 << 17)
+{
+    Writer writer({{"osm_id", int64, delta}, {"tags", map, false, dictionary}, {"geom", binary}}, groupRows);
+    writer.open("parquet-test.parquet");
+    writer.metadata("geo", exporter::Exporter::geoMetadata(exporter::Exporter::tables().front()));
+    for (std::size_t i = 0; i < rows; i++) {
+        writer.integer(1000000000 + i * 2);
+        writer.strings({"building", "yes", "addr:street", "Main Street"});
+        if (i % 2) {
+            writer.null();
+        } else {
+            writer.bytes(std::string("\x01\x01\0\0\0", 5));
+        }
+        writer.endRow();
+    }
+    if (!writer.close() || writer.rows() != rows) {
+        return "";
+    }
+    std::ifstream file("parquet-test.parquet", std::ios::binary);
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    return buffer.str();
+}
+
+/// \class Reader
+/// \brief Read back the files of the Writer, only what it writes
+class Reader {
+  public:
+    /// A field of a Thrift struct, in the compact protocol
+    struct Value {
+        std::int64_t integer = 0;
+        std::string bytes;
+        std::vector<Value> list;
+        std::map<int, Value> fields;
+    };
+    /// The levels and values of a column, the values as text
+    struct Column {
+        std::vector<int> repetitions;
+        std::vector<int> definitions;
+        std::vector<std::string> values;
+    };
+
+    Reader(const std::string &data) : data(data) {};
+
+    /// Read the footer and the columns of all row groups, by path
+    bool read(std::map<std::string, Column> &columns)
+    {
+        if (data.size() < 12 || data.compare(0, 4, "PAR1") != 0) {
+            return false;
+        }
+        std::uint32_t length;
+        std::memcpy(&length, &data[data.size() - 8], sizeof(length));
+        pos = data.size() - 8 - length;
+        auto meta = structure();
+        std::map<std::string, std::pair<int, int>> levels;
+        std::size_t element = 0;
+        schema(meta.fields[2].list, element, "", 0, 0, levels);
+        std::int64_t rows = 0;
+        for (const auto &group: meta.fields[4].list) {
+            rows += group.fields.at(3).integer;
+            for (const auto &chunk: group.fields.at(1).list) {
+                const auto &column = chunk.fields.at(3).fields;
+                std::string path;
+                for (const auto &name: column.at(3).list) {
+                    path += (path.empty() ? "" : ".") + name.bytes;
+                }
+                auto max = levels.at(path);
+                if (!page(column, max.first, max.second, columns[path])) {
+                    return false;
+                }
+            }
+        }
+        return rows == meta.fields[3].integer;
+    };
+
+  private:
+    int byte(void) { return static_cast<std::uint8_t>(data.at(pos++)); };
+    std::uint64_t varint(void)
+    {
+        std::uint64_t value = 0;
+        for (int shift = 0;; shift += 7) {
+            int next = byte();
+            value |= static_cast<std::uint64_t>(next & 0x7f) << shift;
+            if (next < 0x80) {
+                return value;
+            }
+        }
+    };
+    std::int64_t zigzag(void)
+    {
+        auto value = varint();
+        return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+    };
+    std::uint32_t uint32(void)
+    {
+        std::uint32_t value;
+        std::memcpy(&value, &data.at(pos + 3) - 3, sizeof(value));
+        pos += 4;
+        return value;
+    };
+    /// \a width bits at \a bit of the bytes from pos, the lowest first
+    std::uint64_t bits(std::size_t bit, int width) const
+    {
+        std::uint64_t value = 0;
+        for (int i = 0; i < width; i++, bit++) {
+            value |= static_cast<std::uint64_t>(data.at(pos + bit / 8) >> (bit % 8) & 1) << i;
+        }
+        return value;
+    };
+
+    Value value(int type)
+    {
+        Value value;
+        if (type == 1 || type == 2) {
+            value.integer = type == 1;
+        } else if (type == 5 || type == 6) {
+            value.integer = zigzag();
+        } else if (type == 8) {
+            auto size = varint();
+            value.bytes = data.substr(pos, size);
+            pos += size;
+        } else if (type == 9) {
+            int header = byte();
+            std::size_t size = header >> 4 == 15 ? varint() : header >> 4;
+            for (std::size_t i = 0; i < size; i++) {
+                value.list.push_back(this->value(header & 15));
+            }
+        } else if (type == 12) {
+            value = structure();
+        } else {
+            throw std::runtime_error("Unexpected Thrift type");
+        }
+        return value;
+    };
+    Value structure(void)
+    {
+        Value value;
+        int last = 0;
+        for (int header = byte(); header; header = byte()) {
+            last = header >> 4 ? last + (header >> 4) : zigzag();
+            value.fields[last] = this->value(header & 15);
+        }
+        return value;
+    };
+
+    /// The highest levels of the leaves under an element of the schema
+    void schema(const std::vector<Value> &elements, std::size_t &element, const std::string &path,
+                int definition, int repetition, std::map<std::string, std::pair<int, int>> &levels)
+    {
+        const auto &fields = elements.at(element++).fields;
+        int type = fields.count(3) ? fields.at(3).integer : 0;
+        definition += type != 0;
+        repetition += type == 2;
+        std::string name = element == 1 ? "" : (path.empty() ? "" : path + ".") + fields.at(4).bytes;
+        int children = fields.count(5) ? fields.at(5).integer : 0;
+        if (children == 0) {
+            levels[name] = {definition, repetition};
+        }
+        for (int i = 0; i < children; i++) {
+            schema(elements, element, name, definition, repetition, levels);
+        }
+    };
+
+    /// Levels or dictionary indexes, as runs and bit packed groups
+    void hybrid(int width, std::size_t count, std::vector<int> &values)
+    {
+        std::size_t end = values.size() + count;
+        while (values.size() < end) {
+            auto header = varint();
+            if (header & 1) {
+                std::size_t size = (header >> 1) * 8;
+                for (std::size_t i = 0; i < size; i++) {
+                    if (values.size() < end) {
+                        values.push_back(bits(i * width, width));
+                    }
+                }
+                pos += size * width / 8;
+            } else {
+                int value = bits(0, width);
+                pos += (width + 7) / 8;
+                values.insert(values.end(), header >> 1, value);
+            }
+        }
+    };
+
+    void delta(std::size_t count, std::vector<std::string> &values)
+    {
+        std::size_t block = varint(), miniblocks = varint();
+        std::size_t total = varint();
+        std::uint64_t last = zigzag();
+        std::size_t end = values.size() + std::min(count, total);
+        if (values.size() < end) {
+            values.push_back(std::to_string(static_cast<std::int64_t>(last)));
+        }
+        while (values.size() < end) {
+            std::uint64_t min = zigzag();
+            std::vector<int> widths;
+            for (std::size_t m = 0; m < miniblocks; m++) {
+                widths.push_back(byte());
+            }
+            for (std::size_t m = 0; m < miniblocks && values.size() < end; m++) {
+                std::size_t size = block / miniblocks;
+                for (std::size_t i = 0; i < size; i++) {
+                    if (values.size() < end) {
+                        last += min + bits(i * widths[m], widths[m]);
+                        values.push_back(std::to_string(static_cast<std::int64_t>(last)));
+                    }
+                }
+                pos += size * widths[m] / 8;
+            }
+        }
+    };
+
+    void plain(int type, std::size_t count, std::vector<std::string> &values)
+    {
+        for (std::size_t i = 0; i < count; i++) {
+            if (type == 1) {
+                std::int32_t value;
+                std::memcpy(&value, &data.at(pos + 3) - 3, sizeof(value));
+                values.push_back(std::to_string(value));
+                pos += 4;
+            } else if (type == 2) {
+                std::int64_t value;
+                std::memcpy(&value, &data.at(pos + 7) - 7, sizeof(value));
+                values.push_back(std::to_string(value));
+                pos += 8;
+            } else {
+                auto size = uint32();
+                values.push_back(data.substr(pos, size));
+                pos += size;
+            }
+        }
+    };
+
+    /// The dictionary page if any, then the data page of a column chunk
+    bool page(const std::map<int, Value> &column, int definition, int repetition, Column &out)
+    {
+        int type = column.at(1).integer;
+        std::vector<std::string> dictionary;
+        if (column.count(11)) {
+            pos = column.at(11).integer;
+            auto header = structure().fields;
+            plain(type, header.at(7).fields.at(1).integer, dictionary);
+        }
+        pos = column.at(9).integer;
+        auto header = structure().fields;
+        std::size_t end = pos + header.at(3).integer;
+        std::size_t count = header.at(5).fields.at(1).integer;
+        int encoding = header.at(5).fields.at(2).integer;
+        if (repetition) {
+            std::size_t start = pos + 4 + uint32();
+            hybrid(1, count, out.repetitions);
+            pos = start;
+        }
+        std::size_t start = pos + 4 + uint32();
+        hybrid(definition == 1 ? 1 : 2, count, out.definitions);
+        pos = start;
+        count = std::count(out.definitions.end() - count, out.definitions.end(), definition);
+        if (encoding == 0) {
+            plain(type, count, out.values);
+        } else if (encoding == 5) {
+            delta(count, out.values);
+        } else if (encoding == 8) {
+            std::vector<int> indexes;
+            int width = byte();
+            hybrid(width, count, indexes);
+            for (auto index: indexes) {
+                out.values.push_back(dictionary.at(index));
+            }
+        } else {
+            return false;
+        }
+        return encoding == 5 || pos == end;
+    };
+
+    const std::string &data;
+    std::size_t pos = 0;
+};
+
+/// The rows of a column as text, null if they're null
+std::vector<std::string>
+rows(const Reader::Column &column, int definition)
+{
+    std::vector<std::string> rows;
+    auto value = column.values.begin();
+    for (auto level: column.definitions) {
+        rows.push_back(level == definition ? *value++ : "null");
+    }
+    return rows;
+}
+
+/// The rows of a map or list as text, with \a keys for a map
+std::vector<std::string>
+rows(const Reader::Column &values, const Reader::Column *keys = nullptr)
+{
+    std::vector<std::string> rows;
+    std::size_t next = 0;
+    for (std::size_t i = 0; i < values.definitions.size(); i++) {
+        if (values.repetitions[i] == 0) {
+            rows.push_back(values.definitions[i] ? "" : "null");
+        }
+        if (values.definitions[i] == 2) {
+            rows.back() += (keys ? keys->values[next] + "=" : "") + values.values[next] + ";";
+            next++;
+        }
+    }
+    return rows;
+}
+
+int
+main(int argc, char *argv[])
+{
+    logger::LogFile &dbglogfile = logger::LogFile::getDefaultInstance();
+    dbglogfile.setWriteDisk(true);
+    dbglogfile.setLogFilename("parquet-test.log");
+    dbglogfile.setVerbosity(3);
+
+    // The file starts and ends with the magic, with the length of the
+    // footer before the last one
+    std::string data = write(true, true, 3000, 1000);
+    std::uint32_t footer = 0;
+    if (data.size() > 12) {
+        std::memcpy(&footer, &data[data.size() - 8], sizeof(footer));
+    }
+    if (data.size() > 12 && data.compare(0, 4, "PAR1") == 0 && data.compare(data.size() - 4, 4, "PAR1") == 0 &&
+        footer < data.size() - 12) {
+        runtest.pass("Writer::close()");
+    } else {
+        runtest.fail("Writer::close()");
+    }
+
+    // The footer has the GeoParquet metadata
+    std::string geo = exporter::Exporter::geoMetadata(exporter::Exporter::tables().front());
+    if (data.find("geo") != std::string::npos && data.find(geo) != std::string::npos &&
+        geo.find("\"geometry_types\":[\"Point\"]") != std::string::npos &&
+        geo.find("\"primary_column\":\"geom\"") != std::string::npos) {
+        runtest.pass("Exporter::geoMetadata()");
+    } else {
+        runtest.fail("Exporter::geoMetadata()");
+    }
+
+    // Sorted IDs take a few bits each when delta encoded, instead of 8 bytes
+    std::size_t plain = write(false, true, 10000).size();
+    std::size_t delta = write(true, true, 10000).size();
+    if (delta > 0 && plain - delta > 10000 * 7) {
+        runtest.pass("Writer delta encoding");
+    } else {
+        runtest.fail("Writer delta encoding");
+    }
+
+    // Tag keys are written once in the dictionary, then as indexes
+    std::size_t strings = write(true, false, 10000).size();
+    if (delta > 0 && strings - delta > 10000 * 15) {
+        runtest.pass("Writer dictionary encoding");
+    } else {
+        runtest.fail("Writer dictionary encoding");
+    }
+
+    // What's written is read back, over several row groups with nulls,
+    // empty maps, negative and overflowing deltas, and dictionaries
+    // some groups fall back from
+    std::vector<Field> fields = {{"osm_id", int64, true},
+                                 {"version", int32},
+                                 {"timestamp", timestamp, true},
+                                 {"user", string, false, true},
+                                 {"tags", map, false, true},
+                                 {"values", list},
+                                 {"geom", binary}};
+    Writer writer(fields, 300);
+    writer.open("parquet-test.parquet");
+    std::map<std::string, std::vector<std::string>> expected;
+    for (long i = 0; i < 1000; i++) {
+        std::int64_t id = i == 500 ? INT64_MIN : i == 501 ? INT64_MAX : 1000000000 + i * 2 - i % 10 * 7;
+        if (i % 17 == 5) {
+            writer.null();
+            expected["osm_id"].push_back("null");
+        } else {
+            writer.integer(id);
+            expected["osm_id"].push_back(std::to_string(id));
+        }
+        writer.integer(i % 5 - 2);
+        expected["version"].push_back(std::to_string(i % 5 - 2));
+        if (i % 13 == 0) {
+            writer.null();
+            expected["timestamp"].push_back("null");
+        } else {
+            writer.integer(1600000000000000 + i * 1000000);
+            expected["timestamp"].push_back(std::to_string(1600000000000000 + i * 1000000));
+        }
+        std::string user = i < 600 ? "user" + std::to_string(i % 3) : "mapper" + std::to_string(i);
+        writer.bytes(user);
+        expected["user"].push_back(user);
+        std::string name = "N" + std::to_string(i);
+        if (i % 4 == 0) {
+            writer.null();
+            expected["tags"].push_back("null");
+        } else if (i % 4 == 1) {
+            writer.strings({});
+            expected["tags"].push_back("");
+        } else {
+            writer.strings({"building", "yes", "name", name, "note", ""});
+            expected["tags"].push_back("building=yes;name=" + name + ";note=;");
+        }
+        if (i % 11 == 0) {
+            writer.null();
+            expected["values"].push_back("null");
+        } else if (i % 3 == 0) {
+            writer.strings({"a", name});
+            expected["values"].push_back("a;" + name + ";");
+        } else {
+            writer.strings({});
+            expected["values"].push_back("");
+        }
+        std::string geom("\x01\x01\0\0\0", 5);
+        geom += name;
+        if (i % 2) {
+            writer.null();
+            expected["geom"].push_back("null");
+        } else {
+            writer.bytes(geom);
+            expected["geom"].push_back(geom);
+        }
+        writer.endRow();
+    }
+    writer.close();
+    std::ifstream file("parquet-test.parquet", std::ios::binary);
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    data = buffer.str();
+    std::map<std::string, Reader::Column> columns;
+    bool read = false;
+    try {
+        read = Reader(data).read(columns);
+    } catch (std::exception &e) {
+        log_error("Couldn't read the file back: %1%", e.what());
+    }
+    if (read && columns.size() == 8 && rows(columns["osm_id"], 1) == expected["osm_id"]
+        && rows(columns["version"], 1) == expected["version"]
+        && rows(columns["timestamp"], 1) == expected["timestamp"] && rows(columns["user"], 1) == expected["user"]
+        && rows(columns["tags.key_value.value"], &columns["tags.key_value.key"]) == expected["tags"]
+        && rows(columns["values.list.element"]) == expected["values"]
+        && rows(columns["geom"], 1) == expected["geom"]) {
+        runtest.pass("Writer round trip");
+    } else {
+        runtest.fail("Writer round trip");
+    }
+
+    // The same rows are read by pyarrow, if it's installed
+#ifdef PYARROW
+    std::string dump;
+    for (std::size_t i = 0; i < 1000; i++) {
+        for (const auto &column: {"osm_id", "version", "timestamp", "user", "tags", "values"}) {
+            dump += expected[column][i] + "\t";
+        }
+        const std::string &geom = expected["geom"][i];
+        if (geom == "null") {
+            dump += geom;
+        } else {
+            for (unsigned char byte: geom) {
+                dump += "0123456789abcdef"[byte >> 4];
+                dump += "0123456789abcdef"[byte & 15];
+            }
+        }
+        dump += "\n";
+    }
+    std::string command = std::string(PYARROW) + " " + DATADIR
+        + "/testsuite/libunderpass.all/parquet-check.py parquet-test.parquet";
+    std::string output;
+    FILE *pipe = popen(command.c_str(), "r");
+    if (pipe) {
+        char chunk[4096];
+        std::size_t size;
+        while ((size = fread(chunk, 1, sizeof(chunk), pipe)) > 0) {
+            output.append(chunk, size);
+        }
+    }
+    if (pipe && pclose(pipe) == 0 && output == dump) {
+        runtest.pass("Writer read by pyarrow");
+    } else {
+        runtest.fail("Writer read by pyarrow");
+    }
+#else
+    runtest.untested("Writer read by pyarrow");
+#endif
+
+    // Tables that can't be exported
+    exporter::Exporter exporter("localhost/underpass", ".");
+    if (!exporter.exportTable("changesets", 1, 1)) {
+        runtest.pass("Exporter::exportTable(unknown)");
+    } else {
+        runtest.fail("Exporter::exportTable(unknown)");
+    }
+}
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
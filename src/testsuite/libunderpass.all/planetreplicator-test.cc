@@ -57,8 +57,8 @@ void testPath(underpassconfig::UnderpassConfig config) {
         change.readChanges(osmchange->filespec);
     } else {
         TestPlanet planet;
-        auto data = planet.downloadFile(osmchange->getURL()).data;
-        auto xml = planet.processData(osmchange->filespec, *data);
+        auto file = planet.downloadFile(osmchange->getURL());
+        auto xml = planet.processData(osmchange->filespec, file);
         std::istream& input(xml);
         change.readXML(input);
     }
@@ -0,0 +1,199 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <cstdlib>
+#include <dejagnu.h>
+#include <fstream>
+#include <iterator>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <pqxx/pqxx>
+#include "osm/changeset.hh"
+#include "osm/osmchange.hh"
+#include "stats/querystats.hh"
+#include "utils/log.hh"
+
+TestState runtest;
+
+using namespace logger;
+using namespace querystats;
+
+/// \file querystats-test.cc
+/// \brief Test the batched queries for the changesets table
+
+/// Clear the test DB and create the tables
+bool
+initTestDB(const std::string &dbconn)
+{
+    std::string root = getenv("UNDERPASS_SOURCE_TREE_ROOT") ? getenv("UNDERPASS_SOURCE_TREE_ROOT") : "../";
+    std::ifstream schema(root + "setup/db/underpass.sql");
+    std::string sql((std::istreambuf_iterator<char>(schema)), std::istreambuf_iterator<char>());
+    if (sql.empty()) {
+        return false;
+    }
+    try {
+        {
+            pqxx::connection conn{dbconn + " dbname=template1"};
+            pqxx::nontransaction worker{conn};
+            worker.exec0("DROP DATABASE IF EXISTS underpass_test");
+            worker.exec0("CREATE DATABASE underpass_test");
+        }
+        pqxx::connection conn{dbconn + " dbname=underpass_test"};
+        pqxx::nontransaction worker{conn};
+        worker.exec0("CREATE EXTENSION postgis");
+        worker.exec0("CREATE EXTENSION hstore");
+        worker.exec0(sql);
+    } catch (std::exception &e) {
+        log_error("Couldn't create the test database: %1%", e.what());
+        return false;
+    }
+    return true;
+}
+
+/// The rows returned by \a query, a line each with the columns
+/// separated by |, and nothing for NULL
+std::string
+rows(Pq &db, const std::string &query)
+{
+    std::string result;
+    for (const auto &row: db.query(query)) {
+        for (std::size_t i = 0; i < row.size(); i++) {
+            if (i > 0) {
+                result += "|";
+            }
+            if (!row[i].is_null()) {
+                result += row[i].c_str();
+            }
+        }
+        result += "\n";
+    }
+    return result;
+}
+
+/// The statistics of a changeset in a file
+std::shared_ptr<osmchange::ChangeStats>
+makeStats(long id, ptime closed_at)
+{
+    auto change = std::make_shared<osmchange::ChangeStats>();
+    change->changeset = id;
+    change->uid = 100 + id;
+    change->closed_at = closed_at;
+    return change;
+}
+
+int
+main(int argc, char *argv[])
+{
+    logger::LogFile &dbglogfile = logger::LogFile::getDefaultInstance();
+    dbglogfile.setWriteDisk(true);
+    dbglogfile.setLogFilename("querystats-test.log");
+    dbglogfile.setVerbosity(3);
+
+    const std::string dbconn{getenv("UNDERPASS_TEST_DB_CONN")
+                                    ? getenv("UNDERPASS_TEST_DB_CONN")
+                                    : "user=underpass_test host=localhost password=underpass_test"};
+
+    auto db = std::make_shared<Pq>();
+    if (!initTestDB(dbconn) || !db->connect(dbconn + " dbname=underpass_test")) {
+        runtest.untested("QueryStats::applyChanges(no database)");
+        return 0;
+    }
+    QueryStats querystats(db);
+
+    statsaggregator::flushed_t stats;
+    if (querystats.applyChanges(stats).empty()) {
+        runtest.pass("QueryStats::applyChanges(no statistics)");
+    } else {
+        runtest.fail("QueryStats::applyChanges(no statistics)");
+    }
+
+    const std::string counts = "SELECT id, uid, closed_at = '2023-05-01 10:00:00', added->'highway',"
+                               " added->'building''s', modified->'building', array_to_string(files, ',')"
+                               " FROM changesets ORDER BY id";
+    auto closed = time_from_string("2023-05-01 10:00:00");
+    for (long id: {1, 2, 3}) {
+        stats[id][5001001] = makeStats(id, closed);
+    }
+    stats[1][5001001]->added["highway"] = 2;
+    stats[1][5001001]->added["building's"] = 1;
+    stats[1][5001001]->modified["waterway"] = 0;
+    // Nothing to store for changeset 2
+    stats[3][5001001]->modified["building"] = 4;
+    db->query(querystats.applyChanges(stats));
+    if (rows(*db, counts) == "1|101|t|2|1||5001001\n3|103|t|||4|5001001\n") {
+        runtest.pass("QueryStats::applyChanges(statistics)");
+    } else {
+        runtest.fail("QueryStats::applyChanges(statistics)");
+    }
+
+    // A file written again isn't counted twice
+    db->query(querystats.applyChanges(stats));
+    if (rows(*db, counts) == "1|101|t|2|1||5001001\n3|103|t|||4|5001001\n") {
+        runtest.pass("QueryStats::applyChanges(idempotent)");
+    } else {
+        runtest.fail("QueryStats::applyChanges(idempotent)");
+    }
+
+    // The next file is added to the counts, while the one before in the
+    // same flush is skipped
+    stats[1][5001002] = makeStats(1, closed);
+    stats[1][5001002]->added["highway"] = 3;
+    stats.erase(3);
+    db->query(querystats.applyChanges(stats));
+    if (rows(*db, counts) == "1|101|t|5|1||5001001,5001002\n3|103|t|||4|5001001\n") {
+        runtest.pass("QueryStats::applyChanges(added)");
+    } else {
+        runtest.fail("QueryStats::applyChanges(added)");
+    }
+
+    std::list<std::shared_ptr<changesets::ChangeSet>> changes;
+    for (long id: {5, 4, 5}) {
+        auto change = std::make_shared<changesets::ChangeSet>();
+        change->id = id;
+        change->uid = 7;
+        change->editor = "iD";
+        change->created_at = closed;
+        change->min_lat = 1.0;
+        change->max_lat = 2.0;
+        change->min_lon = 3.0;
+        change->max_lon = 4.0;
+        changes.push_back(change);
+    }
+    changes.front()->hashtags.insert("#hot");
+    changes.back()->hashtags.insert("#it's");
+    changes.back()->hashtags.insert("#\"quoted\"");
+    changes.back()->source = "Bing";
+
+    // The last of the duplicate IDs is the one stored
+    db->query(querystats.applyChanges(changes));
+    if (rows(*db, "SELECT id, uid, editor, array_to_string(hashtags, ' '), source, ST_XMin(bbox), ST_YMin(bbox),"
+                  " ST_XMax(bbox), ST_YMax(bbox) FROM changesets WHERE id IN (4, 5) ORDER BY id")
+        == "4|7|iD|||3|1|4|2\n5|7|iD|#&quot;quoted&quot; #it's|Bing|3|1|4|2\n") {
+        runtest.pass("QueryStats::applyChanges(changesets)");
+    } else {
+        runtest.fail("QueryStats::applyChanges(changesets)");
+    }
+}
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
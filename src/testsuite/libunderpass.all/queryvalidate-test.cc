@@ -0,0 +1,144 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <cstdlib>
+#include <dejagnu.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "validate/queryvalidate.hh"
+#include "utils/log.hh"
+
+TestState runtest;
+
+using namespace logger;
+using namespace queryvalidate;
+
+/// \file queryvalidate-test.cc
+/// \brief Test the batched queries for the validation table
+
+// A validated building
+std::shared_ptr<ValidateStatus>
+makeStatus(long osm_id, long version)
+{
+    auto status = std::make_shared<ValidateStatus>();
+    status->osm_id = osm_id;
+    status->version = version;
+    status->changeset = 10;
+    status->uid = 20;
+    status->objtype = osmobjects::way;
+    status->timestamp = time_from_string("2023-05-01 10:00:00");
+    status->center = point_t(1.5, 2.5);
+    status->source = "building";
+    return status;
+}
+
+int
+main(int argc, char *argv[])
+{
+    logger::LogFile &dbglogfile = logger::LogFile::getDefaultInstance();
+    dbglogfile.setWriteDisk(true);
+    dbglogfile.setLogFilename("queryvalidate-test.log");
+    dbglogfile.setVerbosity(3);
+
+    const std::string dbconn{getenv("UNDERPASS_TEST_DB_CONN")
+                                    ? getenv("UNDERPASS_TEST_DB_CONN")
+                                    : "user=underpass_test host=localhost password=underpass_test"};
+
+    // The connection is only used to escape strings
+    auto db = std::make_shared<Pq>();
+    if (!db->connect(dbconn + " dbname=template1")) {
+        runtest.untested("ValidationBatch::query(no database)");
+        return 0;
+    }
+    QueryValidate queryvalidate(db);
+
+    ValidationBatch empty(db);
+    if (empty.empty() && empty.query().empty()) {
+        runtest.pass("ValidationBatch::query(empty)");
+    } else {
+        runtest.fail("ValidationBatch::query(empty)");
+    }
+
+    auto wayval = std::make_shared<std::vector<std::shared_ptr<ValidateStatus>>>();
+    wayval->push_back(makeStatus(1, 1));
+    wayval->back()->status.insert(overlapping);
+    wayval->push_back(makeStatus(2, 3));
+    wayval->back()->status.insert(badvalue);
+    wayval->back()->values.insert("it's \"odd\"");
+    // A later version of way 1 that isn't overlapping anymore
+    wayval->push_back(makeStatus(1, 2));
+    wayval->back()->status.insert(duplicate);
+    // No status at all
+    wayval->push_back(makeStatus(3, 1));
+
+    ValidationBatch batch(db);
+    auto removals = std::make_shared<std::vector<long>>();
+    queryvalidate.ways(wayval, batch, removals);
+    auto query = batch.query();
+    std::cout << query << std::endl;
+
+    // One statement for the deletes, and one for the upserts
+    if (std::count(query.begin(), query.end(), ';') == 2 &&
+        query.find("DELETE FROM validation WHERE (osm_id, status, source) IN (") == 0 &&
+        query.find("(1,'overlapping','building')") != std::string::npos &&
+        query.find("(2,'duplicate','building')") != std::string::npos &&
+        query.find("(osm_id, status) IN ((1,'badvalue'))") != std::string::npos) {
+        runtest.pass("ValidationBatch::query(delete)");
+    } else {
+        runtest.fail("ValidationBatch::query(delete)");
+    }
+
+    // The overlapping row of version 1 was deleted by version 2
+    if (query.find("ARRAY[1,2]::int8[]") != std::string::npos &&
+        query.find("ARRAY['duplicate','badvalue']::status[]") != std::string::npos &&
+        query.find("ARRAY[NULL,'{\"it''s \\\"odd\\\"\"}']::text[]") != std::string::npos &&
+        query.find("ARRAY['POINT(1.5 2.5)','POINT(1.5 2.5)']::text[]") != std::string::npos &&
+        query.find("ARRAY[2,3]::int8[]") != std::string::npos &&
+        query.find("ON CONFLICT (osm_id, status, source) DO UPDATE") != std::string::npos) {
+        runtest.pass("ValidationBatch::query(upsert)");
+    } else {
+        runtest.fail("ValidationBatch::query(upsert)");
+    }
+
+    if (removals->size() == 1 && removals->front() == 3) {
+        runtest.pass("QueryValidate::ways(removals)");
+    } else {
+        runtest.fail("QueryValidate::ways(removals)");
+    }
+
+    // A row deleted and then added again is in both statements
+    ValidationBatch readded(db);
+    auto status = makeStatus(4, 1);
+    readded.remove(4, badgeom, "building");
+    readded.add(*status, badgeom);
+    query = readded.query();
+    if (query.find("(4,'badgeom','building')") != std::string::npos &&
+        query.find("INSERT INTO validation") != std::string::npos) {
+        runtest.pass("ValidationBatch::query(readded)");
+    } else {
+        runtest.fail("ValidationBatch::query(readded)");
+    }
+}
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
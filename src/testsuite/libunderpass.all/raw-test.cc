@@ -133,6 +133,14 @@ getWKTFromDB(const std::string &table, const long id, std::shared_ptr<Pq> &db) {
     }
 }
 
+// The rings may start at another node, so the geometries are compared
+// instead of their text, at the precision of OSM coordinates
+bool
+sameGeometryInDB(const long id, const std::string &expected, std::shared_ptr<Pq> &db) {
+    auto result = db->query("SELECT ST_Equals(ST_SnapToGrid(geom, 0.0000001), ST_SnapToGrid(ST_GeomFromText('" + expected + "', 4326), 0.0000001)) from relations where osm_id=" + std::to_string(id));
+    return !result.empty() && result[0][0].as<bool>();
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -232,7 +240,7 @@ main(int argc, char *argv[])
         // }
 
         processFile("raw-case-9.osc", db);
-        if ( getWKTFromDB("relations", 16193116, db).compare(expectedGeometries[8]) == 0) {
+        if (sameGeometryInDB(16193116, expectedGeometries[8], db)) {
             runtest.pass("Complex, 2 polygon relation made of multiple ways (same changeset)");
         } else {
             runtest.fail("Complex, 2 polygon relation made of multiple ways (same changeset)");
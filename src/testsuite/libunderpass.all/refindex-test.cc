@@ -0,0 +1,138 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <dejagnu.h>
+#include <iostream>
+#include <set>
+#include <string>
+
+#include "raw/refindex.hh"
+#include "utils/log.hh"
+
+TestState runtest;
+
+using namespace logger;
+using namespace queryraw;
+
+/// \file refindex-test.cc
+/// \brief Test the in memory index of references
+
+/// The parents of \a child
+std::set<long>
+parents(const RefIndex &index, long child)
+{
+    std::set<long> result;
+    index.parents(child, result);
+    return result;
+}
+
+int
+main(int argc, char *argv[])
+{
+    logger::LogFile &dbglogfile = logger::LogFile::getDefaultInstance();
+    dbglogfile.setWriteDisk(true);
+    dbglogfile.setLogFilename("refindex-test.log");
+    dbglogfile.setVerbosity(3);
+
+    // Nodes 1 to 3 used by ways 10 and 11, with large and negative IDs
+    RefIndex index;
+    index.assign({{1, 10}, {2, 10}, {2, 11}, {3, 11}, {2, 11}, {1, 8000000000}, {-5, -20}});
+    if (index.size() == 6 && parents(index, 2) == std::set<long>({10, 11})
+        && parents(index, 1) == std::set<long>({10, 8000000000}) && parents(index, -5) == std::set<long>({-20})
+        && parents(index, 4).empty()) {
+        runtest.pass("RefIndex::assign()");
+    } else {
+        runtest.fail("RefIndex::assign()");
+    }
+
+    // Way 10 now uses nodes 3 and 4, and way 12 is new
+    index.update(10, {3, 4}, 2);
+    index.update(12, {4}, 1);
+    if (parents(index, 1) == std::set<long>({8000000000}) && parents(index, 2) == std::set<long>({11})
+        && parents(index, 3) == std::set<long>({10, 11}) && parents(index, 4) == std::set<long>({10, 12})) {
+        runtest.pass("RefIndex::update()");
+    } else {
+        runtest.fail("RefIndex::update()");
+    }
+
+    // An older version doesn't replace a newer one
+    index.update(10, {1}, 1);
+    if (parents(index, 1) == std::set<long>({8000000000}) && parents(index, 3) == std::set<long>({10, 11})) {
+        runtest.pass("RefIndex::update(older)");
+    } else {
+        runtest.fail("RefIndex::update(older)");
+    }
+
+    // A removed way has no references
+    index.update(11, {}, 3);
+    if (parents(index, 2).empty() && parents(index, 3) == std::set<long>({10})) {
+        runtest.pass("RefIndex::update(removed)");
+    } else {
+        runtest.fail("RefIndex::update(removed)");
+    }
+
+    index.compact();
+    if (index.size() == 5 && parents(index, 3) == std::set<long>({10}) && parents(index, 4) == std::set<long>({10, 12})
+        && parents(index, -5) == std::set<long>({-20}) && parents(index, 2).empty()) {
+        runtest.pass("RefIndex::compact()");
+    } else {
+        runtest.fail("RefIndex::compact()");
+    }
+
+    // Enough updates are compacted on their own
+    std::vector<std::pair<long, long>> pairs;
+    for (long way = 0; way < 100000; way++) {
+        pairs.emplace_back(way, way);
+        pairs.emplace_back(way + 1, way);
+    }
+    index.assign(pairs);
+    std::size_t memory = index.memory();
+    std::vector<RefUpdate> updates;
+    for (long way = 0; way < 70000; way++) {
+        updates.push_back({way, {way + 2}, 1});
+    }
+    index.update(updates);
+    if (index.size() > 100000 && parents(index, 2) == std::set<long>({0}) && parents(index, 1).empty()
+        && memory < pairs.size() * sizeof(long)) {
+        runtest.pass("RefIndex::update(compact)");
+    } else {
+        runtest.fail("RefIndex::update(compact)");
+    }
+
+    // A file with enough updates to compact, where an older version of
+    // way 1 comes after a newer one, only compacts once it's all applied
+    updates.clear();
+    updates.push_back({1, {200001}, 5});
+    for (long way = 2; way < 70000; way++) {
+        updates.push_back({way, {way + 3}, 2});
+    }
+    updates.push_back({1, {200002}, 3});
+    index.update(updates);
+    if (parents(index, 200001) == std::set<long>({1}) && parents(index, 200002).empty()
+        && parents(index, 5) == std::set<long>({2}) && index.size() > 100000) {
+        runtest.pass("RefIndex::update(out of order)");
+    } else {
+        runtest.fail("RefIndex::update(out of order)");
+    }
+}
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
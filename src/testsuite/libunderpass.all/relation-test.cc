@@ -0,0 +1,158 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <dejagnu.h>
+#include <iostream>
+#include <string>
+
+#include "osm/osmchange.hh"
+#include "osm/relationbuilder.hh"
+#include "utils/log.hh"
+
+TestState runtest;
+
+using namespace logger;
+using namespace osmchange;
+using namespace osmobjects;
+
+/// \file relation-test.cc
+/// \brief Test building the geometry of relations from their ways
+
+/// A way from its node IDs, at x = ID and y = 0 unless given
+RelationBuilder::Line
+line(const std::vector<long> &refs, const std::vector<point_t> &points = {})
+{
+    RelationBuilder::Line line;
+    line.refs = refs;
+    for (std::size_t i = 0; i < refs.size(); i++) {
+        line.points.push_back(points.empty() ? point_t(refs[i], 0) : points[i]);
+    }
+    return line;
+}
+
+/// Build the relations of a file from its own ways
+std::shared_ptr<OsmRelation>
+build(const std::string &file)
+{
+    OsmChangeFile osc;
+    osc.readChanges(std::string(DATADIR) + "/testsuite/testdata/raw/" + file);
+    osc.buildGeometriesFromNodeCache();
+    for (const auto &change: osc.changes) {
+        if (!change->relations.empty()) {
+            return change->relations.front();
+        }
+    }
+    return std::make_shared<OsmRelation>();
+}
+
+int
+main(int argc, char *argv[])
+{
+    logger::LogFile &dbglogfile = logger::LogFile::getDefaultInstance();
+    dbglogfile.setWriteDisk(true);
+    dbglogfile.setLogFilename("relation-test.log");
+    dbglogfile.setVerbosity(3);
+
+    // Ways in any direction and order are joined at their ends
+    std::vector<RelationBuilder::Line> joined;
+    bool closed = RelationBuilder::join({line({3, 4, 1}), line({1, 2}), line({3, 2})}, joined, true);
+    if (closed && joined.size() == 1 && joined[0].refs == std::vector<long>({3, 4, 1, 2, 3})) {
+        runtest.pass("RelationBuilder::join(rings)");
+    } else {
+        runtest.fail("RelationBuilder::join(rings)");
+    }
+
+    joined.clear();
+    if (!RelationBuilder::join({line({1, 2}), line({2, 3})}, joined, true) && joined.empty()) {
+        runtest.pass("RelationBuilder::join(open ring)");
+    } else {
+        runtest.fail("RelationBuilder::join(open ring)");
+    }
+
+    joined.clear();
+    RelationBuilder::join({line({2, 3}), line({1, 2}), line({3, 4}), line({7, 8})}, joined, false);
+    if (joined.size() == 2 && joined[0].refs.size() == 4 && joined[1].refs.size() == 2) {
+        runtest.pass("RelationBuilder::join(lines)");
+    } else {
+        runtest.fail("RelationBuilder::join(lines)");
+    }
+
+    // An island in a lake in a forest, and another forest next to it
+    auto square = [](long id, double x, double y, double size) {
+        return line({id, id + 1, id + 2, id + 3, id},
+                    {point_t(x, y), point_t(x + size, y), point_t(x + size, y + size),
+                     point_t(x, y + size), point_t(x, y)});
+    };
+    auto nested = RelationBuilder::nest({square(10, 2, 2, 6), square(20, 4, 4, 2),
+                                         square(1, 0, 0, 10), square(30, 20, 0, 1)});
+    if (nested.size() == 3 && nested[0].inners().size() == 1 && nested[1].inners().empty()
+        && boost::geometry::area(nested) == 100 - 36 + 4 + 1) {
+        runtest.pass("RelationBuilder::nest()");
+    } else {
+        runtest.fail("RelationBuilder::nest()");
+    }
+
+    // A multipolygon of two outers, each made of several ways
+    auto relation = build("raw-case-9.osc");
+    if (relation->multipolygon.size() == 2 && boost::geometry::is_valid(relation->multipolygon)) {
+        runtest.pass("RelationBuilder::build(multipolygon)");
+    } else {
+        runtest.fail("RelationBuilder::build(multipolygon)");
+    }
+
+    // The roles don't matter, the inner is inside the outer
+    relation = build("raw-case-8.osc");
+    if (relation->multipolygon.size() == 1 && relation->multipolygon[0].inners().size() == 1) {
+        runtest.pass("RelationBuilder::build(inner)");
+    } else {
+        runtest.fail("RelationBuilder::build(inner)");
+    }
+
+    relation = build("raw-case-6.osc");
+    if (relation->multilinestring.size() == 1 && relation->multipolygon.empty()) {
+        runtest.pass("RelationBuilder::build(multilinestring)");
+    } else {
+        runtest.fail("RelationBuilder::build(multilinestring)");
+    }
+
+    // A way that isn't cached leaves the geometry empty
+    RelationBuilder::waycache_t waycache;
+    RelationBuilder builder(waycache);
+    OsmRelation missing;
+    missing.addTag("type", "multipolygon");
+    missing.addMember(42, osmobjects::way, "outer");
+    std::set<long> ids;
+    builder.missing(missing, ids);
+    std::vector<OsmRelation> copies(64, missing);
+    std::vector<OsmRelation *> relations;
+    for (auto &copy: copies) {
+        relations.push_back(&copy);
+    }
+    if (!builder.build(missing) && missing.multipolygon.empty() && ids.count(42)
+        && builder.build(relations, 4) == 0) {
+        runtest.pass("RelationBuilder::build(missing way)");
+    } else {
+        runtest.fail("RelationBuilder::build(missing way)");
+    }
+}
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,111 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <dejagnu.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <boost/filesystem.hpp>
+
+#include "replicator/replay.hh"
+#include "data/pq.hh"
+#include "underpassconfig.hh"
+#include "utils/log.hh"
+
+TestState runtest;
+
+using namespace logger;
+
+/// \file replay-test.cc
+/// \brief Test reading replication files from a local tree
+
+void
+touch(const boost::filesystem::path &path)
+{
+    boost::filesystem::create_directories(path.parent_path());
+    std::ofstream out(path.string());
+    out << "not empty";
+}
+
+int
+main(int argc, char *argv[])
+{
+    logger::LogFile &dbglogfile = logger::LogFile::getDefaultInstance();
+    dbglogfile.setWriteDisk(true);
+    dbglogfile.setLogFilename("replay-test.log");
+    dbglogfile.setVerbosity(3);
+
+    auto directory = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    touch(directory / "005/999/999.osc.gz");
+    touch(directory / "005/999/999.state.txt");
+    touch(directory / "006/000/000.osc.gz");
+    touch(directory / "006/000/001.osc.gz");
+    touch(directory / "006/000/README.md");
+
+    underpassconfig::UnderpassConfig config;
+    config.replay = directory.string();
+    replay::Replay replayer(config);
+    if (replayer.scan() && replayer.first == 5999999 && replayer.last == 6000001) {
+        runtest.pass("Replay::scan()");
+    } else {
+        runtest.fail("Replay::scan()");
+    }
+
+    replay::ReplayPlanet planet(directory.string());
+    replication::RemoteURL remote("https://planet.openstreetmap.org/replication/minute/006/000/001.osc.gz");
+    auto file = planet.downloadFile(remote);
+    if (file.status == replication::reqfile_t::success && file.size() == 9) {
+        runtest.pass("ReplayPlanet::downloadFile()");
+    } else {
+        runtest.fail("ReplayPlanet::downloadFile()");
+    }
+
+    // The end of the tree is like a file that isn't on the server yet
+    remote.increment();
+    file = planet.downloadFile(remote);
+    if (file.status == replication::reqfile_t::remoteNotFound) {
+        runtest.pass("ReplayPlanet::downloadFile(end)");
+    } else {
+        runtest.fail("ReplayPlanet::downloadFile(end)");
+    }
+
+    // A copy of the cache directory, with the server's layout
+    touch(directory / "replication/minute/007/000/000.osc.gz");
+    remote.updatePath(7, 0, 0);
+    if (planet.localPath(remote) == (directory / "replication/minute/007/000/000.osc.gz").string()) {
+        runtest.pass("ReplayPlanet::localPath()");
+    } else {
+        runtest.fail("ReplayPlanet::localPath()");
+    }
+
+    // Without a connection the SQL is generated, then discarded
+    pq::Pq db;
+    if (db.escapedString("it's").find("''") != std::string::npos && db.query("SELECT 1;").empty()) {
+        runtest.pass("Pq::query(discard)");
+    } else {
+        runtest.fail("Pq::query(discard)");
+    }
+
+    boost::filesystem::remove_all(directory);
+}
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,90 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __SAMECHANGES_HH__
+#define __SAMECHANGES_HH__
+
+/// \file samechanges.hh
+/// \brief Compare parsed OsmChange files, for the tests of the parsers
+/// and of the encoded format
+
+#include "osm/osmchange.hh"
+#include "osm/osmobjects.hh"
+
+// Compare the fields common to all objects
+inline bool
+sameObject(const osmobjects::OsmObject &a, const osmobjects::OsmObject &b)
+{
+    return a.action == b.action && a.type == b.type && a.id == b.id &&
+        a.version == b.version && a.timestamp == b.timestamp &&
+        a.uid == b.uid && a.user == b.user && a.changeset == b.changeset &&
+        a.tags == b.tags;
+}
+
+// Compare everything the parsers fill in
+inline bool
+sameChanges(const osmchange::OsmChangeFile &a, const osmchange::OsmChangeFile &b)
+{
+    if (a.changes.size() != b.changes.size() || a.nodecache.size() != b.nodecache.size()) {
+        return false;
+    }
+    for (auto it = a.nodecache.begin(), bit = b.nodecache.begin(); it != a.nodecache.end(); ++it, ++bit) {
+        if (it->first != bit->first || it->second.get<0>() != bit->second.get<0>() ||
+            it->second.get<1>() != bit->second.get<1>()) {
+            return false;
+        }
+    }
+    for (auto it = a.changes.begin(), bit = b.changes.begin(); it != a.changes.end(); ++it, ++bit) {
+        osmchange::OsmChange *x = it->get();
+        osmchange::OsmChange *y = bit->get();
+        if (x->action != y->action || x->final_entry != y->final_entry ||
+            x->nodes.size() != y->nodes.size() || x->ways.size() != y->ways.size() ||
+            x->relations.size() != y->relations.size()) {
+            return false;
+        }
+        for (auto nit = x->nodes.begin(), nbit = y->nodes.begin(); nit != x->nodes.end(); ++nit, ++nbit) {
+            if (!sameObject(**nit, **nbit)) {
+                return false;
+            }
+        }
+        for (auto wit = x->ways.begin(), wbit = y->ways.begin(); wit != x->ways.end(); ++wit, ++wbit) {
+            if (!sameObject(**wit, **wbit) || (*wit)->refs != (*wbit)->refs) {
+                return false;
+            }
+        }
+        for (auto rit = x->relations.begin(), rbit = y->relations.begin(); rit != x->relations.end(); ++rit, ++rbit) {
+            if (!sameObject(**rit, **rbit) || (*rit)->members.size() != (*rbit)->members.size()) {
+                return false;
+            }
+            for (auto mit = (*rit)->members.begin(), mbit = (*rbit)->members.begin(); mit != (*rit)->members.end(); ++mit, ++mbit) {
+                if (mit->ref != mbit->ref || mit->type != mbit->type || mit->role != mbit->role) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+#endif // EOF __SAMECHANGES_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
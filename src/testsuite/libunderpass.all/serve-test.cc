@@ -0,0 +1,130 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <dejagnu.h>
+#include <iostream>
+#include <string>
+
+#include "serve/rawquery.hh"
+#include "utils/log.hh"
+
+TestState runtest;
+
+using namespace logger;
+
+/// \file serve-test.cc
+/// \brief Test the requests of underpass-serve, without a database
+
+int
+main(int argc, char *argv[])
+{
+    logger::LogFile &dbglogfile = logger::LogFile::getDefaultInstance();
+    dbglogfile.setWriteDisk(true);
+    dbglogfile.setLogFilename("serve-test.log");
+    dbglogfile.setVerbosity(3);
+
+    if (serve::RawQuery::urlDecode("highway%3Dprimary+road") == "highway=primary road") {
+        runtest.pass("RawQuery::urlDecode()");
+    } else {
+        runtest.fail("RawQuery::urlDecode()");
+    }
+
+    if (serve::RawQuery::arrayLiteral({"building", "a \"b\""}) == "{\"building\",\"a \\\"b\\\"\"}") {
+        runtest.pass("RawQuery::arrayLiteral()");
+    } else {
+        runtest.fail("RawQuery::arrayLiteral()");
+    }
+
+    std::string error;
+    serve::RawRequest request;
+    if (request.parse("/raw/polygons?tags=building%3Dyes,amenity&status=badgeom&after=42&limit=100000", "", error)
+        && request.table == "ways_poly" && request.keys.size() == 2 && request.values[0] == "yes"
+        && request.values[1] == "" && request.status == "badgeom" && request.after == 42
+        && request.limit == serve::RawRequest::maxLimit && !request.area && !request.hashtag) {
+        runtest.pass("RawRequest::parse(query string)");
+    } else {
+        runtest.fail("RawRequest::parse(query string)");
+    }
+
+    // The JSON body of the Python API, with null for unused filters
+    serve::RawRequest post;
+    if (post.parse("/raw/nodes", "{\"area\": \"1 2,3 4,1 2\", \"hashtag\": \"hotosm\", \"dateFrom\": null, \"format\": \"fgb\"}", error)
+        && post.table == "nodes" && post.area == "1 2,3 4,1 2" && post.hashtag == "hotosm"
+        && !post.dateFrom && post.statement() == "raw_nodes_fgb") {
+        runtest.pass("RawRequest::parse(body)");
+    } else {
+        runtest.fail("RawRequest::parse(body)");
+    }
+
+    serve::RawRequest bad;
+    if (!bad.parse("/raw/polygons?status=nonsense", "", error) && !error.empty()
+        && !bad.parse("/raw/relations", "", error)
+        && !bad.parse("/raw/lines?limit=-1", "", error)
+        && !bad.parse("/raw/lines", "{not json", error)) {
+        runtest.pass("RawRequest::parse(invalid)");
+    } else {
+        runtest.fail("RawRequest::parse(invalid)");
+    }
+
+    serve::TileRequest tile;
+    if (tile.parse("/raw/lines/14/8192/5461.mvt?tags=highway", error) && tile.z == 14
+        && tile.x == 8192 && tile.y == 5461 && tile.filters.keys[0] == "highway"
+        && tile.statement() == "raw_ways_line_mvt") {
+        runtest.pass("TileRequest::parse()");
+    } else {
+        runtest.fail("TileRequest::parse()");
+    }
+
+    serve::TileRequest outside;
+    if (!outside.parse("/raw/lines/2/4/0.mvt", error) && !outside.parse("/raw/lines/2/a/0.mvt", error)) {
+        runtest.pass("TileRequest::parse(invalid)");
+    } else {
+        runtest.fail("TileRequest::parse(invalid)");
+    }
+
+    serve::ValidationTile validation;
+    if (validation.parse("/validation/14/12075/6878.mvt?status=badgeom,badvalue", error)
+        && validation.z == 14 && validation.statuses.size() == 2 && validation.statuses[1] == "badvalue"
+        && !validation.parse("/validation/14/12075/6878.mvt?status=nonsense", error)) {
+        runtest.pass("ValidationTile::parse()");
+    } else {
+        runtest.fail("ValidationTile::parse()");
+    }
+
+    // Pages follow the osm_id instead of an offset
+    auto sql = serve::RawQuery::features("ways_poly", "geojson");
+    if (sql.find("t.osm_id > $8 ORDER BY t.osm_id LIMIT $9") != std::string::npos
+        && sql.find("OFFSET") == std::string::npos && sql.find("'Polygon'") != std::string::npos) {
+        runtest.pass("RawQuery::features()");
+    } else {
+        runtest.fail("RawQuery::features()");
+    }
+
+    if (serve::RawQuery::header(0) == "{\"type\":\"FeatureCollection\",\"next\":null,\"features\":["
+        && serve::RawQuery::header(7).find("\"next\":7") != std::string::npos) {
+        runtest.pass("RawQuery::header()");
+    } else {
+        runtest.fail("RawQuery::header()");
+    }
+}
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,137 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <dejagnu.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include "stats/statsaggregator.hh"
+#include "utils/log.hh"
+
+TestState runtest;
+
+using namespace logger;
+using namespace statsaggregator;
+
+/// \file statsaggregator-test.cc
+/// \brief Test summing changeset statistics across files
+
+// The statistics of one changeset in one file
+statsmap_t
+makeStats(long id, const std::string &closed_at, int highways, int buildings)
+{
+    auto change = std::make_shared<osmchange::ChangeStats>();
+    change->changeset = id;
+    change->uid = 1;
+    change->closed_at = time_from_string(closed_at);
+    change->added["highway"] = highways;
+    change->modified["building"] = buildings;
+    statsmap_t stats;
+    stats[id] = change;
+    return stats;
+}
+
+// The sum of the \a key counts of \a column in all the files
+int
+total(const filestats_t &files, std::map<std::string, int> osmchange::ChangeStats::*column, const std::string &key)
+{
+    int sum = 0;
+    for (const auto &[file, change]: files) {
+        auto found = ((*change).*column).find(key);
+        if (found != ((*change).*column).end()) {
+            sum += found->second;
+        }
+    }
+    return sum;
+}
+
+int
+main(int argc, char *argv[])
+{
+    logger::LogFile &dbglogfile = logger::LogFile::getDefaultInstance();
+    dbglogfile.setWriteDisk(true);
+    dbglogfile.setLogFilename("statsaggregator-test.log");
+    dbglogfile.setVerbosity(3);
+
+    StatsAggregator aggregator(minutes(10), minutes(60));
+
+    // Changeset 1 spans three minutely files
+    auto first = makeStats(1, "2023-05-01 10:00:00", 2, 1);
+    aggregator.merge(first, 1000, time_from_string("2023-05-01 10:00:30"));
+    aggregator.merge(makeStats(1, "2023-05-01 10:01:00", 3, 0), 1001, time_from_string("2023-05-01 10:01:30"));
+    aggregator.merge(makeStats(2, "2023-05-01 10:02:00", 1, 1), 1002, time_from_string("2023-05-01 10:02:30"));
+    aggregator.merge(makeStats(1, "2023-05-01 10:02:00", 1, 4), 1002, time_from_string("2023-05-01 10:02:30"));
+
+    if (aggregator.flush().empty() && aggregator.size() == 2) {
+        runtest.pass("StatsAggregator::flush(open)");
+    } else {
+        runtest.fail("StatsAggregator::flush(open)");
+    }
+
+    // The caller's statistics aren't changed
+    if (first[1]->added["highway"] == 2) {
+        runtest.pass("StatsAggregator::merge(copy)");
+    } else {
+        runtest.fail("StatsAggregator::merge(copy)");
+    }
+
+    // Nothing new for changeset 1 in the next 10 minutes closes it
+    aggregator.merge(makeStats(2, "2023-05-01 10:12:10", 1, 0), 1012, time_from_string("2023-05-01 10:12:30"));
+    auto flushed = aggregator.flush();
+    if (flushed.size() == 1 && flushed.count(1) && flushed[1].size() == 3 &&
+        total(flushed[1], &osmchange::ChangeStats::added, "highway") == 6 &&
+        total(flushed[1], &osmchange::ChangeStats::modified, "building") == 5 &&
+        flushed[1].rbegin()->second->closed_at == time_from_string("2023-05-01 10:02:00")) {
+        runtest.pass("StatsAggregator::flush(closed)");
+    } else {
+        runtest.fail("StatsAggregator::flush(closed)");
+    }
+
+    // Changeset 2 is still being edited, but ages out after an hour
+    for (int minute = 13; minute < 60; minute++) {
+        auto timestamp = "2023-05-01 10:" + std::to_string(minute) + ":00";
+        aggregator.merge(makeStats(2, timestamp, 1, 0), 1000 + minute, time_from_string(timestamp));
+    }
+    aggregator.merge(makeStats(2, "2023-05-01 11:03:00", 1, 0), 1063, time_from_string("2023-05-01 11:03:00"));
+    flushed = aggregator.flush();
+    if (flushed.size() == 1 && flushed.count(2) &&
+        total(flushed[2], &osmchange::ChangeStats::added, "highway") == 50 &&
+        aggregator.size() == 0) {
+        runtest.pass("StatsAggregator::flush(aged)");
+    } else {
+        runtest.fail("StatsAggregator::flush(aged)");
+    }
+
+    // Each file is kept apart by its sequence, so a replay replaces it
+    aggregator.merge(makeStats(3, "2023-05-01 11:04:00", 1, 0), 1064, time_from_string("2023-05-01 11:04:00"));
+    aggregator.merge(makeStats(3, "2023-05-01 11:05:00", 2, 0), 1065, time_from_string("2023-05-01 11:05:00"));
+    aggregator.merge(makeStats(3, "2023-05-01 11:05:00", 2, 0), 1065, time_from_string("2023-05-01 11:05:00"));
+    flushed = aggregator.flushAll();
+    if (flushed.size() == 1 && flushed[3].size() == 2 &&
+        flushed[3][1065]->added["highway"] == 2 && aggregator.size() == 0) {
+        runtest.pass("StatsAggregator::flushAll()");
+    } else {
+        runtest.fail("StatsAggregator::flushAll()");
+    }
+}
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
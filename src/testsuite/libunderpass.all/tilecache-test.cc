@@ -0,0 +1,138 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <dejagnu.h>
+#include <iostream>
+#include <string>
+#include <boost/filesystem.hpp>
+
+#include "serve/tilecache.hh"
+#include "utils/tiles.hh"
+#include "utils/log.hh"
+
+TestState runtest;
+
+using namespace logger;
+
+/// \file tilecache-test.cc
+/// \brief Test the changed tiles and the tile cache
+
+int
+main(int argc, char *argv[])
+{
+    logger::LogFile &dbglogfile = logger::LogFile::getDefaultInstance();
+    dbglogfile.setWriteDisk(true);
+    dbglogfile.setLogFilename("tilecache-test.log");
+    dbglogfile.setVerbosity(3);
+
+    // A building in Kathmandu, which is in tile 14/12075/6878
+    tiles::TileSet dirty;
+    dirty.add(85.3240, 27.7172, 85.3242, 27.7174);
+    if (dirty.size() == 1 && dirty.covers(14, 12075, 6878) && dirty.covers(16, 48300, 27513)
+        && dirty.covers(10, 754, 429) && dirty.covers(0, 0, 0) && !dirty.covers(14, 12076, 6878)
+        && !dirty.covers(10, 755, 429)) {
+        runtest.pass("TileSet::covers()");
+    } else {
+        runtest.fail("TileSet::covers()");
+    }
+
+    tiles::TileSet copy;
+    if (copy.parse(dirty.text()) && copy.text() == "14:12075/6878" && copy.covers(14, 12075, 6878)
+        && !copy.parse("14:12141") && dirty.notify() == "NOTIFY underpass_tiles, '14:12075/6878';\n") {
+        runtest.pass("TileSet::parse()");
+    } else {
+        runtest.fail("TileSet::parse()");
+    }
+
+    // A large box lowers the zoom instead of adding many tiles
+    tiles::TileSet large;
+    large.add(80.0, 26.0, 88.0, 30.0);
+    large.add(dirty);
+    if (large.zoom() < 14 && large.size() <= 16 && large.covers(14, 12075, 6878)) {
+        runtest.pass("TileSet::add(box)");
+    } else {
+        runtest.fail("TileSet::add(box)");
+    }
+
+    tiles::TileSet many;
+    for (int i = 0; i < 1000; i++) {
+        many.add(-170.0 + i * 0.3, 10.0, -170.0 + i * 0.3, 10.0);
+    }
+    many.coarsen(tiles::TileSet::maxNotify);
+    if (many.size() <= tiles::TileSet::maxNotify && many.notify().size() < 8000
+        && many.covers(14, tiles::TileSet::column(-170.0, 14), tiles::TileSet::row(10.0, 14))) {
+        runtest.pass("TileSet::coarsen()");
+    } else {
+        runtest.fail("TileSet::coarsen()");
+    }
+
+    // Only the tiles that changed are dropped
+    serve::TileCache cache(1024);
+    cache.put("/validation/14/12075/6878.mvt", 14, 12075, 6878, "changed", cache.generation());
+    cache.put("/validation/12/3018/1719.mvt", 12, 3018, 1719, "parent", cache.generation());
+    cache.put("/validation/14/0/0.mvt", 14, 0, 0, "elsewhere", cache.generation());
+    std::string tile;
+    if (cache.invalidate(dirty) == 2 && !cache.get("/validation/14/12075/6878.mvt", tile)
+        && !cache.get("/validation/12/3018/1719.mvt", tile)
+        && cache.get("/validation/14/0/0.mvt", tile) && tile == "elsewhere") {
+        runtest.pass("TileCache::invalidate()");
+    } else {
+        runtest.fail("TileCache::invalidate()");
+    }
+
+    // A tile queried before a change to it was committed isn't added
+    auto since = cache.generation();
+    cache.invalidate(dirty);
+    cache.put("/validation/14/12075/6878.mvt", 14, 12075, 6878, "old", since);
+    cache.put("/validation/14/0/1.mvt", 14, 0, 1, "other", since);
+    bool dropped = !cache.get("/validation/14/12075/6878.mvt", tile) && cache.get("/validation/14/0/1.mvt", tile);
+    since = cache.generation();
+    cache.clear();
+    cache.put("/validation/14/0/2.mvt", 14, 0, 2, "other", since);
+    if (dropped && !cache.get("/validation/14/0/2.mvt", tile)) {
+        runtest.pass("TileCache::put(stale)");
+    } else {
+        runtest.fail("TileCache::put(stale)");
+    }
+
+    // The least recently used tiles are evicted to the directory
+    auto directory = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    serve::TileCache small(10, directory.string(), 10);
+    small.put("a", 14, 1, 1, "aaaaaa", small.generation());
+    small.put("b", 14, 2, 2, "bbbbbb", small.generation());
+    bool spilled = small.size() == 2 && !boost::filesystem::is_empty(directory);
+    if (spilled && small.get("a", tile) && tile == "aaaaaa" && small.get("b", tile) && tile == "bbbbbb") {
+        runtest.pass("TileCache::evict()");
+    } else {
+        runtest.fail("TileCache::evict()");
+    }
+    small.put("c", 14, 3, 3, "cccccccccccc", small.generation());
+    if (!small.get("c", tile) && small.get("b", tile) && tile == "bbbbbb") {
+        runtest.pass("TileCache::put(too large)");
+    } else {
+        runtest.fail("TileCache::put(too large)");
+    }
+    small.clear();
+    boost::filesystem::remove_all(directory);
+}
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
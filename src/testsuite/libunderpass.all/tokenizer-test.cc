@@ -0,0 +1,133 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <dejagnu.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <boost/filesystem.hpp>
+#include "osm/osctokenizer.hh"
+#include "osm/osmchange.hh"
+#include "utils/log.hh"
+#include "samechanges.hh"
+
+TestState runtest;
+
+using namespace logger;
+using namespace osmchange;
+using namespace osmobjects;
+
+/// \file tokenizer-test.cc
+/// \brief Compare the osmChange tokenizer with libxml++
+///
+/// Every .osc file in the testsuite is parsed by both, and the results
+/// must be the same.
+
+#ifdef LIBXML
+// Parse with libxml++, bypassing the configured parser. Unlike
+// readXML(), an error fails the test.
+bool
+parseLibxml(std::string xml, OsmChangeFile &osc)
+{
+    // libxml complains about the missing trailing newline of some files
+    if (xml.empty() || xml.back() != '\n') {
+        xml += '\n';
+    }
+    std::istringstream stream(xml);
+    try {
+        osc.set_substitute_entities(true);
+        osc.parse_stream(stream);
+    } catch (const xmlpp::exception &ex) {
+        log_error("libxml++ exception: %1%", ex.what());
+        return false;
+    }
+    return true;
+}
+#endif
+
+int
+main(int argc, char *argv[])
+{
+    logger::LogFile &dbglogfile = logger::LogFile::getDefaultInstance();
+    dbglogfile.setWriteDisk(true);
+    dbglogfile.setLogFilename("tokenizer-test.log");
+    dbglogfile.setVerbosity(3);
+    setlocale(LC_NUMERIC, "C");
+
+    std::string testdata = DATADIR;
+    testdata += "/testsuite/testdata";
+    boost::filesystem::recursive_directory_iterator it(testdata), eod;
+    for (; it != eod; ++it) {
+        if (it->path().extension() != ".osc") {
+            continue;
+        }
+        std::ifstream file(it->path().string());
+        std::string xml{std::istreambuf_iterator<char>(file), {}};
+        auto name = it->path().filename().string();
+
+        OsmChangeFile tokenized;
+        bool ok = OscTokenizer::parse(xml.data(), xml.size(), tokenized);
+
+#ifdef LIBXML
+        OsmChangeFile parsed;
+        if (ok && parseLibxml(xml, parsed) && sameChanges(parsed, tokenized)) {
+            runtest.pass("OscTokenizer::parse(" + name + ")");
+        } else {
+            runtest.fail("OscTokenizer::parse(" + name + ")");
+        }
+#endif
+    }
+
+    // Entities and whitespace in attribute values
+    std::string xml = "<osmChange><create><node id=\"1\" lat=\"1.5\" lon=\"2.5\" user=\"a&amp;b&#233;&#x20AC;\">"
+        "<tag k=\"name\" v='line\tone&lt;&gt;'/></node></create></osmChange>";
+    OsmChangeFile escaped;
+    OscTokenizer::parse(xml.data(), xml.size(), escaped);
+    if (escaped.changes.size() == 1 && escaped.changes.front()->nodes.size() == 1 &&
+        escaped.changes.front()->nodes.front()->user == "a&b\xc3\xa9\xe2\x82\xac" &&
+        escaped.changes.front()->nodes.front()->tags["name"] == "line one<>" &&
+        escaped.nodecache[1].get<1>() == 1.5) {
+        runtest.pass("OscTokenizer::parse(entities)");
+    } else {
+        runtest.fail("OscTokenizer::parse(entities)");
+    }
+
+    // Truncated files fail instead of reading past the end
+    xml = "<osmChange><create><node id=\"1\" lat=\"1.5";
+    OsmChangeFile truncated;
+    if (!OscTokenizer::parse(xml.data(), xml.size(), truncated)) {
+        runtest.pass("OscTokenizer::parse(truncated)");
+    } else {
+        runtest.fail("OscTokenizer::parse(truncated)");
+    }
+
+    // A number that doesn't parse fails the file
+    xml = "<osmChange><modify><way id=\"1\" version=\"2\"><nd ref=\"x3\"/></way></modify></osmChange>";
+    OsmChangeFile invalid;
+    if (!OscTokenizer::parse(xml.data(), xml.size(), invalid)) {
+        runtest.pass("OscTokenizer::parse(invalid number)");
+    } else {
+        runtest.fail("OscTokenizer::parse(invalid number)");
+    }
+}
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,200 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <dejagnu.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "osm/changebatch.hh"
+#include "osm/osmchange.hh"
+#include "validate/validatecache.hh"
+#include "utils/log.hh"
+
+TestState runtest;
+
+using namespace logger;
+using namespace osmchange;
+using namespace validatecache;
+
+/// \file validatecache-test.cc
+/// \brief Test skipping the validation of unchanged objects
+
+/// Counts the checks instead of doing them
+class CountingValidate : public Validate {
+  public:
+    std::shared_ptr<ValidateStatus> checkNode(const osmobjects::OsmNode &node, const std::string &type) {
+        nodes++;
+        return std::make_shared<ValidateStatus>(node);
+    };
+    std::shared_ptr<ValidateStatus> checkWay(const osmobjects::OsmWay &way, const std::string &type) {
+        ways++;
+        return std::make_shared<ValidateStatus>(way);
+    };
+    int nodes = 0;
+    int ways = 0;
+};
+
+// A change with one building way
+std::shared_ptr<OsmChangeFile>
+makeChange(osmobjects::action_t action, int version, double offset, const std::string &building)
+{
+    auto osc = std::make_shared<OsmChangeFile>();
+    auto change = std::make_shared<OsmChange>(action);
+    auto way = change->newWay();
+    way->id = 10;
+    way->version = version;
+    way->action = action;
+    way->tags["building"] = building;
+    for (auto point: {std::make_pair(0.0, 0.0), std::make_pair(0.0, 1.0),
+                      std::make_pair(1.0, 1.0), std::make_pair(0.0, 0.0)}) {
+        boost::geometry::append(way->linestring, point_t(point.first + offset, point.second));
+    }
+    auto node = change->newNode();
+    node->id = 20;
+    node->version = version;
+    node->action = action;
+    node->tags["place"] = "village";
+    node->setPoint(offset, 0.0);
+    osc->changes.push_back(change);
+    return osc;
+}
+
+int
+main(int argc, char *argv[])
+{
+    logger::LogFile &dbglogfile = logger::LogFile::getDefaultInstance();
+    dbglogfile.setWriteDisk(true);
+    dbglogfile.setLogFilename("validatecache-test.log");
+    dbglogfile.setVerbosity(3);
+
+    std::shared_ptr<Validate> plugin = std::make_shared<CountingValidate>();
+    auto counts = std::static_pointer_cast<CountingValidate>(plugin);
+    auto cache = std::make_shared<ValidateCache>();
+    multipolygon_t poly;
+
+    // Validate the objects, which are all in the priority area, and
+    // commit the results unless \a commit is false
+    auto validate = [&](std::shared_ptr<OsmChangeFile> osc, bool commit = true) {
+        ChangeBatch batch(*osc);
+        batch.areaFilter(poly);
+        std::vector<ValidateCache::Validated> validated;
+        batch.validateWays(poly, plugin, cache, &validated);
+        batch.validateNodes(poly, plugin, cache, &validated);
+        if (commit) {
+            cache->update(validated);
+        }
+    };
+
+    validate(makeChange(osmobjects::create, 1, 0.0, "yes"));
+    if (counts->ways == 1 && counts->nodes == 1) {
+        runtest.pass("ValidateCache(first)");
+    } else {
+        runtest.fail("ValidateCache(first)");
+    }
+
+    // A new version with the same tags and geometry
+    validate(makeChange(osmobjects::modify, 2, 0.0, "yes"));
+    if (counts->ways == 1 && counts->nodes == 1) {
+        runtest.pass("ValidateCache(unchanged)");
+    } else {
+        runtest.fail("ValidateCache(unchanged)");
+    }
+
+    // The tags changed
+    validate(makeChange(osmobjects::modify, 3, 0.0, "house"));
+    if (counts->ways == 2 && counts->nodes == 1) {
+        runtest.pass("ValidateCache(tags)");
+    } else {
+        runtest.fail("ValidateCache(tags)");
+    }
+
+    // The geometry changed
+    validate(makeChange(osmobjects::modify, 4, 0.5, "house"));
+    if (counts->ways == 3 && counts->nodes == 2) {
+        runtest.pass("ValidateCache(geometry)");
+    } else {
+        runtest.fail("ValidateCache(geometry)");
+    }
+
+    // An older version that arrives late doesn't replace the newest
+    validate(makeChange(osmobjects::modify, 2, 0.0, "yes"));
+    validate(makeChange(osmobjects::modify, 5, 0.0, "yes"));
+    if (counts->ways == 5 && counts->nodes == 4) {
+        runtest.pass("ValidateCache(out of order)");
+    } else {
+        runtest.fail("ValidateCache(out of order)");
+    }
+
+    // Deleting forgets the object, so it's validated if it comes back
+    validate(makeChange(osmobjects::remove, 6, 0.0, "yes"));
+    validate(makeChange(osmobjects::modify, 7, 0.0, "yes"));
+    if (counts->ways == 7 && counts->nodes == 5) {
+        runtest.pass("ValidateCache(deleted)");
+    } else {
+        runtest.fail("ValidateCache(deleted)");
+    }
+
+    // Results that weren't committed are validated again
+    validate(makeChange(osmobjects::modify, 8, 0.7, "yes"), false);
+    validate(makeChange(osmobjects::modify, 8, 0.7, "yes"));
+    if (counts->ways == 9 && counts->nodes == 7) {
+        runtest.pass("ValidateCache(uncommitted)");
+    } else {
+        runtest.fail("ValidateCache(uncommitted)");
+    }
+
+    // A deletion is only forgotten once it's committed
+    std::size_t cached = cache->size(osmobjects::way);
+    validate(makeChange(osmobjects::remove, 9, 0.7, "yes"), false);
+    bool kept = cached > 0 && cache->size(osmobjects::way) == cached;
+    validate(makeChange(osmobjects::remove, 9, 0.7, "yes"));
+    if (kept && cache->size(osmobjects::way) == cached - 1) {
+        runtest.pass("ValidateCache(uncommitted deletion)");
+    } else {
+        runtest.fail("ValidateCache(uncommitted deletion)");
+    }
+
+    // When full, the least recently used object is dropped
+    ValidateCache small(2);
+    small.update(osmobjects::way, 1, 1, 100);
+    small.update(osmobjects::way, 2, 1, 200);
+    small.unchanged(osmobjects::way, 1, 1, 100);
+    small.update(osmobjects::way, 3, 1, 300);
+    if (small.size(osmobjects::way) == 2 && small.unchanged(osmobjects::way, 1, 1, 100) &&
+        !small.unchanged(osmobjects::way, 2, 1, 200) && small.unchanged(osmobjects::way, 3, 1, 300)) {
+        runtest.pass("ValidateCache(evict)");
+    } else {
+        runtest.fail("ValidateCache(evict)");
+    }
+
+    // The fingerprint depends on the type of check
+    osmobjects::OsmWay way;
+    way.tags["building"] = "yes";
+    if (ValidateCache::fingerprint(way, "building") != ValidateCache::fingerprint(way, "highway")) {
+        runtest.pass("ValidateCache::fingerprint()");
+    } else {
+        runtest.fail("ValidateCache::fingerprint()");
+    }
+}
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,144 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <dejagnu.h>
+#include <iostream>
+#include <string>
+
+#include "raw/waycache.hh"
+#include "utils/log.hh"
+#include "utils/metrics.hh"
+
+TestState runtest;
+
+using namespace logger;
+using namespace osmobjects;
+using namespace queryraw;
+
+/// \file waycache-test.cc
+/// \brief Test the cache of ways shared by the replication files
+
+/// A way with \a size nodes along the x axis
+OsmWay
+makeWay(long id, int version, int size)
+{
+    OsmWay way;
+    way.id = id;
+    way.version = version;
+    way.addTag("highway", "residential");
+    for (int i = 0; i < size; i++) {
+        way.addRef(id * 100 + i);
+        way.linestring.push_back(point_t(i, 0));
+    }
+    return way;
+}
+
+int
+main(int argc, char *argv[])
+{
+    logger::LogFile &dbglogfile = logger::LogFile::getDefaultInstance();
+    dbglogfile.setWriteDisk(true);
+    dbglogfile.setLogFilename("waycache-test.log");
+    dbglogfile.setVerbosity(3);
+
+    auto &hits = metrics::Registry::getDefaultInstance().counter(
+        "underpass_way_cache_lookups_total", "Lookups in the way cache", {{"result", "hit"}});
+    auto &misses = metrics::Registry::getDefaultInstance().counter(
+        "underpass_way_cache_lookups_total", "Lookups in the way cache", {{"result", "miss"}});
+
+    WayCache cache(1 << 20, 4);
+    cache.put(makeWay(1, 2, 5));
+    auto cached = cache.get(1);
+    if (cached && cached->version == 2 && cached->refs.size() == 5 && cached->linestring.size() == 5
+        && cached->tags.at("highway") == "residential" && !cache.get(2) && hits.value() == 1
+        && misses.value() == 1) {
+        runtest.pass("WayCache::get()");
+    } else {
+        runtest.fail("WayCache::get()");
+    }
+
+    // A closed way from the database only has a polygon
+    OsmWay closed = makeWay(3, 1, 0);
+    closed.refs = {1, 2, 3, 1};
+    closed.polygon = {{point_t(0, 0), point_t(1, 0), point_t(1, 1), point_t(0, 0)}};
+    cache.put(closed);
+    cached = cache.get(3);
+    if (cached && cached->linestring.size() == 4 && cached->polygon.outer().empty()) {
+        runtest.pass("WayCache::put(polygon)");
+    } else {
+        runtest.fail("WayCache::put(polygon)");
+    }
+
+    // An older version doesn't replace a newer one, and a way missing
+    // some of its points isn't kept
+    cache.put(makeWay(1, 1, 3));
+    OsmWay partial = makeWay(1, 3, 5);
+    partial.linestring.resize(4);
+    bool older = cache.get(1)->version == 2;
+    cache.put(partial);
+    if (older && !cache.get(1)) {
+        runtest.pass("WayCache::put(version)");
+    } else {
+        runtest.fail("WayCache::put(version)");
+    }
+
+    // A way read from the database doesn't replace the same version
+    // written since, but the ways committed do
+    OsmWay moved = makeWay(4, 1, 3);
+    moved.linestring[0] = point_t(9, 9);
+    cache.put(moved);
+    cache.add(makeWay(4, 1, 3));
+    cache.add(makeWay(5, 1, 3));
+    bool kept = cache.get(4)->linestring[0].x() == 9 && cache.get(5);
+    moved.linestring[0] = point_t(7, 7);
+    OsmWay deleted;
+    deleted.id = 5;
+    cache.update({moved, deleted});
+    if (kept && cache.get(4)->linestring[0].x() == 7 && !cache.get(5)) {
+        runtest.pass("WayCache::add()");
+    } else {
+        runtest.fail("WayCache::add()");
+    }
+    cache.remove(4);
+
+    cache.remove(3);
+    if (!cache.get(3) && cache.size() == 0 && cache.memory() == 0) {
+        runtest.pass("WayCache::remove()");
+    } else {
+        runtest.fail("WayCache::remove()");
+    }
+
+    // The least recently used ways go first
+    WayCache small(WayCache::bytes(makeWay(0, 1, 10)) * 3 + 10, 1);
+    small.put(makeWay(1, 1, 10));
+    small.put(makeWay(2, 1, 10));
+    small.put(makeWay(3, 1, 10));
+    small.get(1);
+    small.put(makeWay(4, 1, 10));
+    if (small.get(1) && !small.get(2) && small.get(3) && small.get(4) && small.size() == 3) {
+        runtest.pass("WayCache::put(evict)");
+    } else {
+        runtest.fail("WayCache::put(evict)");
+    }
+}
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
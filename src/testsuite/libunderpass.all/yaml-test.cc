@@ -108,6 +108,27 @@ main(int argc, char *argv[])
         runtest.fail("Yaml::containsValue(none)");
         return 1;
     }
+
+    // The lookups that don't copy the tree
+    const auto &config = yaml.get_ref("config");
+    if (config.get_value_ref("minangle") == "84" && config.find("nothere") == nullptr &&
+        yaml.get_ref("nothere").children.empty() && &config.get_ref("maxangle") == config.find("maxangle")) {
+        runtest.pass("Node::get_ref()");
+    } else {
+        runtest.fail("Node::get_ref()");
+        return 1;
+    }
+
+    // Copies have their own indexes
+    yaml::Yaml copy = yaml;
+    yaml = yaml::Yaml();
+    if (copy.contains_value("building:roof", "tiles") && copy.get_ref("config").get_value("complete") == "yes" &&
+        !copy.contains_key("nothere")) {
+        runtest.pass("Yaml::Yaml(copy)");
+    } else {
+        runtest.fail("Yaml::Yaml(copy)");
+        return 1;
+    }
 }
 
 // local Variables:
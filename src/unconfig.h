@@ -5,6 +5,9 @@
    language is requested. */
 /* #undef ENABLE_NLS */
 
+/* Use the built-in osmChange tokenizer instead of libxml++ */
+/* #undef FASTXML */
+
 /* define if the Boost library is available */
 #define HAVE_BOOST /**/
 
@@ -0,0 +1,168 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+/// \file underpass-serve.cc
+/// \brief Serves the raw tables over HTTP, like the Python REST API
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/signal_set.hpp>
+#include <boost/program_options.hpp>
+
+namespace opts = boost::program_options;
+
+#include "serve/pool.hh"
+#include "serve/rawquery.hh"
+#include "serve/server.hh"
+#include "serve/tilecache.hh"
+#include "utils/log.hh"
+#include "utils/metrics.hh"
+#include "underpassconfig.hh"
+
+using namespace logger;
+
+int
+main(int argc, char *argv[])
+{
+    underpassconfig::UnderpassConfig config;
+    unsigned int threads = std::max(std::thread::hardware_concurrency(), 2U);
+
+    opts::variables_map vm;
+    opts::options_description desc("Allowed options");
+
+    try {
+        // clang-format off
+        desc.add_options()
+            ("help,h", "display help")
+            ("server,s", opts::value<std::string>(), "Database server (defaults to localhost/underpass) "
+                                                     "can be a hostname or a full connection string USER:PASSSWORD@HOST/DATABASENAME")
+            ("port", opts::value<unsigned short>()->default_value(8000), "Port to listen on")
+            ("address", opts::value<std::string>()->default_value("127.0.0.1"), "Address to listen on")
+            ("threads", opts::value<unsigned int>(), "Threads answering requests (defaults to the number of cores)")
+            ("connections", opts::value<unsigned int>(), "Database connections (defaults to the number of threads)")
+            ("origin", opts::value<std::string>()->default_value("*"), "Allowed origin for CORS")
+            ("cache-size", opts::value<std::size_t>()->default_value(256), "Megabytes of vector tiles cached in memory, 0 disables the cache")
+            ("cache-dir", opts::value<std::string>(), "Directory for the vector tiles evicted from memory")
+            ("cache-disk", opts::value<std::size_t>()->default_value(1024), "Megabytes of vector tiles cached in the directory")
+            ("cache-age", opts::value<unsigned int>()->default_value(0), "Seconds a cached tile is used, 0 until it changes")
+            ("metrics", opts::value<unsigned short>(), "Serve metrics for Prometheus on this local port")
+            ("verbose,v", "Enable verbosity")
+            ("logstdout,l", "Enable logging to stdout, default is log to underpass-serve.log");
+        // clang-format on
+
+        opts::store(opts::command_line_parser(argc, argv).options(desc).run(), vm);
+        opts::notify(vm);
+    } catch (std::exception &e) {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+
+    if (vm.count("help")) {
+        std::cout << "Usage: options_description [options]" << std::endl;
+        std::cout << desc << std::endl;
+        return 0;
+    }
+
+    logger::LogFile &dbglogfile = logger::LogFile::getDefaultInstance();
+    if (vm.count("verbose")) {
+        dbglogfile.setVerbosity();
+    }
+    if (!vm.count("logstdout")) {
+        dbglogfile.setWriteDisk(true);
+        dbglogfile.setLogFilename("underpass-serve.log");
+    }
+
+    static metrics::Endpoint endpoint;
+    if (vm.count("metrics")) {
+        if (!endpoint.start(vm["metrics"].as<unsigned short>())) {
+            return -1;
+        }
+    }
+
+    if (vm.count("server")) {
+        config.underpass_db_url = vm["server"].as<std::string>();
+    }
+    if (vm.count("threads")) {
+        threads = std::max(vm["threads"].as<unsigned int>(), 1U);
+    }
+    // A request holds a connection only while its query runs, so one
+    // per thread is enough
+    unsigned int connections = threads;
+    if (vm.count("connections")) {
+        connections = std::max(vm["connections"].as<unsigned int>(), 1U);
+    }
+
+    serve::Pool pool;
+    if (!pool.connect(config.underpass_db_url, connections, serve::RawQuery::prepare)) {
+        log_error("Could not connect to the database %1%", config.underpass_db_url);
+        return -1;
+    }
+
+    // The replicator sends the tiles it changed, so the cache only
+    // drops those
+    std::unique_ptr<serve::TileCache> cache;
+    std::unique_ptr<serve::Invalidator> invalidator;
+    auto megabytes = vm["cache-size"].as<std::size_t>();
+    if (megabytes > 0) {
+        std::string directory;
+        if (vm.count("cache-dir")) {
+            directory = vm["cache-dir"].as<std::string>();
+        }
+        cache = std::make_unique<serve::TileCache>(megabytes << 20, directory,
+            vm["cache-disk"].as<std::size_t>() << 20, std::chrono::seconds(vm["cache-age"].as<unsigned int>()));
+        invalidator = std::make_unique<serve::Invalidator>(*cache);
+        invalidator->start(config.underpass_db_url);
+    }
+
+    serve::Server server(pool, vm["origin"].as<std::string>(), cache.get());
+    if (!server.start(vm["port"].as<unsigned short>(), vm["address"].as<std::string>(), threads)) {
+        return -1;
+    }
+    std::cout << "Listening on http://" << vm["address"].as<std::string>() << ":"
+              << server.port() << std::endl;
+
+    // Serve until ^C or a kill
+    boost::asio::io_context ioc;
+    boost::asio::signal_set signals(ioc, SIGINT, SIGTERM);
+    signals.async_wait([](const boost::system::error_code &, int) {});
+    ioc.run();
+    server.stop();
+    if (invalidator) {
+        invalidator->stop();
+    }
+
+    return 0;
+}
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -22,8 +22,10 @@
 #include "unconfig.h"
 #endif
 
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <cctype>
 #include <chrono>
 #include <cstdlib>
 #include <deque>
@@ -59,10 +61,16 @@ namespace opts = boost::program_options;
 
 #include "utils/geoutil.hh"
 #include "utils/log.hh"
+#include "utils/metrics.hh"
 #include "osm/changeset.hh"
 #include "osm/osmchange.hh"
+#include "stats/hashtags.hh"
+#include "replicator/events.hh"
 #include "replicator/threads.hh"
+#include "replicator/backfill.hh"
+#include "replicator/replay.hh"
 #include "bootstrap/bootstrap.hh"
+#include "data/export.hh"
 #include "underpassconfig.hh"
 
 using namespace querystats;
@@ -111,18 +119,28 @@ main(int argc, char *argv[])
             ("oscnoboundary", "Disable boundary polygon for Changesets")
             ("datadir", opts::value<std::string>(), "Directory for remote and local cached files (with ending slash)")
             ("destdir_base", opts::value<std::string>(), "Base directory for local cached files (with ending slash)")
+            ("mirror", "Keep replication files in an indexed local mirror under destdir_base")
             ("verbose,v", "Enable verbosity")
             ("logstdout,l", "Enable logging to stdout, default is log to underpass.log")
             ("changefile", opts::value<std::string>(), "Import change file")
             ("concurrency,c", opts::value<std::string>(), "Concurrency")
+            ("backfill", opts::value<unsigned int>(), "Backfill the timestamp range out of order with this many workers")
+            ("replay", opts::value<std::string>(), "Replay the replication files in this directory instead of downloading them")
+            ("discard", "Generate the SQL without writing it to the database")
+            ("events", opts::value<std::string>(), "Publish the committed changes as JSON lines to this file, to unix:<socket>, or only to /events of --metrics with metrics")
             ("changesets", "Changesets only")
             ("osmchanges", "OsmChanges only")
             ("debug,d", "Enable debug messages for developers")
+            ("metrics", opts::value<unsigned short>(), "Serve metrics for Prometheus on this local port")
             ("disable-stats", "Disable statistics")
             ("disable-validation", "Disable validation")
             ("disable-raw", "Disable raw OSM data")
             ("norefs", "Disable refs (useful for non OSM data)")
+            ("refindex", "Keep the references of ways and relations in memory instead of querying them")
+            ("waycache", opts::value<std::size_t>(), "Keep this many megabytes of recently changed ways in memory")
             ("bootstrap", "Bootstrap data tables")
+            ("export", opts::value<std::string>(), "Export the raw tables and validation results as GeoParquet files to this directory")
+            ("tables", opts::value<std::string>(), "The tables to export, separated by commas (defaults to all of them)")
             ("silent", "Silent");
         // clang-format on
 
@@ -138,6 +156,12 @@ main(int argc, char *argv[])
     if (vm.count("norefs")) {
         config.norefs = true;
     }
+    if (vm.count("refindex")) {
+        config.refindex = true;
+    }
+    if (vm.count("waycache")) {
+        config.waycache = vm["waycache"].as<std::size_t>();
+    }
 
     // Logging
     logger::LogFile &dbglogfile = logger::LogFile::getDefaultInstance();
@@ -155,15 +179,38 @@ main(int argc, char *argv[])
         config.silent = true;
     }
 
+    // Metrics. This is static, so it stops before the registry it
+    // serves is destroyed when exit() is called.
+    static metrics::Endpoint endpoint;
+    if (vm.count("metrics")) {
+        // The most used hashtags of the changesets replicated lately
+        endpoint.route("/hashtags", "application/json", [] {
+            return hashtags::Activity::getDefaultInstance().json(100);
+        });
+        // The events of the files committed lately, with --events
+        endpoint.route("/events", "application/x-ndjson", [] {
+            return events::Publisher::getDefaultInstance().recent();
+        });
+        if (!endpoint.start(vm["metrics"].as<unsigned short>())) {
+            exit(-1);
+        }
+    }
+
     // Database
     if (vm.count("server")) {
         config.underpass_db_url = vm["server"].as<std::string>();
     }
+    if (vm.count("events")) {
+        config.events = vm["events"].as<std::string>();
+    }
 
     // Local cache 
     if (vm.count("destdir_base")) {
         config.destdir_base = vm["destdir_base"].as<std::string>();
     }
+    if (vm.count("mirror")) {
+        config.mirror = true;
+    }
 
     // Concurrency
     if (vm.count("concurrency")) {
@@ -182,7 +229,7 @@ main(int argc, char *argv[])
         config.concurrency = std::thread::hardware_concurrency();
     }
 
-    if (vm.count("timestamp") || vm.count("url") ||  vm.count("changeseturl")) {
+    if (vm.count("timestamp") || vm.count("url") ||  vm.count("changeseturl") || vm.count("replay")) {
 
         // Planet server
         if (vm.count("planet")) {
@@ -249,6 +296,36 @@ main(int argc, char *argv[])
             config.disable_raw = true;
         }
 
+        if (vm.count("discard")) {
+            config.discard = true;
+        }
+
+        // Replay a local tree of replication files, optionally
+        // starting at 'url', without using the network
+        if (vm.count("replay")) {
+            config.replay = vm["replay"].as<std::string>();
+            multipolygon_t * osmboundary = &poly;
+            if (!vm.count("osmnoboundary")) {
+                osmboundary = &geou.boundary;
+            }
+            long first = 0;
+            if (vm.count("url")) {
+                std::vector<std::string> parts;
+                boost::split(parts, vm["url"].as<std::string>(), boost::is_any_of("/"));
+                bool valid = parts.size() == 3 && std::all_of(parts.begin(), parts.end(), [](const std::string &part) {
+                    return !part.empty() && part.size() <= 3 &&
+                        std::all_of(part.begin(), part.end(), [](unsigned char c) { return std::isdigit(c); });
+                });
+                if (!valid) {
+                    log_error("ERROR: 'url' must be a path like 000/075/000!");
+                    exit(-1);
+                }
+                first = std::stol(parts[0]) * 1000000 + std::stol(parts[1]) * 1000 + std::stol(parts[2]);
+            }
+            replay::Replay replayer(config);
+            exit(replayer.start(*osmboundary, first) ? 0 : -1);
+        }
+
         // Replication
         if (vm.count("url") && vm.count("timestamp")) {
             log_debug("ERROR: 'url' takes precedence over 'timestamp' arguments are mutually exclusive!");
@@ -256,6 +333,7 @@ main(int argc, char *argv[])
         }
 
         planetreplicator::PlanetReplicator replicator;
+        replicator.use_mirror = config.mirror;
 
         auto osmchange = std::make_shared<RemoteURL>();
         // Specify a timestamp used by other options
@@ -289,6 +367,24 @@ main(int argc, char *argv[])
             boost::algorithm::replace_all(osmchange->filespec, ".state.txt", ".osc.gz");
         }
 
+        // Backfill a time range
+        if (vm.count("backfill")) {
+            if (config.end_time == not_a_date_time) {
+                log_error("ERROR: 'backfill' needs a range, use 'timestamp' twice!");
+                exit(-1);
+            }
+            config.backfill = vm["backfill"].as<unsigned int>();
+            multipolygon_t * osmboundary = &poly;
+            if (!vm.count("osmnoboundary")) {
+                osmboundary = &geou.boundary;
+            }
+            auto last = replicator.findRemotePath(config, config.end_time);
+            osmchange->destdir_base = config.destdir_base;
+            last->destdir_base = config.destdir_base;
+            backfill::Backfill backfiller(config);
+            exit(backfiller.start(*osmchange, *last, *osmboundary) ? 0 : -1);
+        }
+
         // OsmChanges
         std::thread osmChangeThread;
         if (!vm.count("changesets")) {
@@ -337,6 +433,27 @@ main(int argc, char *argv[])
 
     }
 
+    // Export, each table in a few ID ranges per thread
+    if (vm.count("export")) {
+        std::vector<std::string> tables;
+        if (vm.count("tables")) {
+            boost::split(tables, vm["tables"].as<std::string>(), boost::is_any_of(","));
+        } else {
+            for (const auto &table: exporter::Exporter::tables()) {
+                tables.push_back(table.name);
+            }
+        }
+        exporter::Exporter exporter(config.underpass_db_url, vm["export"].as<std::string>());
+        bool ok = true;
+        for (const auto &table: tables) {
+            log_info("Exporting %1%", table);
+            if (!exporter.exportTable(table, config.concurrency * 4, config.concurrency)) {
+                ok = false;
+            }
+        }
+        exit(ok ? 0 : -1);
+    }
+
     // Bootstrapping
     if (vm.count("bootstrap")){
         std::thread bootstrapThread;
@@ -108,7 +108,7 @@ struct UnderpassConfig {
         if (std::filesystem::exists(filespec)) {
             yaml::Yaml yaml;
             yaml.read(filespec);
-            auto yamlConfig = yaml.get("config");
+            const auto &yamlConfig = yaml.get_ref("config");
             if (yaml.contains_key("underpass_db_url")) {
                 underpass_db_url = yamlConfig.get_value("underpass_db_url");
             }
@@ -170,7 +170,15 @@ struct UnderpassConfig {
     bool disable_stats = false;
     bool disable_raw = false;
     bool norefs = false;
+    bool refindex = false;                           ///< Find the ways and relations using changed objects in memory
+    std::size_t waycache = 0;                        ///< Megabytes of ways kept between files, 0 disables it
     bool silent = false;
+    bool mirror = false;                             ///< Keep replication files in an indexed local mirror
+    unsigned int backfill = 0;                       ///< Number of workers backfilling a time range, 0 disables it
+    unsigned int backfill_range = 60;                ///< Number of replication files in each backfill range
+    std::string replay;                              ///< Directory of replication files replayed instead of downloading
+    bool discard = false;                            ///< Generate the SQL without writing it to a database
+    std::string events;                              ///< File or unix:<socket> the committed changes are published to
 
     ///
     /// \brief getPlanetServer returns either the command line supplied planet server
@@ -27,7 +27,11 @@
 
 #include <boost/filesystem/operations.hpp>
 #include <boost/format.hpp>
+#include <algorithm>
+#include <array>
 #include <cctype>
+#include <chrono>
+#include <condition_variable>
 #include <cstring>
 #include <ctime>
 #include <fstream>
@@ -38,6 +42,7 @@
 #include <sstream>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include <cstdint>
 
@@ -237,7 +242,7 @@ getTimeZoneOffset(double time) {
         // tm_isdst is negative: cannot get TZ info.
         // Convert and print in UTC instead.
         LOG_ONCE(
-            logger::log_error("Cannot get requested timezone information"););
+            log_error("Cannot get requested timezone information"););
         offset = 0;
     }
 
@@ -260,31 +265,59 @@ namespace {
 
 LogFile &dbglogfile = LogFile::getDefaultInstance();
 
-struct Timestamp {
-    std::uint64_t startTicks;
-    std::map<std::thread::id, int> threadMap;
-    Timestamp() : startTicks(clocktime::getTicks()) {}
+const std::uint64_t startTicks = clocktime::getTicks();
+
+/// A message waiting to be written
+struct Message {
+    std::string text;
+    std::uint64_t ticks = 0;
 };
 
-std::ostream &
-operator<<(std::ostream &o, Timestamp &t) {
-    std::thread::id tid = std::this_thread::get_id();
-    int &htid = t.threadMap[tid];
-    if (!htid) {
-        htid = t.threadMap.size();
-        // TODO: notify actual thread id for index
-    }
+/// \struct Ring
+/// \brief The messages of one thread
+///
+/// Only the thread owning it adds messages, and only the writer
+/// thread removes them, so neither takes a lock. The strings in the
+/// slots are reused, so once they're large enough queueing a message
+/// doesn't allocate.
+struct Ring {
+    static constexpr std::size_t capacity = 1024;
+    std::array<Message, capacity> messages;
+    std::atomic<std::size_t> head{0};  ///< The next slot to fill
+    std::atomic<std::size_t> tail{0};  ///< The next slot to write
+    std::atomic<bool> closed{false};   ///< Set when the thread exits
+    int thread = 0;                    ///< Shown in the timestamp
+};
 
-    std::uint64_t diff = clocktime::getTicks() - t.startTicks;
-    // should we split in seconds/ms ?
-    o << "[" << getpid() << ":" << htid << "] " << diff;
+/// Closes the ring of a thread when it exits, so the writer can drop
+/// it once it's empty
+struct RingOwner {
+    std::shared_ptr<Ring> ring;
+    ~RingOwner() {
+        if (ring) {
+            ring->closed.store(true, std::memory_order_release);
+        }
+    }
+};
 
-    return o;
-}
+thread_local RingOwner owner;
 
-Timestamp timestamp;
 } // namespace
 
+/// \struct LogFile::Queues
+/// \brief The rings of all threads and the writer thread
+struct LogFile::Queues {
+    std::mutex mutex;                          ///< Protects everything but the rings' contents
+    std::condition_variable wakeup;            ///< Wakes up the writer
+    std::condition_variable written;           ///< Signals a finished pass over the rings
+    std::vector<std::shared_ptr<Ring>> rings;  ///< One for each thread that logged
+    std::thread writer;
+    std::atomic<bool> stopping{false};         ///< Messages are written directly once set
+    std::uint64_t requested = 0;               ///< The last flush requested
+    std::uint64_t completed = 0;               ///< The last flush done
+    int threads = 0;                           ///< The threads that logged so far
+};
+
 // boost format functions to process the objects
 // created by our hundreds of templates
 
@@ -352,24 +385,62 @@ processLog_unimpl(const boost::format &fmt) {
 
 void
 LogFile::log(const std::string &msg) {
-    std::lock_guard<std::mutex> lock(_ioMutex);
-
     if (!_verbose)
         return; // nothing to do if not verbose
 
+    auto &ring = owner.ring;
+    if (!ring) {
+        ring = std::make_shared<Ring>();
+        std::lock_guard<std::mutex> lock(_queues->mutex);
+        ring->thread = ++_queues->threads;
+        _queues->rings.push_back(ring);
+        if (!_queues->writer.joinable() && !_queues->stopping) {
+            _queues->writer = std::thread(&LogFile::writeQueued, this);
+        }
+    }
+
+    // Once the writer has stopped, at exit, nothing empties the ring
+    if (_queues->stopping.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(_ioMutex);
+        write(msg, ring->thread, clocktime::getTicks());
+        _outstream.flush();
+        return;
+    }
+
+    // Wait for the writer when the ring is full, rather than losing
+    // messages
+    std::size_t head = ring->head.load(std::memory_order_relaxed);
+    std::size_t used;
+    while ((used = head - ring->tail.load(std::memory_order_acquire)) >= Ring::capacity) {
+        _queues->wakeup.notify_one();
+        std::this_thread::yield();
+    }
+    Message &message = ring->messages[head % Ring::capacity];
+    message.text.assign(msg);
+    message.ticks = clocktime::getTicks();
+    ring->head.store(head + 1, std::memory_order_release);
+
+    // Otherwise the writer wakes up on its own every few milliseconds
+    if (used == Ring::capacity / 2) {
+        _queues->wakeup.notify_one();
+    }
+}
+
+void
+LogFile::write(const std::string &msg, int thread, std::uint64_t ticks) {
+    // The caller holds _ioMutex
     if (openLogIfNeeded()) {
         if (_stamp) {
-            _outstream << timestamp << ": " << msg << "\n";
+            _outstream << "[" << getpid() << ":" << thread << "] " << ticks - startTicks << ": " << msg << "\n";
         } else {
             _outstream << msg << "\n";
         }
-        _outstream.flush();
     } else {
         // log to stdout
         if (_stamp) {
-            std::cout << timestamp << " " << msg << std::endl;
+            std::cout << "[" << getpid() << ":" << thread << "] " << ticks - startTicks << " " << msg << "\n";
         } else {
-            std::cout << msg << std::endl;
+            std::cout << msg << "\n";
         }
     }
 
@@ -378,6 +449,64 @@ LogFile::log(const std::string &msg) {
     }
 }
 
+void
+LogFile::writeQueued() {
+    std::unique_lock<std::mutex> lock(_queues->mutex);
+    while (true) {
+        auto requested = _queues->requested;
+        bool stopping = _queues->stopping;
+        auto rings = _queues->rings;
+        lock.unlock();
+
+        {
+            std::lock_guard<std::mutex> io(_ioMutex);
+            for (auto &ring: rings) {
+                std::size_t tail = ring->tail.load(std::memory_order_relaxed);
+                std::size_t head = ring->head.load(std::memory_order_acquire);
+                for (; tail != head; tail++) {
+                    Message &message = ring->messages[tail % Ring::capacity];
+                    write(message.text, ring->thread, message.ticks);
+                    message.text.clear();
+                    ring->tail.store(tail + 1, std::memory_order_release);
+                }
+            }
+            if (_state == OPEN) {
+                _outstream.flush();
+            }
+            std::cout.flush();
+        }
+
+        lock.lock();
+        // A closed ring gets no more messages, so it can go once it's empty
+        _queues->rings.erase(std::remove_if(_queues->rings.begin(), _queues->rings.end(),
+            [](const std::shared_ptr<Ring> &ring) {
+                return ring->closed.load(std::memory_order_acquire) &&
+                    ring->head.load(std::memory_order_acquire) == ring->tail.load(std::memory_order_relaxed);
+            }), _queues->rings.end());
+        _queues->completed = requested;
+        _queues->written.notify_all();
+        if (stopping) {
+            break;
+        }
+        if (_queues->requested == requested && !_queues->stopping) {
+            _queues->wakeup.wait_for(lock, std::chrono::milliseconds(20));
+        }
+    }
+}
+
+void
+LogFile::flush() {
+    std::unique_lock<std::mutex> lock(_queues->mutex);
+    if (!_queues->writer.joinable() || _queues->stopping) {
+        return;
+    }
+    auto requested = ++_queues->requested;
+    _queues->wakeup.notify_one();
+    _queues->written.wait(lock, [this, requested] {
+        return _queues->completed >= requested;
+    });
+}
+
 inline void
 LogFile::log(const std::string &label, const std::string &msg) {
     log(label + ": " + msg);
@@ -385,23 +514,36 @@ LogFile::log(const std::string &label, const std::string &msg) {
 
 void
 LogFile::setLogFilename(const std::string &fname) {
+    // What was logged before goes to the old file
+    flush();
     closeLog();
     _logFilename = fname;
 }
 
 void
 LogFile::setWriteDisk(bool use) {
-    if (!use)
+    if (!use) {
+        flush();
         closeLog();
+    }
     _write = use;
 }
 
 // Default constructor
 LogFile::LogFile()
     : _verbose(0), _network(false), _state(CLOSED), _stamp(true), _write(false),
-      _listener(nullptr) {}
+      _listener(nullptr), _queues(new Queues) {}
 
 LogFile::~LogFile() {
+    // The writer empties the rings once more before it stops
+    {
+        std::lock_guard<std::mutex> lock(_queues->mutex);
+        _queues->stopping = true;
+        _queues->wakeup.notify_one();
+    }
+    if (_queues->writer.joinable()) {
+        _queues->writer.join();
+    }
     if (_state == OPEN)
         closeLog();
 }
@@ -28,7 +28,10 @@
 # include "unconfig.h"
 #endif
 
+#include <atomic>
+#include <cstdint>
 #include <fstream>
+#include <memory>
 #include <mutex>
 #include <boost/format.hpp>
 
@@ -41,6 +44,12 @@
 // the default name for the debug log
 #define DEFAULT_LOGFILE "underpass.log"
 
+// Messages above this level aren't compiled in, configuring with
+// --disable-debug-log sets it to LOG_NORMAL
+#ifndef UNDERPASS_LOG_LEVEL
+#define UNDERPASS_LOG_LEVEL 3
+#endif
+
 // Macro to prevent repeated logging calls for the same
 // event
 #define LOG_ONCE(x) { \
@@ -61,6 +70,11 @@ namespace logger {
 // This is a basic file logging class
 /// \class LogFile
 /// \brief Log messages filtered at several levels
+///
+/// Each thread queues its messages in its own ring buffer, and a
+/// background thread writes them, so logging doesn't wait for the
+/// disk or for other threads. Messages from one thread stay in order,
+/// and the timestamp is taken when they're logged.
 class DSOEXPORT LogFile
 {
 public:
@@ -83,17 +97,28 @@ public:
         IDLE
     };
 
-    /// Intended for use by log_*(). Thread-safe (locks _ioMutex)
+    /// Intended for use by log_*(). Thread-safe, this only queues
+    /// the message for the writer thread.
     /// @param label
     ///        The label string ie: "ERROR" for "ERROR: <msg>"
     /// @param msg
     ///        The message string ie: "bah" for "ERROR: bah"
     void log(const std::string& label, const std::string& msg);
 
-    /// Intended for use by log_*(). Thread-safe (locks _ioMutex)
+    /// Intended for use by log_*(). Thread-safe, this only queues
+    /// the message for the writer thread.
     /// @param msg
     ///        The message to print
     void log(const std::string& msg);
+
+    /// Wait until the messages queued so far are written
+    void flush();
+
+    /// Whether messages of this level are written. This is checked
+    /// before the message is formatted.
+    static bool enabled(LogLevel level) {
+        return getDefaultInstance()._verbose.load(std::memory_order_relaxed) >= level;
+    }
     
     /// Remove the log file
     /// Does NOT lock _ioMutex (should it?)
@@ -122,7 +147,7 @@ public:
     }
 
     int getVerbosity() const {
-        return _verbose;
+        return _verbose.load(std::memory_order_relaxed);
     }
     
     void setNetwork(int x) {
@@ -185,6 +210,12 @@ private:
     // Use getDefaultInstance for getting the singleton
     LogFile ();
 
+    /// Write a message, with _ioMutex held
+    void write(const std::string& msg, int thread, std::uint64_t ticks);
+
+    /// The writer thread, which empties the queues until it's stopped
+    void writeQueued();
+
     /// Mutex for locking I/O during logfile access.
     std::mutex _ioMutex;
 
@@ -192,7 +223,7 @@ private:
     std::ofstream _outstream;
 
     /// How much output is required: 2 or more gives debug output.
-    int _verbose;
+    std::atomic<int> _verbose;
 
     /// Whether to dump all SWF actions
     bool _actiondump;
@@ -217,6 +248,10 @@ private:
     
     logListener _listener;
 
+    /// The queues of all threads, and the writer thread
+    struct Queues;
+    std::unique_ptr<Queues> _queues;
+
 };
 
 DSOEXPORT void processLog_network(const boost::format& fmt);
@@ -235,7 +270,7 @@ log_impl(boost::format& fmt, FuncType func)
 
 template<typename FuncType, typename Arg, typename... Args>
 inline void
-log_impl(boost::format& fmt, FuncType processFunc, Arg arg, Args... args)
+log_impl(boost::format& fmt, FuncType processFunc, const Arg& arg, const Args&... args)
 {
     fmt % arg;
     log_impl(fmt, processFunc, args...);
@@ -243,7 +278,7 @@ log_impl(boost::format& fmt, FuncType processFunc, Arg arg, Args... args)
 
 template<typename StringType, typename FuncType, typename... Args>
 inline void
-log_impl(StringType msg, FuncType func, Args... args)
+log_impl(const StringType& msg, FuncType func, const Args&... args)
 {
     boost::format fmt(msg);
     using namespace boost::io;
@@ -253,41 +288,35 @@ log_impl(StringType msg, FuncType func, Args... args)
     log_impl(fmt, func, args...);
 }
 
-template<typename StringType, typename... Args>
-inline void log_network(StringType msg, Args... args)
-{
-    log_impl(msg, processLog_network, args...);
-}
-
-template<typename StringType, typename... Args>
-inline void log_error(StringType msg, Args... args)
-{
-    log_impl(msg, processLog_error, args...);
-}
-
-template<typename StringType, typename... Args>
-inline void log_unimpl(StringType msg, Args... args)
-{
-    log_impl(msg, processLog_unimpl, args...);
-}
-
-template<typename StringType, typename... Args>
-inline void log_trace(StringType msg, Args... args)
+/// Format and write a message, for the log_* macros
+template<typename FuncType, typename StringType, typename... Args>
+inline void
+log_format(FuncType func, const StringType& msg, const Args&... args)
 {
-    log_impl(msg, processLog_trace, args...);
+    log_impl(msg, func, args...);
 }
 
-template<typename StringType, typename... Args>
-inline void log_debug(StringType msg, Args... args)
-{
-    log_impl(msg, processLog_debug, args...);
-}
+} // namespace logger
+
+// These are macros so the level is checked before the arguments are
+// evaluated, and levels above UNDERPASS_LOG_LEVEL are compiled out.
+#define UNDERPASS_LOG(level, func, ...) \
+    do { \
+        if constexpr (UNDERPASS_LOG_LEVEL >= (level)) { \
+            if (logger::LogFile::enabled(level)) { \
+                logger::log_format(logger::func, __VA_ARGS__); \
+            } \
+        } \
+    } while (0)
+
+#define log_network(...) UNDERPASS_LOG(logger::LogFile::LOG_NORMAL, processLog_network, __VA_ARGS__)
+#define log_error(...) UNDERPASS_LOG(logger::LogFile::LOG_NORMAL, processLog_error, __VA_ARGS__)
+#define log_unimpl(...) UNDERPASS_LOG(logger::LogFile::LOG_NORMAL, processLog_unimpl, __VA_ARGS__)
+#define log_trace(...) UNDERPASS_LOG(logger::LogFile::LOG_NORMAL, processLog_trace, __VA_ARGS__)
+#define log_debug(...) UNDERPASS_LOG(logger::LogFile::LOG_DEBUG, processLog_debug, __VA_ARGS__)
+#define log_info(...) UNDERPASS_LOG(logger::LogFile::LOG_NORMAL, processLog_info, __VA_ARGS__)
 
-template<typename StringType, typename... Args>
-inline void log_info(StringType msg, Args... args)
-{
-    log_impl(msg, processLog_info, args...);
-}
+namespace logger {
 
 
 /// \class HostFunctionReport
@@ -0,0 +1,466 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+/// \file metrics.cc
+/// \brief Counters and latency histograms for the replication loop
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+
+#include "utils/metrics.hh"
+#include "utils/log.hh"
+
+using namespace logger;
+
+namespace beast = boost::beast;   // from <boost/beast.hpp>
+namespace net = boost::asio;      // from <boost/asio.hpp>
+namespace http = beast::http;     // from <boost/beast/http.hpp>
+using tcp = net::ip::tcp;         // from <boost/asio/ip/tcp.hpp>
+
+/// \namespace metrics
+namespace metrics {
+
+namespace {
+
+/// Format a sample value
+std::string
+number(double value)
+{
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.15g", value);
+    return buf;
+}
+
+/// Escape a label value or help text
+std::string
+escape(const std::string &text, bool quotes)
+{
+    std::string out;
+    for (char c: text) {
+        if (c == '\\') {
+            out += "\\\\";
+        } else if (c == '\n') {
+            out += "\\n";
+        } else if (c == '"' && quotes) {
+            out += "\\\"";
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+/// Write one sample line
+void
+sample(std::string &out, const std::string &name, const std::string &labels, const std::string &value)
+{
+    out += name;
+    if (!labels.empty()) {
+        out += "{" + labels + "}";
+    }
+    out += " " + value + "\n";
+}
+
+} // anonymous namespace
+
+std::size_t
+stripe(void)
+{
+    static std::atomic<std::size_t> next{0};
+    thread_local std::size_t mine = next.fetch_add(1, std::memory_order_relaxed) % stripes;
+    return mine;
+}
+
+std::uint64_t
+Counter::value(void) const
+{
+    std::uint64_t total = 0;
+    for (const auto &cell: cells) {
+        total += cell.value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+void
+Counter::write(std::string &out, const std::string &name, const std::string &labels) const
+{
+    sample(out, name, labels, std::to_string(value()));
+}
+
+void
+Gauge::write(std::string &out, const std::string &name, const std::string &labels) const
+{
+    sample(out, name, labels, number(value()));
+}
+
+Histogram::Histogram(double scale)
+    : scale(scale), cells(new Stripe[stripes])
+{
+    for (std::size_t i = 0; i < stripes; i++) {
+        for (auto &count: cells[i].counts) {
+            count.store(0, std::memory_order_relaxed);
+        }
+        cells[i].sum.store(0, std::memory_order_relaxed);
+    }
+}
+
+std::size_t
+Histogram::bucket(std::uint64_t value)
+{
+    if (value < subbuckets) {
+        return value;
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    if (exponent >= maxbits) {
+        return buckets - 1;
+    }
+    return subbuckets * (exponent - subbits + 1) + (value >> (exponent - subbits)) - subbuckets;
+}
+
+std::uint64_t
+Histogram::lowest(std::size_t bucket)
+{
+    if (bucket < subbuckets) {
+        return bucket;
+    }
+    int exponent = bucket / subbuckets + subbits - 1;
+    return (subbuckets + bucket % subbuckets) << (exponent - subbits);
+}
+
+void
+Histogram::record(std::uint64_t value)
+{
+    auto &cell = cells[stripe()];
+    cell.counts[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+    cell.sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+std::vector<std::uint64_t>
+Histogram::totals(void) const
+{
+    std::vector<std::uint64_t> counts(buckets, 0);
+    for (std::size_t i = 0; i < stripes; i++) {
+        for (std::size_t b = 0; b < buckets; b++) {
+            counts[b] += cells[i].counts[b].load(std::memory_order_relaxed);
+        }
+    }
+    return counts;
+}
+
+std::uint64_t
+Histogram::count(void) const
+{
+    std::uint64_t total = 0;
+    for (auto count: totals()) {
+        total += count;
+    }
+    return total;
+}
+
+std::uint64_t
+Histogram::sum(void) const
+{
+    std::uint64_t total = 0;
+    for (std::size_t i = 0; i < stripes; i++) {
+        total += cells[i].sum.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+std::uint64_t
+Histogram::quantile(double q) const
+{
+    auto counts = totals();
+    std::uint64_t total = 0;
+    for (auto count: counts) {
+        total += count;
+    }
+    if (total == 0) {
+        return 0;
+    }
+    auto rank = static_cast<std::uint64_t>(std::ceil(q * total));
+    rank = std::max<std::uint64_t>(rank, 1);
+    std::uint64_t seen = 0;
+    for (std::size_t b = 0; b < buckets; b++) {
+        seen += counts[b];
+        if (seen >= rank) {
+            return (b + 1 < buckets) ? lowest(b + 1) - 1 : lowest(b);
+        }
+    }
+    return lowest(buckets - 1);
+}
+
+// The buckets are shown at each power of two, up to the largest value
+// seen so far, so the bounds of a series never go away.
+void
+Histogram::write(std::string &out, const std::string &name, const std::string &labels) const
+{
+    auto counts = totals();
+    std::size_t last = 0;
+    std::uint64_t total = 0;
+    for (std::size_t b = 0; b < buckets; b++) {
+        if (counts[b]) {
+            last = b;
+            total += counts[b];
+        }
+    }
+    std::string prefix = labels.empty() ? "" : labels + ",";
+    std::uint64_t cumulative = 0;
+    std::size_t b = 0;
+    for (int bits = 1; total > 0 && bits <= maxbits; bits++) {
+        std::uint64_t bound = std::uint64_t(1) << bits;
+        while (b < buckets && lowest(b) < bound) {
+            cumulative += counts[b++];
+        }
+        sample(out, name + "_bucket", prefix + "le=\"" + number((bound - 1) * scale) + "\"",
+               std::to_string(cumulative));
+        if (b > last) {
+            break;
+        }
+    }
+    sample(out, name + "_bucket", prefix + "le=\"+Inf\"", std::to_string(total));
+    sample(out, name + "_sum", labels, number(sum() * scale));
+    sample(out, name + "_count", labels, std::to_string(total));
+}
+
+std::uint64_t
+Timer::stop(void)
+{
+    if (!histogram) {
+        return 0;
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    histogram->record(elapsed);
+    histogram = nullptr;
+    return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+}
+
+Registry &
+Registry::getDefaultInstance(void)
+{
+    static Registry registry;
+    return registry;
+}
+
+template <typename T, typename... Args>
+T &
+Registry::find(const std::string &name, const std::string &help, const std::string &type,
+               const labels_t &labels, Args... args)
+{
+    std::string key;
+    for (const auto &label: labels) {
+        if (!key.empty()) {
+            key += ",";
+        }
+        key += label.first + "=\"" + escape(label.second, true) + "\"";
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &family = families[name];
+    if (family.type.empty()) {
+        family.help = help;
+        family.type = type;
+    } else if (family.type != type) {
+        log_error("Metric %1% is a %2%, not a %3%!", name, family.type, type);
+        throw std::logic_error("Metric " + name + " has the wrong type");
+    }
+    auto &metric = family.metrics[key];
+    if (!metric) {
+        metric = std::make_unique<T>(args...);
+    }
+    return static_cast<T &>(*metric);
+}
+
+Counter &
+Registry::counter(const std::string &name, const std::string &help, const labels_t &labels)
+{
+    return find<Counter>(name, help, "counter", labels);
+}
+
+Gauge &
+Registry::gauge(const std::string &name, const std::string &help, const labels_t &labels)
+{
+    return find<Gauge>(name, help, "gauge", labels);
+}
+
+Histogram &
+Registry::histogram(const std::string &name, const std::string &help,
+                    const labels_t &labels, double scale)
+{
+    return find<Histogram>(name, help, "histogram", labels, scale);
+}
+
+std::string
+Registry::text(void) const
+{
+    std::string out;
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto &family: families) {
+        out += "# HELP " + family.first + " " + escape(family.second.help, false) + "\n";
+        out += "# TYPE " + family.first + " " + family.second.type + "\n";
+        for (const auto &metric: family.second.metrics) {
+            metric.second->write(out, family.first, metric.first);
+        }
+    }
+    return out;
+}
+
+struct Endpoint::Server {
+    net::io_context ioc;
+    tcp::acceptor acceptor{ioc};
+};
+
+namespace {
+
+typedef std::map<std::string, std::pair<std::string, std::function<std::string(void)>>> routes_t;
+
+/// One HTTP request to the endpoint
+class Session : public std::enable_shared_from_this<Session> {
+  public:
+    Session(tcp::socket socket, Registry &registry, const routes_t &routes)
+        : socket(std::move(socket)), registry(registry), routes(routes) {};
+
+    void run(void) {
+        auto self = shared_from_this();
+        http::async_read(socket, buffer, request,
+                         [self](beast::error_code ec, std::size_t) { self->respond(ec); });
+    };
+
+  private:
+    void respond(beast::error_code ec) {
+        if (ec) {
+            return;
+        }
+        response.version(request.version());
+        response.keep_alive(false);
+        auto found = routes.find(std::string(request.target()));
+        if (request.method() == http::verb::get && request.target() == "/metrics") {
+            response.result(http::status::ok);
+            response.set(http::field::content_type, "text/plain; version=0.0.4");
+            response.body() = registry.text();
+        } else if (request.method() == http::verb::get && found != routes.end()) {
+            response.result(http::status::ok);
+            response.set(http::field::content_type, found->second.first);
+            response.body() = found->second.second();
+        } else {
+            response.result(http::status::not_found);
+            response.set(http::field::content_type, "text/plain");
+            response.body() = "Not found\n";
+        }
+        response.prepare_payload();
+        auto self = shared_from_this();
+        http::async_write(socket, response, [self](beast::error_code ec, std::size_t) {
+            self->socket.shutdown(tcp::socket::shutdown_send, ec);
+        });
+    };
+
+    tcp::socket socket;
+    Registry &registry;
+    const routes_t &routes;
+    beast::flat_buffer buffer;
+    http::request<http::empty_body> request;
+    http::response<http::string_body> response;
+};
+
+} // anonymous namespace
+
+Endpoint::Endpoint(Registry &registry)
+    : registry(registry)
+{
+}
+
+Endpoint::~Endpoint(void)
+{
+    stop();
+}
+
+void
+Endpoint::route(const std::string &path, const std::string &type, std::function<std::string(void)> body)
+{
+    routes[path] = {type, std::move(body)};
+}
+
+bool
+Endpoint::start(unsigned short port, const std::string &address)
+{
+    stop();
+    server = std::make_unique<Server>();
+    try {
+        tcp::endpoint endpoint{net::ip::make_address(address), port};
+        server->acceptor.open(endpoint.protocol());
+        server->acceptor.set_option(net::socket_base::reuse_address(true));
+        server->acceptor.bind(endpoint);
+        server->acceptor.listen();
+        listening = server->acceptor.local_endpoint().port();
+    } catch (const boost::system::system_error &ex) {
+        log_error("Couldn't serve metrics on %1%:%2%: %3%", address, port, ex.what());
+        server.reset();
+        return false;
+    }
+    accept();
+    thread = std::thread([this] { server->ioc.run(); });
+    log_debug("Serving metrics on http://%1%:%2%/metrics", address, listening);
+    return true;
+}
+
+void
+Endpoint::stop(void)
+{
+    if (!server) {
+        return;
+    }
+    server->ioc.stop();
+    if (thread.joinable()) {
+        thread.join();
+    }
+    server.reset();
+    listening = 0;
+}
+
+void
+Endpoint::accept(void)
+{
+    server->acceptor.async_accept([this](beast::error_code ec, tcp::socket socket) {
+        if (ec == net::error::operation_aborted) {
+            return;
+        }
+        if (!ec) {
+            std::make_shared<Session>(std::move(socket), registry, routes)->run();
+        }
+        accept();
+    });
+}
+
+} // namespace metrics
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,246 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#ifndef __METRICS_HH__
+#define __METRICS_HH__
+
+/// \file metrics.hh
+/// \brief Counters and latency histograms for the replication loop
+///
+/// The metrics are always on, so recording one has to be cheap. Each
+/// thread adds to its own cache line, and nothing takes a lock except
+/// creating a metric or rendering them all in the Prometheus text
+/// format, which the Endpoint serves over HTTP.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/// \namespace metrics
+namespace metrics {
+
+/// The label names and values of a metric
+typedef std::vector<std::pair<std::string, std::string>> labels_t;
+
+/// The number of cache lines each metric is spread over
+const std::size_t stripes = 8;
+
+/// The stripe the calling thread records to
+std::size_t stripe(void);
+
+/// \class Metric
+/// \brief The interface all metrics share for rendering
+class Metric {
+  public:
+    virtual ~Metric(void) {};
+    /// Write the samples of the metric in Prometheus text format
+    virtual void write(std::string &out, const std::string &name, const std::string &labels) const = 0;
+};
+
+/// \class Counter
+/// \brief A count that only goes up
+class Counter : public Metric {
+  public:
+    /// Add \a n to the count
+    void add(std::uint64_t n = 1) {
+        cells[stripe()].value.fetch_add(n, std::memory_order_relaxed);
+    };
+    /// The sum over all threads
+    std::uint64_t value(void) const;
+    void write(std::string &out, const std::string &name, const std::string &labels) const;
+
+  private:
+    struct alignas(64) Cell {
+        std::atomic<std::uint64_t> value{0};
+    };
+    std::array<Cell, stripes> cells;
+};
+
+/// \class Gauge
+/// \brief A value that is set, like the replication lag
+class Gauge : public Metric {
+  public:
+    void set(double value) { current.store(value, std::memory_order_relaxed); };
+    double value(void) const { return current.load(std::memory_order_relaxed); };
+    void write(std::string &out, const std::string &name, const std::string &labels) const;
+
+  private:
+    std::atomic<double> current{0};
+};
+
+/// \class Histogram
+/// \brief A distribution of integer values, like HdrHistogram
+///
+/// Values are counted in buckets whose width is 1/16 of the power of
+/// two they are in, so any quantile is within about 6% of the real
+/// value. Durations are recorded in microseconds and sizes in bytes,
+/// and \a scale converts them to the unit the samples are shown in.
+class Histogram : public Metric {
+  public:
+    static constexpr int subbits = 4;                       ///< Sub-buckets per power of two, as bits
+    static constexpr std::size_t subbuckets = 1 << subbits; ///< Sub-buckets per power of two
+    static constexpr int maxbits = 48;                      ///< Larger values go in the last bucket
+    static constexpr std::size_t buckets = subbuckets * (maxbits - subbits + 1); ///< The number of buckets
+
+    explicit Histogram(double scale = 1);
+
+    /// Count one \a value
+    void record(std::uint64_t value);
+    /// Count a duration, in microseconds
+    void record(std::chrono::steady_clock::duration elapsed) {
+        record(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+    };
+    /// The number of values counted
+    std::uint64_t count(void) const;
+    /// The sum of the values counted, not scaled
+    std::uint64_t sum(void) const;
+    /// The largest value in the bucket holding the quantile \a q
+    std::uint64_t quantile(double q) const;
+    void write(std::string &out, const std::string &name, const std::string &labels) const;
+
+    /// The bucket a value is counted in
+    static std::size_t bucket(std::uint64_t value);
+    /// The smallest value counted in a bucket
+    static std::uint64_t lowest(std::size_t bucket);
+
+    const double scale;                                ///< Converts values to the unit shown
+
+  private:
+    /// The counts of all buckets summed over all threads
+    std::vector<std::uint64_t> totals(void) const;
+
+    struct alignas(64) Stripe {
+        std::array<std::atomic<std::uint64_t>, buckets> counts;
+        std::atomic<std::uint64_t> sum;
+    };
+    std::unique_ptr<Stripe[]> cells;
+};
+
+/// \class Timer
+/// \brief Records the time until it's stopped or destroyed in microseconds
+class Timer {
+  public:
+    explicit Timer(Histogram &histogram)
+        : histogram(&histogram), start(std::chrono::steady_clock::now()) {};
+    ~Timer(void) { stop(); };
+    /// Record the elapsed time, once, and return it
+    std::uint64_t stop(void);
+
+  private:
+    Histogram *histogram;
+    std::chrono::steady_clock::time_point start;
+};
+
+/// \class Registry
+/// \brief All the metrics, by name and labels
+///
+/// The metrics are created on first use and never removed, so the
+/// references returned stay valid and can be kept to skip the lookup.
+class Registry {
+  public:
+    static Registry &getDefaultInstance(void);
+
+    /// Find or create a counter
+    Counter &counter(const std::string &name, const std::string &help,
+                     const labels_t &labels = {});
+    /// Find or create a gauge
+    Gauge &gauge(const std::string &name, const std::string &help,
+                 const labels_t &labels = {});
+    /// Find or create a histogram. The \a scale is only used when it's
+    /// created, so all the histograms of a name show the same unit.
+    Histogram &histogram(const std::string &name, const std::string &help,
+                         const labels_t &labels = {}, double scale = 1);
+
+    /// All the metrics in the Prometheus text format
+    std::string text(void) const;
+
+  private:
+    /// The metrics sharing a name
+    struct Family {
+        std::string help;                                ///< The description
+        std::string type;                                ///< counter, gauge or histogram
+        std::map<std::string, std::unique_ptr<Metric>> metrics; ///< By rendered labels
+    };
+    /// Find or create a metric, which must be of type \a type
+    template <typename T, typename... Args>
+    T &find(const std::string &name, const std::string &help, const std::string &type,
+            const labels_t &labels, Args... args);
+
+    mutable std::mutex mutex;
+    std::map<std::string, Family> families;
+};
+
+/// \class Endpoint
+/// \brief Serves the metrics of a Registry over HTTP for Prometheus
+///
+/// This is a minimal blocking server on its own thread, which answers
+/// GET /metrics and the routes added. It's meant to listen on a local
+/// address.
+class Endpoint {
+  public:
+    Endpoint(Registry &registry = Registry::getDefaultInstance());
+    ~Endpoint(void);
+
+    /// Also answer GET \a path with what \a body returns, as \a type.
+    /// Routes are added before starting.
+    void route(const std::string &path, const std::string &type, std::function<std::string(void)> body);
+
+    /// Start listening, with port 0 picking a free port
+    bool start(unsigned short port, const std::string &address = "127.0.0.1");
+    /// Stop listening, and wait for the current request
+    void stop(void);
+    /// The port it's listening on
+    unsigned short port(void) const { return listening; };
+
+  private:
+    /// Wait for the next connection
+    void accept(void);
+
+    Registry &registry;
+    /// The content type and body of each extra path
+    std::map<std::string, std::pair<std::string, std::function<std::string(void)>>> routes;
+    struct Server;
+    std::unique_ptr<Server> server;
+    std::thread thread;
+    unsigned short listening = 0;
+};
+
+} // namespace metrics
+
+#endif // EOF __METRICS_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
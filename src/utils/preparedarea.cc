@@ -0,0 +1,131 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <algorithm>
+#include <iterator>
+
+#include "utils/preparedarea.hh"
+
+namespace bgi = boost::geometry::index;
+
+/// \namespace geoutil
+namespace geoutil {
+
+PreparedArea::PreparedArea(const multipolygon_t &area)
+{
+    auto addRing = [this](const polygon_t::ring_type &ring) {
+        for (std::size_t i = 0; i + 1 < ring.size(); i++) {
+            segments.emplace_back(ring[i], ring[i + 1]);
+        }
+    };
+    for (const auto &polygon: area) {
+        if (polygon.outer().empty()) {
+            continue;
+        }
+        vertices.push_back(polygon.outer().front());
+        addRing(polygon.outer());
+        for (const auto &inner: polygon.inners()) {
+            addRing(inner);
+        }
+    }
+    if (segments.empty()) {
+        return;
+    }
+    boost::geometry::envelope(area, envelope);
+
+    // Loading them all at once packs the tree better than inserting
+    std::vector<std::pair<box_t, std::size_t>> boxes;
+    boxes.reserve(segments.size());
+    for (std::size_t i = 0; i < segments.size(); i++) {
+        box_t box;
+        boost::geometry::envelope(segments[i], box);
+        boxes.emplace_back(box, i);
+    }
+    edges = decltype(edges)(boxes.begin(), boxes.end());
+}
+
+bool
+PreparedArea::covers(const point_t &point) const
+{
+    if (segments.empty() || !boost::geometry::covered_by(point, envelope)) {
+        return false;
+    }
+    // Count the edges crossed by a ray going east from the point. The
+    // rings are closed, so an odd count means it's inside.
+    double x = point.x();
+    double y = point.y();
+    box_t ray(point, point_t(envelope.max_corner().x(), y));
+    bool inside = false;
+    for (auto it = edges.qbegin(bgi::intersects(ray)); it != edges.qend(); ++it) {
+        const auto &edge = segments[it->second];
+        double x1 = edge.first.x(), y1 = edge.first.y();
+        double x2 = edge.second.x(), y2 = edge.second.y();
+        if ((y1 > y) == (y2 > y)) {
+            if (y1 == y && y2 == y && x >= std::min(x1, x2) && x <= std::max(x1, x2)) {
+                return true;
+            }
+            continue;
+        }
+        double cross = x1 + (y - y1) * (x2 - x1) / (y2 - y1);
+        if (cross == x) {
+            return true;
+        }
+        if (cross > x) {
+            inside = !inside;
+        }
+    }
+    return inside;
+}
+
+bool
+PreparedArea::intersects(const box_t &box) const
+{
+    if (segments.empty() || !boost::geometry::intersects(box, envelope)) {
+        return false;
+    }
+    // A box inside the area has its corners inside
+    if (covers(box.min_corner())) {
+        return true;
+    }
+    // A box crossing the edge of the area crosses one of its edges
+    for (auto it = edges.qbegin(bgi::intersects(box)); it != edges.qend(); ++it) {
+        if (boost::geometry::intersects(segments[it->second], box)) {
+            return true;
+        }
+    }
+    // Otherwise, the area is either inside the box or away from it
+    for (const auto &vertex: vertices) {
+        if (boost::geometry::covered_by(vertex, box)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace geoutil
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,83 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __PREPAREDAREA_HH__
+#define __PREPAREDAREA_HH__
+
+/// \file preparedarea.hh
+/// \brief A boundary prepared for testing many boxes and points
+///
+/// The priority area is the same for every change, so its edges are
+/// indexed once, and each test only looks at the few edges near it
+/// instead of walking the whole multipolygon.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <utility>
+#include <vector>
+
+#include <boost/geometry.hpp>
+#include <boost/geometry/index/rtree.hpp>
+
+#include "osm/osmobjects.hh"
+
+typedef boost::geometry::model::box<point_t> box_t;
+
+/// \namespace geoutil
+namespace geoutil {
+
+/// \class PreparedArea
+/// \brief A multipolygon with an index of its edges
+///
+/// It can be shared by threads, as nothing changes once it's built.
+class PreparedArea {
+  public:
+    PreparedArea(void){};
+    /// Index the edges of the outer and inner rings of \a area
+    PreparedArea(const multipolygon_t &area);
+
+    /// Is there no area, which means everything is in the priority area
+    bool empty(void) const { return segments.empty(); };
+
+    /// Is the point inside the area, or on its edge
+    bool covers(const point_t &point) const;
+
+    /// Does the box touch the area
+    bool intersects(const box_t &box) const;
+
+  private:
+    typedef boost::geometry::model::segment<point_t> segment_t;
+
+    box_t envelope;                ///< The box around the whole area
+    std::vector<segment_t> segments; ///< The edges of all the rings
+    std::vector<point_t> vertices; ///< A point of each polygon
+    boost::geometry::index::rtree<std::pair<box_t, std::size_t>, boost::geometry::index::rstar<16>> edges;
+};
+
+} // namespace geoutil
+
+#endif // EOF __PREPAREDAREA_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
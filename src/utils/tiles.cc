@@ -0,0 +1,200 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+
+#include "utils/tiles.hh"
+
+/// \namespace tiles
+namespace tiles {
+
+const std::string channel = "underpass_tiles";
+
+namespace {
+
+/// A box covering more tiles than this lowers the zoom
+const long maxBoxTiles = 16;
+
+/// The latitude where web mercator ends
+const double maxLatitude = 85.0511287798;
+
+} // anonymous namespace
+
+long
+TileSet::column(double lon, int z)
+{
+    long n = 1L << z;
+    auto x = static_cast<long>(std::floor((lon + 180.0) / 360.0 * n));
+    return std::clamp(x, 0L, n - 1);
+}
+
+long
+TileSet::row(double lat, int z)
+{
+    long n = 1L << z;
+    double radians = std::clamp(lat, -maxLatitude, maxLatitude) * M_PI / 180.0;
+    auto y = static_cast<long>(std::floor((1.0 - std::asinh(std::tan(radians)) / M_PI) / 2.0 * n));
+    return std::clamp(y, 0L, n - 1);
+}
+
+void
+TileSet::setZoom(int zoom)
+{
+    if (zoom >= z) {
+        return;
+    }
+    int shift = z - zoom;
+    std::set<std::pair<long, long>> parents;
+    for (const auto &tile: tiles) {
+        parents.emplace(tile.first >> shift, tile.second >> shift);
+    }
+    tiles.swap(parents);
+    z = zoom;
+}
+
+void
+TileSet::add(double minlon, double minlat, double maxlon, double maxlat)
+{
+    while (true) {
+        long x0 = column(minlon, z), x1 = column(maxlon, z);
+        // Rows go from north to south
+        long y0 = row(maxlat, z), y1 = row(minlat, z);
+        if (z > 0 && (x1 - x0 + 1) * (y1 - y0 + 1) > maxBoxTiles) {
+            setZoom(z - 1);
+            continue;
+        }
+        for (long x = x0; x <= x1; x++) {
+            for (long y = y0; y <= y1; y++) {
+                tiles.emplace(x, y);
+            }
+        }
+        return;
+    }
+}
+
+void
+TileSet::add(const TileSet &other)
+{
+    setZoom(other.z);
+    int shift = other.z - z;
+    for (const auto &tile: other.tiles) {
+        tiles.emplace(tile.first >> shift, tile.second >> shift);
+    }
+}
+
+void
+TileSet::coarsen(std::size_t max)
+{
+    while (tiles.size() > max && z > 0) {
+        setZoom(z - 1);
+    }
+}
+
+bool
+TileSet::covers(int zoom, long x, long y) const
+{
+    if (zoom >= z) {
+        int shift = zoom - z;
+        return tiles.count({x >> shift, y >> shift}) > 0;
+    }
+    // Look for a child of the tile, one column at a time
+    int shift = z - zoom;
+    long x0 = x << shift, x1 = (x + 1) << shift;
+    long y0 = y << shift, y1 = (y + 1) << shift;
+    auto it = tiles.lower_bound({x0, y0});
+    while (it != tiles.end() && it->first < x1) {
+        if (it->second >= y0 && it->second < y1) {
+            return true;
+        }
+        if (it->second < y0) {
+            it = tiles.lower_bound({it->first, y0});
+        } else {
+            it = tiles.lower_bound({it->first + 1, y0});
+        }
+    }
+    return false;
+}
+
+std::string
+TileSet::text(void) const
+{
+    std::string out = std::to_string(z) + ":";
+    for (const auto &tile: tiles) {
+        if (out.back() != ':') {
+            out += ',';
+        }
+        out += std::to_string(tile.first) + "/" + std::to_string(tile.second);
+    }
+    return out;
+}
+
+bool
+TileSet::parse(const std::string &text)
+{
+    tiles.clear();
+    auto colon = text.find(':');
+    if (colon == std::string::npos) {
+        return false;
+    }
+    try {
+        z = std::stoi(text.substr(0, colon));
+        if (z < 0 || z > 30) {
+            return false;
+        }
+        std::string list = text.substr(colon + 1);
+        if (list.empty()) {
+            return true;
+        }
+        std::vector<std::string> items;
+        boost::split(items, list, boost::is_any_of(","));
+        for (const auto &item: items) {
+            auto slash = item.find('/');
+            if (slash == std::string::npos) {
+                return false;
+            }
+            tiles.emplace(std::stol(item.substr(0, slash)), std::stol(item.substr(slash + 1)));
+        }
+    } catch (const std::exception &e) {
+        return false;
+    }
+    return true;
+}
+
+std::string
+TileSet::notify(void) const
+{
+    // The text is only digits and punctuation, so it needs no quoting
+    return "NOTIFY " + channel + ", '" + text() + "';\n";
+}
+
+} // namespace tiles
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
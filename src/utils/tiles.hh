@@ -0,0 +1,102 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __TILES_HH__
+#define __TILES_HH__
+
+/// \file tiles.hh
+/// \brief Sets of web mercator tiles touched by a batch of changes
+///
+/// The replicator collects the tiles of the objects it writes, and
+/// sends them with NOTIFY when the batch is committed, so a tile
+/// server only drops the cached tiles that changed.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <set>
+#include <string>
+#include <utility>
+
+/// \namespace tiles
+namespace tiles {
+
+/// The channel the changed tiles are sent on
+extern const std::string channel;
+
+/// \class TileSet
+/// \brief The tiles at one zoom level, which also covers their parents
+/// and children
+class TileSet {
+  public:
+    /// The zoom the tiles are collected at
+    static const int defaultZoom = 14;
+    /// The most tiles sent in one notification, which is limited to
+    /// 8000 bytes
+    static const std::size_t maxNotify = 400;
+
+    TileSet(int zoom = defaultZoom) : z(zoom) {};
+
+    /// Add the tiles covering a bounding box in degrees. A box over
+    /// many tiles lowers the zoom of the whole set instead.
+    void add(double minlon, double minlat, double maxlon, double maxlat);
+    /// Add the tiles of another set
+    void add(const TileSet &other);
+
+    /// Lower the zoom until there are at most \a max tiles
+    void coarsen(std::size_t max);
+
+    /// If tile \a z/\a x/\a y contains or is in one of the tiles
+    bool covers(int z, long x, long y) const;
+
+    /// The tiles as "zoom:x/y,x/y,..."
+    std::string text(void) const;
+    /// Read the tiles from text(), returns false if it's not valid
+    bool parse(const std::string &text);
+
+    /// The SQL to send the tiles when the transaction is committed
+    std::string notify(void) const;
+
+    int zoom(void) const { return z; };
+    std::size_t size(void) const { return tiles.size(); };
+    bool empty(void) const { return tiles.empty(); };
+
+    /// The column of the tile with \a lon at zoom \a z
+    static long column(double lon, int z);
+    /// The row of the tile with \a lat at zoom \a z
+    static long row(double lat, int z);
+
+  private:
+    /// Lower the zoom to \a zoom
+    void setZoom(int zoom);
+
+    int z;
+    std::set<std::pair<long, long>> tiles;   ///< The column and row of each tile
+};
+
+} // namespace tiles
+
+#endif // EOF __TILES_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
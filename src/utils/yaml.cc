@@ -57,6 +57,7 @@ void Yaml::read(const std::string &fspec) {
             add_node(node, index, root);
         }
     }
+    this->root.reindex();
 }
 
 void Yaml::add_node(Node &node, int index, Node &parent, int depth) {
@@ -117,99 +118,167 @@ void Yaml::dump() {
     this->root.dump();
 }
 
-Node Yaml::get(std::string key) {
+Node Yaml::get(std::string_view key) const {
     return this->root.get(key);
 }
 
-bool Yaml::contains_key(std::string key) {
+const Node &Yaml::get_ref(std::string_view key) const {
+    return this->root.get_ref(key);
+}
+
+bool Yaml::contains_key(std::string_view key) const {
     return this->root.contains_key(key);
 }
 
-bool Yaml::contains_value(std::string key, std::string value) {
+bool Yaml::contains_value(std::string_view key, std::string_view value) const {
     return this->root.contains_value(key, value);
 }
 
 Node::Node() {};
 Node::~Node() {};
 
-Node Node::get(std::string key) {
-    auto result = Node();
-    this->get(key, result);
-    return result;
+Node::Node(const Node &other)
+    : value(other.value), children(other.children) {
+    // The children rebuilt their own indexes when copied
+    if (other.indexed) {
+        this->build();
+    }
+}
+
+// Moving the children doesn't move the strings the indexes point to
+Node::Node(Node &&other) noexcept
+    : value(std::move(other.value)), children(std::move(other.children)),
+      indexed(other.indexed), index(std::move(other.index)), names(std::move(other.names)) {
+    other.indexed = false;
 }
 
-std::string Node::get_value(std::string key) {
-    auto result = Node();
-    this->get(key, result);
-    if (result.children.size() > 0) {
-        return result.children.front().value;
+Node &Node::operator=(const Node &other) {
+    if (this != &other) {
+        *this = Node(other);
     }
-    return "";
+    return *this;
 }
 
-std::vector<std::string> Node::get_values(std::string key) {
-    auto result = Node();
-    this->get(key, result);
-    std::vector<std::string> values;
-    if (result.children.size() > 0) {
-        for (auto it = result.children.begin(); it != result.children.end(); ++it) {
-            values.push_back(it->value);
+Node &Node::operator=(Node &&other) noexcept {
+    value = std::move(other.value);
+    children = std::move(other.children);
+    indexed = other.indexed;
+    index = std::move(other.index);
+    names = std::move(other.names);
+    other.indexed = false;
+    return *this;
+}
+
+void Node::reindex(void) {
+    for (auto it = std::begin(this->children); it != std::end(this->children); ++it) {
+        it->reindex();
+    }
+    this->build();
+}
+
+void Node::build(void) {
+    index.clear();
+    names.clear();
+    for (std::size_t i = 0; i < children.size(); i++) {
+        const Node &node = children[i];
+        index.emplace(node.value, i);
+        names.insert(node.value);
+        if (node.indexed) {
+            names.insert(node.names.begin(), node.names.end());
         }
     }
-    return values;
+    indexed = true;
 }
 
-void Node::get(std::string key, Node &result) {
+const Node *Node::child(std::string_view key) const {
+    if (indexed) {
+        auto found = index.find(key);
+        return (found != index.end()) ? &children[found->second] : nullptr;
+    }
     for (auto it = std::begin(this->children); it != std::end(this->children); ++it) {
         if (it->value == key) {
-            result = *it;
-            return;
-        }
-        if (it->children.size() > 0) {
-            it->get(key, result);
+            return &*it;
         }
     }
+    return nullptr;
 }
 
-bool Node::contains_key(std::string key) {
-    bool result = false;
-    this->contains_key(key, result);
-    return result;
-}
-
-void Node::contains_key(std::string key, bool &result) {
+bool Node::below(std::string_view key) const {
+    if (indexed) {
+        return names.count(key) > 0;
+    }
     for (auto it = std::begin(this->children); it != std::end(this->children); ++it) {
-        if (it->value == key) {
-            result = true;
-            return;
+        if (it->value == key || it->below(key)) {
+            return true;
         }
-        if (it->children.size() > 0) {
-            it->contains_key(key, result);
+    }
+    return false;
+}
+
+// A child with the key wins over anything deeper, otherwise the
+// match in the last child that has one is used.
+const Node *Node::find(std::string_view key) const {
+    auto found = this->child(key);
+    if (found) {
+        return found;
+    }
+    for (auto it = this->children.rbegin(); it != this->children.rend(); ++it) {
+        if (it->below(key)) {
+            return it->find(key);
         }
     }
+    return nullptr;
 }
 
-bool Node::contains_value(std::string key, std::string value) {
-    bool result = false;
-    this->contains_value(key, value, result);
-    return result;
+const Node &Node::get_ref(std::string_view key) const {
+    static const Node empty;
+    auto found = this->find(key);
+    return found ? *found : empty;
 }
 
-void Node::contains_value(std::string key, std::string value, bool &result) {
-    for (auto it = std::begin(this->children); it != std::end(this->children); ++it) {
-        if (it->value == key) {
-            for (auto itk = std::begin(it->children); itk != std::end(it->children); ++itk) {
-                if (itk->value == value) {
-                    result = true;
-                    return;
-                }
-            }
-            return;
+const std::string &Node::get_value_ref(std::string_view key) const {
+    static const std::string empty;
+    auto found = this->find(key);
+    if (found && found->children.size() > 0) {
+        return found->children.front().value;
+    }
+    return empty;
+}
+
+Node Node::get(std::string_view key) const {
+    return this->get_ref(key);
+}
+
+std::string Node::get_value(std::string_view key) const {
+    return this->get_value_ref(key);
+}
+
+std::vector<std::string> Node::get_values(std::string_view key) const {
+    std::vector<std::string> values;
+    auto found = this->find(key);
+    if (found) {
+        for (auto it = found->children.begin(); it != found->children.end(); ++it) {
+            values.push_back(it->value);
         }
-        if (it->children.size() > 0) {
-            it->contains_value(key, value, result);
+    }
+    return values;
+}
+
+bool Node::contains_key(std::string_view key) const {
+    return this->below(key);
+}
+
+// Only the first child with the key is checked for the value, and
+// the children after it aren't searched.
+bool Node::contains_value(std::string_view key, std::string_view value) const {
+    auto found = this->child(key);
+    auto last = found ? this->children.begin() + (found - this->children.data()) : this->children.end();
+    for (auto it = this->children.begin(); it != last; ++it) {
+        if (it->below(key) && it->contains_value(key, value)) {
+            return true;
         }
     }
+    return found && found->child(value) != nullptr;
 }
 
 void Node::dump() {
@@ -31,14 +31,23 @@
 #endif
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 
 /// \namespace yaml
 namespace yaml {
 
 /// \class Node
 /// \brief Represents a Node inside a nested structure
+///
+/// The lookups search the whole subtree below the Node. Once the
+/// tree is indexed, which Yaml::read() does, they use hash tables of
+/// the children and of all the names below each Node instead of
+/// scanning it. The indexes point into the children, so reindex()
+/// must be called after changing them.
 class Node {
     public:
         ///
@@ -50,29 +59,48 @@ class Node {
         ///
         std::vector<struct Node> children;
         ///
+        /// \brief find returns the Node identified by a key, without copying it
+        /// \param key is the value that must to match with the Node
+        /// \return a pointer to the Node, or nullptr if there is none
+        ///
+        const Node *find(std::string_view key) const;
+        ///
+        /// \brief get_ref returns a Node identified by a key, without copying it
+        /// \param key is the value that must to match with the Node
+        /// \return the Node, or an empty Node if there is none
+        ///
+        const Node &get_ref(std::string_view key) const;
+        ///
+        /// \brief get_value_ref returns the value for a Node that has only one children,
+        ///        without copying it
+        /// \param key is the value that must to match with the parent Node
+        /// \return the string value of the children Node, or an empty string
+        ///
+        const std::string &get_value_ref(std::string_view key) const;
+        ///
         /// \brief get returns a Node identified by a key
         /// \param key is the value that must to match with the Node
         /// \return the Node
         ///
-        Node get(std::string key);
+        Node get(std::string_view key) const;
         ///
         /// \brief get_value returns the value for a Node that has only one children
         /// \param key is the value that must to match with the parent Node
         /// \return the string value of the children Node
         ///
-        std::string get_value(std::string key);
+        std::string get_value(std::string_view key) const;
         ///
         /// \brief get_values returns all values of children Nodes
         /// \param key is the value that must to match with the parent Node
         /// \return a vector of strings with the values of all the Node's children
         ///
-        std::vector<std::string> get_values(std::string key);
+        std::vector<std::string> get_values(std::string_view key) const;
         ///
         /// \brief contains_key check if a key is present in some Node
         /// \param key is the value that must to match with the Node
         /// \return TRUE if key is present or FALSE if not
         ///
-        bool contains_key(std::string key);
+        bool contains_key(std::string_view key) const;
         ///
         /// \brief contains_value check if a combination of key:value is present in some Node
         ///        and one of its children
@@ -80,18 +108,32 @@ class Node {
         /// \param value is the value that must to match with one of the Node's children
         /// \return TRUE if the key:value combination is present or FALSE if not
         ///
-        bool contains_value(std::string key, std::string value);
+        bool contains_value(std::string_view key, std::string_view value) const;
+        ///
+        /// \brief reindex builds the lookup indexes of this Node and all Nodes below it
+        ///
+        void reindex(void);
         ///
         /// \brief dump prints values for all Node's children (all values if Node is root)
         ///
         void dump();
         Node();
+        Node(const Node &other);
+        Node(Node &&other) noexcept;
+        Node &operator=(const Node &other);
+        Node &operator=(Node &&other) noexcept;
         ~Node();
     private:
-        void get(std::string key, Node &node);
-        void contains_key(std::string key, bool &result);
-        void contains_value(std::string key, std::string value, bool &result);
+        /// The first child with the value \a key
+        const Node *child(std::string_view key) const;
+        /// If any Node below this one has the value \a key
+        bool below(std::string_view key) const;
+        /// Build the indexes of this Node from the indexes of its children
+        void build(void);
 
+        bool indexed = false;                                   ///< If the indexes are built
+        std::unordered_map<std::string_view, std::size_t> index; ///< The first child with each value
+        std::unordered_set<std::string_view> names;              ///< All the values below this Node
 };
 
 /// \class Yaml
@@ -109,7 +151,14 @@ class Yaml {
         /// \param key is the value that must to match with the Node
         /// \return the Node
         ///
-        Node get(std::string key);
+        Node get(std::string_view key) const;
+        ///
+        /// \brief get_ref returns a Node identified by a key, starting from the root Node,
+        ///        without copying it
+        /// \param key is the value that must to match with the Node
+        /// \return the Node, or an empty Node if there is none
+        ///
+        const Node &get_ref(std::string_view key) const;
         ///
         /// \brief dump prints all values for all Nodes
         ///
@@ -119,7 +168,7 @@ class Yaml {
         /// \param key is the value that must to match with the Node
         /// \return TRUE if key is present or FALSE if not
         ///
-        bool contains_key(std::string key);
+        bool contains_key(std::string_view key) const;
         ///
         /// \brief contains_value check if a combination of key:value is present in some Node
         ///        and one of its children, starting from the root Node
@@ -127,7 +176,7 @@ class Yaml {
         /// \param value is the value that must to match with one of the Node's children
         /// \return TRUE if the key:value combination is present or FALSE if not
         ///
-        bool contains_value(std::string key, std::string value);
+        bool contains_value(std::string_view key, std::string_view value) const;
     private:
         void add_node(Node &node, int index, Node &parent, int depth = 0);
         void clean(std::string &line);
@@ -49,8 +49,8 @@ DefaultValidation::checkNode(const osmobjects::OsmNode &node, const std::string
         log_error("No config files!");
         return status;
     }
-    yaml::Yaml tests = yamls[type];
-    semantic::Semantic::checkNode(node, type, tests, status);
+    const auto &rules = this->rules(type);
+    semantic::Semantic::checkNode(node, type, rules, status);
 
     return status;
 }
@@ -67,9 +67,9 @@ DefaultValidation::checkWay(const osmobjects::OsmWay &way, const std::string &ty
         log_error("No config files!");
         return status;
     }
-    yaml::Yaml tests = yamls[type];
-    semantic::Semantic::checkWay(way, type, tests, status);
-    geospatial::Geospatial::checkWay(way, type, tests, status);
+    const auto &rules = this->rules(type);
+    semantic::Semantic::checkWay(way, type, rules, status);
+    geospatial::Geospatial::checkWay(way, type, rules, status);
     if (way.linestring.size() > 2) {
         boost::geometry::centroid(way.linestring, status->center);
     }
@@ -88,9 +88,9 @@ DefaultValidation::checkRelation(const osmobjects::OsmRelation &relation, const
         log_error("No config files!");
         return status;
     }
-    yaml::Yaml tests = yamls[type];
-    semantic::Semantic::checkRelation(relation, type, tests, status);
-    // geospatial::Geospatial::checkRelation(relation, type, tests, status);
+    const auto &rules = this->rules(type);
+    semantic::Semantic::checkRelation(relation, type, rules, status);
+    // geospatial::Geospatial::checkRelation(relation, type, rules, status);
     // if (relation.linestring.size() > 2) {
     //     boost::geometry::centroid(way.linestring, status->center);
     // }
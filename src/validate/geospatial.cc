@@ -26,7 +26,7 @@
 #include <boost/geometry.hpp>
 #include <boost/geometry/geometries/polygon.hpp>
 
-#include "utils/yaml.hh"
+#include "validate/ruleprogram.hh"
 #include "geospatial.hh"
 #include "validate.hh"
 #include "osm/osmchange.hh"
@@ -49,24 +49,21 @@ Geospatial::Geospatial() {}
 // This checks a way. A way should always have some tags. Often a polygon
 // with no tags is a building.
 std::shared_ptr<ValidateStatus>
-Geospatial::checkWay(const osmobjects::OsmWay &way, const std::string &type, yaml::Yaml &tests, std::shared_ptr<ValidateStatus> &status)
+Geospatial::checkWay(const osmobjects::OsmWay &way, const std::string &type, const ruleprogram::RuleProgram &rules, std::shared_ptr<ValidateStatus> &status)
 {
     if (way.action == osmobjects::remove) {
         return status;
     }
 
-    auto config = tests.get("config");
-    bool check_badgeom = config.get_value("badgeom") == "yes";
+    bool check_badgeom = rules.check_badgeom;
     // bool check_overlapping = config.get_value("overlapping") == "yes";
     // bool check_duplicate = config.get_value("duplicate") == "yes";
 
     if (way.tags.count(type)) {
         if (check_badgeom) {
-            auto badgeom_minangle = config.get_value("badgeom_minangle");
-            auto badgeom_maxangle = config.get_value("badgeom_maxangle");
             if (!way.linestring.empty() && boost::geometry::equals(way.linestring.back(), way.linestring.front())) {
-                if (badgeom_minangle != "" && badgeom_maxangle != "") {
-                    if (unsquared(way.linestring, std::stod(badgeom_minangle), std::stod(badgeom_maxangle))) {
+                if (rules.badgeom_angles) {
+                    if (unsquared(way.linestring, rules.badgeom_minangle, rules.badgeom_maxangle)) {
                         status->status.insert(badgeom);
                     }
                 } else {
@@ -31,7 +31,7 @@
 #include <memory>
 #include "osm/osmobjects.hh"
 #include "validate.hh"
-#include "utils/yaml.hh"
+#include "validate/ruleprogram.hh"
 
 /// \namespace geospatial
 namespace geospatial {
@@ -43,7 +43,7 @@ class Geospatial
 public:
     Geospatial();
     ~Geospatial(void) {  };
-    static std::shared_ptr<ValidateStatus> checkWay(const osmobjects::OsmWay &way, const std::string &type, yaml::Yaml &tests, std::shared_ptr<ValidateStatus> &status);
+    static std::shared_ptr<ValidateStatus> checkWay(const osmobjects::OsmWay &way, const std::string &type, const ruleprogram::RuleProgram &rules, std::shared_ptr<ValidateStatus> &status);
 private:
     static bool unsquared(const linestring_t &way, double min_angle = 89, double max_angle = 91);
     static bool duplicate(const std::list<std::shared_ptr<osmobjects::OsmWay>> &allways, osmobjects::OsmWay &way);
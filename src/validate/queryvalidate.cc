@@ -81,6 +81,146 @@ std::map<osmobjects::osmtype_t, std::string> objtypes = {
     {osmobjects::relation, "relation"}
 };
 
+ValidationBatch::ValidationBatch(std::shared_ptr<Pq> db)
+    : dbconn(db)
+{
+}
+
+void
+ValidationBatch::add(const ValidateStatus &validation, const valerror_t &status)
+{
+    key_t key{validation.osm_id, status, validation.source};
+    auto found = upserts.find(key);
+    // Like the ON CONFLICT clause, only a newer version replaces a row
+    if (found != upserts.end() && found->second.version >= validation.version) {
+        return;
+    }
+
+    Row row;
+    row.version = validation.version;
+    row.changeset = std::to_string(validation.changeset);
+    row.uid = std::to_string(validation.uid);
+    row.type = "'" + objtypes[validation.objtype] + "'";
+    if (validation.values.size() > 0) {
+        // An array literal, as unnest() would flatten a nested array
+        std::string values;
+        for (const auto &value: std::as_const(validation.values)) {
+            auto tmp = dbconn->escapedString(value);
+            boost::algorithm::replace_all(tmp, "\\", "\\\\");
+            boost::algorithm::replace_all(tmp, "\"", "\\\"");
+            values += "\"" + tmp + "\",";
+        }
+        values.pop_back();
+        row.values = "'{" + values + "}'";
+    } else {
+        row.values = "NULL";
+    }
+    row.timestamp = "'" + to_simple_string(validation.timestamp) + "'";
+    std::stringstream ss;
+    ss << std::setprecision(12) << boost::geometry::wkt(validation.center);
+    row.location = "'" + ss.str() + "'";
+    upserts[key] = row;
+}
+
+void
+ValidationBatch::remove(long osm_id, const valerror_t &status, const std::string &source)
+{
+    key_t key{osm_id, status, source};
+    upserts.erase(key);
+    deletes.insert(key);
+}
+
+void
+ValidationBatch::remove(long osm_id, const valerror_t &status)
+{
+    auto it = upserts.lower_bound(key_t{osm_id, status, ""});
+    while (it != upserts.end() && std::get<0>(it->first) == osm_id && std::get<1>(it->first) == status) {
+        it = upserts.erase(it);
+    }
+    anysource.insert({osm_id, status});
+}
+
+bool
+ValidationBatch::empty(void) const
+{
+    return upserts.empty() && deletes.empty() && anysource.empty();
+}
+
+std::string
+ValidationBatch::query(void) const
+{
+#ifdef TIMING_DEBUG_X
+    boost::timer::auto_cpu_timer timer("ValidationBatch::query: took %w seconds\n");
+#endif
+    std::string query;
+
+    // The deletes go first, as a row deleted and then added again is
+    // in both, while a row added and then deleted is only deleted.
+    if (!deletes.empty() || !anysource.empty()) {
+        std::vector<std::string> conditions;
+        if (!deletes.empty()) {
+            std::string rows;
+            for (const auto &key: deletes) {
+                boost::format fmt("(%d,'%s','%s'),");
+                fmt % std::get<0>(key) % status_list[std::get<1>(key)];
+                fmt % dbconn->escapedString(std::get<2>(key));
+                rows += fmt.str();
+            }
+            rows.pop_back();
+            conditions.push_back("(osm_id, status, source) IN (" + rows + ")");
+        }
+        if (!anysource.empty()) {
+            std::string rows;
+            for (const auto &key: anysource) {
+                boost::format fmt("(%d,'%s'),");
+                fmt % key.first % status_list[key.second];
+                rows += fmt.str();
+            }
+            rows.pop_back();
+            conditions.push_back("(osm_id, status) IN (" + rows + ")");
+        }
+        query += "DELETE FROM validation WHERE " + boost::algorithm::join(conditions, " OR ") + ";";
+    }
+
+    if (!upserts.empty()) {
+        // One array per column, which unnest() turns back into rows
+        std::array<std::string, 10> columns;
+        for (const auto &[key, row]: upserts) {
+            const std::array<std::string, 10> values = {
+                std::to_string(std::get<0>(key)),
+                row.changeset,
+                row.uid,
+                row.type,
+                "'" + status_list[std::get<1>(key)] + "'",
+                row.values,
+                row.timestamp,
+                row.location,
+                "'" + dbconn->escapedString(std::get<2>(key)) + "'",
+                std::to_string(row.version)
+            };
+            for (std::size_t i = 0; i < columns.size(); i++) {
+                columns[i] += values[i] + ",";
+            }
+        }
+        const std::array<std::string, 10> types = {
+            "int8", "int8", "int8", "objtype", "status", "text", "timestamptz", "text", "text", "int8"
+        };
+        query += "INSERT INTO validation AS v (osm_id, changeset, uid, type, status, values, timestamp, location, source, version)";
+        query += " SELECT r.osm_id, r.changeset, r.uid, r.type, r.status, r.vals::text[], r.ts,";
+        query += " ST_GeomFromText(r.location, 4326), r.source, r.version FROM unnest(";
+        for (std::size_t i = 0; i < columns.size(); i++) {
+            columns[i].pop_back();
+            query += "ARRAY[" + columns[i] + "]::" + types[i] + "[]";
+            query += (i + 1 < columns.size()) ? ", " : "";
+        }
+        query += ") AS r(osm_id, changeset, uid, type, status, vals, ts, location, source, version)";
+        query += " ON CONFLICT (osm_id, status, source) DO UPDATE SET version = EXCLUDED.version,";
+        query += " timestamp = EXCLUDED.timestamp WHERE v.version < EXCLUDED.version;";
+    }
+
+    return query;
+}
+
 QueryValidate::QueryValidate(void) {}
 
 QueryValidate::QueryValidate(std::shared_ptr<Pq> db) {
@@ -203,25 +343,21 @@ QueryValidate::ways(
     std::string &task_query,
     std::shared_ptr<std::vector<long>> validation_removals
 ) {
-    for (auto it = wayval->begin(); it != wayval->end(); ++it) {
+    ValidationBatch batch(dbconn);
+    ways(wayval, batch, validation_removals);
+    task_query += batch.query();
+}
+
+void
+QueryValidate::nodes(
+    std::shared_ptr<std::vector<std::shared_ptr<ValidateStatus>>> nodeval,
+    std::string &task_query
+) {
+    for (auto it = nodeval->begin(); it != nodeval->end(); ++it) {
         if (it->get()->status.size() > 0) {
             for (auto status_it = it->get()->status.begin(); status_it != it->get()->status.end(); ++status_it) {
                 task_query += applyChange(*it->get(), *status_it);
             }
-            if (!it->get()->hasStatus(overlapping)) {
-                task_query += updateValidation(it->get()->osm_id, overlapping, "building");
-            }
-            if (!it->get()->hasStatus(duplicate)) {
-                task_query += updateValidation(it->get()->osm_id, duplicate, "building");
-            }
-            if (!it->get()->hasStatus(badgeom)) {
-                task_query += updateValidation(it->get()->osm_id, badgeom, "building");
-            }
-            if (!it->get()->hasStatus(badvalue)) {
-                task_query += updateValidation(it->get()->osm_id, badvalue);
-            }
-        } else {
-            validation_removals->push_back(it->get()->osm_id);
         }
     }
 }
@@ -229,13 +365,39 @@ QueryValidate::ways(
 void
 QueryValidate::nodes(
     std::shared_ptr<std::vector<std::shared_ptr<ValidateStatus>>> nodeval,
-    std::string &task_query
+    std::string &task_query,
+    std::shared_ptr<std::vector<long>> validation_removals
 ) {
-    for (auto it = nodeval->begin(); it != nodeval->end(); ++it) {
+    ValidationBatch batch(dbconn);
+    nodes(nodeval, batch, validation_removals);
+    task_query += batch.query();
+}
+
+void
+QueryValidate::ways(
+    std::shared_ptr<std::vector<std::shared_ptr<ValidateStatus>>> wayval,
+    ValidationBatch &batch,
+    std::shared_ptr<std::vector<long>> validation_removals
+) {
+    for (auto it = wayval->begin(); it != wayval->end(); ++it) {
         if (it->get()->status.size() > 0) {
             for (auto status_it = it->get()->status.begin(); status_it != it->get()->status.end(); ++status_it) {
-                task_query += applyChange(*it->get(), *status_it);
+                batch.add(*it->get(), *status_it);
             }
+            if (!it->get()->hasStatus(overlapping)) {
+                batch.remove(it->get()->osm_id, overlapping, "building");
+            }
+            if (!it->get()->hasStatus(duplicate)) {
+                batch.remove(it->get()->osm_id, duplicate, "building");
+            }
+            if (!it->get()->hasStatus(badgeom)) {
+                batch.remove(it->get()->osm_id, badgeom, "building");
+            }
+            if (!it->get()->hasStatus(badvalue)) {
+                batch.remove(it->get()->osm_id, badvalue);
+            }
+        } else {
+            validation_removals->push_back(it->get()->osm_id);
         }
     }
 }
@@ -243,16 +405,16 @@ QueryValidate::nodes(
 void
 QueryValidate::nodes(
     std::shared_ptr<std::vector<std::shared_ptr<ValidateStatus>>> nodeval,
-    std::string &task_query,
+    ValidationBatch &batch,
     std::shared_ptr<std::vector<long>> validation_removals
 ) {
     for (auto it = nodeval->begin(); it != nodeval->end(); ++it) {
         if (it->get()->status.size() > 0) {
             for (auto status_it = it->get()->status.begin(); status_it != it->get()->status.end(); ++status_it) {
-                task_query += applyChange(*it->get(), *status_it);
+                batch.add(*it->get(), *status_it);
             }
             if (!it->get()->hasStatus(badvalue)) {
-                task_query += updateValidation(it->get()->osm_id, badvalue);
+                batch.remove(it->get()->osm_id, badvalue);
             }
         } else {
             validation_removals->push_back(it->get()->osm_id);
@@ -35,8 +35,11 @@
 #include <algorithm>
 #include <array>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <set>
 #include <string>
+#include <tuple>
 #include <vector>
 
 #include <boost/date_time.hpp>
@@ -60,6 +63,52 @@ namespace osmchange {
 /// \namespace queryvalidate
 namespace queryvalidate {
 
+/// The names of the statuses in the database
+extern std::map<valerror_t, std::string> status_list;
+/// The names of the object types in the database
+extern std::map<osmobjects::osmtype_t, std::string> objtypes;
+
+/// \class ValidationBatch
+/// \brief Collects validation rows to write them with a few statements
+///
+/// Rather than one upsert or delete per status of each object, the
+/// rows are collected and written with one DELETE and one upsert from
+/// unnest(). Only the last change to each row is kept, and the deletes
+/// run first, so the result is the same as running the statements in
+/// the order they were added.
+class ValidationBatch {
+  public:
+    ValidationBatch(std::shared_ptr<Pq> db);
+    /// Insert or update the row for \a status of an object
+    void add(const ValidateStatus &validation, const valerror_t &status);
+    /// Delete the row for \a status of an object from \a source
+    void remove(long osm_id, const valerror_t &status, const std::string &source);
+    /// Delete the rows for \a status of an object from all sources
+    void remove(long osm_id, const valerror_t &status);
+    /// Build the query for all the rows
+    std::string query(void) const;
+    /// If there is nothing to write
+    bool empty(void) const;
+
+  private:
+    /// The primary key of the validation table
+    typedef std::tuple<long, valerror_t, std::string> key_t;
+    /// A row to upsert, with the columns already formatted for SQL
+    struct Row {
+        long version;
+        std::string changeset;
+        std::string uid;
+        std::string type;
+        std::string values;
+        std::string timestamp;
+        std::string location;
+    };
+    std::shared_ptr<Pq> dbconn;                     ///< Used to escape strings
+    std::map<key_t, Row> upserts;                   ///< Rows to insert or update
+    std::set<key_t> deletes;                        ///< Rows to delete
+    std::set<std::pair<long, valerror_t>> anysource; ///< Rows to delete from all sources
+};
+
 /// \class QueryValidate
 /// \brief This build validation queries for the database
 ///
@@ -85,6 +134,10 @@ class QueryValidate  {
     void ways(std::shared_ptr<std::vector<std::shared_ptr<ValidateStatus>>> wayval, std::string &task_query, std::shared_ptr<std::vector<long>> validation_removals);
     void nodes(std::shared_ptr<std::vector<std::shared_ptr<ValidateStatus>>> nodeval, std::string &task_query, std::shared_ptr<std::vector<long>> validation_removals);
     void rels(std::shared_ptr<std::vector<std::shared_ptr<ValidateStatus>>> relval, std::string &task_query, std::shared_ptr<std::vector<long>> validation_removals);
+    /// Add the validation results for ways to a batch
+    void ways(std::shared_ptr<std::vector<std::shared_ptr<ValidateStatus>>> wayval, ValidationBatch &batch, std::shared_ptr<std::vector<long>> validation_removals);
+    /// Add the validation results for nodes to a batch
+    void nodes(std::shared_ptr<std::vector<std::shared_ptr<ValidateStatus>>> nodeval, ValidationBatch &batch, std::shared_ptr<std::vector<long>> validation_removals);
     // Database connection, used for escape strings
     std::shared_ptr<Pq> dbconn;
   };
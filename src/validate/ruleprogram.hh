@@ -0,0 +1,160 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __RULEPROGRAM_HH__
+#define __RULEPROGRAM_HH__
+
+/// \file ruleprogram.hh
+/// \brief The validation rules of a YAML file, compiled for lookups
+///
+/// The YAML tree is searched recursively, and a lookup returns a copy
+/// of the subtree, which is too slow to do for every tag of every
+/// object. A RuleProgram is compiled once when the configuration is
+/// loaded, and validating an object is then only hash table lookups.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "utils/yaml.hh"
+#include "utils/log.hh"
+
+using namespace logger;
+
+/// \namespace ruleprogram
+namespace ruleprogram {
+
+/// \class RuleProgram
+/// \brief The immutable rules for one type of validation
+///
+/// The tables are built by asking the YAML tree about every key and
+/// value it contains, so the answers are the same as querying the tree,
+/// including its quirks with nested entries.
+class RuleProgram {
+  public:
+    /// An empty program, which doesn't check anything
+    RuleProgram(void) {};
+
+    /// Compile the rules in a validation YAML file
+    explicit RuleProgram(const yaml::Yaml &yaml) {
+        const auto &config = yaml.get_ref("config");
+        check_badvalue = config.get_value("badvalue") == "yes";
+        check_incomplete = config.get_value("incomplete") == "yes";
+        check_badgeom = config.get_value("badgeom") == "yes";
+        const auto &minangle = config.get_value_ref("badgeom_minangle");
+        const auto &maxangle = config.get_value_ref("badgeom_maxangle");
+        if (!minangle.empty() && !maxangle.empty()) {
+            try {
+                badgeom_minangle = std::stod(minangle);
+                badgeom_maxangle = std::stod(maxangle);
+                badgeom_angles = true;
+            } catch (const std::exception &e) {
+                log_error("Invalid badgeom angles %1% and %2%", minangle, maxangle);
+            }
+        }
+
+        // A tag is valid if its value is listed under the key, or if
+        // the key has no list of values.
+        const auto &tags = yaml.get_ref("tags");
+        has_tags = tags.children.size() > 0;
+        std::set<std::string> names;
+        collect(tags, names);
+        for (const auto &key: names) {
+            Allowed allowed;
+            allowed.any = tags.get_ref(key).children.size() == 0 && tags.contains_key(key);
+            for (const auto &value: names) {
+                if (tags.contains_value(key, value)) {
+                    allowed.values.insert(value);
+                }
+            }
+            if (allowed.any || !allowed.values.empty()) {
+                valid.emplace(key, std::move(allowed));
+            }
+        }
+
+        const auto &required_tags = yaml.get_ref("required_tags");
+        required_count = required_tags.children.size();
+        if (required_count > 0) {
+            names.clear();
+            collect(required_tags, names);
+            for (const auto &key: names) {
+                if (required_tags.contains_key(key)) {
+                    required.insert(key);
+                }
+            }
+        }
+    };
+
+    /// If the value of a tag is allowed
+    bool isValidTag(const std::string &key, const std::string &value) const {
+        auto found = valid.find(key);
+        if (found != valid.end() && (found->second.any || found->second.values.count(value))) {
+            return true;
+        }
+        log_debug("Bad tag: %1%=%2%", key, value);
+        return false;
+    };
+
+    /// If a tag is one of the required ones
+    bool isRequiredTag(const std::string &key) const {
+        return required.count(key) > 0;
+    };
+
+    bool check_badvalue = false;           ///< Check for tags with bad values
+    bool check_incomplete = false;         ///< Check for missing required tags
+    bool check_badgeom = false;            ///< Check for unsquared buildings
+    bool badgeom_angles = false;           ///< If the angles below are set
+    double badgeom_minangle = 0;           ///< The smallest square angle
+    double badgeom_maxangle = 0;           ///< The largest square angle
+    bool has_tags = false;                 ///< If there is a list of valid tags
+    std::size_t required_count = 0;        ///< The number of required tags
+
+  private:
+    /// The allowed values for a tag key
+    struct Allowed {
+        bool any = false;                   ///< Any value is allowed
+        std::unordered_set<std::string> values; ///< The allowed values
+    };
+
+    /// Collect all the keys and values in a subtree
+    static void collect(const yaml::Node &node, std::set<std::string> &names) {
+        for (const auto &child: node.children) {
+            names.insert(child.value);
+            collect(child, names);
+        }
+    };
+
+    std::unordered_map<std::string, Allowed> valid; ///< The valid tags
+    std::unordered_set<std::string> required;       ///< The required tag keys
+};
+
+} // namespace ruleprogram
+
+#endif // EOF __RULEPROGRAM_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -36,7 +36,7 @@
 #include <boost/geometry.hpp>
 #include <boost/geometry/geometries/polygon.hpp>
 
-#include "utils/yaml.hh"
+#include "validate/ruleprogram.hh"
 #include "semantic.hh"
 #include "validate.hh"
 #include "osm/osmchange.hh"
@@ -94,32 +94,13 @@ Semantic::checkTag(const std::string &key, const std::string &value, std::shared
     }
 }
 
-bool Semantic::isValidTag(const std::string &key, const std::string &value, yaml::Node tags) {
-    if (tags.contains_value(key, value) ||
-        (tags.get(key).children.size() == 0 && tags.contains_key(key))) {
-            return true;
-    }
-    log_debug("Bad tag: %1%=%2%", key, value);
-    return false;
-}
-
-bool Semantic::isRequiredTag(const std::string &key, yaml::Node required_tags) {
-    if (required_tags.children.size() > 0 && required_tags.contains_key(key)) {
-        log_debug("Required tag: %1%", key);
-        return true;
-    }
-    return false;
-}
-
 // Check a POI for tags. A node that is part of a way shouldn't have any
 // tags, this is to check actual POIs, like a school.
 std::shared_ptr<ValidateStatus>
-Semantic::checkNode(const osmobjects::OsmNode &node, const std::string &type, yaml::Yaml &tests, std::shared_ptr<ValidateStatus> &status)
+Semantic::checkNode(const osmobjects::OsmNode &node, const std::string &type, const ruleprogram::RuleProgram &rules, std::shared_ptr<ValidateStatus> &status)
 {
-
-    auto config = tests.get("config");
-    bool check_badvalue = config.get_value("badvalue") == "yes";
-    bool check_incomplete = config.get_value("incomplete") == "yes";
+    bool check_badvalue = rules.check_badvalue;
+    bool check_incomplete = rules.check_incomplete;
 
     if (node.tags.size() == 0) {
         status->status.insert(notags);
@@ -129,27 +110,21 @@ Semantic::checkNode(const osmobjects::OsmNode &node, const std::string &type, ya
         return status;
     }
 
-    // List of valid tags to be validated
-    auto tags = tests.get("tags");
-
     // Not using required_tags disables writing features flagged for not being tag complete
     // from being written to the database thus reducing the size of the results.
-    auto required_tags = tests.get("required_tags");
-
-    std::string key;
     size_t tagexists = 0;
     status->center = node.point;
 
     if (node.tags.count(type)) {
         for (auto vit = std::begin(node.tags); vit != std::end(node.tags); ++vit) {
             if (check_badvalue) {
-                if (!isValidTag(vit->first, vit->second, tags)) {
+                if (!rules.isValidTag(vit->first, vit->second)) {
                     status->status.insert(badvalue);
                     status->values.insert(vit->first + "=" +  vit->second);
                 }
             }
             if (check_incomplete) {
-                if (isRequiredTag(vit->first, required_tags)) {
+                if (rules.isRequiredTag(vit->first)) {
                     tagexists++;
                 }
             }
@@ -157,7 +132,7 @@ Semantic::checkNode(const osmobjects::OsmNode &node, const std::string &type, ya
         }
 
         if (check_incomplete) {
-            if (tagexists != required_tags.children.size()) {
+            if (tagexists != rules.required_count) {
                 status->status.insert(incomplete);
             }
         }
@@ -168,28 +143,15 @@ Semantic::checkNode(const osmobjects::OsmNode &node, const std::string &type, ya
 // This checks a way. A way should always have some tags. Often a polygon
 // with no tags is a building.
 std::shared_ptr<ValidateStatus>
-Semantic::checkWay(const osmobjects::OsmWay &way, const std::string &type, yaml::Yaml &tests, std::shared_ptr<ValidateStatus> &status)
+Semantic::checkWay(const osmobjects::OsmWay &way, const std::string &type, const ruleprogram::RuleProgram &rules, std::shared_ptr<ValidateStatus> &status)
 {
     if (way.action == osmobjects::remove) {
         return status;
     }
 
     // These values are in the config section of the YAML file
-    auto config = tests.get("config");
-    bool check_badvalue = config.get_value("badvalue") == "yes";
-    bool check_incomplete = config.get_value("incomplete") == "yes";
-
-    // List of required tags to be validated
-    yaml::Node required_tags;
-    if (check_incomplete) {
-        required_tags = tests.get("required_tags");
-    }
-
-    // List of valid tags to be validated
-    yaml::Node tags;
-    if (check_badvalue) {
-        tags = tests.get("tags");
-    }
+    bool check_badvalue = rules.check_badvalue;
+    bool check_incomplete = rules.check_incomplete;
 
     if (check_badvalue && way.tags.size() == 0) {
         status->status.insert(notags);
@@ -200,20 +162,20 @@ Semantic::checkWay(const osmobjects::OsmWay &way, const std::string &type, yaml:
     if (way.tags.count(type)) {
         for (auto vit = std::begin(way.tags); vit != std::end(way.tags); ++vit) {
             if (check_badvalue) {
-                if (tags.children.size() > 0 && !isValidTag(vit->first, vit->second, tags)) {
+                if (rules.has_tags && !rules.isValidTag(vit->first, vit->second)) {
                     status->status.insert(badvalue);
                     status->values.insert(vit->first + "=" +  vit->second);
                 }
                 checkTag(vit->first, vit->second, status);
             }
             if (check_incomplete) {
-                if (isRequiredTag(vit->first, required_tags)) {
+                if (rules.isRequiredTag(vit->first)) {
                     tagexists++;
                 }
             }
         }
 
-        if (check_incomplete && tagexists != required_tags.children.size()) {
+        if (check_incomplete && tagexists != rules.required_count) {
             status->status.insert(incomplete);
         }
     }
@@ -222,28 +184,15 @@ Semantic::checkWay(const osmobjects::OsmWay &way, const std::string &type, yaml:
 
 // This checks a relation.
 std::shared_ptr<ValidateStatus>
-Semantic::checkRelation(const osmobjects::OsmRelation &relation, const std::string &type, yaml::Yaml &tests, std::shared_ptr<ValidateStatus> &status)
+Semantic::checkRelation(const osmobjects::OsmRelation &relation, const std::string &type, const ruleprogram::RuleProgram &rules, std::shared_ptr<ValidateStatus> &status)
 {
     if (relation.action == osmobjects::remove) {
         return status;
     }
 
     // These values are in the config section of the YAML file
-    auto config = tests.get("config");
-    bool check_badvalue = config.get_value("badvalue") == "yes";
-    bool check_incomplete = config.get_value("incomplete") == "yes";
-
-    // List of required tags to be validated
-    yaml::Node required_tags;
-    if (check_incomplete) {
-        required_tags = tests.get("required_tags");
-    }
-
-    // List of valid tags to be validated
-    yaml::Node tags;
-    if (check_badvalue) {
-     tags = tests.get("tags");
-    }
+    bool check_badvalue = rules.check_badvalue;
+    bool check_incomplete = rules.check_incomplete;
 
     if (check_badvalue && relation.tags.size() == 0) {
         status->status.insert(notags);
@@ -254,20 +203,20 @@ Semantic::checkRelation(const osmobjects::OsmRelation &relation, const std::stri
     if (relation.tags.count(type)) {
         for (auto vit = std::begin(relation.tags); vit != std::end(relation.tags); ++vit) {
             if (check_badvalue) {
-                if (tags.children.size() > 0 && !isValidTag(vit->first, vit->second, tags)) {
+                if (rules.has_tags && !rules.isValidTag(vit->first, vit->second)) {
                     status->status.insert(badvalue);
                     status->values.insert(vit->first + "=" +  vit->second);
                 }
                 checkTag(vit->first, vit->second, status);
             }
             if (check_incomplete) {
-                if (isRequiredTag(vit->first, required_tags)) {
+                if (rules.isRequiredTag(vit->first)) {
                     tagexists++;
                 }
             }
         }
 
-        if (check_incomplete && tagexists != required_tags.children.size()) {
+        if (check_incomplete && tagexists != rules.required_count) {
             status->status.insert(incomplete);
         }
     }
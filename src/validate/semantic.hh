@@ -41,7 +41,7 @@
 using namespace boost::posix_time;
 using namespace boost::gregorian;
 
-#include "utils/yaml.hh"
+#include "validate/ruleprogram.hh"
 
 #include "validate.hh"
 
@@ -55,12 +55,10 @@ class Semantic
 public:
     Semantic();
     ~Semantic(void) {  };
-    static std::shared_ptr<ValidateStatus> checkNode(const osmobjects::OsmNode &node, const std::string &type, yaml::Yaml &tests, std::shared_ptr<ValidateStatus> &status);
-    static std::shared_ptr<ValidateStatus> checkWay(const osmobjects::OsmWay &way, const std::string &type, yaml::Yaml &tests, std::shared_ptr<ValidateStatus> &status);
-    static std::shared_ptr<ValidateStatus> checkRelation(const osmobjects::OsmRelation &relation, const std::string &type, yaml::Yaml &tests, std::shared_ptr<ValidateStatus> &status);
+    static std::shared_ptr<ValidateStatus> checkNode(const osmobjects::OsmNode &node, const std::string &type, const ruleprogram::RuleProgram &rules, std::shared_ptr<ValidateStatus> &status);
+    static std::shared_ptr<ValidateStatus> checkWay(const osmobjects::OsmWay &way, const std::string &type, const ruleprogram::RuleProgram &rules, std::shared_ptr<ValidateStatus> &status);
+    static std::shared_ptr<ValidateStatus> checkRelation(const osmobjects::OsmRelation &relation, const std::string &type, const ruleprogram::RuleProgram &rules, std::shared_ptr<ValidateStatus> &status);
 private:
-    static bool isValidTag(const std::string &key, const std::string &value, yaml::Node tags);
-    static bool isRequiredTag(const std::string &key, yaml::Node required_tags);
     static void checkTag(const std::string &key, const std::string &value, std::shared_ptr<ValidateStatus> &status);
 };
 
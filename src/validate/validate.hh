@@ -32,6 +32,8 @@
 #include "unconfig.h"
 #endif
 
+#include <map>
+#include <memory>
 #include <string>
 #include <vector>
 #include <iostream>
@@ -52,6 +54,7 @@ using namespace boost::gregorian;
 #include "utils/yaml.hh"
 #include "utils/log.hh"
 #include "utils/geo.hh"
+#include "validate/ruleprogram.hh"
 
 using namespace logger;
 
@@ -195,6 +198,7 @@ class BOOST_SYMBOL_VISIBLE Validate {
                 yaml.read(config.string());
                 if (!config.stem().empty()) {
                     yamls[config.stem()] = yaml;
+                    programs[config.stem()] = std::make_shared<const ruleprogram::RuleProgram>(yaml);
                 }
             }
         }
@@ -205,7 +209,17 @@ class BOOST_SYMBOL_VISIBLE Validate {
     virtual std::shared_ptr<ValidateStatus> checkNode(const osmobjects::OsmNode &node, const std::string &type) = 0;
     virtual std::shared_ptr<ValidateStatus> checkWay(const osmobjects::OsmWay &way, const std::string &type) = 0;
 
+    /// The YAML file for a type of validation. Changes to it aren't
+    /// seen by the checks, which use the rules compiled by loadConfig().
     yaml::Yaml &operator[](const std::string &key) { return yamls[key]; };
+
+    /// The compiled rules for a type of validation, which are empty if
+    /// there is no YAML file for it
+    const ruleprogram::RuleProgram &rules(const std::string &type) const {
+        static const ruleprogram::RuleProgram empty;
+        auto found = programs.find(type);
+        return (found != programs.end()) ? *found->second : empty;
+    };
     
     void dump(void) {
         for (auto it = std::begin(yamls); it != std::end(yamls); ++it) {
@@ -215,6 +229,7 @@ class BOOST_SYMBOL_VISIBLE Validate {
 
   protected:
     std::map<std::string, yaml::Yaml> yamls;
+    std::map<std::string, std::shared_ptr<const ruleprogram::RuleProgram>> programs;
 };
 
 #endif // EOF __VALIDATE_HH__
@@ -0,0 +1,191 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+/// \file validatecache.cc
+/// \brief Skip validating objects whose inputs didn't change
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include <boost/functional/hash.hpp>
+
+#include "validate/validatecache.hh"
+#include "utils/log.hh"
+
+using namespace logger;
+
+/// \namespace validatecache
+namespace validatecache {
+
+namespace {
+
+/// Add the tags of an object to a fingerprint
+void
+hashTags(std::size_t &seed, const osmobjects::OsmObject &obj)
+{
+    // The tags are in a std::map, so they're always in the same order
+    for (const auto &tag: obj.tags) {
+        boost::hash_combine(seed, tag.first);
+        boost::hash_combine(seed, tag.second);
+    }
+}
+
+/// Add a location to a fingerprint
+void
+hashPoint(std::size_t &seed, const point_t &point)
+{
+    boost::hash_combine(seed, point.x());
+    boost::hash_combine(seed, point.y());
+}
+
+} // anonymous namespace
+
+ValidateCache::ValidateCache(std::size_t capacity)
+    : capacity(capacity)
+{
+}
+
+std::uint64_t
+ValidateCache::fingerprint(const osmobjects::OsmNode &node)
+{
+    // Which checks run depends on the tags, so they are all covered
+    std::size_t seed = 0;
+    hashTags(seed, node);
+    hashPoint(seed, node.point);
+    return seed;
+}
+
+std::uint64_t
+ValidateCache::fingerprint(const osmobjects::OsmWay &way, const std::string &type)
+{
+    std::size_t seed = 0;
+    boost::hash_combine(seed, type);
+    hashTags(seed, way);
+    for (const auto &point: way.linestring) {
+        hashPoint(seed, point);
+    }
+    return seed;
+}
+
+ValidateCache::Table &
+ValidateCache::table(osmobjects::osmtype_t type)
+{
+    return (type == osmobjects::node) ? nodes : ways;
+}
+
+const ValidateCache::Table &
+ValidateCache::table(osmobjects::osmtype_t type) const
+{
+    return (type == osmobjects::node) ? nodes : ways;
+}
+
+bool
+ValidateCache::unchanged(osmobjects::osmtype_t type, long id, long version, std::uint64_t fingerprint)
+{
+    std::scoped_lock lock{mutex};
+    auto &cache = table(type);
+    auto found = cache.entries.find(id);
+    if (found == cache.entries.end()) {
+        return false;
+    }
+    cache.used.splice(cache.used.begin(), cache.used, found->second.used);
+    return found->second.version <= version && found->second.fingerprint == fingerprint;
+}
+
+void
+ValidateCache::insert(osmobjects::osmtype_t type, long id, long version, std::uint64_t fingerprint)
+{
+    auto &cache = table(type);
+    auto found = cache.entries.find(id);
+    if (found != cache.entries.end()) {
+        cache.used.splice(cache.used.begin(), cache.used, found->second.used);
+        // Files are processed in parallel, so an older version may
+        // arrive after a newer one, whose result it doesn't replace.
+        if (found->second.version <= version) {
+            found->second.version = version;
+            found->second.fingerprint = fingerprint;
+        }
+        return;
+    }
+    if (cache.entries.size() >= capacity && !cache.used.empty()) {
+        // Dropping one only costs validating it again
+        cache.entries.erase(cache.used.back());
+        cache.used.pop_back();
+    }
+    cache.used.push_front(id);
+    cache.entries.emplace(id, Entry{version, fingerprint, cache.used.begin()});
+}
+
+void
+ValidateCache::update(osmobjects::osmtype_t type, long id, long version, std::uint64_t fingerprint)
+{
+    std::scoped_lock lock{mutex};
+    insert(type, id, version, fingerprint);
+}
+
+void
+ValidateCache::update(const std::vector<Validated> &validated)
+{
+    std::scoped_lock lock{mutex};
+    for (const auto &object: validated) {
+        if (object.removed) {
+            erase(object.type, object.id);
+        } else {
+            insert(object.type, object.id, object.version, object.fingerprint);
+        }
+    }
+}
+
+std::size_t
+ValidateCache::size(osmobjects::osmtype_t type) const
+{
+    std::scoped_lock lock{mutex};
+    return table(type).entries.size();
+}
+
+void
+ValidateCache::remove(osmobjects::osmtype_t type, long id)
+{
+    std::scoped_lock lock{mutex};
+    erase(type, id);
+}
+
+void
+ValidateCache::erase(osmobjects::osmtype_t type, long id)
+{
+    auto &cache = table(type);
+    auto found = cache.entries.find(id);
+    if (found != cache.entries.end()) {
+        cache.used.erase(found->second.used);
+        cache.entries.erase(found);
+    }
+}
+
+} // namespace validatecache
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,122 @@
+//
+// Copyright (c) 2023 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __VALIDATECACHE_HH__
+#define __VALIDATECACHE_HH__
+
+/// \file validatecache.hh
+/// \brief Skip validating objects whose inputs didn't change
+///
+/// Many of the objects in a change are validated again with the same
+/// tags and geometry, like a way that is only in the change because a
+/// node was tagged, or a modified object whose tags didn't change. This
+/// keeps a fingerprint of what each object was last validated with, so
+/// those checks and their database writes can be skipped.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "osm/osmobjects.hh"
+
+/// \namespace validatecache
+namespace validatecache {
+
+/// \class ValidateCache
+/// \brief The fingerprints of the last validated version of objects
+///
+/// The fingerprint is a hash of the tags, the geometry and the type of
+/// check, which is all the validation looks at. It's shared by all the
+/// replication threads. Fingerprints are only recorded, and deleted
+/// objects forgotten, once the results are committed, so a failed write
+/// doesn't skip the objects next time.
+class ValidateCache {
+  public:
+    /// Keep at most \a capacity objects of each type, dropping the least
+    /// recently used ones
+    ValidateCache(std::size_t capacity = 4000000);
+
+    /// An object validated with a fingerprint, or deleted
+    struct Validated {
+        osmobjects::osmtype_t type;
+        long id;
+        long version;
+        std::uint64_t fingerprint;
+        bool removed = false;
+    };
+
+    /// The fingerprint of the inputs of a node check
+    static std::uint64_t fingerprint(const osmobjects::OsmNode &node);
+    /// The fingerprint of the inputs of a way check
+    static std::uint64_t fingerprint(const osmobjects::OsmWay &way, const std::string &type);
+
+    /// If the object was last validated with the same fingerprint, and
+    /// no newer version of it has been validated
+    bool unchanged(osmobjects::osmtype_t type, long id, long version, std::uint64_t fingerprint);
+    /// Record the fingerprint an object was validated with
+    void update(osmobjects::osmtype_t type, long id, long version, std::uint64_t fingerprint);
+    /// Record the fingerprints of the objects in a committed batch, and
+    /// forget the ones it deleted
+    void update(const std::vector<Validated> &validated);
+    /// The number of objects of a type in the cache
+    std::size_t size(osmobjects::osmtype_t type) const;
+    /// Forget an object, when it's deleted
+    void remove(osmobjects::osmtype_t type, long id);
+
+  private:
+    /// The last validated version of an object
+    struct Entry {
+        long version;
+        std::uint64_t fingerprint;
+        std::list<long>::iterator used;    ///< Its place in Table::used
+    };
+    /// The cache for an object type
+    struct Table {
+        std::unordered_map<long, Entry> entries;
+        std::list<long> used;              ///< The IDs, most recently used first
+    };
+    Table &table(osmobjects::osmtype_t type);
+    const Table &table(osmobjects::osmtype_t type) const;
+    /// Record a fingerprint, with the mutex held
+    void insert(osmobjects::osmtype_t type, long id, long version, std::uint64_t fingerprint);
+    /// Forget an object, with the mutex held
+    void erase(osmobjects::osmtype_t type, long id);
+
+    std::size_t capacity;                      ///< Maximum entries per type
+    mutable std::mutex mutex;                  ///< The threads share the cache
+    Table nodes;                               ///< Validated nodes
+    Table ways;                                ///< Validated ways
+};
+
+} // namespace validatecache
+
+#endif // EOF __VALIDATECACHE_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
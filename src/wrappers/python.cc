@@ -24,11 +24,18 @@
 
 #define BOOST_BIND_GLOBAL_PLACEHOLDERS 1
 
+#include <cstdint>
+#include <memory>
 #include <boost/python.hpp>
+#include <boost/python/numpy.hpp>
+#include <boost/dll/import.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/function.hpp>
 // #include "validate/defaultvalidation.hh"
 #include "validate/validate.hh"
 #include "osm/osmobjects.hh"
 #include "osm/osmchange.hh"
+#include "osm/changebatch.hh"
 #include "data/pq.hh"
 
 #include "utils/log.hh"
@@ -38,6 +45,7 @@ using namespace logger;
 
 using namespace boost::python;
 using namespace osmobjects;
+namespace np = boost::python::numpy;
 
 std::map<valerror_t, std::string> results = {
     {notags, "notags"},
@@ -48,7 +56,8 @@ std::map<valerror_t, std::string> results = {
     {badgeom, "badgeom"},
     {orphan, "orphan"},
     {overlapping, "overlapping"},
-    {duplicate, "duplicate"}
+    {duplicate, "duplicate"},
+    {valid, "valid"}
 };
 
 // ValidateStatus* checkNode(defaultvalidation::DefaultValidation& self, const osmobjects::OsmNode &node, const std::string &type) {
@@ -106,8 +115,205 @@ std::string dumpJSON(ValidateStatus& self) {
 //     return output;
 // }
 
+/// \class ReleaseGIL
+/// \brief Let other Python threads run while parsing or validating
+class ReleaseGIL {
+  public:
+    ReleaseGIL(void) : state(PyEval_SaveThread()) {};
+    ~ReleaseGIL(void) { PyEval_RestoreThread(state); };
+
+  private:
+    PyThreadState *state;
+};
+
+/// \struct Changes
+/// \brief A parsed change file, with its columns and geometries
+///
+/// The arrays returned to Python point into the columns, and hold a
+/// reference to this object, so nothing is copied per object.
+struct Changes : boost::noncopyable {
+    osmchange::OsmChangeFile osc;
+    std::unique_ptr<osmchange::ChangeBatch> batch;
+    osmchange::ChangeBatch::Geometries geometries[3];  ///< Nodes, ways and relations
+    std::vector<std::int64_t> timestamps[3];           ///< Seconds since the epoch
+    multipolygon_t poly;                               ///< The last area filter
+};
+
+static_assert(sizeof(action_t) == sizeof(std::int32_t), "actions are exported as int32");
+static_assert(sizeof(osmtype_t) == sizeof(std::int32_t), "member types are exported as int32");
+
+/// Parse a change file, and build the columns and geometries
+std::shared_ptr<Changes>
+readChangeBatch(const std::string &filespec)
+{
+    auto changes = std::make_shared<Changes>();
+    ReleaseGIL unlocked;
+    changes->osc.readChanges(filespec);
+    changes->osc.buildGeometriesFromNodeCache();
+    changes->batch = std::make_unique<osmchange::ChangeBatch>(changes->osc);
+    const osmchange::ChangeBatch::Columns *columns[3] = {
+        &changes->batch->nodes, &changes->batch->ways, &changes->batch->relations};
+    const osmtype_t types[3] = {node, way, relation};
+    const ptime epoch(boost::gregorian::date(1970, 1, 1));
+    for (int i = 0; i < 3; i++) {
+        changes->geometries[i] = changes->batch->geometries(types[i]);
+        changes->timestamps[i].reserve(columns[i]->size());
+        for (const auto &timestamp: columns[i]->timestamps) {
+            // NaT for a missing timestamp
+            changes->timestamps[i].push_back(timestamp.is_special() ? INT64_MIN
+                                             : (timestamp - epoch).total_seconds());
+        }
+    }
+    return changes;
+}
+
+/// Set the priority of the objects from a WKT boundary
+void
+areaFilter(Changes &self, const std::string &wkt)
+{
+    boost::geometry::read_wkt(wkt, self.poly);
+    ReleaseGIL unlocked;
+    self.batch->areaFilter(self.poly);
+}
+
+/// A read only array over \a size values of a column
+template <typename T>
+np::ndarray
+view(const T *data, std::size_t size, const np::dtype &dtype, const object &owner)
+{
+    return np::from_data(static_cast<const void *>(data), dtype, make_tuple(size),
+                         make_tuple(sizeof(T)), owner);
+}
+
+template <typename T>
+np::ndarray
+view(const std::vector<T> &column, const object &owner)
+{
+    return view(column.data(), column.size(), np::dtype::get_builtin<T>(), owner);
+}
+
+/// The columns of \a type, "nodes", "ways" or "relations", as NumPy
+/// arrays sharing the memory of the batch
+dict
+columns(object owner, const std::string &type)
+{
+    Changes &self = extract<Changes &>(owner);
+    auto &batch = *self.batch;
+    int index = 0;
+    const osmchange::ChangeBatch::Columns *columns = &batch.nodes;
+    if (type == "ways") {
+        index = 1;
+        columns = &batch.ways;
+    } else if (type == "relations") {
+        index = 2;
+        columns = &batch.relations;
+    } else if (type != "nodes") {
+        PyErr_SetString(PyExc_ValueError, "type must be nodes, ways or relations");
+        throw_error_already_set();
+    }
+    const np::dtype int32 = np::dtype::get_builtin<std::int32_t>();
+    dict result;
+    result["id"] = view(columns->ids, owner);
+    result["version"] = view(columns->versions, owner);
+    result["action"] = view(columns->actions.data(), columns->size(), int32, owner);
+    result["changeset"] = view(columns->changesets, owner);
+    result["uid"] = view(columns->uids, owner);
+    result["user"] = view(columns->users, owner);
+    result["timestamp"] = view(self.timestamps[index].data(), self.timestamps[index].size(),
+                               np::dtype(object("datetime64[s]")), owner);
+    result["priority"] = view(columns->priority.data(), columns->size(), np::dtype::get_builtin<bool>(), owner);
+    result["change_offsets"] = view(columns->changes, owner);
+    result["tag_offsets"] = view(columns->tags, owner);
+    result["tag_keys"] = view(columns->keys, owner);
+    result["tag_values"] = view(columns->values, owner);
+    result["wkb_offsets"] = view(self.geometries[index].offsets, owner);
+    result["wkb"] = view(self.geometries[index].wkb, owner);
+    if (index == 0) {
+        result["lat"] = view(batch.nodes.lats, owner);
+        result["lon"] = view(batch.nodes.lons, owner);
+    } else if (index == 1) {
+        result["ref_offsets"] = view(batch.ways.offsets, owner);
+        result["refs"] = view(batch.ways.refs, owner);
+    } else {
+        result["member_offsets"] = view(batch.relations.offsets, owner);
+        result["member_refs"] = view(batch.relations.refs, owner);
+        result["member_types"] = view(batch.relations.types.data(), batch.relations.types.size(), int32, owner);
+        result["member_roles"] = view(batch.relations.roles, owner);
+    }
+    return result;
+}
+
+/// The string table the user names and tags index
+list
+strings(Changes &self)
+{
+    list result;
+    for (const auto &value: self.batch->strings) {
+        result.append(value);
+    }
+    return result;
+}
+
+typedef std::shared_ptr<Validate>(plugin_t)();
+
+/// \class Validator
+/// \brief The validation plugin, run on a whole batch at a time
+class Validator {
+  public:
+    Validator(const std::string &plugins)
+    {
+        boost::dll::fs::path lib_path(plugins);
+        creator = boost::dll::import_alias<plugin_t>(lib_path / "libunderpass.so", "create_plugin",
+                                                     boost::dll::load_mode::append_decorations);
+        plugin = creator();
+    };
+
+    /// Validate the nodes or ways in the priority area. The result
+    /// has a row for each status of each object checked.
+    dict validate(Changes &changes, const std::string &type)
+    {
+        std::shared_ptr<std::vector<std::shared_ptr<ValidateStatus>>> statuses;
+        if (type != "nodes" && type != "ways") {
+            PyErr_SetString(PyExc_ValueError, "type must be nodes or ways");
+            throw_error_already_set();
+        }
+        {
+            ReleaseGIL unlocked;
+            if (type == "nodes") {
+                statuses = changes.batch->validateNodes(changes.poly, plugin);
+            } else {
+                statuses = changes.batch->validateWays(changes.poly, plugin);
+            }
+        }
+        std::size_t rows = 0;
+        for (const auto &status: *statuses) {
+            rows += status->status.size();
+        }
+        np::ndarray ids = np::empty(make_tuple(rows), np::dtype::get_builtin<std::int64_t>());
+        np::ndarray codes = np::empty(make_tuple(rows), np::dtype::get_builtin<std::int32_t>());
+        auto *id = reinterpret_cast<std::int64_t *>(ids.get_data());
+        auto *code = reinterpret_cast<std::int32_t *>(codes.get_data());
+        for (const auto &status: *statuses) {
+            for (const auto &value: status->status) {
+                *id++ = status->osm_id;
+                *code++ = value;
+            }
+        }
+        dict result;
+        result["id"] = ids;
+        result["status"] = codes;
+        return result;
+    };
+
+  private:
+    boost::function<plugin_t> creator;  ///< Keeps the library loaded
+    std::shared_ptr<Validate> plugin;
+};
+
 BOOST_PYTHON_MODULE(underpass)
 {
+    np::initialize();
+
     //
     // using namespace defaultvalidation;
     // class_<DefaultValidation, boost::noncopyable>("Validate")
@@ -125,6 +331,23 @@ BOOST_PYTHON_MODULE(underpass)
     class_<OsmChangeFile, boost::noncopyable>("OsmChangeFile")
         .def("readChanges", &OsmChangeFile::readChanges)
         .def("dump", &OsmChangeFile::dump);
+
+    class_<Changes, std::shared_ptr<Changes>, boost::noncopyable>("ChangeBatch", no_init)
+        .def("read", &readChangeBatch)
+        .staticmethod("read")
+        .def("areaFilter", &areaFilter)
+        .def("columns", &columns)
+        .def("strings", &strings);
+
+    class_<Validator, boost::noncopyable>("Validator", init<std::string>())
+        .def("validate", &Validator::validate);
+
+    // The names of the status codes returned by Validator.validate()
+    list statuses;
+    for (int i = notags; i <= valid; i++) {
+        statuses.append(results[static_cast<valerror_t>(i)]);
+    }
+    scope().attr("statuses") = statuses;
 }
 #endif
 